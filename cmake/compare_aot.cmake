@@ -0,0 +1,21 @@
+# Runs SCRIPT with the interpreter MEHH and its --emit-c build COMPILED, and
+# fails unless the compiled program exits cleanly with the same output.
+execute_process(
+  COMMAND ${MEHH} ${SCRIPT}
+  OUTPUT_VARIABLE expected
+  ERROR_VARIABLE expected
+)
+execute_process(
+  COMMAND ${COMPILED}
+  OUTPUT_VARIABLE actual
+  ERROR_VARIABLE actual
+  RESULT_VARIABLE status
+)
+if (NOT status EQUAL 0)
+  message(FATAL_ERROR "${COMPILED} exited with ${status}:\n${actual}")
+endif()
+if (NOT actual STREQUAL expected)
+  message(FATAL_ERROR
+    "Output differs from the interpreter.\n"
+    "Expected:\n${expected}\nActual:\n${actual}")
+endif()
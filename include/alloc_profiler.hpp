@@ -0,0 +1,95 @@
+#pragma once
+
+#include "function.hpp"
+#include "value.hpp"
+#include <absl/container/flat_hash_map.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <utility>
+
+// Counts heap allocations exactly per ValueType and attributes a sample of
+// them to the bytecode site (function and line) that made them. Sampling is
+// by bytes, as in tcmalloc: the gap between samples is drawn from an
+// exponential distribution with mean `interval`, and each sampled
+// allocation is weighted by the inverse of its chance of being picked, so
+// per-site estimates stay unbiased for small and large objects alike.
+//
+// The heap is never collected, so every allocation stays live until the VM
+// is destroyed and live bytes equal allocated bytes. Sizes are object sizes
+// plus string contents; allocator overhead and container growth inside
+// arrays and maps are not counted.
+class AllocationProfiler {
+public:
+  static constexpr size_t DEFAULT_INTERVAL = 1024;
+  static constexpr size_t TYPE_COUNT = static_cast<size_t>(ValueType::OBJ) + 1;
+
+  struct Site {
+    // The function running, or being compiled, or nullptr for the host.
+    const Function *function;
+    size_t line;
+    ValueType type;
+    // Made by the compiler rather than by running code.
+    bool compile;
+
+    bool operator==(const Site &) const = default;
+    template <typename H> friend H AbslHashValue(H h, const Site &site) {
+      return H::combine(std::move(h), site.function, site.line, site.type,
+                        site.compile);
+    }
+  };
+
+  struct Stats {
+    // Estimates, scaled up from the samples.
+    double count = 0;
+    double bytes = 0;
+    uint64_t samples = 0;
+  };
+
+  struct TypeStats {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+  };
+
+  explicit AllocationProfiler(size_t interval = DEFAULT_INTERVAL);
+
+  // Counts an allocation and returns true if it was picked for sampling, in
+  // which case the caller resolves its site and passes it to sample().
+  __attribute__((always_inline)) inline bool count(ValueType type,
+                                                   size_t bytes) {
+    TypeStats &stats = perType[static_cast<size_t>(type)];
+    stats.count++;
+    stats.bytes += bytes;
+    if (__builtin_expect(bytes < bytesUntilSample, 1)) {
+      bytesUntilSample -= bytes;
+      return false;
+    }
+    bytesUntilSample = nextSample();
+    return true;
+  }
+  void sample(const Site &site, size_t bytes);
+
+  [[nodiscard]] size_t interval() const { return meanInterval; }
+  [[nodiscard]] const std::array<TypeStats, TYPE_COUNT> &types() const {
+    return perType;
+  }
+  [[nodiscard]] const absl::flat_hash_map<Site, Stats> &sites() const {
+    return perSite;
+  }
+  [[nodiscard]] static std::string_view typeName(ValueType type);
+
+  // Totals per type, then the sites by descending estimated bytes.
+  void report(std::ostream &out, size_t siteLimit = 30) const;
+  void writeJson(std::ostream &out) const;
+
+private:
+  [[nodiscard]] size_t nextSample();
+
+  const size_t meanInterval;
+  uint64_t random;
+  size_t bytesUntilSample;
+  std::array<TypeStats, TYPE_COUNT> perType{};
+  absl::flat_hash_map<Site, Stats> perSite;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "function.hpp"
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Ahead-of-time compilation of scripts to C, for mehh --emit-c.
+//
+// Every function becomes a C function whose bytecode stack slots, locals
+// included, are C variables; jumps become gotos and the number paths of
+// arithmetic are inlined, while anything touching objects calls the runtime
+// (mehh_aot.h). The generated file embeds the script's source: at startup
+// mehh_aot_main() compiles it again to recreate the functions, constants and
+// property caches, checks that the bytecode is what the C was generated
+// from, and attaches the C functions to it.
+
+// The functions reachable from `script` through constants, script first, in
+// the order the generated entries are numbered.
+[[nodiscard]] std::vector<const Function *>
+aotFunctions(const Function *script);
+
+// FNV-1a over the bytecode and signatures of `functions`.
+[[nodiscard]] uint64_t aotChecksum(const std::vector<const Function *> &functions);
+
+// Writes a C translation unit with a main() that runs the script. Functions
+// whose bytecode can't be translated are left to the interpreter.
+void emitC(const Function *script, std::string_view source, std::ostream &out);
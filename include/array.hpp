@@ -0,0 +1,61 @@
+#pragma once
+
+#include "value.hpp"
+#include <cstddef>
+#include <vector>
+
+// Growable array. While every element is a number the contents live in a
+// contiguous double buffer so native kernels can run over them directly;
+// storing anything else switches the array to a Value buffer.
+class ArrayObj : public Obj {
+public:
+  ArrayObj() : Obj{ValueType::ARRAY}, numeric{true} {}
+
+  [[nodiscard]] bool isNumeric() const { return numeric; }
+  [[nodiscard]] size_t size() const {
+    return numeric ? numbers.size() : values.size();
+  }
+
+  [[nodiscard]] Value get(size_t index) const {
+    return numeric ? Value{numbers[index]} : values[index];
+  }
+
+  void set(size_t index, const Value &value) {
+    if (numeric) {
+      if (__builtin_expect(value.isNumber(), 1)) {
+        numbers[index] = value.asNumber();
+        return;
+      }
+      generalize();
+    }
+    values[index] = value;
+  }
+
+  void push(const Value &value) {
+    if (numeric) {
+      if (__builtin_expect(value.isNumber(), 1)) {
+        numbers.push_back(value.asNumber());
+        return;
+      }
+      generalize();
+    }
+    values.push_back(value);
+  }
+
+  // Grows with zeros (or nil once generalized) or truncates.
+  void resize(size_t size);
+
+  // Switches back to the double buffer if every element is a number.
+  // Returns whether the array is numeric afterwards.
+  bool specialize();
+
+  [[nodiscard]] double *data() { return numbers.data(); }
+  [[nodiscard]] const double *data() const { return numbers.data(); }
+
+private:
+  void generalize();
+
+  bool numeric;
+  std::vector<double> numbers;
+  std::vector<Value> values;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "function.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Column-at-a-time interpreter for numeric functions. Every instruction runs
+// over a batch of rows ("lanes") at once, on double vectors. Lanes that take
+// different branches keep their own program counter; the lowest one runs
+// next with the other lanes masked off, so diverging lanes reconverge where
+// their paths meet again.
+class BatchProgram {
+public:
+  // Lanes per batch.
+  static constexpr size_t WIDTH = 256;
+
+  // Succeeds if `function` only handles numbers and booleans and sticks to
+  // the opcodes below: constants, locals, arithmetic, comparisons, jumps,
+  // loops and return. Anything else has to run on the scalar interpreter.
+  [[nodiscard]] static std::optional<BatchProgram>
+  compile(const Function &function);
+
+  // One column per parameter; `results` has one entry per row and every
+  // column at least as many.
+  void run(std::span<const std::span<const double>> columns,
+           std::span<double> results) const;
+
+private:
+  enum class Kind : uint8_t { NUMBER, BOOL, OTHER };
+
+  // What the verifier learned about the instruction at one offset.
+  struct Site {
+    uint16_t depth;
+    Kind top;
+    Kind second;
+  };
+
+  explicit BatchProgram(const Function &function)
+      : code{&function.chunk->getCode()}, arity{function.arity} {}
+
+  void runBatch(double *stack, uint32_t *pcs, uint8_t *mask, size_t lanes,
+                double *results) const;
+
+  const std::vector<uint8_t> *code;
+  std::vector<double> constants;
+  // Indexed by bytecode offset; only reachable instructions are filled in.
+  std::vector<Site> sites;
+  size_t maxDepth = 0;
+  uint8_t arity;
+};
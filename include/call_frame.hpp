@@ -1,13 +1,12 @@
 #pragma once
 
-#include "boost/container/static_vector.hpp"
 #include "function.hpp"
 #include "value.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <vector>
 
-using StackIterator = boost::container::static_vector<Value, 64>::iterator;
+using StackIterator = Value *;
 
 class CallFrame {
 public:
@@ -21,6 +20,7 @@ public:
   [[nodiscard]] const uint16_t readShort();
   [[nodiscard]] const Value readConstant();
   [[nodiscard]] const Value &readConstantRef();
+  [[nodiscard]] PropertyCache &readCache();
 
   const Closure *const closure;
   StackIterator slots;
@@ -73,3 +73,7 @@ __attribute__((always_inline)) inline const Value &
 CallFrame::readConstantRef() {
   return constants[readByte()];
 }
+
+__attribute__((always_inline)) inline PropertyCache &CallFrame::readCache() {
+  return closure->caches[readShort()];
+}
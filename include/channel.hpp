@@ -0,0 +1,114 @@
+#pragma once
+
+#include "code_image.hpp"
+#include "value.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A value on its way from one VM to another, holding nothing from the
+// sender's heap: strings, arrays and maps are copied, element by element.
+// Nil, booleans and numbers travel as they are, and so do strings of the
+// channel's CodeImage, which outlives every message in it.
+struct Message {
+  enum class Kind : uint8_t { VALUE, STRING, NUMBERS, ARRAY, MAP };
+
+  Kind kind = Kind::VALUE;
+  // VALUE: the value itself.
+  Value value;
+  // STRING: a copy of the text.
+  std::string text;
+  // NUMBERS: a copy of a numeric array's buffer.
+  std::vector<double> numbers;
+  // ARRAY: the elements; MAP: keys and values, alternating.
+  std::vector<Message> items;
+};
+
+// A bounded multi-producer, multi-consumer queue of messages, for pipelines
+// of scripts running on different threads. Sends and receives claim a cell
+// of a ring with one compare-and-swap each (Vyukov's bounded MPMC queue), so
+// there is no lock to contend on. A sender finding the ring full, or a
+// receiver finding it empty, spins briefly and then parks on a counter the
+// other side bumps, sleeping in the kernel until there is room or a message.
+//
+// Scripts get at a channel through a ChannelObj in their own VM, from
+// VM::channel() or the channel() native; any number of VMs may hold one.
+class Channel {
+public:
+  // Holds at least `capacity` messages. Strings from `image` are passed by
+  // reference instead of copied.
+  explicit Channel(size_t capacity,
+                   std::shared_ptr<const CodeImage> image = nullptr);
+  Channel(const Channel &) = delete;
+  Channel &operator=(const Channel &) = delete;
+
+  // Moves `message` in unless the channel is full or closed.
+  [[nodiscard]] bool trySend(Message &message);
+  // Moves the oldest message out unless the channel is empty.
+  [[nodiscard]] bool tryReceive(Message &message);
+
+  // Waits for room, then sends. Returns false if the channel is closed.
+  bool send(Message &message);
+  // Waits for a message. Returns false once the channel is closed and
+  // every message sent before has been received.
+  [[nodiscard]] bool receive(Message &message);
+
+  // Wakes everyone waiting; later sends fail.
+  void close();
+  [[nodiscard]] bool closed() const {
+    return isClosed.load(std::memory_order_acquire);
+  }
+
+  [[nodiscard]] size_t capacity() const { return mask + 1; }
+  [[nodiscard]] const std::shared_ptr<const CodeImage> &image() const {
+    return image_;
+  }
+
+private:
+  // Failed attempts before a waiting sender or receiver parks.
+  static constexpr int SPINS = 64;
+  // Top bit of sendPosition, set by close() so that later sends fail their
+  // compare-and-swap instead of racing with it.
+  static constexpr size_t CLOSED = ~(~size_t{0} >> 1);
+
+  struct alignas(64) Cell {
+    // Equal to the position a sender may fill next, or one past it once
+    // filled, for a receiver to take.
+    std::atomic<size_t> sequence;
+    Message message;
+  };
+
+  // receive() once closed: takes the messages of every send that claimed a
+  // cell before close(), waiting for any still being written.
+  [[nodiscard]] bool drain(Message &message);
+  // Blocks until `counter` moves on from `seen`, unless closed.
+  void park(std::atomic<uint32_t> &counter, std::atomic<uint32_t> &waiters,
+            uint32_t seen);
+  static void wake(std::atomic<uint32_t> &counter,
+                   std::atomic<uint32_t> &waiters);
+
+  const std::shared_ptr<const CodeImage> image_;
+  const size_t mask;
+  std::unique_ptr<Cell[]> cells;
+  alignas(64) std::atomic<size_t> sendPosition{0};
+  alignas(64) std::atomic<size_t> receivePosition{0};
+  // Bumped after every send and receive, for the other side to park on.
+  alignas(64) std::atomic<uint32_t> sends{0};
+  std::atomic<uint32_t> sendWaiters{0};
+  alignas(64) std::atomic<uint32_t> receives{0};
+  std::atomic<uint32_t> receiveWaiters{0};
+  std::atomic<bool> isClosed{false};
+};
+
+// A channel as seen by one VM.
+class ChannelObj : public Obj {
+public:
+  explicit ChannelObj(std::shared_ptr<Channel> channel)
+      : Obj{ValueType::CHANNEL}, channel{std::move(channel)} {}
+
+  const std::shared_ptr<Channel> channel;
+};
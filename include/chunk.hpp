@@ -6,6 +6,9 @@
 #include <sys/cdefs.h>
 #include <vector>
 
+class Closure;
+class Shape;
+
 enum OpCode : uint8_t {
   OP_CONSTANT,
   OP_NIL,
@@ -19,6 +22,10 @@ enum OpCode : uint8_t {
   OP_GET_UPVALUE,
   OP_SET_UPVALUE,
   OP_DEFINE_GLOBAL,
+  OP_GET_PROPERTY,
+  OP_SET_PROPERTY,
+  OP_GET_INDEX,
+  OP_SET_INDEX,
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
@@ -32,9 +39,38 @@ enum OpCode : uint8_t {
   OP_JUMP,
   OP_JUMP_IF_FALSE,
   OP_LOOP,
+  OP_ITERATE,
   OP_CALL,
+  OP_INVOKE,
   OP_CLOSURE,
+  OP_CLOSE_UPVALUE,
   OP_RETURN,
+  OP_YIELD,
+  OP_GENERATOR_RETURN,
+  OP_CLASS,
+  OP_METHOD,
+  OP_ARRAY,
+  OP_MAP,
+};
+
+// Operand pairs following OP_CLOSURE describe where each upvalue comes from.
+// Locals that are never written after being captured are copied into the
+// closure (CAPTURE_VALUE) instead of sharing a heap cell (CAPTURE_LOCAL).
+enum UpvalueCapture : uint8_t {
+  CAPTURE_UPVALUE,
+  CAPTURE_LOCAL,
+  CAPTURE_VALUE,
+};
+
+// Monomorphic inline cache for one property access site. Valid while the
+// receiver's shape equals `shape`.
+struct PropertyCache {
+  const Shape *shape = nullptr;
+  // OP_SET_PROPERTY that appends a field: the shape after the append.
+  Shape *transition = nullptr;
+  // Method found on the class, or nullptr if `slot` names a field.
+  const Closure *method = nullptr;
+  uint32_t slot = 0;
 };
 
 struct Line {
@@ -47,10 +83,14 @@ public:
   // TODO: What type? Implicitly converted from size_t?
   void write(uint8_t byte, size_t line) noexcept;
   size_t writeConstant(const Value &value) noexcept;
+  size_t addCache() noexcept;
+  // Property access sites numbered by addCache(). Their caches live in
+  // each VM's InlineCaches, so running code never writes to the chunk.
+  [[nodiscard]] size_t cacheCount() const noexcept { return caches; }
   [[nodiscard]] __attribute__((always_inline)) inline const std::vector<uint8_t> &getCode() const noexcept;
   [[nodiscard]] __attribute__((always_inline)) inline std::vector<uint8_t> &code() noexcept;
   [[nodiscard]] __attribute__((always_inline)) inline const ValueArray &getConstants() const noexcept;
-  [[nodiscard]] const uint8_t getLine(size_t offset) const noexcept;
+  [[nodiscard]] const size_t getLine(size_t offset) const noexcept;
   [[nodiscard]] const std::vector<Line> &getLines() const noexcept;
   [[nodiscard]] const size_t count() const noexcept;
 
@@ -58,6 +98,7 @@ private:
   std::vector<uint8_t> code_;
   ValueArray constants;
   std::vector<Line> lines;
+  size_t caches = 0;
 };
 
 const std::vector<uint8_t> &Chunk::getCode() const noexcept { return code_; }
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "boost/container/small_vector.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <absl/container/flat_hash_map.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define INSTANCE_INLINE_SLOTS 8
+
+// Hidden class describing the field layout of an instance. Instances that
+// add the same fields in the same order share a Shape, so a property access
+// site only needs to compare shapes to reuse a cached slot.
+class Shape {
+public:
+  static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+  Shape() = default;
+  Shape(const Shape &) = delete;
+  Shape &operator=(const Shape &) = delete;
+
+  [[nodiscard]] uint32_t lookup(const StringObj *name) const;
+  // Returns the shape reached by appending `name`, creating it on first use.
+  [[nodiscard]] Shape *transition(const StringObj *name);
+  [[nodiscard]] uint32_t slotCount() const { return slots.size(); }
+
+private:
+  absl::flat_hash_map<const StringObj *, uint32_t> slots;
+  absl::flat_hash_map<const StringObj *, std::unique_ptr<Shape>> transitions;
+};
+
+// Each class owns the root of its transition tree, so an instance's shape
+// also identifies its class.
+class ClassObj : public Obj {
+public:
+  explicit ClassObj(const StringObj *name)
+      : Obj{ValueType::CLASS}, name{name}, initializer{nullptr} {}
+
+  [[nodiscard]] const Closure *findMethod(const StringObj *name) const;
+
+  const StringObj *name;
+  Shape root;
+  absl::flat_hash_map<const StringObj *, const Closure *> methods;
+  const Closure *initializer;
+};
+
+class Instance : public Obj {
+public:
+  explicit Instance(ClassObj *klass)
+      : Obj{ValueType::INSTANCE}, klass{klass}, shape{&klass->root} {}
+
+  const ClassObj *klass;
+  Shape *shape;
+  // Indexed by the slot numbers in `shape`.
+  boost::container::small_vector<Value, INSTANCE_INLINE_SLOTS> fields;
+};
+
+class BoundMethod : public Obj {
+public:
+  explicit BoundMethod(const Value &receiver, const Closure *method)
+      : Obj{ValueType::BOUND_METHOD}, receiver{receiver}, method{method} {}
+
+  const Value receiver;
+  const Closure *method;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "function.hpp"
+#include "string_intern.hpp"
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+// A script compiled once for any number of VMs: its functions with their
+// bytecode and constants, and the strings its literals and names intern to.
+// Nothing writes to an image after compile(), so VMs on different threads
+// run it at once without locking. Everything a run changes, like globals,
+// property caches and strings made at runtime, stays in each VM, which only
+// needs its own stacks and heap on top of the shared image.
+//
+// Run it on a VM made with VM{image}; see VM::script().
+class CodeImage {
+public:
+  // Compiles `source`, or returns nullptr after reporting a compile error to
+  // `out`.
+  [[nodiscard]] static std::shared_ptr<const CodeImage>
+  compile(std::string_view source, std::ostream &out = std::cout);
+
+  ~CodeImage();
+  CodeImage(const CodeImage &) = delete;
+  CodeImage &operator=(const CodeImage &) = delete;
+
+  // The script's top level.
+  [[nodiscard]] const Function *script() const { return script_; }
+  // The strings the compiler interned. VMs made for the image intern
+  // through it, so equal strings are one object in every one of them.
+  [[nodiscard]] const StringIntern &strings() const { return strings_; }
+
+private:
+  CodeImage() = default;
+
+  StringIntern strings_;
+  const Function *script_ = nullptr;
+};
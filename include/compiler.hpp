@@ -1,4 +1,5 @@
 #pragma once
+#include "alloc_profiler.hpp"
 #include "chunk.hpp"
 #include "function.hpp"
 #include "parser.hpp"
@@ -32,6 +33,18 @@ public:
 struct Local {
   Token name;
   uint8_t depth;
+  // Loop nesting depth of the owning function when the local was declared.
+  uint8_t loopDepth = 0;
+  bool isCaptured = false;
+  // Set when the local may be written after a closure captured it, which
+  // forces a shared cell instead of a by-value copy.
+  bool needsCell = false;
+  // Written inside a loop that is still open and was entered after the
+  // declaration, i.e. a capture inside that loop can observe the write.
+  bool writtenInLoop = false;
+  // Offsets of the OP_CLOSURE capture bytes that refer to this local, patched
+  // once the local goes out of scope.
+  std::vector<size_t> captureSites;
 };
 
 struct Upvalue {
@@ -39,7 +52,13 @@ struct Upvalue {
   bool isLocal;
 };
 
-enum class FunctionType { TYPE_FUNCTION, TYPE_SCRIPT };
+enum class FunctionType {
+  TYPE_FUNCTION,
+  TYPE_INITIALIZER,
+  TYPE_METHOD,
+  TYPE_GENERATOR,
+  TYPE_SCRIPT
+};
 
 class FunctionCompiler {
 public:
@@ -49,8 +68,13 @@ public:
         // TODO: Allocate chunk somewhere appropriate.
         scopeDepth{0}, type{type}, _function{new Function(new Chunk())} {
 
-    // Allocate slot 0 for the function itself.
-    locals.push_back(Local{Token{}, 0});
+    // Allocate slot 0 for the function itself, or the receiver in methods.
+    if (type == FunctionType::TYPE_METHOD ||
+        type == FunctionType::TYPE_INITIALIZER) {
+      locals.push_back(Local{Token{TokenType::THIS, "this", 0}, 0});
+    } else {
+      locals.push_back(Local{Token{}, 0});
+    }
     _function->name = parser.previous.lexeme;
   };
 
@@ -73,6 +97,11 @@ public:
   std::vector<Local> locals;
   std::vector<Upvalue> upvalues;
   uint8_t scopeDepth;
+  uint8_t loopDepth = 0;
+};
+
+struct ClassCompiler {
+  ClassCompiler *enclosing;
 };
 
 class Compiler {
@@ -81,12 +110,23 @@ public:
   [[nodiscard]] const std::optional<const Function *>
   compile(const std::string_view source) noexcept;
 
+  // Reports the strings and functions the compiler creates to `profiler`,
+  // or stops reporting if it is nullptr.
+  void profileAllocations(AllocationProfiler *profiler) noexcept {
+    allocations = profiler;
+  }
+  // Where compile errors are reported; std::cout unless the VM says so.
+  void setOutput(std::ostream &stream) noexcept { out = &stream; }
+
 private:
   StringIntern &stringIntern;
+  AllocationProfiler *allocations = nullptr;
+  std::ostream *out = &std::cout;
   Scanner scanner;
   Parser parser;
   bool canAssign;
   FunctionCompiler *current;
+  ClassCompiler *currentClass = nullptr;
 
   void synchronize();
   [[nodiscard]] Chunk &currentChunk() noexcept;
@@ -107,17 +147,28 @@ private:
   uint8_t resolveUpvalue(FunctionCompiler &compiler,
                          const Token &token) noexcept;
   void markInitialized() noexcept;
+  void markWritten(Local &local) noexcept;
+  void markUpvalueWritten(FunctionCompiler &compiler,
+                          const size_t index) noexcept;
+  void finalizeCaptures(Local &local) noexcept;
+  void beginLoop() noexcept;
+  void endLoop() noexcept;
   const ParseRule getRule(const TokenType type) const;
   inline uint8_t makeConstant(const Value &value) noexcept;
   inline void emitByte(uint8_t byte) noexcept;
   inline void emitBytes(uint8_t byte1, uint8_t byte2) noexcept;
   inline void emitReturn() noexcept;
+  inline void emitReturnOp() noexcept;
   inline void emitConstant(const Value &value) noexcept;
   inline size_t emitJump(const uint8_t instruction) noexcept;
   inline void emitLoop(const size_t loopStart) noexcept;
+  inline void emitCache() noexcept;
   void parsePrecedence(const Precedence precedence) noexcept;
   const uint8_t parseVariable(const std::string_view errorMessage) noexcept;
   const uint8_t identifierConstant(const Token &name) noexcept;
+  const StringObj *intern(const std::string &str) noexcept;
+  void recordAllocation(const Function *function, ValueType type,
+                        size_t bytes) noexcept;
   void defineVariable(uint8_t global) noexcept;
   void declareVariable() noexcept;
   void namedVariable(const Token &name) noexcept;
@@ -137,8 +188,16 @@ private:
   void variable() noexcept;
   void block() noexcept;
   void call() noexcept;
+  void dot() noexcept;
+  void array() noexcept;
+  void map() noexcept;
+  void index() noexcept;
+  void this_() noexcept;
   void declaration() noexcept;
+  void classDeclaration() noexcept;
+  void method() noexcept;
   void varDeclaration() noexcept;
+  void varInitializer(uint8_t global) noexcept;
   void funDeclaration() noexcept;
   void statement() noexcept;
   void printStatement() noexcept;
@@ -146,16 +205,21 @@ private:
   void ifStatement() noexcept;
   void whileStatement() noexcept;
   void forStatement() noexcept;
+  void forInStatement() noexcept;
   void returnStatement() noexcept;
+  void yieldStatement() noexcept;
 
 public:
-  constexpr static ParseRule rules[40] = {
+  constexpr static ParseRule rules[44] = {
       {&Compiler::grouping, &Compiler::call, Precedence::CALL}, // LEFT_PAREN
       {nullptr, nullptr, Precedence::NONE},                     // RIGHT_PAREN
-      {nullptr, nullptr, Precedence::NONE},                     // LEFT_BRACE
+      {&Compiler::map, nullptr, Precedence::NONE},              // LEFT_BRACE
       {nullptr, nullptr, Precedence::NONE},                     // RIGHT_BRACE
+      {&Compiler::array, &Compiler::index, Precedence::CALL},   // LEFT_BRACKET
+      {nullptr, nullptr, Precedence::NONE},                     // RIGHT_BRACKET
       {nullptr, nullptr, Precedence::NONE},                     // COMMA
-      {nullptr, nullptr, Precedence::NONE},                     // DOT
+      {nullptr, nullptr, Precedence::NONE},                     // COLON
+      {nullptr, &Compiler::dot, Precedence::CALL},              // DOT
       {&Compiler::unary, &Compiler::binary, Precedence::TERM},  // MINUS
       {nullptr, &Compiler::binary, Precedence::TERM},           // PLUS
       {nullptr, nullptr, Precedence::NONE},                     // SEMICOLON
@@ -179,12 +243,13 @@ public:
       {nullptr, nullptr, Precedence::NONE},                     // FOR
       {nullptr, nullptr, Precedence::NONE},                     // FUN
       {nullptr, nullptr, Precedence::NONE},                     // IF
+      {nullptr, nullptr, Precedence::NONE},                     // IN
       {&Compiler::literal, nullptr, Precedence::NONE},          // NIL
       {nullptr, &Compiler::or_, Precedence::OR},                // OR
       {nullptr, nullptr, Precedence::NONE},                     // PRINT
       {nullptr, nullptr, Precedence::NONE},                     // RETURN
       {nullptr, nullptr, Precedence::NONE},                     // SUPER
-      {nullptr, nullptr, Precedence::NONE},                     // THIS
+      {&Compiler::this_, nullptr, Precedence::NONE},            // THIS
       {&Compiler::literal, nullptr, Precedence::NONE},          // TRUE
       {nullptr, nullptr, Precedence::NONE},                     // VAR
       {nullptr, nullptr, Precedence::NONE},                     // WHILE
@@ -1,20 +1,46 @@
 #pragma once
 #include "chunk.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <ostream>
 #include <string_view>
 
-void disassembleChunk(const Chunk &chunk, std::string_view name);
+void disassembleChunk(const Chunk &chunk, std::string_view name,
+                      std::ostream &out = std::cout);
 
-[[nodiscard]] size_t disassembleInstruction(const Chunk &chunk, size_t offset);
+// Prints the instruction at `offset` and returns the offset of the next.
+[[nodiscard]] size_t disassembleInstruction(const Chunk &chunk, size_t offset,
+                                            std::ostream &out = std::cout);
 
-[[nodiscard]] size_t simpleInstruction(const std::string_view name,
+// The mnemonic of `opcode`, e.g. "OP_ADD".
+[[nodiscard]] std::string_view opcodeName(uint8_t opcode);
+
+[[nodiscard]] size_t simpleInstruction(std::ostream &out,
+                                       const std::string_view name,
                                        size_t offset);
 
-[[nodiscard]] size_t constantInstruction(const std::string_view name,
+[[nodiscard]] size_t constantInstruction(std::ostream &out,
+                                         const std::string_view name,
                                          const Chunk &chunk, size_t offset);
 
-[[nodiscard]] size_t byteInstruction(const std::string_view name,
+[[nodiscard]] size_t byteInstruction(std::ostream &out,
+                                     const std::string_view name,
                                      const Chunk &chunk, size_t offset);
 
-[[nodiscard]] size_t jumpInstruction(const std::string_view name,
+[[nodiscard]] size_t propertyInstruction(std::ostream &out,
+                                         const std::string_view name,
+                                         const Chunk &chunk, size_t offset);
+
+[[nodiscard]] size_t invokeInstruction(std::ostream &out,
+                                       const std::string_view name,
+                                       const Chunk &chunk, size_t offset);
+
+[[nodiscard]] size_t iterateInstruction(std::ostream &out,
+                                        const std::string_view name,
+                                        const Chunk &chunk, size_t offset);
+
+[[nodiscard]] size_t jumpInstruction(std::ostream &out,
+                                     const std::string_view name,
                                      const int sign, const Chunk &chunk,
                                      size_t offset);
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "fiber.hpp"
+#include "value.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class AwaitableObj;
+
+// A whole-file read or write handed to an EventLoop.
+struct IoRequest {
+  enum class Kind : uint8_t { READ, WRITE };
+
+  Kind kind;
+  std::string path;
+  // READ: the contents, once done. WRITE: what to write.
+  std::string data;
+  // The errno the request failed with, or 0.
+  int error = 0;
+  // Where the VM delivers the result; the backends never touch it.
+  AwaitableObj *awaitable = nullptr;
+};
+
+// Carries out IoRequests off the interpreter thread. Only the thread that
+// owns the EventLoop calls these.
+class IoBackend {
+public:
+  virtual ~IoBackend() = default;
+  virtual void submit(std::unique_ptr<IoRequest> request) = 0;
+  // Appends the requests finished since the last call to `done`. If `wait`,
+  // first blocks until at least one has; a request must be in flight.
+  virtual void reap(std::vector<std::unique_ptr<IoRequest>> &done,
+                    bool wait) = 0;
+  [[nodiscard]] virtual std::string_view name() const = 0;
+};
+
+// The file operations a VM has in flight. Requests go to io_uring when the
+// kernel allows it, where opening, sizing, transferring and closing are
+// each an asynchronous step, so no thread blocks on them. Otherwise a few
+// threads make the blocking calls. MEHH_IO=threads forces the latter.
+//
+// Nothing here runs scripts: the VM reaps finished requests whenever a
+// fiber awaits, joins or yields (see VM::completeIo) and wakes the fibers
+// waiting for them.
+class EventLoop {
+public:
+  enum class Backend : uint8_t { AUTO, IO_URING, THREADS };
+
+  // With IO_URING, falls back to THREADS if io_uring is unavailable.
+  explicit EventLoop(Backend backend = Backend::AUTO);
+  // Waits for the requests in flight, whose buffers it owns.
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  // Starts reading all of `path`, for `awaitable`.
+  void read(std::string path, AwaitableObj *awaitable);
+  // Starts replacing the contents of `path` with `data`, for `awaitable`.
+  void write(std::string path, std::string data, AwaitableObj *awaitable);
+
+  // Requests submitted and not yet reaped.
+  [[nodiscard]] size_t pending() const { return inFlight; }
+
+  // The requests finished since the last call, oldest first. If `wait` and
+  // any are pending, blocks until at least one is done. Valid until the
+  // next call.
+  std::vector<std::unique_ptr<IoRequest>> &reap(bool wait);
+
+  [[nodiscard]] std::string_view backendName() const {
+    return backend->name();
+  }
+
+private:
+  void submit(std::unique_ptr<IoRequest> request);
+
+  std::unique_ptr<IoBackend> backend;
+  std::vector<std::unique_ptr<IoRequest>> finished;
+  size_t inFlight = 0;
+};
+
+// What readFileAsync() and writeFileAsync() return, for await() to wait on.
+class AwaitableObj : public Obj {
+public:
+  AwaitableObj() : Obj{ValueType::AWAITABLE} {}
+
+  bool done = false;
+  // Once done: the contents read, or true for a write; nil or false if the
+  // request failed.
+  Value result;
+  // Fibers blocked in await() on this one.
+  std::vector<FiberObj *> waiters;
+};
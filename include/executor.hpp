@@ -0,0 +1,103 @@
+#pragma once
+
+#include "code_image.hpp"
+#include "vm.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Runs independent script executions on a fixed set of worker threads.
+//
+// Every job gets a VM of its own, built on the worker that runs it and
+// destroyed when the job returns. VMs share nothing but the immutable
+// CodeImage they may be made for: each has its own heap, intern table,
+// globals and output, so jobs can't see each other and no two threads ever
+// touch the same VM. Parallel natives run inline inside jobs,
+// since the workers already keep every core busy.
+//
+// Each worker has a deque of its own. Jobs submitted from inside a job go
+// on the submitting worker's deque and are taken newest first, while the
+// VM that made them is still warm in its cache; others are dealt out in
+// turn. A worker with nothing left steals the oldest job of another before
+// going to sleep, so a burst submitted from one job spreads over them all.
+class Executor {
+public:
+  // How a script run by run() ended, and everything it printed.
+  struct Result {
+    InterpretResult status;
+    std::string output;
+  };
+
+  explicit Executor(size_t workers = std::thread::hardware_concurrency());
+  // Finishes the jobs already submitted, then stops the workers.
+  ~Executor();
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  [[nodiscard]] size_t size() const { return workers.size(); }
+
+  // Calls job(vm) with a fresh VM on one of the workers.
+  template <typename Job>
+  std::future<std::invoke_result_t<Job, VM &>> submit(Job &&job) {
+    using Task = std::packaged_task<std::invoke_result_t<Job, VM &>(VM &)>;
+    auto task = std::make_shared<Task>(std::forward<Job>(job));
+    auto result = task->get_future();
+    post(nullptr, [task](VM &vm) { (*task)(vm); });
+    return result;
+  }
+
+  // Like submit(job), with a fresh VM made for `image`.
+  template <typename Job>
+  std::future<std::invoke_result_t<Job, VM &>>
+  submit(std::shared_ptr<const CodeImage> image, Job &&job) {
+    using Task = std::packaged_task<std::invoke_result_t<Job, VM &>(VM &)>;
+    auto task = std::make_shared<Task>(std::forward<Job>(job));
+    auto result = task->get_future();
+    post(std::move(image), [task](VM &vm) { (*task)(vm); });
+    return result;
+  }
+
+  // Interprets `source` with a fresh VM, capturing what it prints.
+  std::future<Result> run(std::string source);
+  // Runs the top level of `image` on a fresh VM, capturing what it prints.
+  std::future<Result> run(std::shared_ptr<const CodeImage> image);
+
+private:
+  struct Job {
+    std::shared_ptr<const CodeImage> image;
+    std::function<void(VM &)> work;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    std::thread thread;
+  };
+
+  void post(std::shared_ptr<const CodeImage> image,
+            std::function<void(VM &)> work);
+  // Takes the newest job of worker `self`, or else the oldest of another.
+  [[nodiscard]] bool take(size_t self, Job &job);
+  void workerLoop(size_t self);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  // Where the next job submitted from outside the workers goes.
+  std::atomic<size_t> nextWorker{0};
+  // Jobs queued and not yet taken. Raised under `mutex` before the job is
+  // queued, so a worker going to sleep can't miss one and taking it can't
+  // wrap the count below zero.
+  std::atomic<size_t> pending{0};
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+};
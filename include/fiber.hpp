@@ -0,0 +1,63 @@
+#pragma once
+
+#include "call_frame.hpp"
+#include "fixed_stack.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define FRAME_MAX 64
+#define STACK_MAX 256
+
+using ValueStack = FixedStack<Value, STACK_MAX>;
+using FrameStack = FixedStack<CallFrame, FRAME_MAX>;
+
+// A strand of execution with its own value and call frame stacks, started
+// by spawn() and switched to by yield() and join(). Fibers share their VM's
+// heap and globals and take turns on its thread: only the running fiber's
+// stacks are in the VM, and the others keep the VM's registers for them
+// here while they wait. The VM's top level runs on a FiberObj of its own.
+class FiberObj : public Obj {
+public:
+  enum class State : uint8_t {
+    // Spawned; the callee and its arguments are on the stack.
+    NEW,
+    // Running, or waiting in the VM's run queue.
+    READY,
+    // In join() or await(), waiting for another fiber to finish or for a
+    // file operation to complete.
+    BLOCKED,
+    DONE,
+  };
+
+  FiberObj()
+      : Obj{ValueType::FIBER},
+        stack{reinterpret_cast<Value *>(valueStorage)},
+        frames{reinterpret_cast<CallFrame *>(frameStorage)} {}
+  FiberObj(const FiberObj &) = delete;
+  FiberObj &operator=(const FiberObj &) = delete;
+
+  // The VM's registers while the fiber isn't running.
+  ValueStack stack;
+  FrameStack frames;
+  CallFrame *frame = nullptr;
+  // Open upvalues into this fiber's stack.
+  UpvalueObj *openUpvalues = nullptr;
+
+  State state = State::NEW;
+  // What the fiber's function returned, once DONE.
+  Value result;
+  // Fibers blocked in join() on this one.
+  std::vector<FiberObj *> joiners;
+  // The VM's reset count when the fiber was spawned. A runtime error ends
+  // every fiber, so those an awaitable finishing afterwards still lists as
+  // waiters are not woken.
+  size_t generation = 0;
+
+private:
+  // Left uninitialized: spawning a fiber writes only what it pushes.
+  alignas(Value) std::byte valueStorage[STACK_MAX * sizeof(Value)];
+  alignas(CallFrame) std::byte frameStorage[FRAME_MAX * sizeof(CallFrame)];
+};
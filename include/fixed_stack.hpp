@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A stack of at most N elements kept in storage it doesn't own. Copying one
+// copies two pointers, which is how the VM switches between the stacks of
+// different fibers. Elements are never destroyed, so T must be trivially
+// destructible. Pushing onto a full stack throws std::bad_alloc.
+template <typename T, size_t N> class FixedStack {
+  static_assert(std::is_trivially_destructible_v<T>);
+
+public:
+  using value_type = T;
+  using iterator = T *;
+  using const_iterator = const T *;
+  using reverse_iterator = std::reverse_iterator<T *>;
+  using const_reverse_iterator = std::reverse_iterator<const T *>;
+
+  FixedStack() = default;
+  // An empty stack in `storage`, which has room for N elements.
+  explicit FixedStack(T *storage) : base{storage}, top{storage} {}
+
+  [[nodiscard]] static constexpr size_t capacity() { return N; }
+  [[nodiscard]] size_t size() const { return top - base; }
+  [[nodiscard]] bool empty() const { return top == base; }
+
+  [[nodiscard]] T *data() { return base; }
+  [[nodiscard]] const T *data() const { return base; }
+  [[nodiscard]] iterator begin() { return base; }
+  [[nodiscard]] iterator end() { return top; }
+  [[nodiscard]] const_iterator begin() const { return base; }
+  [[nodiscard]] const_iterator end() const { return top; }
+  [[nodiscard]] reverse_iterator rbegin() { return reverse_iterator{top}; }
+  [[nodiscard]] reverse_iterator rend() { return reverse_iterator{base}; }
+  [[nodiscard]] const_reverse_iterator rbegin() const {
+    return const_reverse_iterator{top};
+  }
+  [[nodiscard]] const_reverse_iterator rend() const {
+    return const_reverse_iterator{base};
+  }
+
+  [[nodiscard]] T &operator[](size_t index) { return base[index]; }
+  [[nodiscard]] const T &operator[](size_t index) const { return base[index]; }
+  [[nodiscard]] T &back() { return top[-1]; }
+  [[nodiscard]] const T &back() const { return top[-1]; }
+
+  void push_back(const T &value) {
+    reserve(1);
+    ::new (static_cast<void *>(top++)) T(value);
+  }
+  template <typename... Args> T &emplace_back(Args &&...args) {
+    reserve(1);
+    return *::new (static_cast<void *>(top++)) T(std::forward<Args>(args)...);
+  }
+  // Appends copies of [first, last).
+  void append(const T *first, const T *last) {
+    reserve(last - first);
+    top = std::uninitialized_copy(first, last, top);
+  }
+  void pop_back() { --top; }
+  void clear() { top = base; }
+
+  // Grows with value-initialized elements or truncates.
+  void resize(size_t size) {
+    if (size > this->size()) {
+      reserve(size - this->size());
+    }
+    T *const end = base + size;
+    while (top < end) {
+      ::new (static_cast<void *>(top++)) T();
+    }
+    top = end;
+  }
+
+  // Removes [first, last), moving the elements after it down.
+  iterator erase(iterator first, iterator last) {
+    top = std::move(last, top, first);
+    return first;
+  }
+
+private:
+  __attribute__((always_inline)) inline void reserve(size_t count) const {
+    if (__builtin_expect(static_cast<size_t>(base + N - top) < count, 0)) {
+      overflow();
+    }
+  }
+  [[noreturn]] __attribute__((noinline, cold)) static void overflow() {
+    throw std::bad_alloc{};
+  }
+
+  T *base = nullptr;
+  T *top = nullptr;
+};
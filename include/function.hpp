@@ -2,18 +2,45 @@
 
 #include "chunk.hpp"
 #include "function.fwd.hpp"
+#include "mehh_aot.h"
 #include "value.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+class VM;
+
 using NativeFunctionPtr = Value (*)(int, Value *);
+// Natives that call back into scripts or allocate also get the VM.
+using VMNativeFunctionPtr = Value (*)(VM &, int, Value *);
 class NativeFunction : public Obj {
 public:
   NativeFunction(NativeFunctionPtr fun)
-      : Obj{ValueType::NATIVE_FUNCTION}, fun{fun} {};
+      : Obj{ValueType::NATIVE_FUNCTION}, fun{fun}, vmFun{nullptr} {};
+  NativeFunction(VMNativeFunctionPtr vmFun)
+      : Obj{ValueType::NATIVE_FUNCTION}, fun{nullptr}, vmFun{vmFun} {};
+  // Exactly one of these is set. Plain natives don't touch the VM.
   NativeFunctionPtr fun;
+  VMNativeFunctionPtr vmFun;
+  // Set for plain natives that only read their arguments and have no side
+  // effects, which map and filter may call from worker threads.
+  bool pure = false;
+  // For natives bound from a double(double) function (see VM::bind), which
+  // numeric kernels call directly instead of boxing every element.
+  double (*unary)(double) = nullptr;
+  // The global it was defined as, for tracing.
+  std::string_view name;
+};
+
+// Natives return a pointer to one of these (usually a static) to raise a
+// runtime error instead of producing a value.
+class NativeError : public Obj {
+public:
+  explicit NativeError(std::string_view message)
+      : Obj{ValueType::NATIVE_ERROR}, message{message} {};
+  const std::string_view message;
 };
 
 class Function : public Obj {
@@ -26,13 +53,30 @@ public:
   size_t upvalueCount;
   std::string name;
   uint8_t arity;
+  // Declared with `fun*`: calls make a GeneratorObj instead of running it.
+  bool generator = false;
+  // Native code for the function from mehh --emit-c, used when compiled
+  // code calls it.
+  mehh_entry compiled = nullptr;
 };
 
 // Not to be confused with Compiler "Upvalue".
+// An open upvalue points into the VM stack; closing it copies the value into
+// `closed` and repoints `location` there. Never copy an UpvalueObj once
+// `location` may refer to its own `closed` member.
 class UpvalueObj : public Obj {
 public:
-  explicit UpvalueObj(Value * const function) : Obj(ValueType::UPVALUE), location{function} {}
-  Value * const location;
+  explicit UpvalueObj(Value *const slot)
+      : Obj(ValueType::UPVALUE), location{slot}, next{nullptr} {}
+  // Creates an already closed upvalue holding a copy of `value`.
+  explicit UpvalueObj(const Value &value)
+      : Obj(ValueType::UPVALUE), location{&closed}, closed{value},
+        next{nullptr} {}
+
+  Value *location;
+  Value closed;
+  // Next open upvalue further down the stack.
+  UpvalueObj *next;
 };
 
 class Closure : public Obj {
@@ -40,9 +84,16 @@ public:
   explicit Closure(const Function *function)
       : Obj{ValueType::CLOSURE}, function{function} {
     upvalues.reserve(function->upvalueCount);
+    captured.reserve(function->upvalueCount);
   };
   const Function *function;
-  std::vector<UpvalueObj> upvalues;
+  // The calling VM's caches for the property access sites of `function`
+  // (see InlineCaches), set when the closure is made.
+  PropertyCache *caches = nullptr;
+  std::vector<UpvalueObj *> upvalues;
+  // Storage for upvalues captured by value. Reserved up front so it never
+  // reallocates and the pointers in `upvalues` stay valid.
+  std::vector<UpvalueObj> captured;
 
 private:
 };
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "function.hpp"
+#include "value.hpp"
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// A call of a `fun*` function, suspended between values. Calling the
+// function makes one of these instead of a frame; resuming it, with for-in
+// or by calling it, pushes the frame back where the resumer's stack ends,
+// and `yield` pops it off again. Only the frame's own slot window is saved,
+// so a resume costs about as much as a call.
+class GeneratorObj : public Obj {
+public:
+  enum class State : uint8_t { SUSPENDED, RUNNING, DONE };
+
+  explicit GeneratorObj(const Closure *closure)
+      : Obj{ValueType::GENERATOR}, closure{closure},
+        ip{closure->function->chunk->code().begin()} {}
+
+  const Closure *const closure;
+  // Where the frame carries on from.
+  std::vector<uint8_t>::iterator ip;
+  // The frame's slots while suspended: the generator itself in slot 0, then
+  // the parameters, locals and temporaries.
+  std::vector<Value> slots;
+  // Open upvalues pointing into `slots`, ordered like VM::openUpvalues.
+  UpvalueObj *openUpvalues = nullptr;
+  State state = State::SUSPENDED;
+  // Set while a for-in loop runs the generator: how far past the loop's
+  // OP_ITERATE to jump once it returns.
+  std::optional<uint16_t> loopExit;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "value.hpp"
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Owns runtime-allocated objects for the lifetime of the VM. Nothing is
+// freed before the VM is destroyed, so hot paths avoid allocating: e.g.
+// obj.method(...) compiles to OP_INVOKE, which calls the method without
+// binding it, and only reading obj.method as a value makes a BoundMethod.
+class Heap {
+public:
+  template <typename T, typename... Args> T *allocate(Args &&...args) {
+    auto obj = std::make_unique<T>(std::forward<Args>(args)...);
+    T *ptr = obj.get();
+    objects.push_back(std::move(obj));
+    return ptr;
+  }
+
+private:
+  std::vector<std::unique_ptr<Obj>> objects;
+};
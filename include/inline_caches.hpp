@@ -0,0 +1,34 @@
+#pragma once
+
+#include "chunk.hpp"
+#include <absl/container/flat_hash_map.h>
+#include <cstddef>
+#include <memory>
+
+// A VM's property caches, one array per chunk with an entry for each of its
+// access sites. Kept out of the chunks so compiled code is never written
+// while it runs and one CodeImage can serve many VMs at once.
+class InlineCaches {
+public:
+  // The caches of `chunk`, all empty the first time it is asked for, or
+  // nullptr if it has no property access sites.
+  [[nodiscard]] PropertyCache *of(const Chunk &chunk) {
+    if (chunk.cacheCount() == 0) {
+      return nullptr;
+    }
+    std::unique_ptr<PropertyCache[]> &caches = tables[&chunk];
+    if (caches == nullptr) {
+      caches = std::make_unique<PropertyCache[]>(chunk.cacheCount());
+    }
+    return caches.get();
+  }
+
+  // Like of(), but nullptr if `chunk` has none yet.
+  [[nodiscard]] const PropertyCache *find(const Chunk &chunk) const {
+    const auto it = tables.find(&chunk);
+    return it != tables.end() ? it->second.get() : nullptr;
+  }
+
+private:
+  absl::flat_hash_map<const Chunk *, std::unique_ptr<PropertyCache[]>> tables;
+};
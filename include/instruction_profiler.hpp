@@ -0,0 +1,87 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "function.hpp"
+#include "inline_caches.hpp"
+#include "value.hpp"
+#include <absl/container/flat_hash_map.h>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Counts how often each instruction of each function runs and which value
+// types reach its arithmetic and comparison operands, and prints every
+// function's disassembly annotated with the counts, its hottest basic blocks
+// and the final state of its property caches. Fed by VM::dispatch() in
+// builds configured with MEHH_PROFILE_OPS, like OpProfiler.
+class InstructionProfiler {
+public:
+  // Blocks marked hot in each function.
+  static constexpr size_t HOT_BLOCKS = 3;
+
+  // `caches` are the profiled VM's, for the report; without them every
+  // cache shows as empty.
+  explicit InstructionProfiler(const InlineCaches *caches = nullptr)
+      : caches{caches} {}
+
+  struct Site {
+    uint64_t hits = 0;
+    // Bit n set if a value with ValueType n was seen as the operand; unary
+    // operators only set `left`.
+    uint16_t left = 0;
+    uint16_t right = 0;
+  };
+
+  // `stackTop` is one past the top of the value stack before the
+  // instruction at `offset` runs.
+  __attribute__((always_inline)) inline void record(const Function *function,
+                                                    size_t offset,
+                                                    uint8_t opcode,
+                                                    const Value *stackTop) {
+    if (__builtin_expect(function != lastFunction, 0)) {
+      lastSites = &sitesFor(function);
+      lastFunction = function;
+    }
+    Site &site = (*lastSites)[offset];
+    site.hits++;
+    switch (opcode) {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_EQUAL:
+      site.left |= typeBit(stackTop[-2]);
+      site.right |= typeBit(stackTop[-1]);
+      break;
+    case OP_NEGATE:
+    case OP_NOT:
+      site.left |= typeBit(stackTop[-1]);
+      break;
+    default:
+      break;
+    }
+  }
+
+  // The profile of `function`, one entry per byte of its code, or nullptr
+  // if it never ran.
+  [[nodiscard]] const std::vector<Site> *sites(const Function *function) const;
+  [[nodiscard]] uint64_t hits(const Function *function, size_t offset) const;
+
+  // The disassembly of every function that ran, busiest first.
+  void report(std::ostream &out) const;
+  void report(std::ostream &out, const Function *function) const;
+
+private:
+  [[nodiscard]] static uint16_t typeBit(const Value &value) {
+    return static_cast<uint16_t>(1u << static_cast<unsigned>(value.getType()));
+  }
+  std::vector<Site> &sitesFor(const Function *function);
+
+  const InlineCaches *caches;
+  absl::flat_hash_map<const Function *, std::vector<Site>> profiles;
+  const Function *lastFunction = nullptr;
+  std::vector<Site> *lastSites = nullptr;
+};
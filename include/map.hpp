@@ -0,0 +1,55 @@
+#pragma once
+
+#include "value.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hash map keyed by Values, laid out as a Swiss table: one control byte per
+// slot holding the low 7 bits of the hash (or an empty/deleted marker), in
+// groups of 16 probed with a single SIMD compare.
+//
+// Keys compare by their NaN-boxed bits, which is pointer identity for
+// objects, except that strings compare by contents: most are interned, but
+// those viewing a file (readFile(), lines()) are not. Numbers are
+// normalized so 0 and -0 are the same key.
+class MapObj : public Obj {
+public:
+  struct Entry {
+    Value key;
+    Value value;
+  };
+
+  static constexpr size_t GROUP_WIDTH = 16;
+
+  MapObj();
+
+  // Returns the value stored under `key`, or nullptr.
+  [[nodiscard]] const Value *find(const Value &key) const;
+  void set(const Value &key, const Value &value);
+  // Returns whether `key` was present.
+  bool remove(const Value &key);
+
+  [[nodiscard]] size_t size() const { return count; }
+  [[nodiscard]] size_t capacity() const { return ctrl.size(); }
+  // Index of the first occupied slot at or after `from`, or capacity().
+  [[nodiscard]] size_t nextSlot(size_t from) const;
+  [[nodiscard]] const Entry &slot(size_t index) const { return slots[index]; }
+
+private:
+  static constexpr int8_t EMPTY = -128;
+  static constexpr int8_t DELETED = -2;
+
+  [[nodiscard]] static uint64_t hash(const Value &key);
+  [[nodiscard]] static uint64_t normalize(const Value &key);
+  [[nodiscard]] size_t findSlot(const Value &key, uint64_t hash) const;
+  void rehash(size_t newCapacity);
+  void insertNew(const Value &key, const Value &value, uint64_t hash);
+
+  std::vector<int8_t> ctrl;
+  std::vector<Entry> slots;
+  size_t count;
+  // Insertions left before the table must be rehashed; tombstones count
+  // against it.
+  size_t growthLeft;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "value.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// A whole file mapped read-only into memory, so its contents can be read
+// and handed out as strings without copying them. Strings from readFile()
+// and lines() share ownership of the mapping through StringObj's storage.
+//
+// As with any mapping, changing the file while it is mapped changes what
+// the strings read, and truncating it makes reading past the new end fault.
+class MappedFile {
+public:
+  // nullptr if `path` can't be opened or mapped.
+  [[nodiscard]] static std::shared_ptr<const MappedFile>
+  open(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  [[nodiscard]] std::string_view contents() const { return {data, size}; }
+
+  // Hints that the file will be read front to back, for more read-ahead.
+  void sequential() const;
+  // Gives back the memory of the pages wholly inside [begin, end). They are
+  // read from the file again if touched.
+  void release(size_t begin, size_t end) const;
+
+private:
+  MappedFile(const char *data, size_t size) : data{data}, size{size} {}
+
+  const char *data;
+  size_t size;
+};
+
+// What lines() returns: a file to iterate over a line at a time with
+// `for (var line in lines(path))`. The loop's cursor is the offset of the
+// next line, so each loop starts from the top.
+class LinesObj : public Obj {
+public:
+  explicit LinesObj(std::shared_ptr<const MappedFile> file)
+      : Obj{ValueType::LINES}, file{std::move(file)} {}
+
+  const std::shared_ptr<const MappedFile> file;
+};
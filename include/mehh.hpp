@@ -1,13 +1,48 @@
 #pragma once
 
+#include "sampling_profiler.hpp"
 #include "vm.hpp"
+#include <cstddef>
+#include <fstream>
+#include <memory>
 #include <string>
 
 class Mehh {
 public:
   void repl() noexcept;
   void runFile(const std::string &path) noexcept;
+  // --emit-c[=out.c]: translate the script at `path` to C, for building
+  // against libmehh, instead of running it. Writes to stdout if
+  // `out` is empty. Returns false if the script can't be read or compiled.
+  [[nodiscard]] bool emitC(const std::string &path,
+                           const std::string &out) noexcept;
+
+  // --profile-ops: count opcodes while running. Returns false if this build
+  // has no opcode profiler.
+  [[nodiscard]] bool enableOpProfiler() noexcept;
+  // --disasm-profile: print each function's disassembly annotated with
+  // execution counts. Returns false if this build has no dispatch hook.
+  [[nodiscard]] bool enableDisasmProfile() noexcept;
+  // --profile[=hz]: sample the call stack `hz` times per second of CPU time.
+  // Returns false if the sampling timer can't be set up.
+  [[nodiscard]] bool enableSamplingProfiler(unsigned hz) noexcept;
+  // --perf-counters[=functions]: read hardware counters around each run,
+  // and per function if asked. Returns false if the kernel denies access,
+  // in which case the script still runs without counters.
+  bool enablePerfCounters(bool perFunction) noexcept;
+  // --profile-alloc[=bytes]: count allocations per type and sample their
+  // sites about once every `interval` bytes.
+  void enableAllocationProfiler(size_t interval) noexcept;
+  // --no-jit: interpret loops even in builds with the trace JIT.
+  void disableJit() noexcept;
+  // --trace: record calls and returns as a Chrome trace in mehh-trace.json.
+  [[nodiscard]] bool enableTracing() noexcept;
+  // Prints the reports of the enabled profilers; called once at exit.
+  void writeProfiles() noexcept;
 
 private:
+  // Declared before the VM, whose tracer writes to it until destroyed.
+  std::ofstream traceFile;
   VM vm{};
-};
\ No newline at end of file
+  std::unique_ptr<SamplingProfiler> sampler;
+};
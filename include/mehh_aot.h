@@ -0,0 +1,140 @@
+/* Interface between C code generated by `mehh --emit-c` and the runtime in
+ * libmehh.a. Plain C so the generated file builds with the system C
+ * compiler.
+ *
+ * Values keep the VM's NaN-boxed layout: numbers are doubles, nil and the
+ * booleans are quiet NaNs with a small tag, and objects are quiet NaNs with
+ * the sign bit set and the pointer in the low bits. Number arithmetic and
+ * tests are inlined here; everything that touches objects calls into the
+ * runtime.
+ */
+#ifndef MEHH_AOT_H
+#define MEHH_AOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint64_t mehh_value;
+typedef struct mehh_vm mehh_vm;
+typedef struct mehh_closure mehh_closure;
+typedef struct mehh_cell mehh_cell;
+
+/* A compiled function. `slots` holds the callee or receiver followed by the
+ * arguments. Returns false after reporting a runtime error. */
+typedef bool (*mehh_entry)(mehh_vm *vm, const mehh_closure *closure,
+                           mehh_value *slots, mehh_value *result);
+
+#define MEHH_QNAN UINT64_C(0x7FFC000000000000)
+#define MEHH_SIGN UINT64_C(0x8000000000000000)
+#define MEHH_NIL (MEHH_QNAN | 1)
+#define MEHH_FALSE (MEHH_QNAN | 2)
+#define MEHH_TRUE (MEHH_QNAN | 3)
+
+static inline bool mehh_is_number(mehh_value value) {
+  return (value & MEHH_QNAN) != MEHH_QNAN;
+}
+
+static inline double mehh_as_number(mehh_value value) {
+  double number;
+  memcpy(&number, &value, sizeof(number));
+  return number;
+}
+
+static inline mehh_value mehh_number(double number) {
+  mehh_value value;
+  memcpy(&value, &number, sizeof(value));
+  return value;
+}
+
+static inline mehh_value mehh_bool(bool b) { return b ? MEHH_TRUE : MEHH_FALSE; }
+
+static inline bool mehh_falsey(mehh_value value) {
+  return value == MEHH_NIL || value == MEHH_FALSE;
+}
+
+/* Operators with a number fast path in generated code. */
+enum mehh_operator {
+  MEHH_ADD,
+  MEHH_SUBTRACT,
+  MEHH_MULTIPLY,
+  MEHH_DIVIDE,
+  MEHH_LESS,
+  MEHH_GREATER,
+  MEHH_NEGATE,
+};
+
+/* Operators on anything but two numbers (one for MEHH_NEGATE). */
+bool mehh_arith(mehh_vm *vm, enum mehh_operator op, mehh_value a,
+                mehh_value b, mehh_value *result);
+bool mehh_equal(mehh_value a, mehh_value b);
+
+/* The constants of the closure's function. */
+const mehh_value *mehh_constants(const mehh_closure *closure);
+/* Where upvalue `index` of the closure lives. */
+mehh_value *mehh_upvalue(const mehh_closure *closure, uint8_t index);
+
+bool mehh_get_global(mehh_vm *vm, mehh_value name, mehh_value *result);
+bool mehh_set_global(mehh_vm *vm, mehh_value name, mehh_value value);
+void mehh_define_global(mehh_vm *vm, mehh_value name, mehh_value value);
+
+/* Calls slots[0] with `argCount` arguments from slots[1]. */
+bool mehh_call(mehh_vm *vm, mehh_value *slots, uint8_t argCount,
+               mehh_value *result);
+/* Calls method `name` on the receiver in slots[0]. */
+bool mehh_invoke(mehh_vm *vm, const mehh_closure *closure, mehh_value name,
+                 uint16_t cache, mehh_value *slots, uint8_t argCount,
+                 mehh_value *result);
+
+/* A cell shared by the closures that capture the local at `location`,
+ * until mehh_close() copies the value out at the end of its scope. */
+mehh_cell *mehh_capture(mehh_vm *vm, mehh_value *location);
+void mehh_close(mehh_cell *cell);
+/* Closure construction; captures are added in upvalue order. */
+mehh_value mehh_closure_new(mehh_vm *vm, mehh_value function);
+void mehh_capture_cell(mehh_value closure, mehh_cell *cell);
+void mehh_capture_value(mehh_value closure, mehh_value value);
+void mehh_capture_upvalue(mehh_value closure, const mehh_closure *enclosing,
+                          uint8_t index);
+
+mehh_value mehh_class(mehh_vm *vm, mehh_value name);
+void mehh_method(mehh_vm *vm, mehh_value klass, mehh_value name,
+                 mehh_value method);
+bool mehh_get_property(mehh_vm *vm, const mehh_closure *closure,
+                       mehh_value name, uint16_t cache, mehh_value *object);
+bool mehh_set_property(mehh_vm *vm, const mehh_closure *closure,
+                       mehh_value name, uint16_t cache, mehh_value object,
+                       mehh_value value);
+
+mehh_value mehh_array(mehh_vm *vm, const mehh_value *items, uint8_t count);
+/* `items` holds `count` key and value pairs. */
+mehh_value mehh_map(mehh_vm *vm, const mehh_value *items, uint8_t count);
+bool mehh_get_index(mehh_vm *vm, mehh_value target, mehh_value index,
+                    mehh_value *result);
+bool mehh_set_index(mehh_vm *vm, mehh_value target, mehh_value index,
+                    mehh_value value);
+/* One step of a for-in loop: 1 with the next element in `element`, 0 when
+ * done, -1 on error. */
+int mehh_iterate(mehh_vm *vm, mehh_value sequence, mehh_value *cursor,
+                 mehh_value *element);
+
+void mehh_print(mehh_vm *vm, mehh_value value);
+
+/* Prints the stack trace line of a failed function. */
+void mehh_trace(const mehh_closure *closure, size_t line);
+
+/* Compiles `source`, checks that its bytecode matches what the entries were
+ * generated from, attaches them and runs the script. The exit status. */
+int mehh_aot_main(const char *source, const mehh_entry *entries,
+                  size_t entryCount, uint64_t checksum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "array.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <cmath>
+#include <cstddef>
+#include <fmt/core.h>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+class VM;
+
+// Natives generated from ordinary C++ functions, for VM::bind(). The
+// trampoline for a function is deduced from its type: it checks the
+// argument count once, unboxes every argument into its parameter type and
+// boxes the result, raising a runtime error if an argument doesn't fit.
+// Functions that take a VM & first become VM natives.
+//
+// Parameters may be double, float, integers (which must be passed whole
+// numbers), bool, Value, std::string_view or ArrayObj *. Results may be
+// void (returning nil), a number, bool or Value.
+namespace binding {
+
+// Errors are statics local to the failing branch, so the path taken by
+// well-typed calls never checks whether they have been built.
+template <size_t N> const NativeError &arityError() {
+  static const std::string message =
+      fmt::format("Expected {} argument{}.", N, N == 1 ? "" : "s");
+  static const NativeError error{message};
+  return error;
+}
+
+// Unboxes parameters of type T. check() returns the error to raise if
+// `value` can't be passed as a T, or nullptr.
+template <typename T, typename = void> struct Argument {
+  static_assert(sizeof(T) == 0, "Unsupported native parameter type");
+};
+
+template <> struct Argument<Value> {
+  static const NativeError *check(const Value &) { return nullptr; }
+  static const Value &get(const Value &value) { return value; }
+};
+
+template <> struct Argument<bool> {
+  static const NativeError *check(const Value &value) {
+    if (value.isBool()) {
+      return nullptr;
+    }
+    static const NativeError mismatch{"Argument must be a boolean."};
+    return &mismatch;
+  }
+  static bool get(const Value &value) { return value.asBool(); }
+};
+
+template <typename T>
+struct Argument<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+  static const NativeError *check(const Value &value) {
+    if (value.isNumber()) {
+      return nullptr;
+    }
+    static const NativeError mismatch{"Argument must be a number."};
+    return &mismatch;
+  }
+  static T get(const Value &value) { return static_cast<T>(value.asNumber()); }
+};
+
+template <typename T>
+struct Argument<T, std::enable_if_t<std::is_integral_v<T> &&
+                                    !std::is_same_v<T, bool>>> {
+  static const NativeError *check(const Value &value) {
+    if (value.isNumber()) {
+      const double number = value.asNumber();
+      // Also rejects NaN and numbers out of T's range. T's max isn't
+      // always a double (int64_t's rounds up to 2^63), so the upper bound
+      // is the exact power of two just above it.
+      if (number >= static_cast<double>(std::numeric_limits<T>::min()) &&
+          number < std::ldexp(1.0, std::numeric_limits<T>::digits) &&
+          static_cast<double>(static_cast<T>(number)) == number) {
+        return nullptr;
+      }
+    }
+    static const NativeError mismatch{"Argument must be an integer."};
+    return &mismatch;
+  }
+  static T get(const Value &value) { return static_cast<T>(value.asNumber()); }
+};
+
+template <> struct Argument<std::string_view> {
+  static const NativeError *check(const Value &value) {
+    if (value.is(ValueType::STRING)) {
+      return nullptr;
+    }
+    static const NativeError mismatch{"Argument must be a string."};
+    return &mismatch;
+  }
+  static std::string_view get(const Value &value) {
+    return value.asObj()->as<StringObj>()->str;
+  }
+};
+
+template <> struct Argument<ArrayObj *> {
+  static const NativeError *check(const Value &value) {
+    if (value.isArray()) {
+      return nullptr;
+    }
+    static const NativeError mismatch{"Argument must be an array."};
+    return &mismatch;
+  }
+  static ArrayObj *get(const Value &value) {
+    return value.asObj()->as<ArrayObj>();
+  }
+};
+
+template <> struct Argument<const ArrayObj *> : Argument<ArrayObj *> {};
+
+template <typename T> Value result(T &&value) {
+  using R = std::remove_cvref_t<T>;
+  if constexpr (std::is_same_v<R, Value>) {
+    return value;
+  } else if constexpr (std::is_same_v<R, bool>) {
+    return Value{value};
+  } else if constexpr (std::is_arithmetic_v<R>) {
+    return Value{static_cast<double>(value)};
+  } else {
+    static_assert(sizeof(R) == 0, "Unsupported native result type");
+  }
+}
+
+// Checks and unboxes `args`, then calls `call` with them.
+template <typename... Params, typename Call, size_t... I>
+__attribute__((always_inline)) inline Value
+invoke(int argCount, Value *args, Call &&call, std::index_sequence<I...>) {
+  if (__builtin_expect(argCount != sizeof...(Params), 0)) {
+    return Value{static_cast<const Obj *>(&arityError<sizeof...(Params)>())};
+  }
+  const NativeError *failure = nullptr;
+  if (__builtin_expect(
+          !((failure = Argument<std::remove_cvref_t<Params>>::check(args[I]),
+             failure == nullptr) &&
+            ...),
+          0)) {
+    return Value{static_cast<const Obj *>(failure)};
+  }
+  using R = decltype(call(
+      Argument<std::remove_cvref_t<Params>>::get(args[I])...));
+  if constexpr (std::is_void_v<R>) {
+    call(Argument<std::remove_cvref_t<Params>>::get(args[I])...);
+    return Value{};
+  } else {
+    return result(call(Argument<std::remove_cvref_t<Params>>::get(args[I])...));
+  }
+}
+
+template <auto F, typename Signature = decltype(F)> struct Native {
+  static_assert(sizeof(Signature) == 0,
+                "Natives are bound from pointers to functions");
+};
+
+template <auto F, typename R, typename... Params>
+struct Native<F, R (*)(Params...)> {
+  static constexpr bool USES_VM = false;
+  static Value trampoline(int argCount, Value *args) {
+    return invoke<Params...>(
+        argCount, args, [](auto &&...values) { return F(values...); },
+        std::index_sequence_for<Params...>{});
+  }
+};
+
+template <auto F, typename R, typename... Params>
+struct Native<F, R (*)(VM &, Params...)> {
+  static constexpr bool USES_VM = true;
+  static Value trampoline(VM &vm, int argCount, Value *args) {
+    return invoke<Params...>(
+        argCount, args, [&vm](auto &&...values) { return F(vm, values...); },
+        std::index_sequence_for<Params...>{});
+  }
+};
+
+template <auto F, typename R, typename... Params>
+struct Native<F, R (*)(Params...) noexcept> : Native<F, R (*)(Params...)> {};
+
+template <auto F, typename R, typename... Params>
+struct Native<F, R (*)(VM &, Params...) noexcept>
+    : Native<F, R (*)(VM &, Params...)> {};
+
+// Whether F takes and returns a double, so numeric kernels can call it
+// without boxing.
+template <auto F>
+constexpr bool IS_UNARY =
+    std::is_same_v<decltype(F), double (*)(double)> ||
+    std::is_same_v<decltype(F), double (*)(double) noexcept>;
+
+} // namespace binding
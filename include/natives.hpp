@@ -0,0 +1,71 @@
+#pragma once
+
+#include "function.hpp"
+#include "value.hpp"
+
+// Array natives. Numeric kernels run over the array's double buffer and
+// fail on arrays holding anything other than numbers.
+Value lenNative(int argCount, Value *args);
+Value pushNative(int argCount, Value *args);
+Value resizeNative(int argCount, Value *args);
+Value sumNative(int argCount, Value *args);
+Value dotNative(int argCount, Value *args);
+Value minNative(int argCount, Value *args);
+Value maxNative(int argCount, Value *args);
+// scale(array, factor) scales in place and returns the array.
+Value scaleNative(int argCount, Value *args);
+// axpy(alpha, x, y) computes y = alpha * x + y in place and returns y.
+Value axpyNative(int argCount, Value *args);
+
+// Map natives. len() above also accepts maps.
+// has(map, key) reports whether the key is present.
+Value hasNative(int argCount, Value *args);
+// remove(map, key) deletes the key and reports whether it was present.
+Value removeNative(int argCount, Value *args);
+
+// Math natives.
+Value absNative(int argCount, Value *args);
+Value sqrtNative(int argCount, Value *args);
+
+// now() is wall-clock seconds, for timing work spread over threads.
+Value nowNative(int argCount, Value *args);
+// threads() returns the size of the shared worker pool; threads(n) resizes
+// it and returns n.
+Value threadsNative(int argCount, Value *args);
+
+// Parallel algorithms. Numeric work is split across the worker pool above
+// parallel::SEQUENTIAL_CUTOFF elements. Script callbacks run one at a time
+// on the calling VM's thread; plain native callbacks never enter the
+// interpreter and run in parallel over numeric arrays.
+// sort(array) sorts a numeric array in place and returns it.
+Value sortNative(int argCount, Value *args);
+// map(array, fn) returns a new array of fn(element).
+Value mapNative(VM &vm, int argCount, Value *args);
+// filter(array, fn) returns a new array of the elements fn accepts.
+Value filterNative(VM &vm, int argCount, Value *args);
+// reduce(array, fn, initial) folds left to right.
+Value reduceNative(VM &vm, int argCount, Value *args);
+
+// Channel natives, for passing values between VMs (see Channel). Values are
+// copied into the receiving VM; functions, classes and instances can't be
+// sent.
+// channel(capacity) makes a channel holding up to about `capacity` values.
+Value channelNative(VM &vm, int argCount, Value *args);
+// send(channel, value) waits while the channel is full.
+Value sendNative(int argCount, Value *args);
+// receive(channel) waits for a value, or returns nil once the channel is
+// closed and empty.
+Value receiveNative(VM &vm, int argCount, Value *args);
+// close(channel) ends the stream; receivers drain what is left.
+Value closeNative(int argCount, Value *args);
+
+// File natives. Files are mapped into memory rather than read (see
+// MappedFile); both return nil if the file can't be opened.
+// readFile(path) returns the contents as a string viewing the mapping.
+Value readFileNative(VM &vm, int argCount, Value *args);
+// lines(path) returns something to iterate over the file's lines with, less
+// their line endings, one at a time.
+Value linesNative(VM &vm, int argCount, Value *args);
+
+// flush() writes out what has been printed so far (see Output).
+Value flushNative(VM &vm, int argCount, Value *args);
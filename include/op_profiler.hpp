@@ -0,0 +1,73 @@
+#pragma once
+
+#include "tsc.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Counts executed opcodes and opcode pairs, and samples how many cycles
+// individual instructions take. Fed by VM::dispatch() in builds configured
+// with MEHH_PROFILE_OPS; in other builds the hook is compiled out entirely.
+class OpProfiler {
+public:
+  static constexpr size_t OPCODE_COUNT = 256;
+  // Instructions between two cycle samples. Odd, so the samples don't lock
+  // onto one instruction of an even-length loop body.
+  static constexpr uint32_t SAMPLE_PERIOD = 61;
+
+  OpProfiler();
+
+  __attribute__((always_inline)) inline void record(uint8_t opcode) {
+    if (sampling) {
+      // The sampled instruction ends where the next one is dispatched.
+      cycles[sampledOp] += readTsc() - sampleStart;
+      samples[sampledOp]++;
+      sampling = false;
+    }
+    counts[opcode]++;
+    if (hasPrevious) {
+      pairs[previous * OPCODE_COUNT + opcode]++;
+    }
+    previous = opcode;
+    hasPrevious = true;
+    if (__builtin_expect(--countdown == 0, 0)) {
+      countdown = SAMPLE_PERIOD;
+      sampledOp = opcode;
+      sampling = true;
+      sampleStart = readTsc();
+    }
+  }
+
+  // Called when the VM stops running, so neither a cycle sample nor a pair
+  // spans two separate runs.
+  void endRun() {
+    sampling = false;
+    hasPrevious = false;
+  }
+
+  [[nodiscard]] uint64_t total() const;
+  [[nodiscard]] uint64_t count(uint8_t opcode) const { return counts[opcode]; }
+  [[nodiscard]] uint64_t pairCount(uint8_t first, uint8_t second) const {
+    return pairs[first * OPCODE_COUNT + second];
+  }
+
+  // Opcodes by descending count with their share and average sampled
+  // cycles, followed by the `pairLimit` most frequent pairs.
+  void report(std::ostream &out, size_t pairLimit = 20) const;
+  void writeJson(std::ostream &out) const;
+
+private:
+  std::array<uint64_t, OPCODE_COUNT> counts{};
+  std::array<uint64_t, OPCODE_COUNT> cycles{};
+  std::array<uint64_t, OPCODE_COUNT> samples{};
+  // Row-major [first][second].
+  std::vector<uint64_t> pairs;
+  uint64_t sampleStart = 0;
+  uint32_t countdown = SAMPLE_PERIOD;
+  uint8_t previous = 0;
+  uint8_t sampledOp = 0;
+  bool hasPrevious = false;
+  bool sampling = false;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <fmt/format.h>
+#include <ostream>
+#include <string_view>
+#include <utility>
+
+// What a VM prints, gathered in a buffer and written to its stream a large
+// block at a time rather than a value at a time. The buffer is written out
+// by flush(): explicitly, when it fills up, when a runtime error is
+// reported, when a run returns to the host and when the VM is destroyed.
+// Only a terminal on standard output gets each line as it ends.
+class Output {
+public:
+  // Buffered bytes that trigger a flush.
+  static constexpr size_t CAPACITY = 64 << 10;
+
+  explicit Output(std::ostream &stream);
+  ~Output() { flush(); }
+  Output(const Output &) = delete;
+  Output &operator=(const Output &) = delete;
+
+  // Writes what is buffered to the current stream before switching.
+  void setStream(std::ostream &stream);
+
+  void write(std::string_view text) {
+    buffer.append(text.data(), text.data() + text.size());
+    flushIfFull();
+  }
+  void put(char c) {
+    buffer.push_back(c);
+    flushIfFull();
+  }
+  // The shortest decimal that reads back as `value`, e.g. 0.1 or 1e+21.
+  void number(double value) {
+    fmt::format_to(fmt::appender(buffer), "{}", value);
+    flushIfFull();
+  }
+  template <typename... Args>
+  void format(fmt::format_string<Args...> format, Args &&...args) {
+    fmt::format_to(fmt::appender(buffer), format, std::forward<Args>(args)...);
+    flushIfFull();
+  }
+  // Ends a line, which a terminal gets straight away.
+  void newline() {
+    buffer.push_back('\n');
+    if (lineBuffered || buffer.size() >= CAPACITY) {
+      flush();
+    }
+  }
+
+  void flush();
+
+private:
+  void flushIfFull() {
+    if (__builtin_expect(buffer.size() >= CAPACITY, 0)) {
+      flush();
+    }
+  }
+
+  fmt::memory_buffer buffer;
+  std::ostream *stream;
+  bool lineBuffered;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// Numeric kernels split across ThreadPool::shared(). They never touch the
+// interpreter, so they are safe to run on any thread.
+namespace parallel {
+
+// Inputs up to this many elements run on the calling thread.
+constexpr size_t SEQUENTIAL_CUTOFF = 1 << 14;
+
+// Adds fixed-size blocks with simd::sum, so the result doesn't depend on
+// the number of threads.
+[[nodiscard]] double sum(const double *data, size_t size);
+// Ascending, with NaNs last.
+void sort(double *data, size_t size);
+
+} // namespace parallel
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "function.hpp"
+#include <absl/container/flat_hash_map.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Hardware performance counters (cycles, instructions, branch misses and L1
+// instruction cache misses) read with perf_event_open around VM runs, and
+// optionally charged to the function running between two calls or returns.
+// Counts are for user space on the VM's thread only. If the kernel refuses
+// access the profiler reports itself unavailable and records nothing.
+class PerfCounters {
+public:
+  enum Event { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1I_MISSES, EVENT_COUNT };
+  using Counts = std::array<uint64_t, EVENT_COUNT>;
+
+  struct FunctionCounts {
+    uint64_t calls = 0;
+    // Counts while this function itself was running, excluding callees.
+    Counts self{};
+  };
+
+  // With `perFunction`, the caller reports every call and return.
+  explicit PerfCounters(bool perFunction = false);
+  ~PerfCounters();
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  [[nodiscard]] bool available() const { return leader >= 0; }
+  // Why the counters, or some of them, couldn't be opened.
+  [[nodiscard]] const std::string &error() const { return error_; }
+  [[nodiscard]] bool has(Event event) const { return slot[event] >= 0; }
+  [[nodiscard]] static std::string_view eventName(Event event);
+
+  // Bracket one run. `running` is the function still on the stack when the
+  // run ends, or nullptr.
+  void begin();
+  void end(const Function *running);
+  // Charges the counts since the last snapshot to `caller`, which is
+  // nullptr when the host calls in, and counts a call of `callee`.
+  void enter(const Function *caller, const Function *callee);
+  // Charges the counts since the last snapshot to the returning function.
+  void leave(const Function *callee);
+
+  [[nodiscard]] size_t runs() const { return runCount; }
+  [[nodiscard]] const Counts &total() const { return totals; }
+  [[nodiscard]] const absl::flat_hash_map<const Function *, FunctionCounts> &
+  functions() const {
+    return perFunction;
+  }
+
+  // A table of the totals and, if any were recorded, of the functions by
+  // descending self cycles (or instructions, if cycles are unavailable).
+  void report(std::ostream &out) const;
+  void writeJson(std::ostream &out) const;
+
+private:
+  [[nodiscard]] bool read(Counts &counts) const;
+  void charge(const Function *function);
+
+  const bool trackFunctions;
+  int leader = -1;
+  std::array<int, EVENT_COUNT> fds{-1, -1, -1, -1};
+  // Position of each event in the group read, or -1 if not counted.
+  std::array<int, EVENT_COUNT> slot{-1, -1, -1, -1};
+  size_t opened = 0;
+  std::string error_;
+
+  Counts last{};
+  Counts runStart{};
+  Counts totals{};
+  size_t runCount = 0;
+  absl::flat_hash_map<const Function *, FunctionCounts> perFunction;
+};
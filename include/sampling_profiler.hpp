@@ -0,0 +1,63 @@
+#pragma once
+
+#include "function.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <time.h>
+
+class VM;
+
+// Samples the call stack of one VM from a CPU-time timer signal. The signal
+// handler only copies function pointers and bytecode offsets into a
+// preallocated buffer; names and lines are resolved when writing the
+// profile. Only one profiler can run at a time.
+class SamplingProfiler {
+public:
+  static constexpr unsigned DEFAULT_HZ = 1000;
+  // Frames kept across all samples. Samples arriving after it is full are
+  // counted as dropped.
+  static constexpr size_t BUFFER_FRAMES = size_t{1} << 20;
+
+  explicit SamplingProfiler(unsigned hz = DEFAULT_HZ);
+  ~SamplingProfiler();
+  SamplingProfiler(const SamplingProfiler &) = delete;
+  SamplingProfiler &operator=(const SamplingProfiler &) = delete;
+
+  // Starts sampling `vm`, which must run on the calling thread. Returns
+  // false if the timer can't be set up or another profiler is running.
+  [[nodiscard]] bool start(const VM &vm);
+  void stop();
+
+  [[nodiscard]] size_t samples() const { return sampleCount; }
+  [[nodiscard]] size_t dropped() const { return droppedCount; }
+
+  // Writes one line per distinct stack, `script:1;fib:3;fib:3 42`, in the
+  // collapsed format read by flamegraph.pl and speedscope.
+  void writeCollapsed(std::ostream &out) const;
+
+private:
+  // A sample is a header site (function == nullptr, offset == depth)
+  // followed by its frames, outermost first.
+  struct Site {
+    const Function *function;
+    size_t offset;
+  };
+
+  static void handleSignal(int signal);
+  void sample();
+
+  static std::atomic<SamplingProfiler *> active;
+
+  const unsigned hz;
+  const VM *vm = nullptr;
+  std::unique_ptr<Site[]> buffer;
+  size_t used = 0;
+  size_t sampleCount = 0;
+  size_t droppedCount = 0;
+#ifdef __linux__
+  timer_t timer{};
+#endif
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+// Vectorized kernels over contiguous doubles, and a byte search. Each
+// function is compiled for AVX2 and for baseline x86-64 and the best version
+// is picked at load time.
+namespace simd {
+
+[[nodiscard]] double sum(const double *data, size_t size) noexcept;
+[[nodiscard]] double dot(const double *a, const double *b,
+                         size_t size) noexcept;
+// `size` must be non-zero.
+[[nodiscard]] double min(const double *data, size_t size) noexcept;
+[[nodiscard]] double max(const double *data, size_t size) noexcept;
+void scale(double *data, size_t size, double factor) noexcept;
+// y = alpha * x + y
+void axpy(double alpha, const double *x, double *y, size_t size) noexcept;
+// The index of the first `byte` in `data`, or `size` if there is none.
+[[nodiscard]] size_t find(const char *data, size_t size, char byte) noexcept;
+
+} // namespace simd
@@ -2,7 +2,9 @@
 
 #include "value.hpp"
 #include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 
 struct string_hash {
@@ -22,14 +24,39 @@ class StringIntern {
 private:
   // std::unordered_set<std::string, string_hash, std::equal_to<>> strings;
   std::unordered_set<StringObj, StringObj::hash> strings;
+  // Strings interned before this table, e.g. the literals of a CodeImage.
+  // Never written through, so tables on several threads can share it.
+  const StringIntern *shared;
 
 public:
-  const StringObj* intern(const std::string &str) {
-    auto it = strings.find(StringObj{str});
+  explicit StringIntern(const StringIntern *shared = nullptr)
+      : shared{shared} {}
+
+  const StringObj* intern(std::string_view str) {
+    if (shared != nullptr) {
+      if (const StringObj *found = shared->find(str)) {
+        return found;
+      }
+    }
+    auto it = strings.find(StringObj{str, nullptr});
     if (it != strings.end()) {
       return &*it;
     }
-    auto res = strings.emplace(str);
+    auto res = strings.emplace(std::string{str});
     return &*res.first;
   }
+
+  // Whether `string` came from this table itself, not a shared one.
+  [[nodiscard]] bool owns(const StringObj *string) const {
+    auto it = strings.find(*string);
+    return it != strings.end() && &*it == string;
+  }
+
+  // The interned `str`, or nullptr if it never was.
+  [[nodiscard]] const StringObj *find(std::string_view str) const {
+    auto it = strings.find(StringObj{str, nullptr});
+    return it != strings.end() ? &*it : nullptr;
+  }
+
+  [[nodiscard]] size_t size() const { return strings.size(); }
 };
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that split index ranges between them. The
+// thread submitting work takes part in it, so a pool of size 1 has no
+// workers and runs everything inline.
+class ThreadPool {
+public:
+  using Body = std::function<void(size_t begin, size_t end)>;
+
+  explicit ThreadPool(size_t threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Pool used by the parallel natives. Sized from MEHH_THREADS, or the
+  // number of hardware threads.
+  [[nodiscard]] static ThreadPool &shared();
+
+  // Number of threads taking part in a job, including the caller.
+  [[nodiscard]] size_t size() const { return workers.size() + 1; }
+  // Does nothing when called from inside a job, which needs its workers.
+  void resize(size_t threads);
+
+  // Calls body(begin, end) over disjoint chunks covering [0, count), each at
+  // least `grain` long, and returns once all of them are done. Runs inline
+  // when the range fits in one chunk or when called from a worker or from
+  // inside another job.
+  void parallelFor(size_t count, size_t grain, const Body &body);
+
+  // Makes parallelFor run inline on the calling thread from now on, as on a
+  // worker, for threads that already run alongside others (see Executor).
+  static void runInline();
+
+private:
+  void start(size_t workerCount);
+  void stop();
+  void workerLoop(uint64_t seen);
+  void runChunks();
+
+  std::vector<std::thread> workers;
+  // Serializes jobs and resizing.
+  std::mutex submit;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  uint64_t generation = 0;
+  size_t active = 0;
+  bool stopping = false;
+
+  // The job in flight.
+  const Body *body = nullptr;
+  size_t count = 0;
+  size_t chunk = 0;
+  std::atomic<size_t> next{0};
+};
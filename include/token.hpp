@@ -9,7 +9,10 @@ enum class TokenType {
   RIGHT_PAREN,
   LEFT_BRACE,
   RIGHT_BRACE,
+  LEFT_BRACKET,
+  RIGHT_BRACKET,
   COMMA,
+  COLON,
   DOT,
   MINUS,
   PLUS,
@@ -37,6 +40,7 @@ enum class TokenType {
   FOR,
   FUN,
   IF,
+  IN,
   NIL,
   OR,
   PRINT,
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "function.hpp"
+#include "x64_assembler.hpp"
+#include <absl/container/flat_hash_map.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+class VM;
+
+// Compiles hot loops to x86-64.
+//
+// op_loop counts back-edges per loop header. Once a loop is hot the
+// recorder follows one iteration of its body from the interpreter's current
+// state and compiles that path as it goes: numbers live unboxed in XMM
+// registers, every type or branch it relied on becomes a guard, and calls to
+// closures (and to sqrt, abs and len) are inlined. A failing guard writes
+// the registers back to the VM stack, rebuilds the frames of inlined calls
+// and resumes the interpreter at the instruction that failed it. An exit
+// taken often gets a side trace of its own, patched into the exit, so
+// branchy bodies end up covered by a tree of traces.
+//
+// Only the dynamically typed core is traced: numbers, booleans, nil,
+// globals, upvalues, numeric arrays and calls. Anything else (strings,
+// objects, printing, allocation) ends the recording and leaves the loop to
+// the interpreter.
+class TraceJit {
+public:
+  // Back-edges a loop header takes before its loop is recorded.
+  static constexpr uint16_t HOT_LOOP = 64;
+  // Times a side exit is taken before a trace is recorded from it.
+  static constexpr uint32_t HOT_EXIT = 16;
+
+  struct Stats {
+    size_t traces = 0;
+    size_t sideTraces = 0;
+    // Recordings given up on.
+    size_t aborts = 0;
+    uint64_t entries = 0;
+    // Loop iterations run as machine code.
+    uint64_t iterations = 0;
+  };
+
+  TraceJit();
+  ~TraceJit();
+  TraceJit(const TraceJit &) = delete;
+  TraceJit &operator=(const TraceJit &) = delete;
+
+  // Called when the loop whose header the innermost frame is at gets hot.
+  // Runs the loop's trace, recording it first if there is none, and leaves
+  // the VM wherever the trace exited. Returns whether the loop is traced, in
+  // which case op_loop calls again on its next back-edge.
+  bool loop(VM &vm);
+
+  [[nodiscard]] const Stats &stats() const { return stats_; }
+
+private:
+  struct Tree;
+  class Recorder;
+
+  struct Loop {
+    std::unique_ptr<Tree> tree;
+    uint8_t failures = 0;
+    bool disabled = false;
+  };
+
+  [[nodiscard]] std::unique_ptr<Tree> record(VM &vm, const Function *function,
+                                             uint32_t header);
+  // Records a side trace from the exit the VM has just left through.
+  void extend(VM &vm, Tree &tree, uint32_t exit);
+  [[nodiscard]] bool enter(VM &vm, Tree &tree);
+  // Fills in the pointers and array views the tree reads at entry. Returns
+  // false if a location is missing or two of them alias.
+  [[nodiscard]] bool resolve(VM &vm, Tree &tree, size_t base);
+  void leave(VM &vm, const Tree &tree, uint32_t exit, size_t base);
+  // Copies linked code into the code arena. Returns null once it is full.
+  [[nodiscard]] uint8_t *install(X64Assembler &as);
+  // Points the jump ending at `end` in installed code to `target`.
+  void patch(uint8_t *end, const uint8_t *target);
+  void protect(bool writable);
+
+  absl::flat_hash_map<std::pair<const Function *, uint32_t>, Loop> loops;
+  // Code for every trace, mapped lazily and never freed before the JIT.
+  uint8_t *arena = nullptr;
+  size_t used = 0;
+  Stats stats_;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "tsc.hpp"
+#include "value.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <thread>
+
+// Records function and native entries and exits with TSC timestamps into a
+// single-producer ring that a background thread drains into a Chrome trace
+// (JSON), viewable in chrome://tracing or Perfetto. The VM thread never
+// waits: calls made while the ring is nearly full are dropped and counted,
+// together with everything they call, so the trace stays well nested.
+class Tracer {
+public:
+  static constexpr size_t CAPACITY = size_t{1} << 18;
+  // Slots only exits may use, enough to close every call that can be open
+  // at once (frames and the natives between them).
+  static constexpr size_t EXIT_RESERVE = 256;
+
+  // Starts the flush thread. `out` must outlive the tracer.
+  explicit Tracer(std::ostream &out);
+  ~Tracer();
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  // `callee` is a Function or a NativeFunction. Only the VM thread may
+  // record events.
+  __attribute__((always_inline)) inline void enter(const Obj *callee) {
+    push(Event{readTsc(), callee, true});
+  }
+  __attribute__((always_inline)) inline void exit(const Obj *callee) {
+    push(Event{readTsc(), callee, false});
+  }
+
+  // Flushes what is left, finishes the JSON and joins the flush thread.
+  // Further events are ignored.
+  void stop();
+
+  [[nodiscard]] uint64_t dropped() const {
+    return droppedCount.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Event {
+    uint64_t tsc;
+    const Obj *callee;
+    bool enter;
+  };
+
+  __attribute__((always_inline)) inline void push(const Event &event) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (__builtin_expect(suppressed != 0, 0)) {
+      // Inside a dropped call.
+      suppressed += event.enter ? 1 : -1;
+      droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (__builtin_expect(event.enter &&
+                             h - tail.load(std::memory_order_acquire) >=
+                                 CAPACITY - EXIT_RESERVE,
+                         0)) {
+      suppressed = 1;
+      droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    ring[h & (CAPACITY - 1)] = event;
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  void flushLoop();
+  void drain();
+
+  std::ostream &out;
+  std::unique_ptr<Event[]> ring;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  std::atomic<uint64_t> droppedCount{0};
+  // Depth of the dropped call the VM is in; VM thread only.
+  size_t suppressed = 0;
+  std::atomic<bool> stopping{false};
+  const uint64_t startTsc;
+  double ticksPerMicrosecond;
+  const int pid;
+  const int tid;
+  std::thread flusher;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// A cheap, monotonic-enough cycle counter for profiling. Uses the time stamp
+// counter on x86 and falls back to the steady clock (in nanoseconds)
+// elsewhere, so values are only comparable with each other.
+__attribute__((always_inline)) inline uint64_t readTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
@@ -4,6 +4,8 @@
 #include <bitset>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <string_view>
 
 // using nil = std::monostate;
@@ -27,6 +29,17 @@ enum class ValueType {
   CLOSURE,
   UPVALUE,
   STRING,
+  CLASS,
+  INSTANCE,
+  BOUND_METHOD,
+  ARRAY,
+  MAP,
+  CHANNEL,
+  FIBER,
+  GENERATOR,
+  AWAITABLE,
+  LINES,
+  NATIVE_ERROR,
   OBJ,
 };
 
@@ -55,10 +68,29 @@ public:
 class StringObj : public Obj {
 
 public:
-  explicit StringObj(const std::string str)
-      : Obj{ValueType::STRING}, str{str} {};
+  explicit StringObj(std::string str)
+      : Obj{ValueType::STRING}, owned{std::move(str)}, str{owned},
+        contentHash{std::hash<std::string_view>{}(this->str)} {};
+  // Views `chars` where they are instead of copying them. `storage` keeps
+  // them alive, e.g. a file mapping, or is nullptr if they outlive the
+  // string anyway.
+  StringObj(std::string_view chars, std::shared_ptr<const void> storage)
+      : Obj{ValueType::STRING}, storage{std::move(storage)}, str{chars},
+        contentHash{std::hash<std::string_view>{}(chars)} {};
+  StringObj(const StringObj &other)
+      : Obj{ValueType::STRING}, owned{other.owned}, storage{other.storage},
+        str{other.str.data() == other.owned.data() ? std::string_view{owned}
+                                                   : other.str},
+        contentHash{other.contentHash} {}
 
-  const std::string str;
+private:
+  const std::string owned;
+  const std::shared_ptr<const void> storage;
+
+public:
+  const std::string_view str;
+  // Hash of `str`, for the intern table and maps.
+  const size_t contentHash;
 
 bool operator==(const StringObj& obj) const
   {
@@ -69,7 +101,7 @@ bool operator==(const StringObj& obj) const
   {
     size_t operator()(const StringObj& obj) const
     {
-      return std::hash<std::string>{}(obj.str);
+      return obj.contentHash;
     }
   };
 };
@@ -118,6 +150,21 @@ public:
            asObj()->getType() == ValueType::FUNCTION;
   }
 
+  [[nodiscard]] const bool isInstance() const {
+    return ((_value & (quiet_nan | sign_bit)) == (quiet_nan | sign_bit)) &&
+           asObj()->getType() == ValueType::INSTANCE;
+  }
+
+  [[nodiscard]] const bool isArray() const {
+    return ((_value & (quiet_nan | sign_bit)) == (quiet_nan | sign_bit)) &&
+           asObj()->getType() == ValueType::ARRAY;
+  }
+
+  [[nodiscard]] const bool isMap() const {
+    return ((_value & (quiet_nan | sign_bit)) == (quiet_nan | sign_bit)) &&
+           asObj()->getType() == ValueType::MAP;
+  }
+
   [[nodiscard]] const bool is(ValueType type) const {
     auto t = getType();
     if (t == type) {
@@ -140,6 +187,9 @@ public:
 
   [[nodiscard]] const bool asBool() const { return _value == true_val; };
 
+  // The raw NaN-boxed representation.
+  [[nodiscard]] const uint64_t bits() const { return _value; }
+
   [[nodiscard]] Obj *asObj() const {
     return reinterpret_cast<Obj *>(_value & ~(sign_bit | quiet_nan));
   };
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "output.hpp"
 #include "value.hpp"
 #include <cstddef>
 #include <cstdint>
+#include <iostream>
+#include <ostream>
 #include <vector>
 
 // TODO: This is literally just a vector - get rid of ValueArray
@@ -30,5 +33,7 @@ size_t ValueArray::write(const Value &value) noexcept {
   return values.size();
 }
 
-void printValue(const Value &value);
+// Prints `value` the way the print statement does, without the newline.
+void printValue(const Value &value, Output &out);
+void printValue(const Value &value, std::ostream &out = std::cout);
 
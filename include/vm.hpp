@@ -1,55 +1,301 @@
 #pragma once
 
 #include "boost/container/static_vector.hpp"
+#include "alloc_profiler.hpp"
+#include "array.hpp"
 #include "boost/unordered/unordered_map.hpp"
 #include "call_frame.hpp"
+#include "channel.hpp"
 #include "chunk.hpp"
+#include "class.hpp"
+#include "code_image.hpp"
 #include "compiler.hpp"
+#include "event_loop.hpp"
+#include "fiber.hpp"
 #include "function.hpp"
+#include "generator.hpp"
+#include "heap.hpp"
+#include "inline_caches.hpp"
+#include "instruction_profiler.hpp"
+#include "mapped_file.hpp"
+#include "map.hpp"
+#include "native_binding.hpp"
+#include "op_profiler.hpp"
+#include "output.hpp"
+#include "perf_counters.hpp"
 #include "string_intern.hpp"
+#include "trace_jit.hpp"
+#include "tracer.hpp"
 #include "value.hpp"
 #include <absl/container/flat_hash_map.h>
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <fmt/core.h>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <time.h>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
-#define FRAME_MAX 64
-#define STACK_MAX 256
-
 enum InterpretResult {
   INTERPRET_OK,
   INTERPRET_COMPILE_ERROR,
   INTERPRET_RUNTIME_ERROR
 };
 
+// Something the host calls with VM::call(): a script compiled by
+// VM::load() or the VM's code image, whose call runs its top level, or a
+// global function, class,
+// native or generator a script defined, from VM::function(). Valid for the life of the
+// VM that made it.
+class Handle {
+public:
+  [[nodiscard]] const Value &value() const { return callee; }
+
+private:
+  friend class VM;
+  explicit Handle(Value callee) : callee{callee} {}
+  Value callee;
+};
+
 class VM {
 public:
   VM() noexcept;
+  // A VM for running `image`, which it shares with any other VMs made for
+  // it instead of compiling a copy of its own.
+  explicit VM(std::shared_ptr<const CodeImage> image) noexcept;
   [[nodiscard]] const InterpretResult interpret(const std::string_view source);
+  // Compiles `source` without running it, e.g. for mehh --emit-c.
+  [[nodiscard]] std::optional<const Function *>
+  compile(const std::string_view source);
   const InterpretResult run();
   InterpretResult dispatch();
 
+  // Calls `callee` with `args` and runs it to completion on this VM, for
+  // natives that take script callbacks. Returns false after reporting a
+  // runtime error, in which case the VM has already been reset.
+  [[nodiscard]] bool callFunction(const Value &callee, int argCount,
+                                  const Value *args, Value &result);
+
+  // Calls `callee` once per row, with one argument taken from each column,
+  // and stores the numeric results. Numeric functions the batch interpreter
+  // accepts run a whole batch of rows per instruction; anything else is
+  // called row by row.
+  [[nodiscard]] InterpretResult
+  callBatch(const Value &callee,
+            std::span<const std::span<const double>> columns,
+            std::span<double> results);
+
+  // The value of a global variable, e.g. a function defined by a script.
+  [[nodiscard]] std::optional<Value> global(std::string_view name) const;
+
+  // Compiles `source` once, for hosts that run the same script many times.
+  // Returns nullopt after reporting a compile error.
+  [[nodiscard]] std::optional<Handle> load(std::string_view source);
+  // The top level of the code image the VM was made for, or nullopt if it
+  // has none.
+  [[nodiscard]] std::optional<Handle> script() const;
+  // The global function, class, native or generator called `name`, if there
+  // is one.
+  [[nodiscard]] std::optional<Handle> function(std::string_view name) const;
+  // Defines the global native `name` calling F, a C++ function whose
+  // parameter and result types are unboxed and boxed by a trampoline
+  // generated for it (see native_binding.hpp), e.g. vm.bind<&lerp>("lerp").
+  // Pass `pure` if F is reentrant and has no side effects, so map and filter
+  // may call it from worker threads.
+  template <auto F> void bind(std::string name, bool pure = false) {
+    NativeFunction *native =
+        allocate<NativeFunction>(&binding::Native<F>::trampoline);
+    if constexpr (binding::IS_UNARY<F>) {
+      native->unary = F;
+    }
+    native->pure = pure && native->fun != nullptr;
+    defineNative(std::move(name), native);
+  }
+
+  // The interned string `str`, e.g. to pass to call().
+  [[nodiscard]] Value string(std::string_view str) {
+    return Value{stringIntern.intern(str)};
+  }
+  // A new string viewing `chars` in place instead of copying them;
+  // `storage` keeps them alive, e.g. a MappedFile. It isn't interned, so
+  // the intern table never holds on to it or its storage; strings compare
+  // by contents anyway, in maps too.
+  [[nodiscard]] Value string(std::string_view chars,
+                             std::shared_ptr<const void> storage) {
+    return Value{allocate<StringObj>(chars, std::move(storage))};
+  }
+
+  // A ChannelObj for `channel`, so scripts on this VM can send and receive
+  // on it, e.g. to pass to call().
+  [[nodiscard]] Value channel(std::shared_ptr<Channel> channel) {
+    return Value{allocate<ChannelObj>(std::move(channel))};
+  }
+
+  // The code image the VM was made for, or nullptr.
+  [[nodiscard]] const CodeImage *codeImage() const { return image.get(); }
+
+  // Calls `handle` and runs it to completion, without recompiling anything.
+  // Each argument (a Value, bool or number) is built straight into the
+  // callee's stack window, so the script reads it in place. Returns nullopt
+  // after reporting a runtime error, in which case the VM has been reset.
+  template <typename... Args>
+  [[nodiscard]] std::optional<Value> call(const Handle &handle,
+                                          Args &&...args) {
+    if (__builtin_expect(stack.size() + sizeof...(Args) + 1 > STACK_MAX, 0)) {
+      runtimeError("Stack overflow");
+      return std::nullopt;
+    }
+    stack.push_back(handle.callee);
+    (stack.push_back(argument(std::forward<Args>(args))), ...);
+    Value result;
+    if (!callPushed(sizeof...(Args), result)) {
+      return std::nullopt;
+    }
+    return result;
+  }
+
+  // The active call frames, outermost first, as last published: frames
+  // appear only once fully built, so profilers may call it from a signal
+  // handler that interrupts a call, a return or a fiber switch.
+  [[nodiscard]] std::span<const CallFrame> callStack() const {
+    const size_t depth = sampledDepth.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    return {sampledFrames.load(std::memory_order_relaxed), depth};
+  }
+
+  // Starts counting executed instructions. Returns false if this build was
+  // configured without MEHH_PROFILE_OPS and so has no dispatch hook.
+  [[nodiscard]] bool enableOpProfiler();
+  [[nodiscard]] const OpProfiler *opProfile() const {
+    return opProfiler.get();
+  }
+
+  // Counts executions and operand types per instruction, for an annotated
+  // disassembly. Needs MEHH_PROFILE_OPS like enableOpProfiler().
+  [[nodiscard]] bool enableInstructionProfiler();
+  [[nodiscard]] const InstructionProfiler *instructionProfile() const {
+    return instructionProfiler.get();
+  }
+
+  // Reads hardware counters around every run and, with `perFunction`, on
+  // every call and return. Check available() on the result: without
+  // permission to use perf_event_open, nothing is recorded.
+  const PerfCounters &enablePerfCounters(bool perFunction);
+  [[nodiscard]] const PerfCounters *perfProfile() const {
+    return perfCounters.get();
+  }
+
+  // Traces calls and returns to `out` as Chrome trace JSON until
+  // stopTracing(), which returns the number of events dropped.
+  void startTracing(std::ostream &out);
+  uint64_t stopTracing();
+
+  // Counts every object allocated from here on, sampling the allocation
+  // sites about once every `interval` bytes.
+  const AllocationProfiler &enableAllocationProfiler(size_t interval);
+  [[nodiscard]] const AllocationProfiler *allocationProfile() const {
+    return allocProfiler.get();
+  }
+
+  // Sends printed values and error reports to `stream` instead of std::cout,
+  // e.g. to keep the output of VMs running side by side apart.
+  void setOutput(std::ostream &stream) {
+    out.setStream(stream);
+    compiler.setOutput(stream);
+  }
+  // Writes out what scripts have printed so far. Runs flush on their own
+  // when they return to the host or fail.
+  void flush() { out.flush(); }
+
+  // Compiles hot loops to machine code (see TraceJit). On by default in
+  // builds configured with MEHH_JIT; returns false in others.
+  bool enableJit(bool enable);
+  [[nodiscard]] const TraceJit *traceJit() const { return jit.get(); }
+
+  template <typename T, typename... Args> T *allocate(Args &&...args) {
+    T *object = heap.allocate<T>(std::forward<Args>(args)...);
+    if (__builtin_expect(allocProfiler != nullptr, 0)) {
+      recordAllocation(object->getType(), sizeof(T));
+    }
+    return object;
+  }
+
 private:
+  // The runtime of AOT-compiled code (mehh_aot.h) works on the VM directly.
+  friend class AotRuntime;
+  // So do traces, and the JIT rebuilds frames when they exit.
+  friend class TraceJit;
+
   CallFrame *frame;
   NativeFunction native = NativeFunction{VM::clockNative};
-  boost::container::static_vector<Closure, STACK_MAX> closures;
-  boost::container::static_vector<Value, STACK_MAX> stack;
+  // Shared cells for captured locals. A deque so cells never move.
+  std::deque<UpvalueObj> upvalues;
+  // Open upvalues, sorted by stack slot from the top of the stack down.
+  UpvalueObj *openUpvalues = nullptr;
+  // The running fiber's stacks.
+  ValueStack stack;
   boost::container::static_vector<StringObj, STACK_MAX>
       strings; // TODO: Temp - Fixme
-  boost::container::static_vector<CallFrame, FRAME_MAX> frames;
+  FrameStack frames;
+  // What callStack() reads: the first sampledDepth frames at sampledFrames.
+  // Only ever written on the VM's own thread, so signal fences order them.
+  std::atomic<const CallFrame *> sampledFrames{nullptr};
+  std::atomic<size_t> sampledDepth{0};
+  // The fiber the top level runs on, and the one running now.
+  FiberObj mainFiber;
+  FiberObj *fiber = &mainFiber;
+  // Fibers waiting for their turn, oldest first.
+  std::deque<FiberObj *> runnable;
+  // Set by yield() and join() for callValue() to switch to once the native
+  // has returned.
+  FiberObj *pendingSwitch = nullptr;
+  // Runtime errors so far; see FiberObj::generation.
+  size_t resets = 0;
+  // File operations started by readFileAsync() and writeFileAsync(), made
+  // on first use.
+  std::unique_ptr<EventLoop> eventLoop;
+  // run() returns once a return brings the frame count back to this depth;
+  // non-zero only while callFunction() runs a callback.
+  size_t exitDepth = 0;
+  // Calls into AOT-compiled functions in progress. They have no CallFrame
+  // but count towards FRAME_MAX.
+  size_t compiledDepth = 0;
   std::vector<uint8_t>::const_iterator ip;
   absl::flat_hash_map<std::string_view, Value> globals;
   const Chunk *chunk;
+  Heap heap;
+  std::shared_ptr<const CodeImage> image;
+  // The closure for image->script(), if there is an image.
+  Value imageScript;
+  InlineCaches inlineCaches;
   StringIntern stringIntern;
+  const StringObj *initString;
   Compiler compiler;
+  std::unique_ptr<OpProfiler> opProfiler;
+  std::unique_ptr<InstructionProfiler> instructionProfiler;
+  std::unique_ptr<PerfCounters> perfCounters;
+  // Set only when counters are charged per function.
+  PerfCounters *callCounters = nullptr;
+  std::unique_ptr<Tracer> tracer;
+  std::unique_ptr<AllocationProfiler> allocProfiler;
+  std::unique_ptr<TraceJit> jit;
+  Output out{std::cout};
+  // Back-edges left before a loop is handed to the JIT, hashed by the loop
+  // header's address.
+  std::array<uint16_t, 64> hotLoops;
   InterpretResult op_return();
+  InterpretResult op_yield();
+  InterpretResult op_generator_return();
   InterpretResult op_call();
   InterpretResult op_subtract();
   InterpretResult op_constant();
@@ -76,35 +322,209 @@ private:
   InterpretResult op_jump();
   InterpretResult op_jump_if_false();
   InterpretResult op_loop();
+  InterpretResult op_iterate();
   InterpretResult op_closure();
+  InterpretResult op_close_upvalue();
+  InterpretResult op_class();
+  InterpretResult op_method();
+  InterpretResult op_get_property();
+  InterpretResult op_set_property();
+  InterpretResult op_invoke();
+  InterpretResult op_array();
+  InterpretResult op_map();
+  InterpretResult op_get_index();
+  InterpretResult op_set_index();
 
   static Value clockNative(int argCount, Value *args) {
     return Value{static_cast<double>(clock()) / CLOCKS_PER_SEC};
   }
 
+  // spawn(fn, args...) queues a new fiber calling fn(args...) and returns
+  // it. yield() lets the next queued fiber run. join(fiber) waits for the
+  // fiber to finish and returns its result. See fiber.cpp.
+  static Value spawnNative(VM &vm, int argCount, Value *args);
+  static Value yieldNative(VM &vm, int argCount, Value *args);
+  static Value joinNative(VM &vm, int argCount, Value *args);
+  // readFileAsync(path) and writeFileAsync(path, text) start a file
+  // operation and return an awaitable for it; await(awaitable) waits for it
+  // to finish, letting other fibers run meanwhile. See async_io.cpp.
+  static Value readFileAsyncNative(VM &vm, int argCount, Value *args);
+  static Value writeFileAsyncNative(VM &vm, int argCount, Value *args);
+  static Value awaitNative(VM &vm, int argCount, Value *args);
+  [[nodiscard]] EventLoop &io() {
+    if (eventLoop == nullptr) {
+      eventLoop = std::make_unique<EventLoop>();
+    }
+    return *eventLoop;
+  }
+  [[nodiscard]] bool ioPending() const {
+    return eventLoop != nullptr && eventLoop->pending() > 0;
+  }
+  // Delivers the results of finished file operations and queues the fibers
+  // awaiting them. If `wait`, first blocks until one finishes.
+  void completeIo(bool wait);
+  // Whether the running fiber may switch: only when the interpreter isn't
+  // nested inside a native, a callback or compiled code, which keep state
+  // on the C++ stack.
+  [[nodiscard]] bool canSwitchFiber() const {
+    return exitDepth == 0 && compiledDepth == 0 && !frames.empty();
+  }
+  // Swaps the running fiber's registers for those of `pendingSwitch`,
+  // starting it first if it is new. Returns false after a runtime error.
+  [[nodiscard]] bool switchFiber();
+  // Called when the running fiber returns from its function: hands the
+  // result to its joiners and switches to the next fiber.
+  [[nodiscard]] bool finishFiber();
+
+  // Publishes the frame count to callStack(), after a push has finished
+  // building the new frame or a pop has removed one.
+  __attribute__((always_inline)) inline void publishFrames() {
+    std::atomic_signal_fence(std::memory_order_release);
+    sampledDepth.store(frames.size(), std::memory_order_relaxed);
+  }
+  // Publishes `frames` after it was pointed at another fiber's frames. The
+  // count drops to zero first so callStack() never pairs one fiber's frames
+  // with another's depth.
+  void publishFrameStack() {
+    sampledDepth.store(0, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_release);
+    sampledFrames.store(frames.data(), std::memory_order_relaxed);
+    publishFrames();
+  }
+
+  // Called by op_loop when a loop header's counter runs out. Returns
+  // whether the loop is traced.
+  [[nodiscard]] bool hotLoop();
   [[nodiscard]] inline const bool isFalsey(const Value &val);
   [[nodiscard]] inline const bool valuesEqual(const Value &a, const Value &b);
   [[nodiscard]] const bool callValue(const Value &callee,
                                      const uint8_t argCount);
-  [[nodiscard]] const UpvalueObj captureUpvalue(const StackIterator &local);
+  [[nodiscard]] UpvalueObj *captureUpvalue(Value *local);
+  void closeUpvalues(const Value *last);
+  // Attributes an allocation to the instruction running, if sampled.
+  void recordAllocation(ValueType type, size_t bytes);
   [[nodiscard]] const bool call(const Closure *closure, const uint8_t argCount);
+  // Replaces the callee and arguments of a call of a `fun*` function with a
+  // generator holding them.
+  void newGenerator(const Closure *closure, uint8_t argCount);
+  // Pushes the frame of `generator` on top of the stack to carry on.
+  [[nodiscard]] bool resumeGenerator(GeneratorObj *generator);
+  // Runs `generator` up to its next yield or its return, for compiled code.
+  // `result` is what it yielded, or nil once it is done.
+  [[nodiscard]] bool runGenerator(GeneratorObj *generator, Value &result);
+  // Sets `line` to the line of `lines` starting at offset `cursor` and moves
+  // the cursor to the next one. Returns false at the end of the file.
+  [[nodiscard]] bool nextLine(const LinesObj *lines, Value &cursor,
+                              Value &line);
+  // Allocates a closure of `function` using this VM's property caches.
+  [[nodiscard]] Closure *newClosure(const Function *function) {
+    Closure *closure = allocate<Closure>(function);
+    closure->caches = inlineCaches.of(*function->chunk);
+    return closure;
+  }
+  // Calls the callee pushed below the top `argCount` values, as
+  // callFunction() does once it has pushed them.
+  [[nodiscard]] bool callPushed(int argCount, Value &result);
+  static Value argument(const Value &value) { return value; }
+  static Value argument(bool value) { return Value{value}; }
+  template <typename T>
+    requires std::is_arithmetic_v<T>
+  static Value argument(T value) {
+    return Value{static_cast<double>(value)};
+  }
+  // Like callFunction(), but `slots` starts with the receiver that goes in
+  // slot 0 instead of the callee.
+  [[nodiscard]] bool callClosure(const Closure *closure, int argCount,
+                                 const Value *slots, Value &result);
+  // Runs the frame pushed above `depth`, if any, and pops its result.
+  [[nodiscard]] bool finishCall(size_t depth, CallFrame *caller,
+                                Value &result);
+  [[nodiscard]] const bool invokeProperty(Instance *instance,
+                                          const StringObj *name,
+                                          PropertyCache &cache,
+                                          const uint8_t argCount);
 
   void defineNative(std::string name, NativeFunction *fn);
+  void defineNative(std::string name, NativeFunctionPtr fn);
+  // Defines a native with no side effects; see NativeFunction::pure.
+  void definePureNative(std::string name, NativeFunctionPtr fn);
+  void defineNative(std::string name, VMNativeFunctionPtr fn);
   template <typename... Args>
   __attribute__((always_inline)) inline void
   runtimeError(const std::string_view format, Args &&...args) {
-    std::cout << fmt::vformat(format, fmt::make_format_args(args...)) << '\n';
+    out.write(fmt::vformat(format, fmt::make_format_args(args...)));
+    out.newline();
     for (int i = frames.size() - 1; i >= 0; i--) {
       // TODO: use iterator directly
       size_t line = frames[i].closure->function->chunk->getLine(std::distance(
           frames[i].closure->function->chunk->code().begin(), frames[i].ip()));
-      std::cout << fmt::format("[line {}] in script\n", line);
+      out.format("[line {}] in script\n", line);
       if (frames[i].closure->function->name.empty()) {
-        std::cout << "script\n";
+        out.write("script\n");
       } else {
-        std::cout << frames[i].closure->function->name << "\n";
+        out.write(frames[i].closure->function->name);
+        out.newline();
+      }
+    }
+    out.flush();
+    resetStack();
+  }
+
+  // Drops the state of an aborted run so the next interpret() starts clean.
+  void resetStack() {
+    if (tracer) {
+      for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+        tracer->exit(it->closure->function);
       }
     }
+    // Generators that were running can't be resumed.
+    for (const CallFrame &aborted : frames) {
+      if (aborted.closure->function->generator) {
+        aborted.slots[0].asObj()->as<GeneratorObj>()->state =
+            GeneratorObj::State::DONE;
+      }
+    }
+    closeUpvalues(stack.data());
+    stack.clear();
+    frames.clear();
+    publishFrames();
+    // An error ends every fiber; the next run starts on the main one.
+    resets++;
+    mainFiber.state = FiberObj::State::READY;
+    mainFiber.generation = resets;
+    if (fiber != &mainFiber) {
+      fiber->state = FiberObj::State::DONE;
+      fiber = &mainFiber;
+      stack = mainFiber.stack;
+      frames = mainFiber.frames;
+      openUpvalues = mainFiber.openUpvalues;
+      closeUpvalues(stack.data());
+      stack.clear();
+      frames.clear();
+      publishFrameStack();
+    }
+    runnable.clear();
+    pendingSwitch = nullptr;
+  }
+
+  // Validates an array index operand, reporting a runtime error if it is
+  // not an integer within bounds.
+  __attribute__((always_inline)) inline bool
+  checkIndex(const ArrayObj *array, const Value &index) {
+    if (__builtin_expect(!index.isNumber(), 0)) {
+      runtimeError("Array index must be a number.");
+      return false;
+    }
+    const double i = index.asNumber();
+    // Also rejects NaN and fractional indices.
+    if (__builtin_expect(!(i >= 0 && i < array->size()) ||
+                             static_cast<double>(static_cast<size_t>(i)) != i,
+                         0)) {
+      runtimeError("Array index {} out of bounds for length {}.", i,
+                   array->size());
+      return false;
+    }
+    return true;
   }
 
   template <typename BinaryOperation>
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Just enough of x86-64 to compile traces: 64-bit integer moves and
+// compares, scalar double arithmetic, and jumps to labels. Memory operands
+// are always [base + disp32], or [base + index * 8] for array elements.
+class X64Assembler {
+public:
+  enum Reg : uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+  };
+  // XMM registers are numbered 0 to 15.
+  using Xmm = uint8_t;
+
+  enum Condition : uint8_t {
+    BELOW = 0x2,
+    ABOVE_EQUAL = 0x3,
+    EQUAL = 0x4,
+    NOT_EQUAL = 0x5,
+    BELOW_EQUAL = 0x6,
+    ABOVE = 0x7,
+    PARITY = 0xA,
+    NOT_PARITY = 0xB,
+  };
+
+  // A position in the code that jumps can target before it is bound.
+  struct Label {
+    size_t id;
+  };
+
+  [[nodiscard]] const std::vector<uint8_t> &code() const { return bytes; }
+  [[nodiscard]] size_t size() const { return bytes.size(); }
+
+  [[nodiscard]] Label label();
+  void bind(Label label);
+  // Binds `label` to an address outside this code, e.g. in another trace.
+  void bindExternal(Label label, const uint8_t *address);
+  // Resolves jumps for code that will run at `address`. Every label used
+  // must be bound.
+  void link(uint8_t *address);
+
+  void push(Reg reg);
+  void pop(Reg reg);
+  void ret();
+
+  void movImm(Reg dst, uint64_t imm);
+  void mov(Reg dst, Reg src);
+  void load(Reg dst, Reg base, int32_t disp);
+  void store(Reg base, int32_t disp, Reg src);
+  void andReg(Reg dst, Reg src);
+  void subReg(Reg dst, Reg src);
+  void cmp(Reg a, Reg b);
+  void cmpMem(Reg a, Reg base, int32_t disp);
+  void cmpImm(Reg a, int8_t imm);
+  void addImm(Reg dst, int8_t imm);
+
+  void movsdLoad(Xmm dst, Reg base, int32_t disp);
+  void movsdStore(Reg base, int32_t disp, Xmm src);
+  void movsdLoadIndexed(Xmm dst, Reg base, Reg index);
+  void movsdStoreIndexed(Reg base, Reg index, Xmm src);
+  void movqToXmm(Xmm dst, Reg src);
+  void movqFromXmm(Reg dst, Xmm src);
+  void movapd(Xmm dst, Xmm src);
+  void addsd(Xmm dst, Xmm src);
+  void subsd(Xmm dst, Xmm src);
+  void mulsd(Xmm dst, Xmm src);
+  void divsd(Xmm dst, Xmm src);
+  void sqrtsd(Xmm dst, Xmm src);
+  void andpd(Xmm dst, Xmm src);
+  void xorpd(Xmm dst, Xmm src);
+  void ucomisd(Xmm a, Xmm b);
+  void cvttsd2si(Reg dst, Xmm src);
+  void cvtsi2sd(Xmm dst, Reg src);
+
+  void jmp(Label target);
+  void jcc(Condition condition, Label target);
+  // Overwrites the target of the jmp ending at `end` in linked code.
+  static void retarget(uint8_t *end, const uint8_t *target);
+
+private:
+  void byte(uint8_t b) { bytes.push_back(b); }
+  void imm32(uint32_t imm);
+  void rex(bool wide, uint8_t reg, uint8_t index, uint8_t base);
+  // ModRM (and SIB) for [base + disp32].
+  void memory(uint8_t reg, Reg base, int32_t disp);
+  void sse(uint8_t prefix, uint8_t opcode, uint8_t reg, uint8_t rm,
+           bool wide = false);
+  void sseMemory(uint8_t prefix, uint8_t opcode, uint8_t reg, Reg base,
+                 int32_t disp);
+  void sseIndexed(uint8_t prefix, uint8_t opcode, uint8_t reg, Reg base,
+                  Reg index);
+  void aluReg(uint8_t opcode, Reg rm, Reg reg);
+
+  struct Fixup {
+    // Offset of the rel32 field; the jump ends 4 bytes later.
+    size_t at;
+    size_t label;
+  };
+  std::vector<uint8_t> bytes;
+  // Offset of each label in `bytes`, or an absolute address once external.
+  std::vector<intptr_t> labels;
+  std::vector<bool> external;
+  std::vector<Fixup> fixups;
+};
@@ -0,0 +1,167 @@
+#include "alloc_profiler.hpp"
+#include "chunk.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::string siteName(const AllocationProfiler::Site &site) {
+  if (site.function == nullptr) {
+    return "(host)";
+  }
+  const std::string_view name = site.function->name.empty()
+                                    ? std::string_view{"script"}
+                                    : std::string_view{site.function->name};
+  return fmt::format("{}{}:{}", site.compile ? "(compile) " : "", name,
+                     site.line);
+}
+
+} // namespace
+
+AllocationProfiler::AllocationProfiler(size_t interval)
+    : meanInterval{std::max<size_t>(interval, 1)},
+      random{0x9e3779b97f4a7c15ULL}, bytesUntilSample{nextSample()} {}
+
+size_t AllocationProfiler::nextSample() {
+  // xorshift64*; the top 53 bits give a uniform double in (0, 1].
+  random ^= random >> 12;
+  random ^= random << 25;
+  random ^= random >> 27;
+  const uint64_t bits = (random * 0x2545f4914f6cdd1dULL) >> 11;
+  const double uniform =
+      (static_cast<double>(bits) + 1.0) / static_cast<double>(1ULL << 53);
+  const double gap = -std::log(uniform) * static_cast<double>(meanInterval);
+  return std::max<size_t>(static_cast<size_t>(gap), 1);
+}
+
+void AllocationProfiler::sample(const Site &site, size_t bytes) {
+  // An allocation of `bytes` is picked with probability 1 - e^(-bytes/mean).
+  const double picked =
+      -std::expm1(-static_cast<double>(bytes) / meanInterval);
+  Stats &stats = perSite[site];
+  stats.count += 1.0 / picked;
+  stats.bytes += static_cast<double>(bytes) / picked;
+  stats.samples++;
+}
+
+std::string_view AllocationProfiler::typeName(ValueType type) {
+  switch (type) {
+  case ValueType::NUMBER:
+    return "number";
+  case ValueType::BOOL:
+    return "bool";
+  case ValueType::NIL:
+    return "nil";
+  case ValueType::FUNCTION:
+    return "function";
+  case ValueType::NATIVE_FUNCTION:
+    return "native";
+  case ValueType::CLOSURE:
+    return "closure";
+  case ValueType::UPVALUE:
+    return "upvalue";
+  case ValueType::STRING:
+    return "string";
+  case ValueType::CLASS:
+    return "class";
+  case ValueType::INSTANCE:
+    return "instance";
+  case ValueType::BOUND_METHOD:
+    return "bound method";
+  case ValueType::ARRAY:
+    return "array";
+  case ValueType::MAP:
+    return "map";
+  case ValueType::CHANNEL:
+    return "channel";
+  case ValueType::FIBER:
+    return "fiber";
+  case ValueType::GENERATOR:
+    return "generator";
+  case ValueType::AWAITABLE:
+    return "awaitable";
+  case ValueType::LINES:
+    return "lines";
+  case ValueType::NATIVE_ERROR:
+    return "native error";
+  default:
+    return "object";
+  }
+}
+
+void AllocationProfiler::report(std::ostream &out, size_t siteLimit) const {
+  TypeStats total{};
+  for (const TypeStats &stats : perType) {
+    total.count += stats.count;
+    total.bytes += stats.bytes;
+  }
+  // Nothing is freed before the VM goes away.
+  out << "Allocations (all still live):\n";
+  out << fmt::format("{:<16} {:>12} {:>14}\n", "type", "count", "live bytes");
+  for (size_t type = 0; type < TYPE_COUNT; type++) {
+    if (perType[type].count != 0) {
+      out << fmt::format("{:<16} {:>12} {:>14}\n",
+                         typeName(static_cast<ValueType>(type)),
+                         perType[type].count, perType[type].bytes);
+    }
+  }
+  out << fmt::format("{:<16} {:>12} {:>14}\n", "total", total.count,
+                     total.bytes);
+
+  std::vector<std::pair<Site, Stats>> sorted(perSite.begin(), perSite.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    return a.second.bytes > b.second.bytes;
+  });
+  if (sorted.size() > siteLimit) {
+    sorted.resize(siteLimit);
+  }
+  out << fmt::format("\nSites (sampled every {} bytes on average):\n",
+                     meanInterval);
+  out << fmt::format("{:<32} {:<12} {:>12} {:>14} {:>8}\n", "site", "type",
+                     "~count", "~live bytes", "samples");
+  for (const auto &[site, stats] : sorted) {
+    out << fmt::format("{:<32} {:<12} {:>12.0f} {:>14.0f} {:>8}\n",
+                       siteName(site), typeName(site.type), stats.count,
+                       stats.bytes, stats.samples);
+  }
+}
+
+void AllocationProfiler::writeJson(std::ostream &out) const {
+  out << fmt::format("{{\"interval\":{},\"types\":{{", meanInterval);
+  bool first = true;
+  for (size_t type = 0; type < TYPE_COUNT; type++) {
+    if (perType[type].count == 0) {
+      continue;
+    }
+    out << fmt::format("{}\"{}\":{{\"count\":{},\"bytes\":{}}}",
+                       first ? "" : ",", typeName(static_cast<ValueType>(type)),
+                       perType[type].count, perType[type].bytes);
+    first = false;
+  }
+  out << "},\"sites\":[";
+  first = true;
+  for (const auto &[site, stats] : perSite) {
+    const std::string_view name =
+        site.function == nullptr ? std::string_view{"(host)"}
+        : site.function->name.empty()
+            ? std::string_view{"script"}
+            : std::string_view{site.function->name};
+    out << fmt::format(
+        "{}{{\"function\":\"{}\",\"line\":{},\"type\":\"{}\","
+        "\"compile\":{},\"count\":{:.0f},\"bytes\":{:.0f},\"samples\":{}}}",
+        first ? "" : ",", name, site.line, typeName(site.type), site.compile,
+        stats.count, stats.bytes, stats.samples);
+    first = false;
+  }
+  out << "]}\n";
+}
@@ -0,0 +1,603 @@
+#include "aot.hpp"
+#include "chunk.hpp"
+#include "debug.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+uint16_t readShort(const std::vector<uint8_t> &code, size_t offset) {
+  return static_cast<uint16_t>(code[offset] << 8 | code[offset + 1]);
+}
+
+size_t instructionLength(const Chunk &chunk, size_t offset) {
+  const std::vector<uint8_t> &code = chunk.getCode();
+  switch (code[offset]) {
+  case OP_CONSTANT:
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_CALL:
+  case OP_CLASS:
+  case OP_METHOD:
+  case OP_ARRAY:
+  case OP_MAP:
+    return 2;
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+    return 3;
+  case OP_ITERATE:
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+    return 4;
+  case OP_INVOKE:
+    return 5;
+  case OP_CLOSURE: {
+    const Value constant =
+        chunk.getConstants().getValues()[code[offset + 1]];
+    return 2 + 2 * constant.asObj()->as<Function>()->upvalueCount;
+  }
+  default:
+    return 1;
+  }
+}
+
+// Where control can go after the instruction at `offset`, with the stack
+// depth on arrival, given the depth before it.
+struct Successor {
+  size_t offset;
+  size_t depth;
+};
+
+std::vector<Successor> successors(const Chunk &chunk, size_t offset,
+                                  size_t depth) {
+  const std::vector<uint8_t> &code = chunk.getCode();
+  const size_t next = offset + instructionLength(chunk, offset);
+  switch (code[offset]) {
+  case OP_CONSTANT:
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_GET_GLOBAL:
+  case OP_GET_LOCAL:
+  case OP_GET_UPVALUE:
+  case OP_CLOSURE:
+  case OP_CLASS:
+    return {{next, depth + 1}};
+  case OP_POP:
+  case OP_DEFINE_GLOBAL:
+  case OP_CLOSE_UPVALUE:
+  case OP_METHOD:
+  case OP_PRINT:
+  case OP_SET_PROPERTY:
+  case OP_GET_INDEX:
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+    return {{next, depth - 1}};
+  case OP_SET_INDEX:
+    return {{next, depth - 2}};
+  case OP_CALL:
+    return {{next, depth - code[offset + 1]}};
+  case OP_INVOKE:
+    return {{next, depth - code[offset + 2]}};
+  case OP_ARRAY:
+    return {{next, depth + 1 - code[offset + 1]}};
+  case OP_MAP:
+    return {{next, depth + 1 - 2 * code[offset + 1]}};
+  case OP_JUMP:
+    return {{next + readShort(code, offset + 1), depth}};
+  case OP_JUMP_IF_FALSE:
+    return {{next, depth}, {next + readShort(code, offset + 1), depth}};
+  case OP_LOOP:
+    return {{next - readShort(code, offset + 1), depth}};
+  case OP_ITERATE:
+    return {{next, depth + 1}, {next + readShort(code, offset + 2), depth}};
+  case OP_YIELD:
+    return {{next, depth - 1}};
+  case OP_RETURN:
+  case OP_GENERATOR_RETURN:
+    return {};
+  default:
+    // SET_GLOBAL, SET_LOCAL, SET_UPVALUE, GET_PROPERTY, NOT, NEGATE.
+    return {{next, depth}};
+  }
+}
+
+// Whether the instruction can raise a runtime error.
+bool canFail(uint8_t opcode) {
+  switch (opcode) {
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+  case OP_GET_INDEX:
+  case OP_SET_INDEX:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_NEGATE:
+  case OP_ITERATE:
+  case OP_CALL:
+  case OP_INVOKE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Stack depth before each reachable instruction, counting slot 0 and the
+// parameters, or nothing if two paths disagree.
+std::optional<std::vector<std::optional<size_t>>>
+stackDepths(const Function &function) {
+  const Chunk &chunk = *function.chunk;
+  std::vector<std::optional<size_t>> depths(chunk.count());
+  std::vector<size_t> work{0};
+  depths[0] = 1 + function.arity;
+  while (!work.empty()) {
+    const size_t offset = work.back();
+    work.pop_back();
+    for (const Successor &next : successors(chunk, offset, *depths[offset])) {
+      if (next.offset >= chunk.count()) {
+        return std::nullopt;
+      }
+      if (!depths[next.offset].has_value()) {
+        depths[next.offset] = next.depth;
+        work.push_back(next.offset);
+      } else if (*depths[next.offset] != next.depth) {
+        return std::nullopt;
+      }
+    }
+  }
+  return depths;
+}
+
+std::string cString(std::string_view text) {
+  std::string literal = "\"";
+  for (const char c : text) {
+    switch (c) {
+    case '"':
+      literal += "\\\"";
+      break;
+    case '\\':
+      literal += "\\\\";
+      break;
+    case '\n':
+      literal += "\\n\"\n    \"";
+      break;
+    case '\t':
+      literal += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20 ||
+          static_cast<unsigned char>(c) >= 0x7f) {
+        literal += fmt::format("\\{:03o}", static_cast<unsigned char>(c));
+      } else {
+        literal += c;
+      }
+    }
+  }
+  return literal + "\"";
+}
+
+std::string_view functionName(const Function *function) {
+  return function->name.empty() ? std::string_view{"script"}
+                                : std::string_view{function->name};
+}
+
+// Translates one function; returns false, having written nothing, if its
+// bytecode doesn't have a consistent stack depth or it is a generator.
+bool emitFunction(const Function *function, size_t index,
+                  std::ostream &result) {
+  // A generator's frame outlives each resume, which a C function can't do.
+  if (function->generator) {
+    return false;
+  }
+  std::ostringstream out;
+  const auto depths = stackDepths(*function);
+  if (!depths.has_value()) {
+    return false;
+  }
+  const Chunk &chunk = *function->chunk;
+  const std::vector<uint8_t> &code = chunk.getCode();
+  const std::vector<Value> &constants = chunk.getConstants().getValues();
+
+  size_t slots = 1 + function->arity;
+  bool failing = false;
+  std::vector<bool> target(code.size() + 1, false);
+  std::vector<bool> captured(256, false);
+  for (size_t offset = 0; offset < code.size();
+       offset += instructionLength(chunk, offset)) {
+    if (!(*depths)[offset].has_value()) {
+      continue;
+    }
+    const size_t depth = *(*depths)[offset];
+    failing = failing || canFail(code[offset]);
+    const std::vector<Successor> next = successors(chunk, offset, depth);
+    for (const Successor &successor : next) {
+      slots = std::max(slots, successor.depth);
+    }
+    switch (code[offset]) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_ITERATE:
+      // The jump is always the last successor.
+      target[next.back().offset] = true;
+      break;
+    default:
+      break;
+    }
+    if (code[offset] == OP_CLOSURE) {
+      const Function *inner = constants[code[offset + 1]].asObj()->as<Function>();
+      for (size_t i = 0; i < inner->upvalueCount; i++) {
+        if (code[offset + 2 + 2 * i] == CAPTURE_LOCAL) {
+          captured[code[offset + 3 + 2 * i]] = true;
+        }
+      }
+    }
+  }
+  std::string closeCells;
+  for (size_t slot = 0; slot < captured.size(); slot++) {
+    if (captured[slot]) {
+      closeCells += fmt::format("  if (c{0} != NULL) mehh_close(c{0});\n", slot);
+    }
+  }
+
+  out << fmt::format("/* {} (line {}) */\n", functionName(function),
+                     chunk.getLine(0));
+  out << fmt::format("static bool mehh_f{}(mehh_vm *vm, const mehh_closure "
+                     "*closure, mehh_value *slots, mehh_value *result) {{\n",
+                     index);
+  out << "  const mehh_value *K = mehh_constants(closure);\n";
+  if (failing) {
+    out << "  size_t line = 0;\n";
+  }
+  for (size_t slot = 0; slot < slots; slot++) {
+    out << fmt::format("  mehh_value v{} = {};\n", slot,
+                       slot <= function->arity
+                           ? fmt::format("slots[{}]", slot)
+                           : std::string{"MEHH_NIL"});
+  }
+  for (size_t slot = 0; slot < captured.size(); slot++) {
+    if (captured[slot]) {
+      out << fmt::format("  mehh_cell *c{} = NULL;\n", slot);
+    }
+  }
+  out << "  (void)K;\n  (void)v0;\n";
+
+  for (size_t offset = 0; offset < code.size();
+       offset += instructionLength(chunk, offset)) {
+    if (!(*depths)[offset].has_value()) {
+      continue;
+    }
+    const size_t d = *(*depths)[offset];
+    const size_t line = chunk.getLine(offset);
+    const std::string fail = fmt::format("FAIL({});", line);
+    if (target[offset]) {
+      out << fmt::format("L{}:;\n", offset);
+    }
+    out << fmt::format("  /* {:04} {} */\n", offset, opcodeName(code[offset]));
+    const uint8_t operand = offset + 1 < code.size() ? code[offset + 1] : 0;
+
+    auto args = [&](size_t base, size_t count) {
+      std::string list;
+      for (size_t slot = base; slot < base + count; slot++) {
+        list += fmt::format("{}v{}", slot == base ? "" : ", ", slot);
+      }
+      return list;
+    };
+    auto arith = [&](std::string_view op, std::string_view cOp,
+                     bool comparison) {
+      const std::string number =
+          comparison ? fmt::format("mehh_bool(mehh_as_number(v{0}) {1} "
+                                   "mehh_as_number(v{2}))",
+                                   d - 2, cOp, d - 1)
+                     : fmt::format("mehh_number(mehh_as_number(v{0}) {1} "
+                                   "mehh_as_number(v{2}))",
+                                   d - 2, cOp, d - 1);
+      out << fmt::format(
+          "  if (mehh_is_number(v{0}) && mehh_is_number(v{1})) v{0} = {2};\n"
+          "  else if (!mehh_arith(vm, {3}, v{0}, v{1}, &v{0})) {4}\n",
+          d - 2, d - 1, number, op, fail);
+    };
+
+    switch (code[offset]) {
+    case OP_CONSTANT: {
+      const Value constant = constants[operand];
+      if (constant.isNumber()) {
+        out << fmt::format("  v{} = UINT64_C(0x{:016x}); /* {} */\n", d,
+                           constant.bits(), constant.asNumber());
+      } else {
+        out << fmt::format("  v{} = K[{}];\n", d, operand);
+      }
+      break;
+    }
+    case OP_NIL:
+      out << fmt::format("  v{} = MEHH_NIL;\n", d);
+      break;
+    case OP_TRUE:
+      out << fmt::format("  v{} = MEHH_TRUE;\n", d);
+      break;
+    case OP_FALSE:
+      out << fmt::format("  v{} = MEHH_FALSE;\n", d);
+      break;
+    case OP_POP:
+      break;
+    case OP_GET_GLOBAL:
+      out << fmt::format("  if (!mehh_get_global(vm, K[{}], &v{})) {}\n",
+                         operand, d, fail);
+      break;
+    case OP_SET_GLOBAL:
+      out << fmt::format("  if (!mehh_set_global(vm, K[{}], v{})) {}\n",
+                         operand, d - 1, fail);
+      break;
+    case OP_DEFINE_GLOBAL:
+      out << fmt::format("  mehh_define_global(vm, K[{}], v{});\n", operand,
+                         d - 1);
+      break;
+    case OP_GET_LOCAL:
+      out << fmt::format("  v{} = v{};\n", d, operand);
+      break;
+    case OP_SET_LOCAL:
+      out << fmt::format("  v{} = v{};\n", operand, d - 1);
+      break;
+    case OP_GET_UPVALUE:
+      out << fmt::format("  v{} = *mehh_upvalue(closure, {});\n", d, operand);
+      break;
+    case OP_SET_UPVALUE:
+      out << fmt::format("  *mehh_upvalue(closure, {}) = v{};\n", operand,
+                         d - 1);
+      break;
+    case OP_GET_PROPERTY:
+      out << fmt::format(
+          "  if (!mehh_get_property(vm, closure, K[{}], {}, &v{})) {}\n",
+          operand, readShort(code, offset + 2), d - 1, fail);
+      break;
+    case OP_SET_PROPERTY:
+      out << fmt::format("  if (!mehh_set_property(vm, closure, K[{}], {}, "
+                         "v{}, v{})) {}\n  v{} = v{};\n",
+                         operand, readShort(code, offset + 2), d - 2, d - 1,
+                         fail, d - 2, d - 1);
+      break;
+    case OP_GET_INDEX:
+      out << fmt::format("  if (!mehh_get_index(vm, v{0}, v{1}, &v{0})) {2}\n",
+                         d - 2, d - 1, fail);
+      break;
+    case OP_SET_INDEX:
+      out << fmt::format(
+          "  if (!mehh_set_index(vm, v{0}, v{1}, v{2})) {3}\n  v{0} = v{2};\n",
+          d - 3, d - 2, d - 1, fail);
+      break;
+    case OP_EQUAL:
+      out << fmt::format(
+          "  v{0} = mehh_bool(mehh_is_number(v{0}) && mehh_is_number(v{1})\n"
+          "                       ? mehh_as_number(v{0}) == "
+          "mehh_as_number(v{1})\n"
+          "                       : mehh_equal(v{0}, v{1}));\n",
+          d - 2, d - 1);
+      break;
+    case OP_GREATER:
+      arith("MEHH_GREATER", ">", true);
+      break;
+    case OP_LESS:
+      arith("MEHH_LESS", "<", true);
+      break;
+    case OP_ADD:
+      arith("MEHH_ADD", "+", false);
+      break;
+    case OP_SUBTRACT:
+      arith("MEHH_SUBTRACT", "-", false);
+      break;
+    case OP_MULTIPLY:
+      arith("MEHH_MULTIPLY", "*", false);
+      break;
+    case OP_DIVIDE:
+      arith("MEHH_DIVIDE", "/", false);
+      break;
+    case OP_NOT:
+      out << fmt::format("  v{0} = mehh_bool(mehh_falsey(v{0}));\n", d - 1);
+      break;
+    case OP_NEGATE:
+      out << fmt::format(
+          "  if (mehh_is_number(v{0})) v{0} = mehh_number(-mehh_as_number(v{0}));\n"
+          "  else if (!mehh_arith(vm, MEHH_NEGATE, v{0}, v{0}, &v{0})) {1}\n",
+          d - 1, fail);
+      break;
+    case OP_PRINT:
+      out << fmt::format("  mehh_print(vm, v{});\n", d - 1);
+      break;
+    case OP_JUMP:
+      out << fmt::format("  goto L{};\n", offset + 3 + readShort(code, offset + 1));
+      break;
+    case OP_JUMP_IF_FALSE:
+      out << fmt::format("  if (mehh_falsey(v{})) goto L{};\n", d - 1,
+                         offset + 3 + readShort(code, offset + 1));
+      break;
+    case OP_LOOP:
+      out << fmt::format("  goto L{};\n", offset + 3 - readShort(code, offset + 1));
+      break;
+    case OP_ITERATE:
+      out << fmt::format(
+          "  {{\n    const int step = mehh_iterate(vm, v{0}, &v{1}, &v{2});\n"
+          "    if (step < 0) {3}\n    if (step == 0) goto L{4};\n  }}\n",
+          operand, operand + 1, d, fail,
+          offset + 4 + readShort(code, offset + 2));
+      break;
+    case OP_CALL: {
+      const size_t base = d - 1 - operand;
+      out << fmt::format("  {{\n    mehh_value args[] = {{{}}};\n"
+                         "    if (!mehh_call(vm, args, {}, &v{})) {}\n  }}\n",
+                         args(base, operand + 1), operand, base, fail);
+      break;
+    }
+    case OP_INVOKE: {
+      const uint8_t argCount = code[offset + 2];
+      const size_t base = d - 1 - argCount;
+      out << fmt::format(
+          "  {{\n    mehh_value args[] = {{{}}};\n"
+          "    if (!mehh_invoke(vm, closure, K[{}], {}, args, {}, &v{})) {}\n"
+          "  }}\n",
+          args(base, argCount + 1), operand, readShort(code, offset + 3),
+          argCount, base, fail);
+      break;
+    }
+    case OP_CLOSURE: {
+      const Function *inner = constants[operand].asObj()->as<Function>();
+      out << fmt::format("  v{} = mehh_closure_new(vm, K[{}]);\n", d, operand);
+      for (size_t i = 0; i < inner->upvalueCount; i++) {
+        const uint8_t capture = code[offset + 2 + 2 * i];
+        const uint8_t slot = code[offset + 3 + 2 * i];
+        switch (capture) {
+        case CAPTURE_LOCAL:
+          out << fmt::format("  if (c{0} == NULL) c{0} = mehh_capture(vm, &v{0});\n"
+                             "  mehh_capture_cell(v{1}, c{0});\n",
+                             slot, d);
+          break;
+        case CAPTURE_VALUE:
+          out << fmt::format("  mehh_capture_value(v{}, v{});\n", d, slot);
+          break;
+        default:
+          out << fmt::format("  mehh_capture_upvalue(v{}, closure, {});\n", d,
+                             slot);
+          break;
+        }
+      }
+      break;
+    }
+    case OP_CLOSE_UPVALUE:
+      if (captured[d - 1]) {
+        out << fmt::format("  if (c{0} != NULL) {{\n    mehh_close(c{0});\n"
+                           "    c{0} = NULL;\n  }}\n",
+                           d - 1);
+      }
+      break;
+    case OP_RETURN:
+      out << closeCells;
+      out << fmt::format("  *result = v{};\n  return true;\n", d - 1);
+      break;
+    case OP_CLASS:
+      out << fmt::format("  v{} = mehh_class(vm, K[{}]);\n", d, operand);
+      break;
+    case OP_METHOD:
+      out << fmt::format("  mehh_method(vm, v{}, K[{}], v{});\n", d - 2,
+                         operand, d - 1);
+      break;
+    case OP_ARRAY: {
+      const size_t base = d - operand;
+      if (operand == 0) {
+        out << fmt::format("  v{} = mehh_array(vm, NULL, 0);\n", base);
+      } else {
+        out << fmt::format("  {{\n    mehh_value items[] = {{{}}};\n"
+                           "    v{} = mehh_array(vm, items, {});\n  }}\n",
+                           args(base, operand), base, operand);
+      }
+      break;
+    }
+    case OP_MAP: {
+      const size_t base = d - 2 * operand;
+      if (operand == 0) {
+        out << fmt::format("  v{} = mehh_map(vm, NULL, 0);\n", base);
+      } else {
+        out << fmt::format("  {{\n    mehh_value items[] = {{{}}};\n"
+                           "    v{} = mehh_map(vm, items, {});\n  }}\n",
+                           args(base, 2 * operand), base, operand);
+      }
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+
+  if (failing) {
+    out << "mehh_fail:\n";
+    out << closeCells;
+    out << "  mehh_trace(closure, line);\n  return false;\n";
+  }
+  out << "}\n\n";
+  result << out.str();
+  return true;
+}
+
+} // namespace
+
+std::vector<const Function *> aotFunctions(const Function *script) {
+  std::vector<const Function *> functions{script};
+  // Breadth first through the constant tables.
+  for (size_t i = 0; i < functions.size(); i++) {
+    for (const Value &constant :
+         functions[i]->chunk->getConstants().getValues()) {
+      if (constant.isFunction()) {
+        functions.push_back(constant.asObj()->as<Function>());
+      }
+    }
+  }
+  return functions;
+}
+
+uint64_t aotChecksum(const std::vector<const Function *> &functions) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto mix = [&](uint64_t byte) {
+    hash ^= byte;
+    hash *= 0x100000001b3ULL;
+  };
+  for (const Function *function : functions) {
+    mix(function->arity);
+    mix(function->upvalueCount);
+    mix(function->chunk->getConstants().count());
+    for (const uint8_t byte : function->chunk->getCode()) {
+      mix(byte);
+    }
+  }
+  return hash;
+}
+
+void emitC(const Function *script, std::string_view source,
+           std::ostream &out) {
+  const std::vector<const Function *> functions = aotFunctions(script);
+  out << "/* Generated by mehh --emit-c. Do not edit. */\n";
+  out << "#include \"mehh_aot.h\"\n\n";
+  out << "#define FAIL(n) do { line = (n); goto mehh_fail; } while (0)\n\n";
+
+  std::vector<bool> emitted(functions.size());
+  for (size_t i = 0; i < functions.size(); i++) {
+    emitted[i] = emitFunction(functions[i], i, out);
+  }
+
+  out << "static const mehh_entry entries[] = {\n";
+  for (size_t i = 0; i < functions.size(); i++) {
+    out << fmt::format("    {}, /* {} */\n",
+                       emitted[i] ? fmt::format("mehh_f{}", i) : "NULL",
+                       functionName(functions[i]));
+  }
+  out << "};\n\n";
+  out << "static const char source[] =\n    " << cString(source) << ";\n\n";
+  out << "int main(void) {\n";
+  out << fmt::format("  return mehh_aot_main(source, entries, {}, "
+                     "UINT64_C(0x{:016x}));\n",
+                     functions.size(), aotChecksum(functions));
+  out << "}\n";
+}
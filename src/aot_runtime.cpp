@@ -0,0 +1,578 @@
+#include "aot.hpp"
+#include "array.hpp"
+#include "chunk.hpp"
+#include "class.hpp"
+#include "function.hpp"
+#include "generator.hpp"
+#include "map.hpp"
+#include "mapped_file.hpp"
+#include "mehh_aot.h"
+#include "value.hpp"
+#include "value_array.hpp"
+#include "vm.hpp"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// The runtime behind mehh_aot.h: the same operations as the interpreter's
+// opcodes, on values passed in C variables instead of the VM stack.
+class AotRuntime {
+public:
+  static VM &vm(mehh_vm *vm) { return *reinterpret_cast<VM *>(vm); }
+  static Output &out(mehh_vm *vm) { return AotRuntime::vm(vm).out; }
+  static Value value(mehh_value bits) { return std::bit_cast<Value>(bits); }
+  static mehh_value bits(const Value &value) { return value.bits(); }
+  static const Closure *closure(const mehh_closure *closure) {
+    return reinterpret_cast<const Closure *>(closure);
+  }
+  static const StringObj *string(mehh_value name) {
+    return value(name).asObj()->as<StringObj>();
+  }
+  static Closure *newClosure(VM &vm, const Function *function) {
+    return vm.newClosure(function);
+  }
+  static PropertyCache &cache(const mehh_closure *closure, uint16_t index) {
+    return AotRuntime::closure(closure)->caches[index];
+  }
+
+  static bool arith(VM &vm, mehh_operator op, const Value &a, const Value &b,
+                    Value &result) {
+    switch (op) {
+    case MEHH_ADD:
+      if (a.isString() && b.isString()) {
+        result = Value{vm.stringIntern.intern(
+            std::string{a.asObj()->as<StringObj>()->str} +
+            std::string{b.asObj()->as<StringObj>()->str})};
+        return true;
+      }
+      vm.runtimeError("Operands must be two numbers or two strings.");
+      return false;
+    case MEHH_LESS:
+      vm.runtimeError("Operands must be numbers.");
+      return false;
+    case MEHH_NEGATE:
+      vm.runtimeError("Operand must be a number");
+      return false;
+    default:
+      vm.runtimeError("Operands must be numbers");
+      return false;
+    }
+  }
+
+  static bool equal(const Value &a, const Value &b) {
+    if (a.getType() != b.getType()) {
+      return false;
+    }
+    switch (a.getType()) {
+    case ValueType::NUMBER:
+      return a.asNumber() == b.asNumber();
+    case ValueType::STRING:
+      return a.asObj()->as<StringObj>()->str == b.asObj()->as<StringObj>()->str;
+    default:
+      // nil and the booleans have one representation each; objects compare
+      // by identity.
+      return a.bits() == b.bits();
+    }
+  }
+
+  static bool getGlobal(VM &vm, const StringObj *name, Value &result) {
+    const auto variable = vm.globals.find(name->str);
+    if (variable == vm.globals.end()) {
+      vm.runtimeError("Undefined variable '{}.'", name->str);
+      return false;
+    }
+    result = variable->second;
+    return true;
+  }
+
+  static bool setGlobal(VM &vm, const StringObj *name, const Value &value) {
+    const auto variable = vm.globals.find(name->str);
+    if (variable == vm.globals.end()) {
+      vm.runtimeError("Undefined variable '{}'.", name->str);
+      return false;
+    }
+    variable->second = value;
+    return true;
+  }
+
+  static void defineGlobal(VM &vm, const StringObj *name, const Value &value) {
+    vm.globals.insert_or_assign(name->str, value);
+  }
+
+  // Runs `closure` with the receiver and arguments in `slots`: natively if
+  // it was compiled, otherwise in the interpreter.
+  static bool callClosure(VM &vm, const Closure *closure, Value *slots,
+                          uint8_t argCount, Value &result) {
+    const Function *function = closure->function;
+    if (function->compiled == nullptr) {
+      return vm.callClosure(closure, argCount, slots, result);
+    }
+    if (__builtin_expect(argCount != function->arity, 0)) {
+      vm.runtimeError("Expected {} arguments but got {}.", function->arity,
+                      argCount);
+      return false;
+    }
+    if (__builtin_expect(vm.frames.size() + vm.compiledDepth >= FRAME_MAX, 0)) {
+      vm.runtimeError("Stack overflow");
+      return false;
+    }
+    vm.compiledDepth++;
+    mehh_value out;
+    const bool ok = function->compiled(
+        reinterpret_cast<mehh_vm *>(&vm),
+        reinterpret_cast<const mehh_closure *>(closure),
+        reinterpret_cast<mehh_value *>(slots), &out);
+    vm.compiledDepth--;
+    result = value(out);
+    return ok;
+  }
+
+  static bool call(VM &vm, Value *slots, uint8_t argCount, Value &result) {
+    const Value callee = slots[0];
+    if (callee.isObj()) {
+      switch (callee.asObj()->getType()) {
+      case ValueType::CLOSURE:
+        return callClosure(vm, callee.asObj()->as<Closure>(), slots, argCount,
+                           result);
+      case ValueType::BOUND_METHOD: {
+        const BoundMethod *bound = callee.asObj()->as<BoundMethod>();
+        slots[0] = bound->receiver;
+        return callClosure(vm, bound->method, slots, argCount, result);
+      }
+      case ValueType::CLASS: {
+        ClassObj *klass = callee.asObj()->as<ClassObj>();
+        slots[0] = Value{vm.allocate<Instance>(klass)};
+        if (klass->initializer != nullptr) {
+          return callClosure(vm, klass->initializer, slots, argCount, result);
+        }
+        if (argCount != 0) {
+          vm.runtimeError("Expected 0 arguments but got {}.", argCount);
+          return false;
+        }
+        result = slots[0];
+        return true;
+      }
+      default:
+        break;
+      }
+    }
+    // Natives, and the error for anything else.
+    return vm.callFunction(callee, argCount, slots + 1, result);
+  }
+
+  static bool invoke(VM &vm, const StringObj *name, PropertyCache &cache,
+                     Value *slots, uint8_t argCount, Value &result) {
+    if (__builtin_expect(!slots[0].isInstance(), 0)) {
+      vm.runtimeError("Only instances have methods.");
+      return false;
+    }
+    Instance *instance = slots[0].asObj()->as<Instance>();
+    if (__builtin_expect(cache.shape == instance->shape &&
+                             cache.method != nullptr,
+                         1)) {
+      return callClosure(vm, cache.method, slots, argCount, result);
+    }
+    // A field holding a callable shadows methods.
+    const uint32_t slot = instance->shape->lookup(name);
+    if (slot != Shape::NOT_FOUND) {
+      cache = PropertyCache{instance->shape, nullptr, nullptr, slot};
+      slots[0] = instance->fields[slot];
+      return call(vm, slots, argCount, result);
+    }
+    const Closure *method = instance->klass->findMethod(name);
+    if (__builtin_expect(method == nullptr, 0)) {
+      vm.runtimeError("Undefined property '{}'.", name->str);
+      return false;
+    }
+    cache = PropertyCache{instance->shape, nullptr, method, 0};
+    return callClosure(vm, method, slots, argCount, result);
+  }
+
+  static UpvalueObj *capture(VM &vm, Value *location) {
+    // Compiled code closes its cells itself, so they stay off the VM's
+    // list of open upvalues.
+    return &vm.upvalues.emplace_back(location);
+  }
+
+  static Value newClass(VM &vm, const StringObj *name) {
+    return Value{vm.allocate<ClassObj>(name)};
+  }
+
+  static void method(VM &vm, ClassObj *klass, const StringObj *name,
+                     const Closure *method) {
+    klass->methods.insert_or_assign(name, method);
+    if (name == vm.initString) {
+      klass->initializer = method;
+    }
+  }
+
+  static bool getProperty(VM &vm, const StringObj *name, PropertyCache &cache,
+                          Value &object) {
+    if (__builtin_expect(!object.isInstance(), 0)) {
+      vm.runtimeError("Only instances have properties.");
+      return false;
+    }
+    Instance *instance = object.asObj()->as<Instance>();
+    if (__builtin_expect(cache.shape == instance->shape, 1)) {
+      object = cache.method == nullptr
+                   ? instance->fields[cache.slot]
+                   : Value{vm.allocate<BoundMethod>(object, cache.method)};
+      return true;
+    }
+    const uint32_t slot = instance->shape->lookup(name);
+    if (slot != Shape::NOT_FOUND) {
+      cache = PropertyCache{instance->shape, nullptr, nullptr, slot};
+      object = instance->fields[slot];
+      return true;
+    }
+    const Closure *method = instance->klass->findMethod(name);
+    if (__builtin_expect(method == nullptr, 0)) {
+      vm.runtimeError("Undefined property '{}'.", name->str);
+      return false;
+    }
+    cache = PropertyCache{instance->shape, nullptr, method, 0};
+    object = Value{vm.allocate<BoundMethod>(object, method)};
+    return true;
+  }
+
+  static bool setProperty(VM &vm, const StringObj *name, PropertyCache &cache,
+                          const Value &object, const Value &value) {
+    if (__builtin_expect(!object.isInstance(), 0)) {
+      vm.runtimeError("Only instances have fields.");
+      return false;
+    }
+    Instance *instance = object.asObj()->as<Instance>();
+    if (__builtin_expect(cache.shape == instance->shape, 1)) {
+      if (cache.transition == nullptr) {
+        instance->fields[cache.slot] = value;
+      } else {
+        instance->fields.push_back(value);
+        instance->shape = cache.transition;
+      }
+      return true;
+    }
+    const uint32_t slot = instance->shape->lookup(name);
+    if (slot != Shape::NOT_FOUND) {
+      cache = PropertyCache{instance->shape, nullptr, nullptr, slot};
+      instance->fields[slot] = value;
+    } else {
+      Shape *next = instance->shape->transition(name);
+      cache = PropertyCache{instance->shape, next, nullptr,
+                            instance->shape->slotCount()};
+      instance->fields.push_back(value);
+      instance->shape = next;
+    }
+    return true;
+  }
+
+  static Value array(VM &vm, const mehh_value *items, uint8_t count) {
+    ArrayObj *array = vm.allocate<ArrayObj>();
+    for (uint8_t i = 0; i < count; i++) {
+      array->push(value(items[i]));
+    }
+    return Value{array};
+  }
+
+  static Value map(VM &vm, const mehh_value *items, uint8_t count) {
+    MapObj *map = vm.allocate<MapObj>();
+    for (uint8_t i = 0; i < count; i++) {
+      map->set(value(items[2 * i]), value(items[2 * i + 1]));
+    }
+    return Value{map};
+  }
+
+  static bool getIndex(VM &vm, const Value &target, const Value &index,
+                       Value &result) {
+    if (target.isMap()) {
+      // Missing keys read as nil.
+      const Value *found = target.asObj()->as<MapObj>()->find(index);
+      result = found != nullptr ? *found : Value{};
+      return true;
+    }
+    if (__builtin_expect(!target.isArray(), 0)) {
+      vm.runtimeError("Only arrays and maps can be indexed.");
+      return false;
+    }
+    const ArrayObj *array = target.asObj()->as<ArrayObj>();
+    if (__builtin_expect(!vm.checkIndex(array, index), 0)) {
+      return false;
+    }
+    result = array->get(static_cast<size_t>(index.asNumber()));
+    return true;
+  }
+
+  static bool setIndex(VM &vm, const Value &target, const Value &index,
+                       const Value &value) {
+    if (target.isMap()) {
+      target.asObj()->as<MapObj>()->set(index, value);
+      return true;
+    }
+    if (__builtin_expect(!target.isArray(), 0)) {
+      vm.runtimeError("Only arrays and maps can be indexed.");
+      return false;
+    }
+    ArrayObj *array = target.asObj()->as<ArrayObj>();
+    if (__builtin_expect(!vm.checkIndex(array, index), 0)) {
+      return false;
+    }
+    array->set(static_cast<size_t>(index.asNumber()), value);
+    return true;
+  }
+
+  static int iterate(VM &vm, const Value &sequence, Value &cursor,
+                     Value &element) {
+    const size_t index = static_cast<size_t>(cursor.asNumber());
+    if (sequence.isArray()) {
+      const ArrayObj *array = sequence.asObj()->as<ArrayObj>();
+      if (index < array->size()) {
+        element = array->get(index);
+        cursor.setNumber(static_cast<double>(index + 1));
+        return 1;
+      }
+      return 0;
+    }
+    if (sequence.isMap()) {
+      const MapObj *map = sequence.asObj()->as<MapObj>();
+      const size_t next = map->nextSlot(index);
+      if (next < map->capacity()) {
+        element = map->slot(next).key;
+        cursor.setNumber(static_cast<double>(next + 1));
+        return 1;
+      }
+      return 0;
+    }
+    if (sequence.is(ValueType::GENERATOR)) {
+      GeneratorObj *generator = sequence.asObj()->as<GeneratorObj>();
+      if (!vm.runGenerator(generator, element)) {
+        return -1;
+      }
+      return generator->state == GeneratorObj::State::DONE ? 0 : 1;
+    }
+    if (sequence.is(ValueType::LINES)) {
+      return vm.nextLine(sequence.asObj()->as<LinesObj>(), cursor, element)
+                 ? 1
+                 : 0;
+    }
+    vm.runtimeError("Can only iterate over arrays, maps, generators and lines.");
+    return -1;
+  }
+
+  static int main(const char *source, const mehh_entry *entries,
+                  size_t entryCount, uint64_t checksum) {
+    const std::unique_ptr<VM> vm = std::make_unique<VM>();
+    const std::optional<const Function *> script = vm->compile(source);
+    if (!script.has_value()) {
+      return 65;
+    }
+    const std::vector<const Function *> functions = aotFunctions(*script);
+    if (functions.size() != entryCount || aotChecksum(functions) != checksum) {
+      std::cerr << "Compiled code does not match the bytecode of its source; "
+                   "regenerate it with this version of mehh --emit-c.\n";
+      return 70;
+    }
+    for (size_t i = 0; i < entryCount; i++) {
+      // The compiler allocated the functions; they are only const to users.
+      const_cast<Function *>(functions[i])->compiled = entries[i];
+    }
+    Value slots[] = {Value{vm->newClosure(*script)}};
+    Value result;
+    return callClosure(*vm, slots[0].asObj()->as<Closure>(), slots, 0, result)
+               ? 0
+               : 70;
+  }
+};
+
+extern "C" {
+
+bool mehh_arith(mehh_vm *vm, enum mehh_operator op, mehh_value a,
+                mehh_value b, mehh_value *result) {
+  Value out;
+  if (!AotRuntime::arith(AotRuntime::vm(vm), op, AotRuntime::value(a),
+                         AotRuntime::value(b), out)) {
+    return false;
+  }
+  *result = out.bits();
+  return true;
+}
+
+bool mehh_equal(mehh_value a, mehh_value b) {
+  return AotRuntime::equal(AotRuntime::value(a), AotRuntime::value(b));
+}
+
+const mehh_value *mehh_constants(const mehh_closure *closure) {
+  const std::vector<Value> &constants =
+      AotRuntime::closure(closure)->function->chunk->getConstants().getValues();
+  return reinterpret_cast<const mehh_value *>(constants.data());
+}
+
+mehh_value *mehh_upvalue(const mehh_closure *closure, uint8_t index) {
+  return reinterpret_cast<mehh_value *>(
+      AotRuntime::closure(closure)->upvalues[index]->location);
+}
+
+bool mehh_get_global(mehh_vm *vm, mehh_value name, mehh_value *result) {
+  Value out;
+  if (!AotRuntime::getGlobal(AotRuntime::vm(vm), AotRuntime::string(name),
+                             out)) {
+    return false;
+  }
+  *result = out.bits();
+  return true;
+}
+
+bool mehh_set_global(mehh_vm *vm, mehh_value name, mehh_value value) {
+  return AotRuntime::setGlobal(AotRuntime::vm(vm), AotRuntime::string(name),
+                               AotRuntime::value(value));
+}
+
+void mehh_define_global(mehh_vm *vm, mehh_value name, mehh_value value) {
+  AotRuntime::defineGlobal(AotRuntime::vm(vm), AotRuntime::string(name),
+                           AotRuntime::value(value));
+}
+
+bool mehh_call(mehh_vm *vm, mehh_value *slots, uint8_t argCount,
+               mehh_value *result) {
+  Value out;
+  if (!AotRuntime::call(AotRuntime::vm(vm), reinterpret_cast<Value *>(slots),
+                        argCount, out)) {
+    return false;
+  }
+  *result = out.bits();
+  return true;
+}
+
+bool mehh_invoke(mehh_vm *vm, const mehh_closure *closure, mehh_value name,
+                 uint16_t cache, mehh_value *slots, uint8_t argCount,
+                 mehh_value *result) {
+  Value out;
+  if (!AotRuntime::invoke(AotRuntime::vm(vm), AotRuntime::string(name),
+                          AotRuntime::cache(closure, cache),
+                          reinterpret_cast<Value *>(slots), argCount, out)) {
+    return false;
+  }
+  *result = out.bits();
+  return true;
+}
+
+mehh_cell *mehh_capture(mehh_vm *vm, mehh_value *location) {
+  return reinterpret_cast<mehh_cell *>(AotRuntime::capture(
+      AotRuntime::vm(vm), reinterpret_cast<Value *>(location)));
+}
+
+void mehh_close(mehh_cell *cell) {
+  UpvalueObj *upvalue = reinterpret_cast<UpvalueObj *>(cell);
+  upvalue->closed = *upvalue->location;
+  upvalue->location = &upvalue->closed;
+}
+
+mehh_value mehh_closure_new(mehh_vm *vm, mehh_value function) {
+  const Function *fun = AotRuntime::value(function).asObj()->as<Function>();
+  return Value{AotRuntime::newClosure(AotRuntime::vm(vm), fun)}.bits();
+}
+
+void mehh_capture_cell(mehh_value closure, mehh_cell *cell) {
+  AotRuntime::value(closure).asObj()->as<Closure>()->upvalues.push_back(
+      reinterpret_cast<UpvalueObj *>(cell));
+}
+
+void mehh_capture_value(mehh_value closure, mehh_value value) {
+  Closure *target = AotRuntime::value(closure).asObj()->as<Closure>();
+  target->upvalues.push_back(
+      &target->captured.emplace_back(AotRuntime::value(value)));
+}
+
+void mehh_capture_upvalue(mehh_value closure, const mehh_closure *enclosing,
+                          uint8_t index) {
+  AotRuntime::value(closure).asObj()->as<Closure>()->upvalues.push_back(
+      AotRuntime::closure(enclosing)->upvalues[index]);
+}
+
+mehh_value mehh_class(mehh_vm *vm, mehh_value name) {
+  return AotRuntime::newClass(AotRuntime::vm(vm), AotRuntime::string(name))
+      .bits();
+}
+
+void mehh_method(mehh_vm *vm, mehh_value klass, mehh_value name,
+                 mehh_value method) {
+  AotRuntime::method(AotRuntime::vm(vm),
+                     AotRuntime::value(klass).asObj()->as<ClassObj>(),
+                     AotRuntime::string(name),
+                     AotRuntime::value(method).asObj()->as<Closure>());
+}
+
+bool mehh_get_property(mehh_vm *vm, const mehh_closure *closure,
+                       mehh_value name, uint16_t cache, mehh_value *object) {
+  Value target = AotRuntime::value(*object);
+  if (!AotRuntime::getProperty(AotRuntime::vm(vm), AotRuntime::string(name),
+                               AotRuntime::cache(closure, cache), target)) {
+    return false;
+  }
+  *object = target.bits();
+  return true;
+}
+
+bool mehh_set_property(mehh_vm *vm, const mehh_closure *closure,
+                       mehh_value name, uint16_t cache, mehh_value object,
+                       mehh_value value) {
+  return AotRuntime::setProperty(
+      AotRuntime::vm(vm), AotRuntime::string(name),
+      AotRuntime::cache(closure, cache), AotRuntime::value(object),
+      AotRuntime::value(value));
+}
+
+mehh_value mehh_array(mehh_vm *vm, const mehh_value *items, uint8_t count) {
+  return AotRuntime::array(AotRuntime::vm(vm), items, count).bits();
+}
+
+mehh_value mehh_map(mehh_vm *vm, const mehh_value *items, uint8_t count) {
+  return AotRuntime::map(AotRuntime::vm(vm), items, count).bits();
+}
+
+bool mehh_get_index(mehh_vm *vm, mehh_value target, mehh_value index,
+                    mehh_value *result) {
+  Value out;
+  if (!AotRuntime::getIndex(AotRuntime::vm(vm), AotRuntime::value(target),
+                            AotRuntime::value(index), out)) {
+    return false;
+  }
+  *result = out.bits();
+  return true;
+}
+
+bool mehh_set_index(mehh_vm *vm, mehh_value target, mehh_value index,
+                    mehh_value value) {
+  return AotRuntime::setIndex(AotRuntime::vm(vm), AotRuntime::value(target),
+                              AotRuntime::value(index),
+                              AotRuntime::value(value));
+}
+
+int mehh_iterate(mehh_vm *vm, mehh_value sequence, mehh_value *cursor,
+                 mehh_value *element) {
+  return AotRuntime::iterate(AotRuntime::vm(vm), AotRuntime::value(sequence),
+                             *reinterpret_cast<Value *>(cursor),
+                             *reinterpret_cast<Value *>(element));
+}
+
+void mehh_print(mehh_vm *vm, mehh_value value) {
+  printValue(AotRuntime::value(value), AotRuntime::out(vm));
+  AotRuntime::out(vm).newline();
+}
+
+void mehh_trace(const mehh_closure *closure, size_t line) {
+  const Function *function = AotRuntime::closure(closure)->function;
+  std::cout << "[line " << line << "] in script\n"
+            << (function->name.empty() ? std::string{"script"}
+                                       : function->name)
+            << '\n';
+}
+
+int mehh_aot_main(const char *source, const mehh_entry *entries,
+                  size_t entryCount, uint64_t checksum) {
+  return AotRuntime::main(source, entries, entryCount, checksum);
+}
+}
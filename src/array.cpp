@@ -0,0 +1,39 @@
+#include "array.hpp"
+#include "value.hpp"
+#include <cstddef>
+#include <vector>
+
+void ArrayObj::resize(size_t size) {
+  if (numeric) {
+    numbers.resize(size, 0.0);
+  } else {
+    values.resize(size, Value{});
+  }
+}
+
+bool ArrayObj::specialize() {
+  if (numeric) {
+    return true;
+  }
+  for (const Value &value : values) {
+    if (!value.isNumber()) {
+      return false;
+    }
+  }
+  numbers.reserve(values.size());
+  for (const Value &value : values) {
+    numbers.push_back(value.asNumber());
+  }
+  values = std::vector<Value>{};
+  numeric = true;
+  return true;
+}
+
+void ArrayObj::generalize() {
+  values.reserve(numbers.size() + 1);
+  for (const double number : numbers) {
+    values.emplace_back(number);
+  }
+  numbers = std::vector<double>{};
+  numeric = false;
+}
@@ -0,0 +1,98 @@
+#include "event_loop.hpp"
+#include "fiber.hpp"
+#include "value.hpp"
+#include "vm.hpp"
+#include <memory>
+#include <string>
+
+namespace {
+
+const NativeError expectedOneArgument{"Expected 1 argument."};
+const NativeError expectedTwoArguments{"Expected 2 arguments."};
+const NativeError expectedPath{"Path must be a string."};
+const NativeError expectedContents{"Contents must be a string."};
+const NativeError expectedAwaitable{"Argument must be an awaitable."};
+
+__attribute__((always_inline)) inline Value error(const NativeError &error) {
+  return Value{static_cast<const Obj *>(&error)};
+}
+
+} // namespace
+
+Value VM::readFileAsyncNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].isString()) {
+    return error(expectedPath);
+  }
+  AwaitableObj *awaitable = vm.allocate<AwaitableObj>();
+  vm.io().read(std::string{args[0].asObj()->as<StringObj>()->str},
+                awaitable);
+  return Value{awaitable};
+}
+
+Value VM::writeFileAsyncNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  if (!args[0].isString()) {
+    return error(expectedPath);
+  }
+  if (!args[1].isString()) {
+    return error(expectedContents);
+  }
+  AwaitableObj *awaitable = vm.allocate<AwaitableObj>();
+  vm.io().write(std::string{args[0].asObj()->as<StringObj>()->str},
+                std::string{args[1].asObj()->as<StringObj>()->str}, awaitable);
+  return Value{awaitable};
+}
+
+Value VM::awaitNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].is(ValueType::AWAITABLE)) {
+    return error(expectedAwaitable);
+  }
+  AwaitableObj *awaitable = args[0].asObj()->as<AwaitableObj>();
+  if (!awaitable->done) {
+    vm.completeIo(false);
+  }
+  while (!awaitable->done) {
+    // Other fibers run meanwhile if there are any and this one can switch;
+    // otherwise there is nothing to do but wait, e.g. in a callback.
+    if (!vm.runnable.empty() && vm.canSwitchFiber()) {
+      vm.fiber->state = FiberObj::State::BLOCKED;
+      awaitable->waiters.push_back(vm.fiber);
+      vm.pendingSwitch = vm.runnable.front();
+      vm.runnable.pop_front();
+      // Overwritten with the result when the operation finishes.
+      return Value{};
+    }
+    vm.completeIo(true);
+  }
+  return awaitable->result;
+}
+
+void VM::completeIo(bool wait) {
+  for (std::unique_ptr<IoRequest> &request : io().reap(wait)) {
+    AwaitableObj *awaitable = request->awaitable;
+    awaitable->done = true;
+    if (request->kind == IoRequest::Kind::READ) {
+      awaitable->result =
+          request->error == 0 ? string(request->data) : Value{};
+    } else {
+      awaitable->result = Value{request->error == 0};
+    }
+    for (FiberObj *waiter : awaitable->waiters) {
+      if (waiter->generation != resets) {
+        continue;
+      }
+      waiter->stack.back() = awaitable->result;
+      waiter->state = FiberObj::State::READY;
+      runnable.push_back(waiter);
+    }
+    awaitable->waiters.clear();
+  }
+}
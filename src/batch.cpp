@@ -0,0 +1,349 @@
+#include "batch.hpp"
+#include "chunk.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t DONE = UINT32_MAX;
+constexpr uint16_t UNREACHABLE = UINT16_MAX;
+
+__attribute__((always_inline)) inline uint16_t readShort(
+    const std::vector<uint8_t> &code, size_t offset) {
+  return static_cast<uint16_t>(code[offset] << 8 | code[offset + 1]);
+}
+
+// out = op(a, b) on the lanes in `mask`. The unmasked loop is the common
+// case and vectorizes.
+template <typename Op>
+__attribute__((always_inline)) inline void
+apply(double *out, const double *a, const double *b, const uint8_t *mask,
+      bool uniform, size_t lanes, Op op) {
+  if (uniform) {
+    for (size_t i = 0; i < lanes; i++) {
+      out[i] = op(a[i], b[i]);
+    }
+  } else {
+    for (size_t i = 0; i < lanes; i++) {
+      out[i] = mask[i] ? op(a[i], b[i]) : out[i];
+    }
+  }
+}
+
+} // namespace
+
+std::optional<BatchProgram> BatchProgram::compile(const Function &function) {
+  const std::vector<uint8_t> &code = function.chunk->getCode();
+  const std::vector<Value> &values = function.chunk->getConstants().getValues();
+  BatchProgram program{function};
+  program.sites.assign(code.size(), Site{UNREACHABLE, Kind::OTHER, Kind::OTHER});
+  program.constants.resize(values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    program.constants[i] = values[i].isNumber() ? values[i].asNumber() : 0;
+  }
+
+  // Abstract interpretation over the kinds on the stack. Every path into an
+  // instruction has to agree on them, which also fixes the stack depth.
+  std::vector<std::optional<std::vector<Kind>>> states(code.size());
+  std::vector<size_t> worklist{0};
+  states[0].emplace(1 + function.arity, Kind::NUMBER);
+  (*states[0])[0] = Kind::OTHER; // The callee's own slot.
+
+  while (!worklist.empty()) {
+    const size_t offset = worklist.back();
+    worklist.pop_back();
+    std::vector<Kind> stack = *states[offset];
+    const size_t depth = stack.size();
+    program.maxDepth = std::max(program.maxDepth, depth + 1);
+    program.sites[offset] =
+        Site{static_cast<uint16_t>(depth),
+             depth > 0 ? stack[depth - 1] : Kind::OTHER,
+             depth > 1 ? stack[depth - 2] : Kind::OTHER};
+
+    auto numbers = [&](size_t count) {
+      return stack.size() >= count &&
+             std::all_of(stack.end() - count, stack.end(),
+                         [](Kind kind) { return kind == Kind::NUMBER; });
+    };
+    auto scalar = [&] {
+      return !stack.empty() && stack.back() != Kind::OTHER;
+    };
+
+    size_t successors[2];
+    size_t successorCount = 1;
+    switch (code[offset]) {
+    case OP_CONSTANT:
+      if (!values[code[offset + 1]].isNumber()) {
+        return std::nullopt;
+      }
+      stack.push_back(Kind::NUMBER);
+      successors[0] = offset + 2;
+      break;
+    case OP_TRUE:
+    case OP_FALSE:
+      stack.push_back(Kind::BOOL);
+      successors[0] = offset + 1;
+      break;
+    case OP_POP:
+      if (stack.empty()) {
+        return std::nullopt;
+      }
+      stack.pop_back();
+      successors[0] = offset + 1;
+      break;
+    case OP_GET_LOCAL: {
+      const uint8_t slot = code[offset + 1];
+      if (slot >= stack.size() || stack[slot] == Kind::OTHER) {
+        return std::nullopt;
+      }
+      stack.push_back(stack[slot]);
+      successors[0] = offset + 2;
+      break;
+    }
+    case OP_SET_LOCAL: {
+      const uint8_t slot = code[offset + 1];
+      if (slot == 0 || slot >= stack.size() || !scalar()) {
+        return std::nullopt;
+      }
+      stack[slot] = stack.back();
+      successors[0] = offset + 2;
+      break;
+    }
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+      if (!numbers(2)) {
+        return std::nullopt;
+      }
+      stack.pop_back();
+      successors[0] = offset + 1;
+      break;
+    case OP_GREATER:
+    case OP_LESS:
+      if (!numbers(2)) {
+        return std::nullopt;
+      }
+      stack.pop_back();
+      stack.back() = Kind::BOOL;
+      successors[0] = offset + 1;
+      break;
+    case OP_EQUAL:
+      if (stack.size() < 2 || stack[depth - 1] == Kind::OTHER ||
+          stack[depth - 2] == Kind::OTHER) {
+        return std::nullopt;
+      }
+      stack.pop_back();
+      stack.back() = Kind::BOOL;
+      successors[0] = offset + 1;
+      break;
+    case OP_NOT:
+      if (!scalar()) {
+        return std::nullopt;
+      }
+      stack.back() = Kind::BOOL;
+      successors[0] = offset + 1;
+      break;
+    case OP_NEGATE:
+      if (!numbers(1)) {
+        return std::nullopt;
+      }
+      successors[0] = offset + 1;
+      break;
+    case OP_JUMP:
+      successors[0] = offset + 3 + readShort(code, offset + 1);
+      break;
+    case OP_JUMP_IF_FALSE:
+      if (!scalar()) {
+        return std::nullopt;
+      }
+      successors[0] = offset + 3;
+      successors[1] = offset + 3 + readShort(code, offset + 1);
+      successorCount = 2;
+      break;
+    case OP_LOOP:
+      successors[0] = offset + 3 - readShort(code, offset + 1);
+      break;
+    case OP_RETURN:
+      if (!numbers(1)) {
+        return std::nullopt;
+      }
+      successorCount = 0;
+      break;
+    default:
+      return std::nullopt;
+    }
+
+    for (size_t i = 0; i < successorCount; i++) {
+      const size_t next = successors[i];
+      if (next >= code.size()) {
+        return std::nullopt;
+      }
+      if (!states[next].has_value()) {
+        states[next] = stack;
+        worklist.push_back(next);
+      } else if (*states[next] != stack) {
+        return std::nullopt;
+      }
+    }
+  }
+  return program;
+}
+
+void BatchProgram::run(std::span<const std::span<const double>> columns,
+                       std::span<double> results) const {
+  std::vector<double> stack(maxDepth * WIDTH);
+  std::vector<uint32_t> pcs(WIDTH);
+  std::vector<uint8_t> mask(WIDTH);
+  for (size_t base = 0; base < results.size(); base += WIDTH) {
+    const size_t lanes = std::min(WIDTH, results.size() - base);
+    for (size_t arg = 0; arg < arity; arg++) {
+      std::copy_n(columns[arg].data() + base, lanes,
+                  stack.data() + (arg + 1) * WIDTH);
+    }
+    std::fill_n(pcs.data(), lanes, 0);
+    runBatch(stack.data(), pcs.data(), mask.data(), lanes,
+             results.data() + base);
+  }
+}
+
+void BatchProgram::runBatch(double *stack, uint32_t *pcs, uint8_t *mask,
+                            size_t lanes, double *results) const {
+  const std::vector<uint8_t> &code = *this->code;
+  auto column = [&](size_t slot) { return stack + slot * WIDTH; };
+
+  for (;;) {
+    const uint32_t pc = *std::min_element(pcs, pcs + lanes);
+    if (pc == DONE) {
+      return;
+    }
+    bool uniform = true;
+    for (size_t i = 0; i < lanes; i++) {
+      mask[i] = pcs[i] == pc;
+      uniform &= mask[i];
+    }
+
+    const Site &site = sites[pc];
+    double *top = site.depth > 0 ? column(site.depth - 1) : nullptr;
+    double *second = site.depth > 1 ? column(site.depth - 2) : nullptr;
+    double *push = column(site.depth);
+    uint32_t next = pc + 1;
+
+    switch (code[pc]) {
+    case OP_CONSTANT: {
+      const double constant = constants[code[pc + 1]];
+      apply(push, push, push, mask, uniform, lanes,
+            [=](double, double) { return constant; });
+      next = pc + 2;
+      break;
+    }
+    case OP_TRUE:
+    case OP_FALSE: {
+      const double constant = code[pc] == OP_TRUE ? 1 : 0;
+      apply(push, push, push, mask, uniform, lanes,
+            [=](double, double) { return constant; });
+      break;
+    }
+    case OP_POP:
+      break;
+    case OP_GET_LOCAL: {
+      const double *local = column(code[pc + 1]);
+      apply(push, local, local, mask, uniform, lanes,
+            [](double a, double) { return a; });
+      next = pc + 2;
+      break;
+    }
+    case OP_SET_LOCAL: {
+      apply(column(code[pc + 1]), top, top, mask, uniform, lanes,
+            [](double a, double) { return a; });
+      next = pc + 2;
+      break;
+    }
+    case OP_ADD:
+      apply(second, second, top, mask, uniform, lanes,
+            [](double a, double b) { return a + b; });
+      break;
+    case OP_SUBTRACT:
+      apply(second, second, top, mask, uniform, lanes,
+            [](double a, double b) { return a - b; });
+      break;
+    case OP_MULTIPLY:
+      apply(second, second, top, mask, uniform, lanes,
+            [](double a, double b) { return a * b; });
+      break;
+    case OP_DIVIDE:
+      apply(second, second, top, mask, uniform, lanes,
+            [](double a, double b) { return a / b; });
+      break;
+    case OP_GREATER:
+      apply(second, second, top, mask, uniform, lanes,
+            [](double a, double b) { return a > b ? 1.0 : 0.0; });
+      break;
+    case OP_LESS:
+      apply(second, second, top, mask, uniform, lanes,
+            [](double a, double b) { return a < b ? 1.0 : 0.0; });
+      break;
+    case OP_EQUAL:
+      if (site.top != site.second) {
+        // A number never equals a boolean.
+        apply(second, second, top, mask, uniform, lanes,
+              [](double, double) { return 0.0; });
+      } else {
+        apply(second, second, top, mask, uniform, lanes,
+              [](double a, double b) { return a == b ? 1.0 : 0.0; });
+      }
+      break;
+    case OP_NOT:
+      if (site.top == Kind::NUMBER) {
+        // Numbers are always truthy.
+        apply(top, top, top, mask, uniform, lanes,
+              [](double, double) { return 0.0; });
+      } else {
+        apply(top, top, top, mask, uniform, lanes,
+              [](double a, double) { return a == 0 ? 1.0 : 0.0; });
+      }
+      break;
+    case OP_NEGATE:
+      apply(top, top, top, mask, uniform, lanes,
+            [](double a, double) { return -a; });
+      break;
+    case OP_JUMP:
+      next = pc + 3 + readShort(code, pc + 1);
+      break;
+    case OP_LOOP:
+      next = pc + 3 - readShort(code, pc + 1);
+      break;
+    case OP_JUMP_IF_FALSE: {
+      const uint32_t target = pc + 3 + readShort(code, pc + 1);
+      const bool test = site.top == Kind::BOOL;
+      for (size_t i = 0; i < lanes; i++) {
+        if (mask[i]) {
+          pcs[i] = test && top[i] == 0 ? target : pc + 3;
+        }
+      }
+      continue;
+    }
+    case OP_RETURN:
+      for (size_t i = 0; i < lanes; i++) {
+        if (mask[i]) {
+          results[i] = top[i];
+          pcs[i] = DONE;
+        }
+      }
+      continue;
+    }
+
+    if (uniform) {
+      std::fill_n(pcs, lanes, next);
+    } else {
+      for (size_t i = 0; i < lanes; i++) {
+        pcs[i] = mask[i] ? next : pcs[i];
+      }
+    }
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "function.hpp"
+#include "value.hpp"
+#include <cstddef>
+#include <string>
+
+// The compiler never frees the functions it returns. Benchmarks that compile
+// in a loop release them here so the heap doesn't grow without bound.
+inline void releaseFunction(const Function *function) {
+    for (const Value &constant : function->chunk->getConstants().getValues()) {
+        if (constant.isFunction()) {
+            releaseFunction(constant.asObj()->as<Function>());
+        }
+    }
+    delete function->chunk;
+    delete function;
+}
+
+// A synthetic program of `functions` functions with about 25 lines each,
+// for measuring the front end on large inputs. Never meant to be run.
+inline std::string largeSource(size_t functions) {
+    std::string source;
+    for (size_t i = 0; i < functions; i++) {
+        const std::string n = std::to_string(i);
+        source += "fun f" + n + "(a, b) {\n";
+        for (size_t j = 0; j < 16; j++) {
+            const std::string k = std::to_string(j);
+            source += "  var x" + k + " = a * " + k + " + b - " + n + ";\n";
+        }
+        source += "  var s = \"string \" + \"f" + n + "\";\n"
+                  "  if (x0 < x1 and x2 >= x3) { x0 = x1; } else { x1 = x0; }\n"
+                  "  while (x0 > 0) x0 = x0 - 1;\n"
+                  "  for (var i = 0; i < 10; i = i + 1) x2 = x2 + i;\n"
+                  "  fun inner(c) { return c + a; }\n"
+                  "  return inner(x0 + x1 + x2) / 2;\n"
+                  "}\n";
+    }
+    return source;
+}
@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+#include "channel.hpp"
+#include "vm.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Numbers passed through a 1024-slot channel by state.range(0) producer and
+// as many consumer threads, including parking whenever one side outruns
+// the other.
+static void BM_ChannelThroughput(benchmark::State &state) {
+    constexpr int64_t MESSAGES = 1 << 16;
+    const int pairs = static_cast<int>(state.range(0));
+    for (auto _ : state) {
+        Channel channel{1024};
+        std::vector<std::thread> threads;
+        for (int i = 0; i < pairs; i++) {
+            threads.emplace_back([&] {
+                Message message;
+                while (channel.receive(message)) {
+                    benchmark::DoNotOptimize(message.value);
+                }
+            });
+        }
+        std::vector<std::thread> producers;
+        for (int i = 0; i < pairs; i++) {
+            producers.emplace_back([&] {
+                for (int64_t n = 0; n < MESSAGES / pairs; n++) {
+                    Message message;
+                    message.value = Value{static_cast<double>(n)};
+                    channel.send(message);
+                }
+            });
+        }
+        for (std::thread &producer : producers) {
+            producer.join();
+        }
+        channel.close();
+        for (std::thread &consumer : threads) {
+            consumer.join();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * MESSAGES);
+}
+BENCHMARK(BM_ChannelThroughput)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+
+// A producer script and a consumer script on their own VMs and threads,
+// passing small arrays, which are copied on the way.
+static void BM_ChannelScripts(benchmark::State &state) {
+    constexpr int MESSAGES = 10000;
+    const std::string producer =
+        "fun produce(ch, n) {\n"
+        "  for (var i = 0; i < n; i = i + 1) send(ch, [i, i + 1]);\n"
+        "  close(ch);\n"
+        "}\n";
+    const std::string consumer =
+        "fun consume(ch) {\n"
+        "  var total = 0;\n"
+        "  for (var v = receive(ch); v != nil; v = receive(ch))\n"
+        "    total = total + v[1];\n"
+        "  return total;\n"
+        "}\n";
+    for (auto _ : state) {
+        const auto channel = std::make_shared<Channel>(256);
+        std::thread sending([&] {
+            VM vm{};
+            if (vm.interpret(producer) == INTERPRET_OK) {
+                (void)vm.call(*vm.function("produce"), vm.channel(channel),
+                              MESSAGES);
+            }
+        });
+        VM vm{};
+        if (vm.interpret(consumer) != INTERPRET_OK ||
+            !vm.call(*vm.function("consume"), vm.channel(channel))
+                 .has_value()) {
+            state.SkipWithError("Script failed");
+        }
+        sending.join();
+    }
+    state.SetItemsProcessed(state.iterations() * MESSAGES);
+}
+BENCHMARK(BM_ChannelScripts)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,44 @@
+#include <benchmark/benchmark.h>
+#include "code_image.hpp"
+#include "vm.hpp"
+#include <memory>
+#include <sstream>
+#include <string>
+
+static const std::string SOURCE =
+    "class P { init(x) { this.x = x; } }\n"
+    "fun f(n) { return P(n).x * 2 + 1; }\n"
+    "var s = 0;\n"
+    "for (var i = 0; i < 20; i = i + 1) s = s + f(i);\n"
+    "print s;\n";
+
+// Starting an isolate for a script and running it once, compiling the
+// source in every VM.
+static void BM_IsolateFromSource(benchmark::State &state) {
+    std::ostringstream out;
+    for (auto _ : state) {
+        const std::unique_ptr<VM> vm = std::make_unique<VM>();
+        vm->setOutput(out);
+        if (vm->interpret(SOURCE) != INTERPRET_OK) {
+            state.SkipWithError("Script failed");
+        }
+        out.str({});
+    }
+}
+BENCHMARK(BM_IsolateFromSource);
+
+// The same with every VM made for one shared CodeImage, which only leaves
+// the VM's own stacks, heap and caches to set up.
+static void BM_IsolateFromImage(benchmark::State &state) {
+    const std::shared_ptr<const CodeImage> image = CodeImage::compile(SOURCE);
+    std::ostringstream out;
+    for (auto _ : state) {
+        const std::unique_ptr<VM> vm = std::make_unique<VM>(image);
+        vm->setOutput(out);
+        if (!vm->call(*vm->script()).has_value()) {
+            state.SkipWithError("Script failed");
+        }
+        out.str({});
+    }
+}
+BENCHMARK(BM_IsolateFromImage);
@@ -0,0 +1,24 @@
+#include <benchmark/benchmark.h>
+#include "bench.hpp"
+#include "compiler.hpp"
+#include "function.hpp"
+#include "string_intern.hpp"
+#include <optional>
+#include <string>
+
+static void BM_CompilerLargeSource(benchmark::State &state) {
+    const std::string source = largeSource(state.range(0));
+    StringIntern intern;
+    Compiler compiler{intern};
+    for (auto _ : state) {
+        const std::optional<const Function *> function =
+            compiler.compile(source);
+        if (!function.has_value()) {
+            state.SkipWithError("Large source failed to compile");
+            break;
+        }
+        releaseFunction(function.value());
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_CompilerLargeSource)->Arg(10)->Arg(100);
@@ -0,0 +1,82 @@
+#include <benchmark/benchmark.h>
+#include "bench.hpp"
+#include "compiler.hpp"
+#include "string_intern.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <vector>
+
+// End-to-end benchmarks: every bench/corpus/*.mehh script is registered
+// twice, as corpus/<name> (compile and run on a fresh VM) and as
+// compile/<name> (compile only). MEHH_BENCH_CORPUS overrides the directory.
+
+static void runScript(benchmark::State &state, const std::string &source) {
+    // Scripts print their results; keep them out of the report.
+    std::streambuf *out = std::cout.rdbuf(nullptr);
+    for (auto _ : state) {
+        VM vm{};
+        if (vm.interpret(source) != INTERPRET_OK) {
+            state.SkipWithError("Script failed");
+            break;
+        }
+    }
+    std::cout.rdbuf(out);
+    std::cout.clear();
+}
+
+static void compileScript(benchmark::State &state, const std::string &source) {
+    StringIntern intern;
+    Compiler compiler{intern};
+    for (auto _ : state) {
+        const std::optional<const Function *> function =
+            compiler.compile(source);
+        if (!function.has_value()) {
+            state.SkipWithError("Script failed to compile");
+            break;
+        }
+        releaseFunction(function.value());
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+
+static bool registerCorpus() {
+    const char *override = std::getenv("MEHH_BENCH_CORPUS");
+    const std::filesystem::path dir{override != nullptr ? override
+                                                        : MEHH_BENCH_CORPUS};
+    std::error_code error;
+    std::vector<std::filesystem::path> scripts;
+    for (const auto &entry : std::filesystem::directory_iterator{dir, error}) {
+        if (entry.path().extension() == ".mehh") {
+            scripts.push_back(entry.path());
+        }
+    }
+    if (error) {
+        std::cerr << "Could not read benchmark corpus " << dir << ": "
+                  << error.message() << '\n';
+        return false;
+    }
+    std::sort(scripts.begin(), scripts.end());
+
+    for (const std::filesystem::path &path : scripts) {
+        std::ifstream file{path};
+        const std::string source((std::istreambuf_iterator<char>(file)),
+                                 std::istreambuf_iterator<char>());
+        const std::string name = path.stem().string();
+        benchmark::RegisterBenchmark(("corpus/" + name).c_str(), runScript,
+                                     source)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("compile/" + name).c_str(),
+                                     compileScript, source)
+            ->Unit(benchmark::kMicrosecond);
+    }
+    return true;
+}
+
+[[maybe_unused]] static const bool corpusRegistered = registerCorpus();
@@ -0,0 +1,58 @@
+#include <benchmark/benchmark.h>
+#include "vm.hpp"
+#include <optional>
+#include <string>
+
+// The cost of calling into a script from C++: through a handle, which
+// re-enters the interpreter directly, against interpreting a call
+// expression, which recompiles it every time.
+
+static const char *const ADD = "fun add(a, b) { return a + b; }";
+
+static std::optional<Handle> loadAdd(VM &vm) {
+    const std::optional<Handle> script = vm.load(ADD);
+    if (!script.has_value() || !vm.call(*script).has_value()) {
+        return std::nullopt;
+    }
+    return vm.function("add");
+}
+
+static void BM_HostCallHandle(benchmark::State &state) {
+    VM vm{};
+    const std::optional<Handle> add = loadAdd(vm);
+    if (!add.has_value()) {
+        state.SkipWithError("Script failed");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(vm.call(*add, 1.0, 2.0));
+    }
+}
+BENCHMARK(BM_HostCallHandle);
+
+// A native behind a handle: the call path without any bytecode.
+static void BM_HostCallNative(benchmark::State &state) {
+    VM vm{};
+    const Handle abs = vm.function("abs").value();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(vm.call(abs, -1.0));
+    }
+}
+BENCHMARK(BM_HostCallNative);
+
+static void BM_HostCallInterpret(benchmark::State &state) {
+    VM vm{};
+    if (!loadAdd(vm).has_value()) {
+        state.SkipWithError("Script failed");
+        return;
+    }
+    // The result goes to a global, since interpret() has no return value.
+    const std::string call = "var sum = add(1, 2);";
+    for (auto _ : state) {
+        if (vm.interpret(call) != INTERPRET_OK) {
+            state.SkipWithError("Script failed");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_HostCallInterpret);
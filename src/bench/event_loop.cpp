@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+#include "event_loop.hpp"
+#include "vm.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+constexpr int FILES = 64;
+
+// FILES files of 64KB in a directory of their own.
+const std::filesystem::path &corpus() {
+    static const std::filesystem::path dir = [] {
+        const std::filesystem::path dir =
+            std::filesystem::temp_directory_path() /
+            ("mehh_bench_io_" + std::to_string(getpid()));
+        std::filesystem::create_directories(dir);
+        const std::string contents(64 << 10, 'x');
+        for (int i = 0; i < FILES; i++) {
+            std::ofstream{dir / std::to_string(i)} << contents;
+        }
+        return dir;
+    }();
+    return dir;
+}
+
+} // namespace
+
+// Every file read through the event loop with all reads in flight at once;
+// state.range(0) picks the backend.
+static void BM_EventLoopReads(benchmark::State &state) {
+    EventLoop loop{static_cast<EventLoop::Backend>(state.range(0))};
+    state.SetLabel(std::string{loop.backendName()});
+    const std::filesystem::path &dir = corpus();
+    for (auto _ : state) {
+        for (int i = 0; i < FILES; i++) {
+            loop.read((dir / std::to_string(i)).string(), nullptr);
+        }
+        while (loop.pending() > 0) {
+            benchmark::DoNotOptimize(loop.reap(true).size());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * FILES);
+}
+BENCHMARK(BM_EventLoopReads)
+    ->Arg(static_cast<int64_t>(EventLoop::Backend::IO_URING))
+    ->Arg(static_cast<int64_t>(EventLoop::Backend::THREADS));
+
+// Every file read by a script, one fiber per file awaiting its read, against
+// awaiting each read before starting the next.
+static void BM_AwaitReads(benchmark::State &state) {
+    const bool concurrent = state.range(0) != 0;
+    VM vm{};
+    std::ostringstream out;
+    vm.setOutput(out);
+    std::string names = "[";
+    for (int i = 0; i < FILES; i++) {
+        names += (i > 0 ? ", \"" : "\"") + std::to_string(i) + "\"";
+    }
+    names += "]";
+    const std::string source =
+        "var dir = \"" + (corpus() / "").string() + "\";\n"
+        "var names = " + names + ";\n"
+        "fun load(name) { return await(readFileAsync(dir + name)); }\n" +
+        (concurrent ? "var fibers = [];\n"
+                      "for (var name in names) push(fibers, spawn(load, name));\n"
+                      "for (var f in fibers) join(f);\n"
+                    : "for (var name in names) load(name);\n");
+    for (auto _ : state) {
+        if (vm.interpret(source) != INTERPRET_OK) {
+            state.SkipWithError("script failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * FILES);
+}
+BENCHMARK(BM_AwaitReads)->Arg(0)->Arg(1);
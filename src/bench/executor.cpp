@@ -0,0 +1,38 @@
+#include <benchmark/benchmark.h>
+#include "executor.hpp"
+#include <cstddef>
+#include <future>
+#include <string>
+#include <vector>
+
+// Independent scripts per second on an executor with state.range(0)
+// workers. Each iteration runs a batch of small scripts, every one on a
+// fresh VM; items/s should grow with the number of workers up to the
+// number of cores.
+static void BM_ExecutorThroughput(benchmark::State &state) {
+    constexpr size_t BATCH = 256;
+    Executor executor{static_cast<size_t>(state.range(0))};
+    const std::string source = "fun f(n) { return n * 2 + 1; }\n"
+                               "var s = 0;\n"
+                               "for (var i = 0; i < 200; i = i + 1) s = s + f(i);\n"
+                               "print s;\n";
+    std::vector<std::future<Executor::Result>> results;
+    results.reserve(BATCH);
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; i++) {
+            results.push_back(executor.run(source));
+        }
+        for (std::future<Executor::Result> &result : results) {
+            if (result.get().status != INTERPRET_OK) {
+                state.SkipWithError("Script failed");
+            }
+        }
+        results.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+BENCHMARK(BM_ExecutorThroughput)
+    ->RangeMultiplier(2)
+    ->Range(1, 16)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
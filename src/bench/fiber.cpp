@@ -0,0 +1,46 @@
+#include <benchmark/benchmark.h>
+#include "vm.hpp"
+#include <sstream>
+#include <string>
+
+// Two fibers handing control back and forth with yield(); one item is one
+// switch.
+static void BM_FiberSwitch(benchmark::State &state) {
+    constexpr int SWITCHES = 20000;
+    VM vm{};
+    std::ostringstream out;
+    vm.setOutput(out);
+    vm.enableJit(false);
+    const std::string source =
+        "fun ping(n) { for (var i = 0; i < n; i = i + 1) yield(); }\n"
+        "spawn(ping, " + std::to_string(SWITCHES / 2) + ");\n"
+        "ping(" + std::to_string(SWITCHES / 2) + ");\n";
+    for (auto _ : state) {
+        if (vm.interpret(source) != INTERPRET_OK) {
+            state.SkipWithError("script failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * SWITCHES);
+}
+BENCHMARK(BM_FiberSwitch);
+
+// Spawning a fiber and joining it straight away.
+static void BM_FiberSpawnJoin(benchmark::State &state) {
+    constexpr int FIBERS = 1000;
+    VM vm{};
+    std::ostringstream out;
+    vm.setOutput(out);
+    const std::string source =
+        "fun id(x) { return x; }\n"
+        "for (var i = 0; i < " + std::to_string(FIBERS) + "; i = i + 1) "
+        "join(spawn(id, i));\n";
+    for (auto _ : state) {
+        if (vm.interpret(source) != INTERPRET_OK) {
+            state.SkipWithError("script failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * FIBERS);
+}
+BENCHMARK(BM_FiberSpawnJoin);
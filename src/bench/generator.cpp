@@ -0,0 +1,44 @@
+#include <benchmark/benchmark.h>
+#include "vm.hpp"
+#include <sstream>
+#include <string>
+
+namespace {
+
+constexpr int ELEMENTS = 10000;
+
+void runScript(benchmark::State &state, const std::string &source) {
+    VM vm{};
+    std::ostringstream out;
+    vm.setOutput(out);
+    // Traces inline the plain call but not a generator's frame; compare the
+    // interpreter's cost of each.
+    vm.enableJit(false);
+    for (auto _ : state) {
+        if (vm.interpret(source) != INTERPRET_OK) {
+            state.SkipWithError("script failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * ELEMENTS);
+}
+
+} // namespace
+
+// Summing a range produced by a generator, one resume per element.
+static void BM_GeneratorIterate(benchmark::State &state) {
+    runScript(state, "fun* range(n) { for (var i = 0; i < n; i = i + 1) yield i; }\n"
+                     "var total = 0;\n"
+                     "for (var x in range(" + std::to_string(ELEMENTS) + ")) "
+                     "total = total + x;\n");
+}
+BENCHMARK(BM_GeneratorIterate);
+
+// The same sum with a plain function call per element, for comparison.
+static void BM_GeneratorBaselineCall(benchmark::State &state) {
+    runScript(state, "fun id(i) { return i; }\n"
+                     "var total = 0;\n"
+                     "for (var i = 0; i < " + std::to_string(ELEMENTS) + "; "
+                     "i = i + 1) total = total + id(i);\n");
+}
+BENCHMARK(BM_GeneratorBaselineCall);
@@ -0,0 +1,187 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fmt/core.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// mehh_bench runs the microbenchmarks and the script corpus, then prints the
+// median and p95 wall time of every benchmark over its repetitions next to
+// a stored baseline:
+//
+//   mehh_bench --benchmark_repetitions=10 --baseline=bench/baseline.txt
+//   mehh_bench --benchmark_repetitions=10 --save-baseline=bench/baseline.txt
+//
+// Any other flag is passed on to Google Benchmark.
+
+namespace {
+
+struct Summary {
+    double median;
+    double p95;
+};
+
+// Nearest-rank percentile of `times`, which must not be empty.
+double percentile(std::vector<double> times, double p) {
+    std::sort(times.begin(), times.end());
+    const size_t rank = static_cast<size_t>(std::ceil(p * times.size()));
+    return times[std::max<size_t>(rank, 1) - 1];
+}
+
+double toNanoseconds(double time, benchmark::TimeUnit unit) {
+    switch (unit) {
+    case benchmark::kSecond:
+        return time * 1e9;
+    case benchmark::kMillisecond:
+        return time * 1e6;
+    case benchmark::kMicrosecond:
+        return time * 1e3;
+    default:
+        return time;
+    }
+}
+
+// Collects the wall time of each repetition, in nanoseconds, while the
+// console reporter prints as usual.
+class BaselineReporter : public benchmark::ConsoleReporter {
+public:
+    void ReportRuns(const std::vector<Run> &runs) override {
+        for (const Run &run : runs) {
+            if (run.run_type != Run::RT_Iteration || run.error_occurred) {
+                continue;
+            }
+            const std::string name = run.benchmark_name();
+            if (!times.contains(name)) {
+                order.push_back(name);
+            }
+            times[name].push_back(
+                toNanoseconds(run.GetAdjustedRealTime(), run.time_unit));
+        }
+        ConsoleReporter::ReportRuns(runs);
+    }
+
+    [[nodiscard]] std::vector<std::pair<std::string, Summary>>
+    summaries() const {
+        std::vector<std::pair<std::string, Summary>> result;
+        for (const std::string &name : order) {
+            const std::vector<double> &samples = times.at(name);
+            result.emplace_back(name, Summary{percentile(samples, 0.5),
+                                              percentile(samples, 0.95)});
+        }
+        return result;
+    }
+
+private:
+    std::vector<std::string> order;
+    std::map<std::string, std::vector<double>> times;
+};
+
+std::string formatTime(double ns) {
+    if (ns >= 1e6) {
+        return fmt::format("{:.2f} ms", ns / 1e6);
+    }
+    if (ns >= 1e3) {
+        return fmt::format("{:.2f} us", ns / 1e3);
+    }
+    return fmt::format("{:.1f} ns", ns);
+}
+
+// Baseline files hold one `name median_ns p95_ns` line per benchmark, after
+// `#` comment lines noting what the numbers were recorded against.
+std::map<std::string, Summary> readBaseline(const std::string &path) {
+    std::map<std::string, Summary> baseline;
+    std::ifstream file{path};
+    if (!file.is_open()) {
+        std::cerr << "No baseline at " << path << "\n";
+        return baseline;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.starts_with('#')) {
+            continue;
+        }
+        std::istringstream fields{line};
+        std::string name;
+        Summary summary{};
+        if (fields >> name >> summary.median >> summary.p95) {
+            baseline[name] = summary;
+        }
+    }
+    return baseline;
+}
+
+void writeBaseline(const std::string &path,
+                   const std::vector<std::pair<std::string, Summary>> &runs) {
+    std::ofstream file{path};
+    if (!file.is_open()) {
+        std::cerr << "Could not write baseline: " << path << "\n";
+        return;
+    }
+    for (const auto &[name, summary] : runs) {
+        file << fmt::format("{} {:.1f} {:.1f}\n", name, summary.median,
+                            summary.p95);
+    }
+    std::cerr << "Baseline written to " << path << "\n";
+}
+
+void compare(const std::vector<std::pair<std::string, Summary>> &runs,
+             const std::map<std::string, Summary> &baseline) {
+    std::cout << fmt::format("\n{:<40} {:>12} {:>12} {:>12} {:>8}\n",
+                             "benchmark", "median", "p95", "baseline",
+                             "change");
+    for (const auto &[name, summary] : runs) {
+        const auto old = baseline.find(name);
+        std::string before = "-";
+        std::string change = "-";
+        if (old != baseline.end()) {
+            before = formatTime(old->second.median);
+            change = fmt::format(
+                "{:+.1f}%",
+                100.0 * (summary.median / old->second.median - 1.0));
+        }
+        std::cout << fmt::format("{:<40} {:>12} {:>12} {:>12} {:>8}\n", name,
+                                 formatTime(summary.median),
+                                 formatTime(summary.p95), before, change);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string baselinePath;
+    std::string savePath;
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg{argv[i]};
+        if (arg.starts_with("--baseline=")) {
+            baselinePath = arg.substr(arg.find('=') + 1);
+        } else if (arg.starts_with("--save-baseline=")) {
+            savePath = arg.substr(arg.find('=') + 1);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    BaselineReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+
+    const auto runs = reporter.summaries();
+    if (!savePath.empty()) {
+        writeBaseline(savePath, runs);
+    }
+    compare(runs, baselinePath.empty() ? std::map<std::string, Summary>{}
+                                       : readBaseline(baselinePath));
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <benchmark/benchmark.h>
+#include "mapped_file.hpp"
+#include "vm.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+constexpr int64_t LINES = 1 << 18;
+
+// LINES lines of 64 bytes, each one different.
+const std::string &logFile() {
+    static const std::string path = [] {
+        const std::string path =
+            (std::filesystem::temp_directory_path() /
+             ("mehh_bench_lines_" + std::to_string(getpid())))
+                .string();
+        std::ofstream out{path, std::ios::binary};
+        for (int64_t i = 0; i < LINES; i++) {
+            const std::string number = std::to_string(i);
+            out << number << std::string(63 - number.size(), '.') << '\n';
+        }
+        return path;
+    }();
+    return path;
+}
+
+} // namespace
+
+// Mapping the file, as readFile() and mehh do, against copying it through
+// istreambuf_iterator.
+static void BM_MapFile(benchmark::State &state) {
+    const std::string &path = logFile();
+    for (auto _ : state) {
+        const std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+        benchmark::DoNotOptimize(file->contents().data());
+    }
+    state.SetBytesProcessed(state.iterations() * LINES * 64);
+}
+BENCHMARK(BM_MapFile);
+
+static void BM_CopyFile(benchmark::State &state) {
+    const std::string &path = logFile();
+    for (auto _ : state) {
+        std::ifstream file{path};
+        const std::string contents((std::istreambuf_iterator<char>(file)),
+                                   std::istreambuf_iterator<char>());
+        benchmark::DoNotOptimize(contents.data());
+    }
+    state.SetBytesProcessed(state.iterations() * LINES * 64);
+}
+BENCHMARK(BM_CopyFile);
+
+// A script counting the lines of the file; one item is one line.
+static void BM_Lines(benchmark::State &state) {
+    VM vm{};
+    std::ostringstream out;
+    vm.setOutput(out);
+    const std::string source = "var count = 0;\n"
+                               "for (var line in lines(\"" + logFile() +
+                               "\")) count = count + 1;\n";
+    for (auto _ : state) {
+        if (vm.interpret(source) != INTERPRET_OK) {
+            state.SkipWithError("script failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * LINES);
+}
+BENCHMARK(BM_Lines);
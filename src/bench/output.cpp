@@ -0,0 +1,27 @@
+#include <benchmark/benchmark.h>
+#include "vm.hpp"
+#include <fstream>
+#include <string>
+
+// A script printing numbers and strings to /dev/null; one item is one
+// print statement.
+static void BM_Print(benchmark::State &state) {
+    constexpr int PRINTS = 20000;
+    VM vm{};
+    std::ofstream out{"/dev/null"};
+    vm.setOutput(out);
+    const std::string source =
+        "for (var i = 0; i < " + std::to_string(PRINTS / 2) +
+        "; i = i + 1) {\n"
+        "  print i / 7;\n"
+        "  print \"line\";\n"
+        "}\n";
+    for (auto _ : state) {
+        if (vm.interpret(source) != INTERPRET_OK) {
+            state.SkipWithError("script failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * PRINTS);
+}
+BENCHMARK(BM_Print);
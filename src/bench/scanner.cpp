@@ -0,0 +1,24 @@
+#include <benchmark/benchmark.h>
+#include "bench.hpp"
+#include "scanner.hpp"
+#include "token.hpp"
+#include <cstddef>
+#include <string>
+
+static void BM_ScannerLargeSource(benchmark::State &state) {
+    const std::string source = largeSource(state.range(0));
+    size_t tokens = 0;
+    for (auto _ : state) {
+        Scanner scanner;
+        scanner.init(source);
+        for (Token token = scanner.scanToken();
+             token.type != TokenType::END_OF_FILE;
+             token = scanner.scanToken()) {
+            tokens++;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["tokens"] = benchmark::Counter(
+        static_cast<double>(tokens), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ScannerLargeSource)->Arg(100);
@@ -0,0 +1,42 @@
+#include <benchmark/benchmark.h>
+#include "string_intern.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+static std::vector<std::string> identifiers(size_t count) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < count; i++) {
+        names.push_back("identifier" + std::to_string(i));
+    }
+    return names;
+}
+
+// Looking up strings that are already interned, e.g. identifiers seen again
+// while compiling.
+static void BM_StringInternHit(benchmark::State &state) {
+    StringIntern intern;
+    const std::vector<std::string> names = identifiers(state.range(0));
+    for (const std::string &name : names) {
+        intern.intern(name);
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(intern.intern(names[i]));
+        i = i + 1 == names.size() ? 0 : i + 1;
+    }
+}
+BENCHMARK(BM_StringInternHit)->Arg(16)->Arg(4096);
+
+// Interning fresh strings, e.g. the results of concatenation.
+static void BM_StringInternMiss(benchmark::State &state) {
+    const std::vector<std::string> names = identifiers(state.range(0));
+    for (auto _ : state) {
+        StringIntern intern;
+        for (const std::string &name : names) {
+            benchmark::DoNotOptimize(intern.intern(name));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(BM_StringInternMiss)->Arg(4096);
@@ -0,0 +1,72 @@
+#include <benchmark/benchmark.h>
+#include "value.hpp"
+#include <cstddef>
+#include <vector>
+
+static void BM_ValueBoxNumber(benchmark::State &state) {
+    double x = 0;
+    for (auto _ : state) {
+        Value value{x};
+        benchmark::DoNotOptimize(value);
+        x = value.asNumber() + 1;
+    }
+}
+BENCHMARK(BM_ValueBoxNumber);
+
+static void BM_ValueBoxObj(benchmark::State &state) {
+    StringObj string{"boxed"};
+    for (auto _ : state) {
+        Value value{static_cast<Obj *>(&string)};
+        benchmark::DoNotOptimize(value);
+        benchmark::DoNotOptimize(value.asObj());
+    }
+}
+BENCHMARK(BM_ValueBoxObj);
+
+// Classifies a mix of numbers, booleans, nil and strings, as the VM does
+// for every operand.
+static void BM_ValueGetType(benchmark::State &state) {
+    StringObj string{"mixed"};
+    std::vector<Value> values;
+    for (size_t i = 0; i < 1024; i++) {
+        switch (i % 4) {
+        case 0:
+            values.emplace_back(static_cast<double>(i));
+            break;
+        case 1:
+            values.emplace_back(i % 8 == 1);
+            break;
+        case 2:
+            values.emplace_back();
+            break;
+        default:
+            values.emplace_back(static_cast<Obj *>(&string));
+            break;
+        }
+    }
+    for (auto _ : state) {
+        size_t strings = 0;
+        for (const Value &value : values) {
+            strings += value.getType() == ValueType::STRING;
+        }
+        benchmark::DoNotOptimize(strings);
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK(BM_ValueGetType);
+
+static void BM_ValueIsNumber(benchmark::State &state) {
+    std::vector<Value> values;
+    for (size_t i = 0; i < 1024; i++) {
+        values.emplace_back(static_cast<double>(i));
+    }
+    for (auto _ : state) {
+        size_t numbers = 0;
+        for (const Value &value : values) {
+            numbers += value.isNumber();
+        }
+        benchmark::DoNotOptimize(numbers);
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK(BM_ValueIsNumber);
@@ -0,0 +1,144 @@
+#include "channel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+Channel::Channel(size_t capacity, std::shared_ptr<const CodeImage> image)
+    : image_{std::move(image)},
+      mask{std::bit_ceil(std::max<size_t>(capacity, 2)) - 1},
+      cells{std::make_unique<Cell[]>(mask + 1)} {
+  for (size_t i = 0; i <= mask; i++) {
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool Channel::trySend(Message &message) {
+  size_t position = sendPosition.load(std::memory_order_relaxed);
+  for (;;) {
+    // Set by close(), so no cell is claimed after it.
+    if (position & CLOSED) {
+      return false;
+    }
+    Cell &cell = cells[position & mask];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const auto lag = static_cast<intptr_t>(sequence - position);
+    if (lag == 0) {
+      if (sendPosition.compare_exchange_weak(position, position + 1,
+                                             std::memory_order_relaxed)) {
+        cell.message = std::move(message);
+        cell.sequence.store(position + 1, std::memory_order_release);
+        wake(sends, receiveWaiters);
+        return true;
+      }
+    } else if (lag < 0) {
+      // The cell still holds the message from a lap ago.
+      return false;
+    } else {
+      position = sendPosition.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool Channel::tryReceive(Message &message) {
+  size_t position = receivePosition.load(std::memory_order_relaxed);
+  for (;;) {
+    Cell &cell = cells[position & mask];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const auto lag = static_cast<intptr_t>(sequence - (position + 1));
+    if (lag == 0) {
+      if (receivePosition.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+        message = std::move(cell.message);
+        cell.sequence.store(position + mask + 1, std::memory_order_release);
+        wake(receives, sendWaiters);
+        return true;
+      }
+    } else if (lag < 0) {
+      // Not filled yet.
+      return false;
+    } else {
+      position = receivePosition.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool Channel::send(Message &message) {
+  for (int attempt = 0;; attempt++) {
+    // Read before trying, so a receive in between makes park() return.
+    const uint32_t seen = receives.load();
+    if (trySend(message)) {
+      return true;
+    }
+    if (closed()) {
+      return false;
+    }
+    if (attempt < SPINS) {
+      std::this_thread::yield();
+    } else {
+      park(receives, sendWaiters, seen);
+    }
+  }
+}
+
+bool Channel::receive(Message &message) {
+  for (int attempt = 0;; attempt++) {
+    const uint32_t seen = sends.load();
+    if (tryReceive(message)) {
+      return true;
+    }
+    if (closed()) {
+      return drain(message);
+    }
+    if (attempt < SPINS) {
+      std::this_thread::yield();
+    } else {
+      park(sends, receiveWaiters, seen);
+    }
+  }
+}
+
+bool Channel::drain(Message &message) {
+  // Sends that claimed a cell before close() still fill it; wait for those
+  // rather than lose their messages.
+  const size_t end = sendPosition.load(std::memory_order_acquire) & ~CLOSED;
+  while (receivePosition.load(std::memory_order_relaxed) < end) {
+    if (tryReceive(message)) {
+      return true;
+    }
+    std::this_thread::yield();
+  }
+  return false;
+}
+
+void Channel::close() {
+  sendPosition.fetch_or(CLOSED, std::memory_order_acq_rel);
+  isClosed.store(true, std::memory_order_release);
+  sends.fetch_add(1);
+  receives.fetch_add(1);
+  sends.notify_all();
+  receives.notify_all();
+}
+
+void Channel::park(std::atomic<uint32_t> &counter,
+                   std::atomic<uint32_t> &waiters, uint32_t seen) {
+  // Registered before the last look at the counter, so a wake() that
+  // misses us has already moved it on and the wait returns at once.
+  waiters.fetch_add(1);
+  if (!closed()) {
+    counter.wait(seen);
+  }
+  waiters.fetch_sub(1);
+}
+
+void Channel::wake(std::atomic<uint32_t> &counter,
+                   std::atomic<uint32_t> &waiters) {
+  counter.fetch_add(1);
+  if (waiters.load() != 0) {
+    counter.notify_one();
+  }
+}
@@ -22,10 +22,12 @@ size_t Chunk::writeConstant(const Value &value) noexcept {
   return constants.write(value);
 }
 
+size_t Chunk::addCache() noexcept { return caches++; }
+
 // TODO: Debug
 const std::vector<Line> &Chunk::getLines() const noexcept { return lines; }
 
-const uint8_t Chunk::getLine(size_t offset) const noexcept {
+const size_t Chunk::getLine(size_t offset) const noexcept {
   int i = 0;
   int count = 0;
   if (lines.empty()) {
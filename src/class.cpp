@@ -0,0 +1,31 @@
+#include "class.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <cstdint>
+#include <memory>
+
+uint32_t Shape::lookup(const StringObj *name) const {
+  const auto it = slots.find(name);
+  if (it == slots.end()) {
+    return NOT_FOUND;
+  }
+  return it->second;
+}
+
+Shape *Shape::transition(const StringObj *name) {
+  auto &next = transitions[name];
+  if (next == nullptr) {
+    next = std::make_unique<Shape>();
+    next->slots = slots;
+    next->slots.emplace(name, slotCount());
+  }
+  return next.get();
+}
+
+const Closure *ClassObj::findMethod(const StringObj *name) const {
+  const auto it = methods.find(name);
+  if (it == methods.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
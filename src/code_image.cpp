@@ -0,0 +1,42 @@
+#include "code_image.hpp"
+#include "compiler.hpp"
+#include "value.hpp"
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string_view>
+
+namespace {
+
+// The compiler allocates functions and chunks without owning them; the image
+// does.
+void release(const Function *function) {
+  for (const Value &constant : function->chunk->getConstants().getValues()) {
+    if (constant.isFunction()) {
+      release(constant.asObj()->as<Function>());
+    }
+  }
+  delete function->chunk;
+  delete function;
+}
+
+} // namespace
+
+std::shared_ptr<const CodeImage> CodeImage::compile(std::string_view source,
+                                                    std::ostream &out) {
+  std::shared_ptr<CodeImage> image{new CodeImage{}};
+  Compiler compiler{image->strings_};
+  compiler.setOutput(out);
+  const std::optional<const Function *> script = compiler.compile(source);
+  if (!script.has_value()) {
+    return nullptr;
+  }
+  image->script_ = *script;
+  return image;
+}
+
+CodeImage::~CodeImage() {
+  if (script_ != nullptr) {
+    release(script_);
+  }
+}
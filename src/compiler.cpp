@@ -28,6 +28,8 @@ Compiler::compile(const std::string_view source) noexcept {
 
   FunctionCompiler global{FunctionType::TYPE_SCRIPT, nullptr, parser, scanner};
   current = &global;
+  recordAllocation(global.getFunction(), ValueType::FUNCTION,
+                   sizeof(Function) + sizeof(Chunk));
 
   parser.hadError = false;
   parser.panicMode = false;
@@ -107,16 +109,16 @@ void Compiler::errorAt(const Token &token,
     return;
   }
   parser.panicMode = true;
-  std::cout << "[line " << token.line << "] Error";
+  *out << "[line " << token.line << "] Error";
   if (token.type == TokenType::END_OF_FILE) {
-    std::cout << " at end";
+    *out << " at end";
   } else if (token.type == TokenType::ERROR) {
     // nothing
   } else {
-    std::cout << " at " << token.lexeme;
+    *out << " at " << token.lexeme;
   }
 
-  std::cout << ": " << message << '\n';
+  *out << ": " << message << '\n';
   parser.hadError = true;
 }
 
@@ -130,6 +132,10 @@ void Compiler::error(const std::string_view message) noexcept {
 
 void Compiler::endCompiler() noexcept {
   emitReturn();
+  // Locals still in scope are closed by OP_RETURN.
+  for (Local &local : current->locals) {
+    finalizeCaptures(local);
+  }
 #ifdef DEBUG_PRINT_CODE
   if (!parser.hadError) {
     disassembleChunk(currentChunk(), current->getFunction()->name.empty()
@@ -149,14 +155,33 @@ void Compiler::endScope() noexcept {
   current->scopeDepth--;
   while (!current->locals.empty() &&
          current->locals.back().depth > current->scopeDepth) {
-    emitByte(OP_POP);
+    Local &local = current->locals.back();
+    finalizeCaptures(local);
+    if (local.isCaptured && local.needsCell) {
+      emitByte(OP_CLOSE_UPVALUE);
+    } else {
+      emitByte(OP_POP);
+    }
     current->locals.pop_back();
   }
 }
 
+void Compiler::beginLoop() noexcept { current->loopDepth++; }
+
+void Compiler::endLoop() noexcept {
+  current->loopDepth--;
+  // Writes made inside the loop can no longer be observed by a capture that
+  // happens after it.
+  for (Local &local : current->locals) {
+    if (local.loopDepth == current->loopDepth) {
+      local.writtenInLoop = false;
+    }
+  }
+}
+
 void Compiler::addLocal(const Token &token) noexcept {
   // TODO: Enforce max depth.
-  current->locals.push_back({token, UINT8_MAX});
+  current->locals.push_back({token, UINT8_MAX, current->loopDepth});
 }
 
 size_t Compiler::addUpvalue(FunctionCompiler &compiler, const size_t index,
@@ -212,6 +237,35 @@ void Compiler::markInitialized() noexcept {
   current->locals.back().depth = current->scopeDepth;
 }
 
+void Compiler::markWritten(Local &local) noexcept {
+  if (local.isCaptured) {
+    local.needsCell = true;
+  }
+  if (current->loopDepth > local.loopDepth) {
+    local.writtenInLoop = true;
+  }
+}
+
+void Compiler::markUpvalueWritten(FunctionCompiler &compiler,
+                                  const size_t index) noexcept {
+  // Follow the upvalue chain to the local it originates from. Writes from
+  // another function always need a shared cell.
+  const Upvalue &upvalue = compiler.upvalues[index];
+  if (upvalue.isLocal) {
+    compiler.getEnclosing()->locals[upvalue.index].needsCell = true;
+  } else {
+    markUpvalueWritten(*compiler.getEnclosing(), upvalue.index);
+  }
+}
+
+void Compiler::finalizeCaptures(Local &local) noexcept {
+  const uint8_t capture = local.needsCell ? CAPTURE_LOCAL : CAPTURE_VALUE;
+  for (const size_t site : local.captureSites) {
+    currentChunk().code()[site] = capture;
+  }
+  local.captureSites.clear();
+}
+
 uint8_t Compiler::makeConstant(const Value &value) noexcept {
   size_t constant = currentChunk().writeConstant(value);
   if (constant > UINT8_MAX) {
@@ -231,8 +285,18 @@ void Compiler::emitBytes(uint8_t byte1, uint8_t byte2) noexcept {
 }
 
 void Compiler::emitReturn() noexcept {
-  emitByte(OpCode::OP_NIL);
-  emitByte(OpCode::OP_RETURN);
+  if (current->getType() == FunctionType::TYPE_INITIALIZER) {
+    emitBytes(OpCode::OP_GET_LOCAL, 0);
+  } else {
+    emitByte(OpCode::OP_NIL);
+  }
+  emitReturnOp();
+}
+
+void Compiler::emitReturnOp() noexcept {
+  emitByte(current->getType() == FunctionType::TYPE_GENERATOR
+               ? OpCode::OP_GENERATOR_RETURN
+               : OpCode::OP_RETURN);
 }
 
 void Compiler::emitConstant(const Value &value) noexcept {
@@ -257,6 +321,15 @@ void Compiler::emitLoop(const size_t loopStart) noexcept {
   emitByte(offset & 0xff);
 }
 
+void Compiler::emitCache() noexcept {
+  size_t cache = currentChunk().addCache();
+  if (cache > UINT16_MAX) {
+    error("Too many property accesses in one function.");
+  }
+  emitByte((cache >> 8) & 0xff);
+  emitByte(cache & 0xff);
+}
+
 void Compiler::parsePrecedence(const Precedence precedence) noexcept {
   advance();
   const ParseFn prefixRule = getRule(parser.previous.type).prefix;
@@ -291,8 +364,7 @@ Compiler::parseVariable(const std::string_view errorMessage) noexcept {
 }
 
 const uint8_t Compiler::identifierConstant(const Token &name) noexcept {
-  // TODO: This is wrong
-  const StringObj *const interned = stringIntern.intern(std::string{parser.previous.lexeme});
+  const StringObj *const interned = intern(std::string{name.lexeme});
   // TODO: This is wrong
   return makeConstant(Value{interned});
 }
@@ -340,6 +412,11 @@ void Compiler::namedVariable(const Token &name) noexcept {
   }
   if (canAssign && match(TokenType::EQUAL)) {
     expression();
+    if (setOp == OpCode::OP_SET_LOCAL) {
+      markWritten(current->locals[arg]);
+    } else if (setOp == OpCode::OP_SET_UPVALUE) {
+      markUpvalueWritten(*current, arg);
+    }
     emitBytes(setOp, arg);
   } else {
     emitBytes(getOp, arg);
@@ -358,7 +435,11 @@ void Compiler::patchJump(size_t offset) noexcept {
 
 void Compiler::createFunction(const FunctionType type) noexcept {
   FunctionCompiler compiler{type, current, parser, scanner};
+  // Charged to the function the declaration appears in.
+  recordAllocation(current->getFunction(), ValueType::FUNCTION,
+                   sizeof(Function) + sizeof(Chunk));
   current = &compiler;
+  compiler.function().generator = type == FunctionType::TYPE_GENERATOR;
   beginScope();
   consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
   if (!check(TokenType::RIGHT_PAREN)) {
@@ -378,8 +459,26 @@ void Compiler::createFunction(const FunctionType type) noexcept {
   endCompiler();
   emitBytes(OpCode::OP_CLOSURE, makeConstant(Value{compiler.getFunction()}));
   for (int i = 0; i < compiler.getFunction()->upvalueCount; i++) {
-    emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-    emitByte(compiler.upvalues[i].index);
+    const Upvalue &upvalue = compiler.upvalues[i];
+    if (!upvalue.isLocal) {
+      emitBytes(CAPTURE_UPVALUE, upvalue.index);
+      continue;
+    }
+    // Patched to CAPTURE_LOCAL or CAPTURE_VALUE when the local goes out of
+    // scope and all writes to it have been seen.
+    Local &local = current->locals[upvalue.index];
+    local.isCaptured = true;
+    // A capture inside a loop that also writes the local sees the write on
+    // the next iteration. A local function capturing itself is captured
+    // before its slot holds the closure.
+    if ((local.writtenInLoop && current->loopDepth > local.loopDepth) ||
+        ((type == FunctionType::TYPE_FUNCTION ||
+          type == FunctionType::TYPE_GENERATOR) &&
+         upvalue.index == current->locals.size() - 1)) {
+      local.needsCell = true;
+    }
+    local.captureSites.push_back(currentChunk().count());
+    emitBytes(CAPTURE_LOCAL, upvalue.index);
   }
 }
 
@@ -508,12 +607,30 @@ void Compiler::literal() noexcept {
   }
 }
 
+const StringObj *Compiler::intern(const std::string &str) noexcept {
+  const size_t interned = stringIntern.size();
+  const StringObj *string = stringIntern.intern(str);
+  // Only a string seen for the first time allocates.
+  if (stringIntern.size() != interned) {
+    recordAllocation(current->getFunction(), ValueType::STRING,
+                     sizeof(StringObj) + str.size());
+  }
+  return string;
+}
+
+void Compiler::recordAllocation(const Function *function, ValueType type,
+                                size_t bytes) noexcept {
+  if (allocations != nullptr && allocations->count(type, bytes)) {
+    allocations->sample({function, parser.previous.line, type, true}, bytes);
+  }
+}
+
 void Compiler::string() noexcept {
   if (parser.previous.lexeme.size() < 2) {
     return;
   }
   // TODO: This is wrong
-  const StringObj * interned = stringIntern.intern(
+  const StringObj * interned = intern(
       std::string{parser.previous.lexeme.substr(1, parser.previous.lexeme.size() - 2)});
   // TODO: This is also wrong
   emitConstant(Value{interned});
@@ -530,7 +647,9 @@ void Compiler::block() noexcept {
 }
 
 void Compiler::declaration() noexcept {
-  if (match(TokenType::FUN)) {
+  if (match(TokenType::CLASS)) {
+    classDeclaration();
+  } else if (match(TokenType::FUN)) {
     funDeclaration();
   } else if (match(TokenType::VAR)) {
     varDeclaration();
@@ -547,9 +666,126 @@ void Compiler::call() noexcept {
   emitBytes(OpCode::OP_CALL, argCount);
 }
 
+void Compiler::dot() noexcept {
+  consume(TokenType::IDENTIFIER, "Expect property name after '.'.");
+  uint8_t name = identifierConstant(parser.previous);
+
+  if (canAssign && match(TokenType::EQUAL)) {
+    expression();
+    emitBytes(OpCode::OP_SET_PROPERTY, name);
+    emitCache();
+  } else if (match(TokenType::LEFT_PAREN)) {
+    // Fused get + call, so `obj.method()` doesn't allocate a bound method.
+    uint8_t argCount = argumentList();
+    emitBytes(OpCode::OP_INVOKE, name);
+    emitByte(argCount);
+    emitCache();
+  } else {
+    emitBytes(OpCode::OP_GET_PROPERTY, name);
+    emitCache();
+  }
+}
+
+void Compiler::array() noexcept {
+  uint8_t count = 0;
+  if (!check(TokenType::RIGHT_BRACKET)) {
+    do {
+      expression();
+      if (count == UINT8_MAX) {
+        error("Can't have more than 255 elements in an array literal.");
+      }
+      count++;
+    } while (match(TokenType::COMMA));
+  }
+  consume(TokenType::RIGHT_BRACKET, "Expect ']' after array elements.");
+  emitBytes(OpCode::OP_ARRAY, count);
+}
+
+void Compiler::map() noexcept {
+  uint8_t count = 0;
+  if (!check(TokenType::RIGHT_BRACE)) {
+    do {
+      expression();
+      consume(TokenType::COLON, "Expect ':' after map key.");
+      expression();
+      if (count == UINT8_MAX) {
+        error("Can't have more than 255 entries in a map literal.");
+      }
+      count++;
+    } while (match(TokenType::COMMA));
+  }
+  consume(TokenType::RIGHT_BRACE, "Expect '}' after map entries.");
+  emitBytes(OpCode::OP_MAP, count);
+}
+
+void Compiler::index() noexcept {
+  // The index expression resets canAssign.
+  const bool assign = canAssign;
+  expression();
+  consume(TokenType::RIGHT_BRACKET, "Expect ']' after index.");
+
+  if (assign && match(TokenType::EQUAL)) {
+    expression();
+    emitByte(OpCode::OP_SET_INDEX);
+  } else {
+    emitByte(OpCode::OP_GET_INDEX);
+  }
+  canAssign = assign;
+}
+
+void Compiler::this_() noexcept {
+  if (currentClass == nullptr) {
+    error("Can't use 'this' outside of a class.");
+    return;
+  }
+  // 'this' is never assignable.
+  const bool assign = canAssign;
+  canAssign = false;
+  variable();
+  canAssign = assign;
+}
+
+void Compiler::classDeclaration() noexcept {
+  consume(TokenType::IDENTIFIER, "Expect class name.");
+  const Token className = parser.previous;
+  uint8_t nameConstant = identifierConstant(className);
+  declareVariable();
+
+  emitBytes(OpCode::OP_CLASS, nameConstant);
+  defineVariable(nameConstant);
+
+  ClassCompiler classCompiler{currentClass};
+  currentClass = &classCompiler;
+
+  // Load the class back so OP_METHOD can find it below each method closure.
+  canAssign = false;
+  namedVariable(className);
+  consume(TokenType::LEFT_BRACE, "Expect '{' before class body.");
+  while (!check(TokenType::RIGHT_BRACE) && !check(TokenType::END_OF_FILE)) {
+    method();
+  }
+  consume(TokenType::RIGHT_BRACE, "Expect '}' after class body.");
+  emitByte(OpCode::OP_POP);
+
+  currentClass = currentClass->enclosing;
+}
+
+void Compiler::method() noexcept {
+  consume(TokenType::IDENTIFIER, "Expect method name.");
+  uint8_t constant = identifierConstant(parser.previous);
+  const FunctionType type = parser.previous.lexeme == "init"
+                                ? FunctionType::TYPE_INITIALIZER
+                                : FunctionType::TYPE_METHOD;
+  createFunction(type);
+  emitBytes(OpCode::OP_METHOD, constant);
+}
+
 void Compiler::varDeclaration() noexcept {
   uint8_t global = parseVariable("Expect variable name.");
+  varInitializer(global);
+}
 
+void Compiler::varInitializer(uint8_t global) noexcept {
   if (match(TokenType::EQUAL)) {
     expression();
   } else {
@@ -560,9 +796,11 @@ void Compiler::varDeclaration() noexcept {
 }
 
 void Compiler::funDeclaration() noexcept {
+  const bool generator = match(TokenType::STAR);
   uint8_t global = parseVariable("Expect function name");
   markInitialized();
-  createFunction(FunctionType::TYPE_FUNCTION);
+  createFunction(generator ? FunctionType::TYPE_GENERATOR
+                           : FunctionType::TYPE_FUNCTION);
   defineVariable(global);
 }
 
@@ -581,6 +819,13 @@ void Compiler::statement() noexcept {
     ifStatement();
   } else if (match(TokenType::RETURN)) {
     returnStatement();
+  } else if (current->getType() == FunctionType::TYPE_GENERATOR &&
+             check(TokenType::IDENTIFIER) &&
+             parser.current.lexeme == "yield") {
+    // A keyword only in generator bodies; elsewhere yield() is the native
+    // that switches fibers.
+    advance();
+    yieldStatement();
   } else {
     expressionStatement();
   }
@@ -618,6 +863,7 @@ void Compiler::ifStatement() noexcept {
 
 void Compiler::whileStatement() noexcept {
   size_t loopStart = currentChunk().count();
+  beginLoop();
   consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'");
   expression();
   consume(TokenType::RIGHT_PAREN, "Expect ')' after condition");
@@ -627,6 +873,7 @@ void Compiler::whileStatement() noexcept {
 
   statement();
   emitLoop(loopStart);
+  endLoop();
   patchJump(exitJump);
   emitByte(OP_POP);
 }
@@ -637,13 +884,20 @@ void Compiler::forStatement() noexcept {
   if (match(TokenType::SEMICOLON)) {
     // No initializer.
   } else if (match(TokenType::VAR)) {
-    varDeclaration();
+    uint8_t global = parseVariable("Expect variable name.");
+    if (match(TokenType::IN)) {
+      forInStatement();
+      endScope();
+      return;
+    }
+    varInitializer(global);
   } else {
     expressionStatement();
   }
 
   size_t loopStart = currentChunk().count();
   size_t exitJump = 0;
+  beginLoop();
   if (!match(TokenType::SEMICOLON)) {
     expression();
     consume(TokenType::SEMICOLON, "Expect ';' after for loop condition");
@@ -666,6 +920,7 @@ void Compiler::forStatement() noexcept {
 
   statement();
   emitLoop(loopStart);
+  endLoop();
 
   if (exitJump != 0) {
     patchJump(exitJump);
@@ -674,6 +929,41 @@ void Compiler::forStatement() noexcept {
   endScope();
 }
 
+// for (var name in sequence) body
+//
+// The loop variable, the sequence and a cursor live in consecutive local
+// slots; OP_ITERATE advances the cursor and pushes the next element, or
+// jumps past the loop once the sequence is exhausted.
+void Compiler::forInStatement() noexcept {
+  const uint8_t variable = current->locals.size() - 1;
+  emitByte(OP_NIL);
+  markInitialized();
+
+  expression();
+  consume(TokenType::RIGHT_PAREN, "Expect ')' after for-in sequence");
+  // Hidden locals; the leading space keeps them out of reach of user code.
+  addLocal(Token{TokenType::IDENTIFIER, " sequence", parser.previous.line});
+  markInitialized();
+  emitConstant(Value{0.0});
+  addLocal(Token{TokenType::IDENTIFIER, " cursor", parser.previous.line});
+  markInitialized();
+
+  size_t loopStart = currentChunk().count();
+  beginLoop();
+  emitBytes(OP_ITERATE, variable + 1);
+  emitByte(0xff);
+  emitByte(0xff);
+  size_t exitJump = currentChunk().count() - 2;
+  emitBytes(OP_SET_LOCAL, variable);
+  markWritten(current->locals[variable]);
+  emitByte(OP_POP);
+
+  statement();
+  emitLoop(loopStart);
+  endLoop();
+  patchJump(exitJump);
+}
+
 void Compiler::returnStatement() noexcept {
   if (current->getType() == FunctionType::TYPE_SCRIPT) {
     error("Can't return from top level code");
@@ -681,10 +971,23 @@ void Compiler::returnStatement() noexcept {
   if (match(TokenType::SEMICOLON)) {
     emitReturn();
   } else {
+    if (current->getType() == FunctionType::TYPE_INITIALIZER) {
+      error("Can't return a value from an initializer.");
+    }
     expression();
     consume(TokenType::SEMICOLON, "Expect ';' after return value.");
-    emitByte(OpCode::OP_RETURN);
+    emitReturnOp();
+  }
+}
+
+void Compiler::yieldStatement() noexcept {
+  if (match(TokenType::SEMICOLON)) {
+    emitByte(OpCode::OP_NIL);
+  } else {
+    expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after yield value.");
   }
+  emitByte(OpCode::OP_YIELD);
 }
 
 const ParseRule Compiler::getRule(const TokenType type) const {
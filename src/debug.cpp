@@ -7,135 +7,298 @@
 #include <fmt/core.h>
 #include <iomanip>
 #include <iostream>
+#include <ostream>
 #include <string_view>
 
-void disassembleChunk(const Chunk &chunk, const std::string_view name) {
-  std::cout << fmt::format("== {} ==\n", name);
+void disassembleChunk(const Chunk &chunk, const std::string_view name,
+                      std::ostream &out) {
+  out << fmt::format("== {} ==\n", name);
 
   for (size_t offset = 0; offset < chunk.count();) {
-    offset = disassembleInstruction(chunk, offset);
+    offset = disassembleInstruction(chunk, offset, out);
   }
 }
 
-size_t disassembleInstruction(const Chunk &chunk, size_t offset) {
-  std::cout << std::setfill('0') << std::right << std::setw(4) << offset << ' ';
+size_t disassembleInstruction(const Chunk &chunk, size_t offset,
+                              std::ostream &out) {
+  out << std::setfill('0') << std::right << std::setw(4) << offset << ' ';
 
   if (offset >= chunk.count())
     return chunk.count() - 1;
 
-  uint8_t line = chunk.getLine(offset);
+  size_t line = chunk.getLine(offset);
   if (offset > 0 && line == chunk.getLine(offset - 1)) {
-    std::cout << "    | ";
+    out << "    | ";
   } else {
-    std::cout << static_cast<int>(line) << ' ';
+    out << static_cast<int>(line) << ' ';
   }
 
-  const OpCode &instruction{chunk.getCode()[offset]};
+  const uint8_t instruction = chunk.getCode()[offset];
   switch (instruction) {
   case OP_NIL:
-    return simpleInstruction("OP_NIL", offset);
+    return simpleInstruction(out, "OP_NIL", offset);
   case OP_TRUE:
-    return simpleInstruction("OP_TRUE", offset);
+    return simpleInstruction(out, "OP_TRUE", offset);
   case OP_FALSE:
-    return simpleInstruction("OP_FALSE", offset);
+    return simpleInstruction(out, "OP_FALSE", offset);
   case OP_RETURN:
-    return simpleInstruction("OP_RETURN", offset);
+    return simpleInstruction(out, "OP_RETURN", offset);
+  case OP_YIELD:
+    return simpleInstruction(out, "OP_YIELD", offset);
+  case OP_GENERATOR_RETURN:
+    return simpleInstruction(out, "OP_GENERATOR_RETURN", offset);
   case OP_CONSTANT:
-    return constantInstruction("OP_CONSTANT", chunk, offset);
+    return constantInstruction(out, "OP_CONSTANT", chunk, offset);
   case OP_NEGATE:
-    return simpleInstruction("OP_NEGATE", offset);
+    return simpleInstruction(out, "OP_NEGATE", offset);
   case OP_ADD:
-    return simpleInstruction("OP_ADD", offset);
+    return simpleInstruction(out, "OP_ADD", offset);
   case OP_SUBTRACT:
-    return simpleInstruction("OP_SUBTRACT", offset);
+    return simpleInstruction(out, "OP_SUBTRACT", offset);
   case OP_MULTIPLY:
-    return simpleInstruction("OP_MULTIPLY", offset);
+    return simpleInstruction(out, "OP_MULTIPLY", offset);
   case OP_DIVIDE:
-    return simpleInstruction("OP_DIVIDE", offset);
+    return simpleInstruction(out, "OP_DIVIDE", offset);
   case OP_NOT:
-    return simpleInstruction("OP_NOT", offset);
+    return simpleInstruction(out, "OP_NOT", offset);
   case OP_EQUAL:
-    return simpleInstruction("OP_EQUAL", offset);
+    return simpleInstruction(out, "OP_EQUAL", offset);
   case OP_GREATER:
-    return simpleInstruction("OP_GREATER", offset);
+    return simpleInstruction(out, "OP_GREATER", offset);
   case OP_LESS:
-    return simpleInstruction("OP_LESS", offset);
+    return simpleInstruction(out, "OP_LESS", offset);
   case OP_PRINT:
-    return simpleInstruction("OP_PRINT", offset);
+    return simpleInstruction(out, "OP_PRINT", offset);
   case OP_POP:
-    return simpleInstruction("OP_POP", offset);
+    return simpleInstruction(out, "OP_POP", offset);
   case OP_DEFINE_GLOBAL:
-    return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+    return constantInstruction(out, "OP_DEFINE_GLOBAL", chunk, offset);
   case OP_GET_GLOBAL:
-    return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+    return constantInstruction(out, "OP_GET_GLOBAL", chunk, offset);
   case OP_SET_GLOBAL:
-    return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+    return constantInstruction(out, "OP_SET_GLOBAL", chunk, offset);
   case OP_GET_LOCAL:
-    return byteInstruction("OP_GET_LOCAL", chunk, offset);
+    return byteInstruction(out, "OP_GET_LOCAL", chunk, offset);
   case OP_SET_LOCAL:
-    return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    return byteInstruction(out, "OP_SET_LOCAL", chunk, offset);
   case OP_GET_UPVALUE:
-    return byteInstruction("OP_GET_UPVALUE", chunk, offset);
+    return byteInstruction(out, "OP_GET_UPVALUE", chunk, offset);
   case OP_SET_UPVALUE:
-    return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+    return byteInstruction(out, "OP_SET_UPVALUE", chunk, offset);
   case OP_JUMP:
-    return jumpInstruction("OP_JUMP", 1, chunk, offset);
+    return jumpInstruction(out, "OP_JUMP", 1, chunk, offset);
   case OP_JUMP_IF_FALSE:
-    return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    return jumpInstruction(out, "OP_JUMP_IF_FALSE", 1, chunk, offset);
   case OP_LOOP:
-    return jumpInstruction("OP_LOOP", -1, chunk, offset);
+    return jumpInstruction(out, "OP_LOOP", -1, chunk, offset);
+  case OP_ITERATE:
+    return iterateInstruction(out, "OP_ITERATE", chunk, offset);
   case OP_CALL:
-    return byteInstruction("OP_CALL", chunk, offset);
+    return byteInstruction(out, "OP_CALL", chunk, offset);
   case OP_CLOSURE: {
     offset++;
     uint8_t constant = chunk.getCode()[offset++];
-    std::cout << "OP_CLOSURE " << constant;
-    printValue(chunk.getConstants().getValues()[constant]);
-    std::cout << "\n";
+    out << "OP_CLOSURE " << static_cast<int>(constant) << ' ';
+    printValue(chunk.getConstants().getValues()[constant], out);
+    out << "\n";
     const Function *function =
         chunk.getConstants().getValues()[constant].asObj()->as<Function>();
     for (int j = 0; j < function->upvalueCount; j++) {
-      int isLocal = chunk.getCode()[offset++];
+      int capture = chunk.getCode()[offset++];
       int index = chunk.getCode()[offset++];
 
-      std::cout << std::setfill('0') << std::right << std::setw(4) << offset - 2
+      out << std::setfill('0') << std::right << std::setw(4) << offset - 2
                 << ' ';
-      std::cout << (isLocal ? "local" : "upvalue") << " " << index;
+      switch (capture) {
+      case CAPTURE_LOCAL:
+        out << "local";
+        break;
+      case CAPTURE_VALUE:
+        out << "value";
+        break;
+      default:
+        out << "upvalue";
+        break;
+      }
+      out << " " << index << "\n";
     }
     return offset;
   }
+  case OP_CLOSE_UPVALUE:
+    return simpleInstruction(out, "OP_CLOSE_UPVALUE", offset);
+  case OP_CLASS:
+    return constantInstruction(out, "OP_CLASS", chunk, offset);
+  case OP_METHOD:
+    return constantInstruction(out, "OP_METHOD", chunk, offset);
+  case OP_GET_PROPERTY:
+    return propertyInstruction(out, "OP_GET_PROPERTY", chunk, offset);
+  case OP_SET_PROPERTY:
+    return propertyInstruction(out, "OP_SET_PROPERTY", chunk, offset);
+  case OP_INVOKE:
+    return invokeInstruction(out, "OP_INVOKE", chunk, offset);
+  case OP_ARRAY:
+    return byteInstruction(out, "OP_ARRAY", chunk, offset);
+  case OP_MAP:
+    return byteInstruction(out, "OP_MAP", chunk, offset);
+  case OP_GET_INDEX:
+    return simpleInstruction(out, "OP_GET_INDEX", offset);
+  case OP_SET_INDEX:
+    return simpleInstruction(out, "OP_SET_INDEX", offset);
   default:
-    std::cout << "Unknown opcode: " << instruction;
-    return offset;
+    out << "Unknown opcode: " << static_cast<int>(instruction) << '\n';
+    return offset + 1;
   }
 }
 
-size_t simpleInstruction(const std::string_view name, size_t offset) {
-  std::cout << name << "\n";
+std::string_view opcodeName(uint8_t opcode) {
+  switch (opcode) {
+  case OP_CONSTANT:
+    return "OP_CONSTANT";
+  case OP_NIL:
+    return "OP_NIL";
+  case OP_TRUE:
+    return "OP_TRUE";
+  case OP_FALSE:
+    return "OP_FALSE";
+  case OP_POP:
+    return "OP_POP";
+  case OP_GET_GLOBAL:
+    return "OP_GET_GLOBAL";
+  case OP_SET_GLOBAL:
+    return "OP_SET_GLOBAL";
+  case OP_GET_LOCAL:
+    return "OP_GET_LOCAL";
+  case OP_SET_LOCAL:
+    return "OP_SET_LOCAL";
+  case OP_GET_UPVALUE:
+    return "OP_GET_UPVALUE";
+  case OP_SET_UPVALUE:
+    return "OP_SET_UPVALUE";
+  case OP_DEFINE_GLOBAL:
+    return "OP_DEFINE_GLOBAL";
+  case OP_GET_PROPERTY:
+    return "OP_GET_PROPERTY";
+  case OP_SET_PROPERTY:
+    return "OP_SET_PROPERTY";
+  case OP_GET_INDEX:
+    return "OP_GET_INDEX";
+  case OP_SET_INDEX:
+    return "OP_SET_INDEX";
+  case OP_EQUAL:
+    return "OP_EQUAL";
+  case OP_GREATER:
+    return "OP_GREATER";
+  case OP_LESS:
+    return "OP_LESS";
+  case OP_ADD:
+    return "OP_ADD";
+  case OP_SUBTRACT:
+    return "OP_SUBTRACT";
+  case OP_MULTIPLY:
+    return "OP_MULTIPLY";
+  case OP_DIVIDE:
+    return "OP_DIVIDE";
+  case OP_NOT:
+    return "OP_NOT";
+  case OP_NEGATE:
+    return "OP_NEGATE";
+  case OP_PRINT:
+    return "OP_PRINT";
+  case OP_JUMP:
+    return "OP_JUMP";
+  case OP_JUMP_IF_FALSE:
+    return "OP_JUMP_IF_FALSE";
+  case OP_LOOP:
+    return "OP_LOOP";
+  case OP_ITERATE:
+    return "OP_ITERATE";
+  case OP_CALL:
+    return "OP_CALL";
+  case OP_INVOKE:
+    return "OP_INVOKE";
+  case OP_CLOSURE:
+    return "OP_CLOSURE";
+  case OP_CLOSE_UPVALUE:
+    return "OP_CLOSE_UPVALUE";
+  case OP_RETURN:
+    return "OP_RETURN";
+  case OP_YIELD:
+    return "OP_YIELD";
+  case OP_GENERATOR_RETURN:
+    return "OP_GENERATOR_RETURN";
+  case OP_CLASS:
+    return "OP_CLASS";
+  case OP_METHOD:
+    return "OP_METHOD";
+  case OP_ARRAY:
+    return "OP_ARRAY";
+  case OP_MAP:
+    return "OP_MAP";
+  default:
+    return "OP_UNKNOWN";
+  }
+}
+
+size_t simpleInstruction(std::ostream &out, const std::string_view name, size_t offset) {
+  out << name << "\n";
   return offset + 1;
 }
 
-size_t constantInstruction(const std::string_view name, const Chunk &chunk,
+size_t constantInstruction(std::ostream &out, const std::string_view name, const Chunk &chunk,
                            size_t offset) {
   uint8_t constant = chunk.getCode()[offset + 1];
-  std::cout << name << " " << constant << '\'';
-  printValue(chunk.getConstants().getValues()[constant]);
-  std::cout << '\'' << "\n";
+  out << name << " " << static_cast<int>(constant) << '\'';
+  printValue(chunk.getConstants().getValues()[constant], out);
+  out << '\'' << "\n";
   return offset + 2;
 }
 
-size_t byteInstruction(const std::string_view name, const Chunk &chunk,
+size_t propertyInstruction(std::ostream &out, const std::string_view name, const Chunk &chunk,
+                           size_t offset) {
+  uint8_t constant = chunk.getCode()[offset + 1];
+  uint16_t cache =
+      chunk.getCode()[offset + 2] << 8 | chunk.getCode()[offset + 3];
+  out << name << " " << static_cast<int>(constant) << '\'';
+  printValue(chunk.getConstants().getValues()[constant], out);
+  out << "' cache " << cache << "\n";
+  return offset + 4;
+}
+
+size_t invokeInstruction(std::ostream &out, const std::string_view name, const Chunk &chunk,
+                         size_t offset) {
+  uint8_t constant = chunk.getCode()[offset + 1];
+  uint8_t argCount = chunk.getCode()[offset + 2];
+  uint16_t cache =
+      chunk.getCode()[offset + 3] << 8 | chunk.getCode()[offset + 4];
+  out << name << " (" << static_cast<int>(argCount) << " args) "
+            << static_cast<int>(constant) << '\'';
+  printValue(chunk.getConstants().getValues()[constant], out);
+  out << "' cache " << cache << "\n";
+  return offset + 5;
+}
+
+size_t byteInstruction(std::ostream &out, const std::string_view name, const Chunk &chunk,
                        size_t offset) {
   uint8_t slot = chunk.getCode()[offset + 1];
-  std::cout << name << " " << slot << '\n';
+  out << name << " " << static_cast<int>(slot) << '\n';
   return offset + 2;
 }
 
-size_t jumpInstruction(const std::string_view name, const int sign,
+size_t iterateInstruction(std::ostream &out, const std::string_view name, const Chunk &chunk,
+                          size_t offset) {
+  uint8_t slot = chunk.getCode()[offset + 1];
+  uint16_t jump =
+      chunk.getCode()[offset + 2] << 8 | chunk.getCode()[offset + 3];
+  out << name << " " << static_cast<int>(slot) << " " << offset
+            << " -> " << offset + 4 + jump << "\n";
+  return offset + 4;
+}
+
+size_t jumpInstruction(std::ostream &out, const std::string_view name, const int sign,
                        const Chunk &chunk, size_t offset) {
   uint16_t jump =
       chunk.getCode()[offset + 1] << 8 | chunk.getCode()[offset + 2];
-  std::cout << name << " " << offset << " -> " << offset + 3 + sign * jump
+  out << name << " " << offset << " -> " << offset + 3 + sign * jump
             << "\n";
   return offset + 3;
 }
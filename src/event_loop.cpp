@@ -0,0 +1,510 @@
+#include "event_loop.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Longest single read or write; the kernel takes at most this much anyway.
+constexpr size_t MAX_TRANSFER = size_t{1} << 30;
+
+constexpr int READ_FLAGS = O_RDONLY | O_CLOEXEC;
+constexpr int WRITE_FLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+// Blocking read or write of a whole file, for the thread backend.
+void perform(IoRequest &request) {
+  const bool reading = request.kind == IoRequest::Kind::READ;
+  const int fd =
+      open(request.path.c_str(), reading ? READ_FLAGS : WRITE_FLAGS, 0644);
+  if (fd < 0) {
+    request.error = errno;
+    return;
+  }
+  if (reading) {
+    struct stat info;
+    // Files that don't know their size (e.g. in /proc) are read in blocks.
+    const size_t size =
+        fstat(fd, &info) == 0 && info.st_size > 0 ? info.st_size : 4096;
+    request.data.resize(size);
+    size_t offset = 0;
+    for (;;) {
+      if (offset == request.data.size()) {
+        request.data.resize(request.data.size() * 2);
+      }
+      const ssize_t n = read(fd, request.data.data() + offset,
+                             std::min(request.data.size() - offset,
+                                      MAX_TRANSFER));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        request.error = n < 0 ? errno : 0;
+        break;
+      }
+      offset += n;
+    }
+    request.data.resize(offset);
+  } else {
+    size_t offset = 0;
+    while (offset < request.data.size()) {
+      const ssize_t n =
+          write(fd, request.data.data() + offset,
+                std::min(request.data.size() - offset, MAX_TRANSFER));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        request.error = errno;
+        break;
+      }
+      offset += n;
+    }
+  }
+  if (close(fd) != 0 && request.error == 0 && !reading) {
+    request.error = errno;
+  }
+}
+
+// A few threads making blocking calls.
+class ThreadBackend : public IoBackend {
+public:
+  static constexpr size_t THREADS = 4;
+
+  ThreadBackend() {
+    for (size_t i = 0; i < THREADS; i++) {
+      threads.emplace_back(&ThreadBackend::workerLoop, this);
+    }
+  }
+
+  ~ThreadBackend() override {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
+    }
+    work.notify_all();
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  }
+
+  void submit(std::unique_ptr<IoRequest> request) override {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      queue.push_back(std::move(request));
+    }
+    work.notify_one();
+  }
+
+  void reap(std::vector<std::unique_ptr<IoRequest>> &done,
+            bool wait) override {
+    std::unique_lock<std::mutex> lock{mutex};
+    if (wait) {
+      finished.wait(lock, [&] { return !completed.empty(); });
+    }
+    for (std::unique_ptr<IoRequest> &request : completed) {
+      done.push_back(std::move(request));
+    }
+    completed.clear();
+  }
+
+  [[nodiscard]] std::string_view name() const override { return "threads"; }
+
+private:
+  void workerLoop() {
+    std::unique_lock<std::mutex> lock{mutex};
+    for (;;) {
+      work.wait(lock, [&] { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      std::unique_ptr<IoRequest> request = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      perform(*request);
+      lock.lock();
+      completed.push_back(std::move(request));
+      finished.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable work;
+  std::condition_variable finished;
+  std::deque<std::unique_ptr<IoRequest>> queue;
+  std::vector<std::unique_ptr<IoRequest>> completed;
+  bool stopping = false;
+};
+
+// io_uring through its system calls. Each request walks through open,
+// statx (reads only), as many reads or writes as it takes, and close, with
+// one submission queue entry in flight at a time.
+class UringBackend : public IoBackend {
+public:
+  static constexpr unsigned ENTRIES = 256;
+
+  // nullptr if the kernel refuses io_uring, e.g. under seccomp.
+  static std::unique_ptr<UringBackend> create() {
+    auto backend = std::unique_ptr<UringBackend>{new UringBackend{}};
+    return backend->ring >= 0 ? std::move(backend) : nullptr;
+  }
+
+  ~UringBackend() override {
+    if (ring < 0) {
+      return;
+    }
+    // The kernel may still be writing into the buffers of these.
+    std::vector<std::unique_ptr<IoRequest>> done;
+    while (active > 0) {
+      reap(done, true);
+      done.clear();
+    }
+    munmap(sqes, sqeSize);
+    if (cqRing != sqRing) {
+      munmap(cqRing, cqSize);
+    }
+    munmap(sqRing, sqSize);
+    close(ring);
+  }
+
+  void submit(std::unique_ptr<IoRequest> request) override {
+    Op *op = new Op{std::move(request)};
+    active++;
+    start(op);
+    enter(0, 0);
+  }
+
+  void reap(std::vector<std::unique_ptr<IoRequest>> &done,
+            bool wait) override {
+    const size_t before = done.size();
+    for (;;) {
+      drain(done);
+      const bool block = wait && done.size() == before && active > 0;
+      if (unsubmitted == 0 && !block) {
+        return;
+      }
+      enter(block ? 1 : 0, block ? IORING_ENTER_GETEVENTS : 0);
+    }
+  }
+
+  [[nodiscard]] std::string_view name() const override { return "io_uring"; }
+
+private:
+  struct Op {
+    enum class Step : uint8_t { OPEN, STAT, TRANSFER, CLOSE };
+
+    std::unique_ptr<IoRequest> request;
+    Step step = Step::OPEN;
+    int fd = -1;
+    size_t offset = 0;
+    struct statx stat;
+  };
+
+  UringBackend() {
+    io_uring_params params{};
+    ring = static_cast<int>(syscall(__NR_io_uring_setup, ENTRIES, &params));
+    if (ring < 0) {
+      return;
+    }
+    sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+      sqSize = cqSize = std::max(sqSize, cqSize);
+    }
+    sqRing = map(sqSize, IORING_OFF_SQ_RING);
+    cqRing = single || sqRing == nullptr ? sqRing
+                                         : map(cqSize, IORING_OFF_CQ_RING);
+    sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqeMap = map(sqeSize, IORING_OFF_SQES);
+    if (sqRing == nullptr || cqRing == nullptr || sqeMap == nullptr) {
+      // Leaves nothing mapped that the destructor would unmap twice.
+      for (void *mapping : {sqRing, cqRing != sqRing ? cqRing : nullptr}) {
+        if (mapping != nullptr) {
+          munmap(mapping, mapping == sqRing ? sqSize : cqSize);
+        }
+      }
+      if (sqeMap != nullptr) {
+        munmap(sqeMap, sqeSize);
+      }
+      close(ring);
+      ring = -1;
+      return;
+    }
+    auto at = [](void *base, uint32_t offset) {
+      return reinterpret_cast<unsigned *>(static_cast<char *>(base) + offset);
+    };
+    sqHead = at(sqRing, params.sq_off.head);
+    sqTail = at(sqRing, params.sq_off.tail);
+    sqMask = *at(sqRing, params.sq_off.ring_mask);
+    sqEntries = *at(sqRing, params.sq_off.ring_entries);
+    sqArray = at(sqRing, params.sq_off.array);
+    cqHead = at(cqRing, params.cq_off.head);
+    cqTail = at(cqRing, params.cq_off.tail);
+    cqMask = *at(cqRing, params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(cqRing) +
+                                            params.cq_off.cqes);
+    sqes = static_cast<io_uring_sqe *>(sqeMap);
+  }
+
+  void *map(size_t size, uint64_t offset) const {
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring, offset);
+    return mapping == MAP_FAILED ? nullptr : mapping;
+  }
+
+  // Queues the next step of `op`, or holds it back while the queue is full.
+  void start(Op *op) {
+    io_uring_sqe sqe{};
+    sqe.user_data = reinterpret_cast<uint64_t>(op);
+    IoRequest &request = *op->request;
+    const bool reading = request.kind == IoRequest::Kind::READ;
+    switch (op->step) {
+    case Op::Step::OPEN:
+      sqe.opcode = IORING_OP_OPENAT;
+      sqe.fd = AT_FDCWD;
+      sqe.addr = reinterpret_cast<uint64_t>(request.path.c_str());
+      sqe.open_flags = reading ? READ_FLAGS : WRITE_FLAGS;
+      sqe.len = 0644;
+      break;
+    case Op::Step::STAT:
+      sqe.opcode = IORING_OP_STATX;
+      sqe.fd = op->fd;
+      sqe.addr = reinterpret_cast<uint64_t>("");
+      sqe.statx_flags = AT_EMPTY_PATH;
+      sqe.len = STATX_SIZE;
+      sqe.off = reinterpret_cast<uint64_t>(&op->stat);
+      break;
+    case Op::Step::TRANSFER:
+      sqe.opcode = reading ? IORING_OP_READ : IORING_OP_WRITE;
+      sqe.fd = op->fd;
+      sqe.addr = reinterpret_cast<uint64_t>(request.data.data() + op->offset);
+      sqe.len = static_cast<uint32_t>(
+          std::min(request.data.size() - op->offset, MAX_TRANSFER));
+      sqe.off = op->offset;
+      break;
+    case Op::Step::CLOSE:
+      sqe.opcode = IORING_OP_CLOSE;
+      sqe.fd = op->fd;
+      break;
+    }
+    const unsigned tail = *sqTail;
+    if (!backlog.empty() ||
+        tail - std::atomic_ref<unsigned>{*sqHead}.load(
+                   std::memory_order_acquire) ==
+            sqEntries) {
+      backlog.push_back(sqe);
+      return;
+    }
+    push(sqe);
+  }
+
+  void push(const io_uring_sqe &sqe) {
+    const unsigned tail = *sqTail;
+    const unsigned index = tail & sqMask;
+    sqes[index] = sqe;
+    sqArray[index] = index;
+    std::atomic_ref<unsigned>{*sqTail}.store(tail + 1,
+                                             std::memory_order_release);
+    unsubmitted++;
+  }
+
+  // Moves held back entries into the queue as far as they fit.
+  void refill() {
+    while (!backlog.empty() &&
+           *sqTail - std::atomic_ref<unsigned>{*sqHead}.load(
+                         std::memory_order_acquire) <
+               sqEntries) {
+      push(backlog.front());
+      backlog.pop_front();
+    }
+  }
+
+  void enter(unsigned minComplete, unsigned flags) {
+    refill();
+    for (;;) {
+      const long submitted = syscall(__NR_io_uring_enter, ring, unsubmitted,
+                                     minComplete, flags, nullptr, 0);
+      if (submitted >= 0) {
+        unsubmitted -= static_cast<unsigned>(submitted);
+        return;
+      }
+      if (errno != EINTR) {
+        // EAGAIN or EBUSY: the completion queue needs draining first.
+        return;
+      }
+    }
+  }
+
+  // Takes every completion off the queue, advancing each request a step.
+  void drain(std::vector<std::unique_ptr<IoRequest>> &done) {
+    unsigned head = *cqHead;
+    const unsigned tail =
+        std::atomic_ref<unsigned>{*cqTail}.load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      const io_uring_cqe &cqe = cqes[head & cqMask];
+      advance(reinterpret_cast<Op *>(cqe.user_data), cqe.res, done);
+    }
+    std::atomic_ref<unsigned>{*cqHead}.store(head, std::memory_order_release);
+  }
+
+  void advance(Op *op, int result, std::vector<std::unique_ptr<IoRequest>> &done) {
+    IoRequest &request = *op->request;
+    const bool reading = request.kind == IoRequest::Kind::READ;
+    switch (op->step) {
+    case Op::Step::OPEN:
+      if (result < 0) {
+        request.error = -result;
+        return finish(op, done);
+      }
+      op->fd = result;
+      op->step = reading ? Op::Step::STAT : Op::Step::TRANSFER;
+      if (!reading && request.data.empty()) {
+        op->step = Op::Step::CLOSE;
+      }
+      return start(op);
+    case Op::Step::STAT:
+      if (result < 0) {
+        request.error = -result;
+        op->step = Op::Step::CLOSE;
+        return start(op);
+      }
+      // Files that don't know their size (e.g. in /proc) are read in
+      // blocks.
+      request.data.resize(op->stat.stx_size > 0 ? op->stat.stx_size : 4096);
+      op->step = Op::Step::TRANSFER;
+      return start(op);
+    case Op::Step::TRANSFER:
+      if (result == -EINTR || result == -EAGAIN) {
+        return start(op);
+      }
+      if (result < 0) {
+        request.error = -result;
+      } else if (result == 0) {
+        // End of file before the size statx gave, or a write going nowhere.
+        if (!reading) {
+          request.error = EIO;
+        }
+      } else {
+        op->offset += result;
+        if (op->offset < request.data.size()) {
+          return start(op);
+        }
+        if (reading && op->stat.stx_size == 0) {
+          request.data.resize(request.data.size() * 2);
+          return start(op);
+        }
+      }
+      if (reading) {
+        request.data.resize(op->offset);
+      }
+      op->step = Op::Step::CLOSE;
+      return start(op);
+    case Op::Step::CLOSE:
+      if (result < 0 && request.error == 0 && !reading) {
+        request.error = -result;
+      }
+      return finish(op, done);
+    }
+  }
+
+  void finish(Op *op, std::vector<std::unique_ptr<IoRequest>> &done) {
+    done.push_back(std::move(op->request));
+    delete op;
+    active--;
+  }
+
+  int ring = -1;
+  void *sqRing = nullptr;
+  void *cqRing = nullptr;
+  size_t sqSize = 0;
+  size_t cqSize = 0;
+  size_t sqeSize = 0;
+  unsigned *sqHead = nullptr;
+  unsigned *sqTail = nullptr;
+  unsigned *sqArray = nullptr;
+  unsigned sqMask = 0;
+  unsigned sqEntries = 0;
+  io_uring_sqe *sqes = nullptr;
+  unsigned *cqHead = nullptr;
+  unsigned *cqTail = nullptr;
+  unsigned cqMask = 0;
+  io_uring_cqe *cqes = nullptr;
+  // Entries queued but not yet passed to io_uring_enter.
+  unsigned unsubmitted = 0;
+  // Entries waiting for room in the submission queue.
+  std::deque<io_uring_sqe> backlog;
+  // Requests between submit() and being reaped.
+  size_t active = 0;
+};
+
+} // namespace
+
+EventLoop::EventLoop(Backend choice) {
+  if (choice == Backend::AUTO) {
+    const char *env = std::getenv("MEHH_IO");
+    choice = env != nullptr && std::strcmp(env, "threads") == 0
+                 ? Backend::THREADS
+                 : Backend::IO_URING;
+  }
+  if (choice == Backend::IO_URING) {
+    backend = UringBackend::create();
+  }
+  if (backend == nullptr) {
+    backend = std::make_unique<ThreadBackend>();
+  }
+}
+
+EventLoop::~EventLoop() {
+  while (inFlight > 0) {
+    reap(true);
+  }
+}
+
+void EventLoop::read(std::string path, AwaitableObj *awaitable) {
+  auto request = std::make_unique<IoRequest>();
+  request->kind = IoRequest::Kind::READ;
+  request->path = std::move(path);
+  request->awaitable = awaitable;
+  submit(std::move(request));
+}
+
+void EventLoop::write(std::string path, std::string data,
+                      AwaitableObj *awaitable) {
+  auto request = std::make_unique<IoRequest>();
+  request->kind = IoRequest::Kind::WRITE;
+  request->path = std::move(path);
+  request->data = std::move(data);
+  request->awaitable = awaitable;
+  submit(std::move(request));
+}
+
+void EventLoop::submit(std::unique_ptr<IoRequest> request) {
+  inFlight++;
+  backend->submit(std::move(request));
+}
+
+std::vector<std::unique_ptr<IoRequest>> &EventLoop::reap(bool wait) {
+  finished.clear();
+  backend->reap(finished, wait && inFlight > 0);
+  inFlight -= finished.size();
+  return finished;
+}
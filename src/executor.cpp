@@ -0,0 +1,124 @@
+#include "executor.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+// The executor and worker the calling thread belongs to, if any.
+thread_local const Executor *currentExecutor = nullptr;
+thread_local size_t currentWorker = 0;
+
+} // namespace
+
+Executor::Executor(size_t workerCount) {
+  workerCount = std::max<size_t>(workerCount, 1);
+  workers.reserve(workerCount);
+  for (size_t i = 0; i < workerCount; i++) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+  // Only once every deque exists, since workers steal from each other.
+  for (size_t i = 0; i < workerCount; i++) {
+    workers[i]->thread = std::thread{&Executor::workerLoop, this, i};
+  }
+}
+
+Executor::~Executor() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (const std::unique_ptr<Worker> &worker : workers) {
+    worker->thread.join();
+  }
+}
+
+std::future<Executor::Result> Executor::run(std::string source) {
+  return submit([source = std::move(source)](VM &vm) {
+    std::ostringstream output;
+    vm.setOutput(output);
+    const InterpretResult status = vm.interpret(source);
+    return Result{status, std::move(output).str()};
+  });
+}
+
+std::future<Executor::Result>
+Executor::run(std::shared_ptr<const CodeImage> image) {
+  return submit(std::move(image), [](VM &vm) {
+    std::ostringstream output;
+    vm.setOutput(output);
+    const InterpretResult status = vm.call(*vm.script()).has_value()
+                                       ? INTERPRET_OK
+                                       : INTERPRET_RUNTIME_ERROR;
+    return Result{status, std::move(output).str()};
+  });
+}
+
+void Executor::post(std::shared_ptr<const CodeImage> image,
+                    std::function<void(VM &)> work) {
+  const size_t target =
+      currentExecutor == this
+          ? currentWorker
+          : nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+  // Counted before the job can be taken, so a worker taking it at once
+  // can't bring the count below zero.
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  try {
+    std::lock_guard<std::mutex> lock{workers[target]->mutex};
+    workers[target]->jobs.push_back(Job{std::move(image), std::move(work)});
+  } catch (...) {
+    std::lock_guard<std::mutex> lock{mutex};
+    pending.fetch_sub(1, std::memory_order_relaxed);
+    throw;
+  }
+  wake.notify_one();
+}
+
+bool Executor::take(size_t self, Job &job) {
+  for (size_t i = 0; i < workers.size(); i++) {
+    Worker &worker = *workers[(self + i) % workers.size()];
+    std::lock_guard<std::mutex> lock{worker.mutex};
+    if (worker.jobs.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      job = std::move(worker.jobs.back());
+      worker.jobs.pop_back();
+    } else {
+      job = std::move(worker.jobs.front());
+      worker.jobs.pop_front();
+    }
+    pending.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void Executor::workerLoop(size_t self) {
+  ThreadPool::runInline();
+  currentExecutor = this;
+  currentWorker = self;
+  for (;;) {
+    Job job;
+    if (!take(self, job)) {
+      std::unique_lock<std::mutex> lock{mutex};
+      wake.wait(lock, [&] {
+        return stopping || pending.load(std::memory_order_relaxed) != 0;
+      });
+      if (pending.load(std::memory_order_relaxed) == 0) {
+        return;
+      }
+      continue;
+    }
+    // On the heap: a VM holds its whole stack and frame array inline.
+    const std::unique_ptr<VM> vm = std::make_unique<VM>(std::move(job.image));
+    job.work(*vm);
+  }
+}
@@ -0,0 +1,146 @@
+#include "fiber.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include "vm.hpp"
+#include <cstddef>
+
+namespace {
+
+const NativeError expectedCallee{"Expected at least 1 argument."};
+const NativeError expectedNoArguments{"Expected 0 arguments."};
+const NativeError expectedOneArgument{"Expected 1 argument."};
+const NativeError expectedFunction{"Argument must be a function."};
+const NativeError wrongArity{"Wrong number of arguments for the function."};
+const NativeError spawnGenerator{"Can't spawn a generator function."};
+const NativeError expectedFiber{"Argument must be a fiber."};
+const NativeError joinSelf{"A fiber can't join itself."};
+const NativeError deadlock{"Deadlock: every fiber is waiting."};
+const NativeError nestedSwitch{
+    "Can't switch fibers inside a native callback or compiled code."};
+
+__attribute__((always_inline)) inline Value error(const NativeError &error) {
+  return Value{static_cast<const Obj *>(&error)};
+}
+
+} // namespace
+
+Value VM::spawnNative(VM &vm, int argCount, Value *args) {
+  if (argCount < 1) {
+    return error(expectedCallee);
+  }
+  if (!args[0].is(ValueType::CLOSURE)) {
+    return error(expectedFunction);
+  }
+  const Function *function = args[0].asObj()->as<Closure>()->function;
+  if (function->arity != argCount - 1) {
+    return error(wrongArity);
+  }
+  if (function->generator) {
+    return error(spawnGenerator);
+  }
+  FiberObj *spawned = vm.allocate<FiberObj>();
+  spawned->generation = vm.resets;
+  for (int i = 0; i < argCount; i++) {
+    spawned->stack.push_back(args[i]);
+  }
+  vm.runnable.push_back(spawned);
+  return Value{spawned};
+}
+
+Value VM::yieldNative(VM &vm, int argCount, Value *) {
+  if (argCount != 0) {
+    return error(expectedNoArguments);
+  }
+  // Fibers whose file operations have finished get a turn too.
+  if (vm.ioPending()) {
+    vm.completeIo(false);
+  }
+  if (vm.runnable.empty()) {
+    return Value{};
+  }
+  if (!vm.canSwitchFiber()) {
+    return error(nestedSwitch);
+  }
+  vm.runnable.push_back(vm.fiber);
+  vm.pendingSwitch = vm.runnable.front();
+  vm.runnable.pop_front();
+  return Value{};
+}
+
+Value VM::joinNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].is(ValueType::FIBER)) {
+    return error(expectedFiber);
+  }
+  FiberObj *target = args[0].asObj()->as<FiberObj>();
+  if (target->state == FiberObj::State::DONE) {
+    return target->result;
+  }
+  if (target == vm.fiber) {
+    return error(joinSelf);
+  }
+  if (!vm.canSwitchFiber()) {
+    return error(nestedSwitch);
+  }
+  // Fibers waiting for file operations aren't stuck.
+  while (vm.runnable.empty() && vm.ioPending()) {
+    vm.completeIo(true);
+  }
+  if (vm.runnable.empty()) {
+    return error(deadlock);
+  }
+  vm.fiber->state = FiberObj::State::BLOCKED;
+  target->joiners.push_back(vm.fiber);
+  vm.pendingSwitch = vm.runnable.front();
+  vm.runnable.pop_front();
+  // Overwritten with the target's result when it finishes.
+  return Value{};
+}
+
+bool VM::switchFiber() {
+  FiberObj *next = pendingSwitch;
+  pendingSwitch = nullptr;
+  fiber->stack = stack;
+  fiber->frames = frames;
+  fiber->frame = frame;
+  fiber->openUpvalues = openUpvalues;
+  stack = next->stack;
+  frames = next->frames;
+  publishFrameStack();
+  openUpvalues = next->openUpvalues;
+  fiber = next;
+  if (next->state == FiberObj::State::NEW) {
+    next->state = FiberObj::State::READY;
+    if (!call(stack[0].asObj()->as<Closure>(), stack.size() - 1)) {
+      return false;
+    }
+  }
+  frame = &frames.back();
+  return true;
+}
+
+bool VM::finishFiber() {
+  FiberObj *finished = fiber;
+  finished->state = FiberObj::State::DONE;
+  finished->result = stack.back();
+  stack.clear();
+  for (FiberObj *joiner : finished->joiners) {
+    // join() left a placeholder for its result on the joiner's stack.
+    joiner->stack.back() = finished->result;
+    joiner->state = FiberObj::State::READY;
+    runnable.push_back(joiner);
+  }
+  finished->joiners.clear();
+  while (runnable.empty() && ioPending()) {
+    completeIo(true);
+  }
+  if (runnable.empty()) {
+    runtimeError("Deadlock: every fiber is waiting");
+    return false;
+  }
+  pendingSwitch = runnable.front();
+  runnable.pop_front();
+  return switchFiber();
+}
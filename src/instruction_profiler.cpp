@@ -0,0 +1,251 @@
+#include "instruction_profiler.hpp"
+#include "alloc_profiler.hpp"
+#include "chunk.hpp"
+#include "class.hpp"
+#include "debug.hpp"
+#include "function.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::string_view functionName(const Function *function) {
+  return function->name.empty() ? std::string_view{"script"}
+                                : std::string_view{function->name};
+}
+
+uint16_t readShort(const std::vector<uint8_t> &code, size_t offset) {
+  return static_cast<uint16_t>(code[offset] << 8 | code[offset + 1]);
+}
+
+// "number" or "{number|string}".
+std::string typeSet(uint16_t mask) {
+  std::string names;
+  size_t count = 0;
+  for (size_t type = 0; type < AllocationProfiler::TYPE_COUNT; type++) {
+    if ((mask & (1u << type)) != 0) {
+      names += fmt::format("{}{}", count == 0 ? "" : "|",
+                           AllocationProfiler::typeName(
+                               static_cast<ValueType>(type)));
+      count++;
+    }
+  }
+  return count > 1 ? "{" + names + "}" : names;
+}
+
+std::string typeNote(const InstructionProfiler::Site &site, uint8_t opcode) {
+  if (site.left == 0) {
+    return {};
+  }
+  const bool unary = opcode == OP_NEGATE || opcode == OP_NOT;
+  const bool monomorphic =
+      std::has_single_bit(site.left) &&
+      (unary || std::has_single_bit(site.right));
+  return fmt::format("types {}{}{}", typeSet(site.left),
+                     unary ? "" : ", " + typeSet(site.right),
+                     monomorphic ? "" : " (polymorphic)");
+}
+
+std::string cacheNote(const PropertyCache &cache) {
+  if (cache.shape == nullptr) {
+    return "cache empty";
+  }
+  if (cache.method != nullptr) {
+    return fmt::format("cache method {}", functionName(cache.method->function));
+  }
+  if (cache.transition != nullptr) {
+    return fmt::format("cache append slot {}", cache.slot);
+  }
+  return fmt::format("cache field slot {}", cache.slot);
+}
+
+struct Block {
+  size_t start;
+  uint64_t hits = 0;
+  // Instructions executed in the block.
+  uint64_t work = 0;
+};
+
+// Splits `chunk` into basic blocks: code starts a block at offset 0, at
+// jump targets and after jumps and returns.
+std::vector<Block> basicBlocks(const Chunk &chunk) {
+  const std::vector<uint8_t> &code = chunk.getCode();
+  std::vector<bool> leader(code.size() + 1, false);
+  leader[0] = true;
+  std::ostringstream discard;
+  for (size_t offset = 0; offset < code.size();) {
+    const size_t next = disassembleInstruction(chunk, offset, discard);
+    switch (code[offset]) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+      leader[std::min(next + readShort(code, offset + 1), code.size())] = true;
+      leader[next] = true;
+      break;
+    case OP_LOOP:
+      leader[next - readShort(code, offset + 1)] = true;
+      leader[next] = true;
+      break;
+    case OP_ITERATE:
+      leader[std::min(next + readShort(code, offset + 2), code.size())] = true;
+      leader[next] = true;
+      break;
+    case OP_RETURN:
+    case OP_YIELD:
+    case OP_GENERATOR_RETURN:
+      leader[next] = true;
+      break;
+    default:
+      break;
+    }
+    offset = next;
+  }
+  std::vector<Block> blocks;
+  for (size_t offset = 0; offset < code.size(); offset++) {
+    if (leader[offset]) {
+      blocks.push_back(Block{offset});
+    }
+  }
+  return blocks;
+}
+
+} // namespace
+
+std::vector<InstructionProfiler::Site> &
+InstructionProfiler::sitesFor(const Function *function) {
+  std::vector<Site> &sites = profiles[function];
+  if (sites.empty()) {
+    sites.resize(function->chunk->count());
+  }
+  return sites;
+}
+
+const std::vector<InstructionProfiler::Site> *
+InstructionProfiler::sites(const Function *function) const {
+  const auto it = profiles.find(function);
+  return it == profiles.end() ? nullptr : &it->second;
+}
+
+uint64_t InstructionProfiler::hits(const Function *function,
+                                   size_t offset) const {
+  const std::vector<Site> *profile = sites(function);
+  return profile == nullptr || offset >= profile->size()
+             ? 0
+             : (*profile)[offset].hits;
+}
+
+void InstructionProfiler::report(std::ostream &out) const {
+  std::vector<std::pair<const Function *, uint64_t>> functions;
+  for (const auto &[function, sites] : profiles) {
+    uint64_t total = 0;
+    for (const Site &site : sites) {
+      total += site.hits;
+    }
+    functions.emplace_back(function, total);
+  }
+  std::sort(functions.begin(), functions.end(),
+            [](const auto &a, const auto &b) { return a.second > b.second; });
+  for (const auto &[function, total] : functions) {
+    report(out, function);
+    out << '\n';
+  }
+}
+
+void InstructionProfiler::report(std::ostream &out,
+                                 const Function *function) const {
+  const std::vector<Site> *profile = sites(function);
+  if (profile == nullptr) {
+    return;
+  }
+  const Chunk &chunk = *function->chunk;
+  const std::vector<uint8_t> &code = chunk.getCode();
+  const PropertyCache *siteCaches =
+      caches != nullptr ? caches->find(chunk) : nullptr;
+  const auto cacheAt = [&](uint16_t index) {
+    return siteCaches != nullptr ? siteCaches[index] : PropertyCache{};
+  };
+
+  std::vector<Block> blocks = basicBlocks(chunk);
+  uint64_t total = 0;
+  for (size_t b = 0; b < blocks.size(); b++) {
+    const size_t end = b + 1 < blocks.size() ? blocks[b + 1].start : code.size();
+    blocks[b].hits = (*profile)[blocks[b].start].hits;
+    for (size_t offset = blocks[b].start; offset < end; offset++) {
+      blocks[b].work += (*profile)[offset].hits;
+    }
+    total += blocks[b].work;
+  }
+  // Hottest blocks by instructions executed, not by entries.
+  std::vector<size_t> order(blocks.size());
+  for (size_t b = 0; b < order.size(); b++) {
+    order[b] = b;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return blocks[a].work > blocks[b].work;
+  });
+  std::vector<size_t> rank(blocks.size(), 0);
+  for (size_t r = 0; r < std::min(HOT_BLOCKS, order.size()); r++) {
+    if (blocks[order[r]].work != 0) {
+      rank[order[r]] = r + 1;
+    }
+  }
+
+  out << fmt::format("== {} (line {}): {} instructions ==\n",
+                     functionName(function), chunk.getLine(0), total);
+  size_t block = 0;
+  for (size_t offset = 0; offset < code.size();) {
+    if (block < blocks.size() && blocks[block].start == offset) {
+      out << fmt::format("-- block {:04} entered {}", offset,
+                         blocks[block].hits);
+      if (rank[block] != 0) {
+        out << fmt::format("  <== hot #{} ({:.1f}%)", rank[block],
+                           100.0 * blocks[block].work / total);
+      }
+      out << '\n';
+      block++;
+    }
+
+    std::ostringstream text;
+    const size_t next = disassembleInstruction(chunk, offset, text);
+    std::string lines = text.str();
+
+    const uint8_t opcode = code[offset];
+    std::string note;
+    switch (opcode) {
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+      note = cacheNote(cacheAt(readShort(code, offset + 2)));
+      break;
+    case OP_INVOKE:
+      note = cacheNote(cacheAt(readShort(code, offset + 3)));
+      break;
+    default:
+      note = typeNote((*profile)[offset], opcode);
+      break;
+    }
+    const size_t end = lines.find('\n');
+    if (!note.empty() && end != std::string::npos) {
+      lines.insert(end, fmt::format("  ; {}", note));
+    }
+
+    // The count goes in front of the first line only; OP_CLOSURE continues
+    // with one line per capture.
+    const std::string first = fmt::format("{:>10}  ", (*profile)[offset].hits);
+    for (size_t at = 0; at < lines.size();) {
+      const size_t eol = std::min(lines.find('\n', at), lines.size());
+      out << (at == 0 ? first : std::string(first.size(), ' '))
+          << std::string_view{lines}.substr(at, eol - at) << '\n';
+      at = eol + 1;
+    }
+    offset = next;
+  }
+}
@@ -1,20 +1,104 @@
 #include "mehh.hpp"
+#include <charconv>
+#include <cstddef>
 #include <cstdlib>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
 
 #include "Tracy.hpp"
 
+[[noreturn]] static void usage() {
+  std::cerr << "Usage: mehh [--profile[=hz]] [--profile-ops] "
+               "[--disasm-profile] [--perf-counters[=functions]] "
+               "[--profile-alloc[=bytes]] [--trace] [--no-jit] "
+               "[--emit-c[=out.c]] [path]\n";
+  exit(64);
+}
+
 int main(int argc, char *argv[]) {
   ZoneScoped;
   Mehh mehh{};
-  if (argc == 1) {
+  const char *path = nullptr;
+  std::optional<std::string> emitC;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg{argv[i]};
+    if (arg == "--profile-ops") {
+      if (!mehh.enableOpProfiler()) {
+        std::cerr << "--profile-ops requires a build configured with "
+                     "-DMEHH_PROFILE_OPS=ON\n";
+        exit(64);
+      }
+    } else if (arg == "--disasm-profile") {
+      if (!mehh.enableDisasmProfile()) {
+        std::cerr << "--disasm-profile requires a build configured with "
+                     "-DMEHH_PROFILE_OPS=ON\n";
+        exit(64);
+      }
+    } else if (arg == "--profile" || arg.starts_with("--profile=")) {
+      unsigned hz = SamplingProfiler::DEFAULT_HZ;
+      if (arg != "--profile") {
+        const std::string_view rate = arg.substr(arg.find('=') + 1);
+        const auto [end, error] =
+            std::from_chars(rate.data(), rate.data() + rate.size(), hz);
+        if (error != std::errc{} || end != rate.data() + rate.size() ||
+            hz == 0) {
+          usage();
+        }
+      }
+      if (!mehh.enableSamplingProfiler(hz)) {
+        std::cerr << "Could not start the sampling profiler\n";
+        exit(64);
+      }
+    } else if (arg == "--perf-counters" ||
+               arg == "--perf-counters=functions") {
+      // Runs without counters if they are unavailable.
+      mehh.enablePerfCounters(arg != "--perf-counters");
+    } else if (arg == "--profile-alloc" ||
+               arg.starts_with("--profile-alloc=")) {
+      size_t interval = AllocationProfiler::DEFAULT_INTERVAL;
+      if (arg != "--profile-alloc") {
+        const std::string_view bytes = arg.substr(arg.find('=') + 1);
+        const auto [end, error] = std::from_chars(
+            bytes.data(), bytes.data() + bytes.size(), interval);
+        if (error != std::errc{} || end != bytes.data() + bytes.size() ||
+            interval == 0) {
+          usage();
+        }
+      }
+      mehh.enableAllocationProfiler(interval);
+    } else if (arg == "--trace") {
+      if (!mehh.enableTracing()) {
+        std::cerr << "Could not open mehh-trace.json\n";
+        exit(64);
+      }
+    } else if (arg == "--no-jit") {
+      mehh.disableJit();
+    } else if (arg == "--emit-c" || arg.starts_with("--emit-c=")) {
+      emitC = arg == "--emit-c" ? "" : std::string{arg.substr(9)};
+      if (arg != "--emit-c" && emitC->empty()) {
+        usage();
+      }
+    } else if (!arg.starts_with("--") && path == nullptr) {
+      path = argv[i];
+    } else {
+      usage();
+    }
+  }
+
+  if (emitC.has_value()) {
+    if (path == nullptr) {
+      usage();
+    }
+    return mehh.emitC(path, *emitC) ? 0 : 65;
+  }
+  if (path == nullptr) {
     mehh.repl();
-  } else if (argc == 2) {
-    mehh.runFile(argv[1]);
   } else {
-    std::cerr << "Usage: mehh [path]\n";
-    exit(64);
+    mehh.runFile(path);
   }
+  mehh.writeProfiles();
 
   return 0;
 }
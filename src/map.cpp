@@ -0,0 +1,199 @@
+#include "map.hpp"
+#include "value.hpp"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Bit i is set if control byte i of the group satisfies the predicate.
+using BitMask = uint32_t;
+
+#ifdef __SSE2__
+__attribute__((always_inline)) inline BitMask matchByte(const int8_t *group,
+                                                        int8_t byte) {
+  const __m128i ctrl =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(byte), ctrl));
+}
+
+// Empty and deleted bytes are the negative ones.
+__attribute__((always_inline)) inline BitMask
+matchEmptyOrDeleted(const int8_t *group) {
+  const __m128i ctrl =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return _mm_movemask_epi8(ctrl);
+}
+#else
+__attribute__((always_inline)) inline BitMask matchByte(const int8_t *group,
+                                                        int8_t byte) {
+  BitMask mask = 0;
+  for (size_t i = 0; i < MapObj::GROUP_WIDTH; i++) {
+    mask |= static_cast<BitMask>(group[i] == byte) << i;
+  }
+  return mask;
+}
+
+__attribute__((always_inline)) inline BitMask
+matchEmptyOrDeleted(const int8_t *group) {
+  BitMask mask = 0;
+  for (size_t i = 0; i < MapObj::GROUP_WIDTH; i++) {
+    mask |= static_cast<BitMask>(group[i] < 0) << i;
+  }
+  return mask;
+}
+#endif
+
+__attribute__((always_inline)) inline size_t h1(uint64_t hash) {
+  return hash >> 7;
+}
+
+__attribute__((always_inline)) inline int8_t h2(uint64_t hash) {
+  return hash & 0x7f;
+}
+
+// At most 7/8 of the slots are used before growing.
+__attribute__((always_inline)) inline size_t maxLoad(size_t capacity) {
+  return capacity - capacity / 8;
+}
+
+} // namespace
+
+MapObj::MapObj()
+    : Obj{ValueType::MAP}, ctrl(GROUP_WIDTH, EMPTY), slots(GROUP_WIDTH),
+      count{0}, growthLeft{maxLoad(GROUP_WIDTH)} {}
+
+uint64_t MapObj::normalize(const Value &key) {
+  if (key.isNumber() && key.asNumber() == 0) {
+    return Value{0.0}.bits();
+  }
+  return key.bits();
+}
+
+// Strings hash by contents, other objects by pointer and numbers by their
+// bits; all go through the same cheap finalizer so the low pointer bits
+// (always zero) and the high double bits (mostly equal) still spread across
+// groups.
+uint64_t MapObj::hash(const Value &key) {
+  uint64_t h = key.isString() ? key.asObj()->as<StringObj>()->contentHash
+                              : normalize(key);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+size_t MapObj::findSlot(const Value &key, uint64_t hash) const {
+  const uint64_t bits = normalize(key);
+  const StringObj *string =
+      key.isString() ? key.asObj()->as<StringObj>() : nullptr;
+  const size_t groupMask = capacity() / GROUP_WIDTH - 1;
+  size_t group = h1(hash) & groupMask;
+  // Triangular probing over groups visits every group once.
+  for (size_t step = 1;; step++) {
+    const int8_t *ctrlGroup = ctrl.data() + group * GROUP_WIDTH;
+    for (BitMask match = matchByte(ctrlGroup, h2(hash)); match != 0;
+         match &= match - 1) {
+      const size_t index = group * GROUP_WIDTH + std::countr_zero(match);
+      const Value &candidate = slots[index].key;
+      if (candidate.bits() == bits ||
+          (string != nullptr && candidate.isString() &&
+           candidate.asObj()->as<StringObj>()->str == string->str)) {
+        return index;
+      }
+    }
+    if (matchByte(ctrlGroup, EMPTY) != 0) {
+      return capacity();
+    }
+    group = (group + step) & groupMask;
+  }
+}
+
+const Value *MapObj::find(const Value &key) const {
+  const size_t index = findSlot(key, hash(key));
+  if (index == capacity()) {
+    return nullptr;
+  }
+  return &slots[index].value;
+}
+
+void MapObj::set(const Value &key, const Value &value) {
+  const uint64_t h = hash(key);
+  const size_t index = findSlot(key, h);
+  if (index != capacity()) {
+    slots[index].value = value;
+    return;
+  }
+  if (growthLeft == 0) {
+    // Grow if mostly live entries, otherwise just drop tombstones.
+    rehash(count * 2 >= maxLoad(capacity()) ? capacity() * 2 : capacity());
+  }
+  insertNew(key, value, h);
+}
+
+void MapObj::insertNew(const Value &key, const Value &value, uint64_t hash) {
+  const size_t groupMask = capacity() / GROUP_WIDTH - 1;
+  size_t group = h1(hash) & groupMask;
+  for (size_t step = 1;; step++) {
+    const BitMask free = matchEmptyOrDeleted(ctrl.data() + group * GROUP_WIDTH);
+    if (free != 0) {
+      const size_t index = group * GROUP_WIDTH + std::countr_zero(free);
+      if (ctrl[index] == EMPTY) {
+        growthLeft--;
+      }
+      ctrl[index] = h2(hash);
+      slots[index].key = normalize(key) == key.bits() ? key : Value{0.0};
+      slots[index].value = value;
+      count++;
+      return;
+    }
+    group = (group + step) & groupMask;
+  }
+}
+
+bool MapObj::remove(const Value &key) {
+  const size_t index = findSlot(key, hash(key));
+  if (index == capacity()) {
+    return false;
+  }
+  // A group that still has an empty slot never overflowed, so no probe
+  // continues past it and the slot can become empty again.
+  const int8_t *group = ctrl.data() + index / GROUP_WIDTH * GROUP_WIDTH;
+  if (matchByte(group, EMPTY) != 0) {
+    ctrl[index] = EMPTY;
+    growthLeft++;
+  } else {
+    ctrl[index] = DELETED;
+  }
+  slots[index] = Entry{Value{}, Value{}};
+  count--;
+  return true;
+}
+
+size_t MapObj::nextSlot(size_t from) const {
+  for (size_t index = from; index < capacity(); index++) {
+    if (ctrl[index] >= 0) {
+      return index;
+    }
+  }
+  return capacity();
+}
+
+void MapObj::rehash(size_t newCapacity) {
+  std::vector<int8_t> oldCtrl(newCapacity, EMPTY);
+  std::vector<Entry> oldSlots(newCapacity);
+  oldCtrl.swap(ctrl);
+  oldSlots.swap(slots);
+  count = 0;
+  growthLeft = maxLoad(newCapacity);
+  for (size_t index = 0; index < oldCtrl.size(); index++) {
+    if (oldCtrl[index] >= 0) {
+      const Entry &entry = oldSlots[index];
+      insertNew(entry.key, entry.value, hash(entry.key));
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#include "mapped_file.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    return nullptr;
+  }
+  const size_t size = static_cast<size_t>(info.st_size);
+  // mmap rejects empty mappings; an empty file needs none.
+  void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                        : nullptr;
+  // The mapping keeps the file open.
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  return std::shared_ptr<const MappedFile>{
+      new MappedFile{static_cast<const char *>(data), size}};
+}
+
+MappedFile::~MappedFile() {
+  if (size > 0) {
+    munmap(const_cast<char *>(data), size);
+  }
+}
+
+void MappedFile::sequential() const {
+  if (size > 0) {
+    madvise(const_cast<char *>(data), size, MADV_SEQUENTIAL);
+  }
+}
+
+void MappedFile::release(size_t begin, size_t end) const {
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  // The mapping starts on a page boundary.
+  begin = (begin + page - 1) / page * page;
+  end = end / page * page;
+  if (begin < end) {
+    madvise(const_cast<char *>(data) + begin, end - begin, MADV_DONTNEED);
+  }
+}
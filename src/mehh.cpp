@@ -1,8 +1,12 @@
 #include "mehh.hpp"
+#include "aot.hpp"
+#include "mapped_file.hpp"
 #include "vm.hpp"
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <optional>
 #include <string>
 
 void Mehh::repl() noexcept {
@@ -16,6 +20,13 @@ void Mehh::repl() noexcept {
 }
 
 void Mehh::runFile(const std::string &path) noexcept {
+  // Compiled straight from the mapping, without reading it into a string.
+  if (const std::shared_ptr<const MappedFile> mapped = MappedFile::open(path)) {
+    InterpretResult result = vm.interpret(mapped->contents());
+    return;
+  }
+
+  // Pipes, FIFOs and /dev/stdin can't be mapped; read them instead.
   std::ifstream file{path};
 
   if (!file.is_open()) {
@@ -25,8 +36,130 @@ void Mehh::runFile(const std::string &path) noexcept {
 
   std::string source((std::istreambuf_iterator<char>(file)),
                      std::istreambuf_iterator<char>());
-
   InterpretResult result = vm.interpret(source);
+}
+
+bool Mehh::emitC(const std::string &path, const std::string &out) noexcept {
+  std::ifstream file{path};
+
+  if (!file.is_open()) {
+    std::cerr << "Could not open file: " << path << std::endl;
+    return false;
+  }
+
+  const std::string source((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+  const std::optional<const Function *> script = vm.compile(source);
+  if (!script.has_value()) {
+    return false;
+  }
+  if (out.empty()) {
+    ::emitC(*script, source, std::cout);
+    return true;
+  }
+  std::ofstream output{out};
+  if (!output.is_open()) {
+    std::cerr << "Could not write file: " << out << std::endl;
+    return false;
+  }
+  ::emitC(*script, source, output);
+  return true;
+}
+
+bool Mehh::enableOpProfiler() noexcept { return vm.enableOpProfiler(); }
+
+bool Mehh::enableDisasmProfile() noexcept {
+  return vm.enableInstructionProfiler();
+}
+
+bool Mehh::enableSamplingProfiler(unsigned hz) noexcept {
+  sampler = std::make_unique<SamplingProfiler>(hz);
+  return sampler->start(vm);
+}
+
+bool Mehh::enablePerfCounters(bool perFunction) noexcept {
+  const PerfCounters &counters = vm.enablePerfCounters(perFunction);
+  if (!counters.available()) {
+    std::cerr << "Performance counters unavailable: " << counters.error()
+              << std::endl;
+  }
+  return counters.available();
+}
+
+void Mehh::enableAllocationProfiler(size_t interval) noexcept {
+  vm.enableAllocationProfiler(interval);
+}
+
+void Mehh::disableJit() noexcept { vm.enableJit(false); }
 
-  file.close();
+bool Mehh::enableTracing() noexcept {
+  traceFile.open("mehh-trace.json");
+  if (!traceFile.is_open()) {
+    return false;
+  }
+  vm.startTracing(traceFile);
+  return true;
+}
+
+void Mehh::writeProfiles() noexcept {
+  if (traceFile.is_open()) {
+    const uint64_t dropped = vm.stopTracing();
+    traceFile.close();
+    std::cerr << "Trace written to mehh-trace.json";
+    if (dropped != 0) {
+      std::cerr << " (" << dropped << " events dropped)";
+    }
+    std::cerr << std::endl;
+  }
+  if (sampler) {
+    sampler->stop();
+    const std::string foldedPath = "mehh-profile.folded";
+    std::ofstream folded{foldedPath};
+    if (folded.is_open()) {
+      sampler->writeCollapsed(folded);
+      std::cerr << sampler->samples() << " samples ("
+                << sampler->dropped() << " dropped) written to " << foldedPath
+                << std::endl;
+    } else {
+      std::cerr << "Could not write profile: " << foldedPath << std::endl;
+    }
+  }
+  if (const InstructionProfiler *profile = vm.instructionProfile()) {
+    profile->report(std::cerr);
+  }
+  if (const OpProfiler *profile = vm.opProfile()) {
+    profile->report(std::cerr);
+    const std::string jsonPath = "mehh-ops.json";
+    std::ofstream json{jsonPath};
+    if (!json.is_open()) {
+      std::cerr << "Could not write opcode profile: " << jsonPath << std::endl;
+      return;
+    }
+    profile->writeJson(json);
+    std::cerr << "Opcode profile written to " << jsonPath << std::endl;
+  }
+  if (const PerfCounters *counters = vm.perfProfile();
+      counters != nullptr && counters->available()) {
+    counters->report(std::cerr);
+    const std::string jsonPath = "mehh-perf.json";
+    std::ofstream json{jsonPath};
+    if (!json.is_open()) {
+      std::cerr << "Could not write counters: " << jsonPath << std::endl;
+      return;
+    }
+    counters->writeJson(json);
+    std::cerr << "Counters written to " << jsonPath << std::endl;
+  }
+  if (const AllocationProfiler *profile = vm.allocationProfile()) {
+    profile->report(std::cerr);
+    const std::string jsonPath = "mehh-alloc.json";
+    std::ofstream json{jsonPath};
+    if (!json.is_open()) {
+      std::cerr << "Could not write allocation profile: " << jsonPath
+                << std::endl;
+      return;
+    }
+    profile->writeJson(json);
+    std::cerr << "Allocation profile written to " << jsonPath << std::endl;
+  }
 }
@@ -0,0 +1,621 @@
+#include "natives.hpp"
+#include "array.hpp"
+#include "channel.hpp"
+#include "function.hpp"
+#include "map.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include "value.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const NativeError expectedNoArguments{"Expected 0 arguments."};
+const NativeError expectedOneArgument{"Expected 1 argument."};
+const NativeError expectedTwoArguments{"Expected 2 arguments."};
+const NativeError expectedThreeArguments{"Expected 3 arguments."};
+const NativeError expectedArray{"Argument must be an array."};
+const NativeError expectedMap{"Argument must be a map."};
+const NativeError expectedArrayOrMap{"Argument must be an array or a map."};
+const NativeError expectedNumber{"Argument must be a number."};
+const NativeError expectedSize{"Size must be a non-negative integer."};
+const NativeError expectedNumbers{"Array must contain only numbers."};
+const NativeError emptyArray{"Array must not be empty."};
+const NativeError lengthMismatch{"Arrays must have the same length."};
+const NativeError expectedPath{"Path must be a string."};
+const NativeError expectedThreadCount{
+    "Thread count must be a positive integer."};
+// Never printed: the callback reported its own error.
+const NativeError callbackFailed{"Callback failed."};
+
+__attribute__((always_inline)) inline Value error(const NativeError &error) {
+  return Value{static_cast<const Obj *>(&error)};
+}
+
+// Returns the array in `value` if it is numeric, or nullptr.
+__attribute__((always_inline)) inline ArrayObj *
+numericArray(const Value &value) {
+  if (!value.isArray()) {
+    return nullptr;
+  }
+  ArrayObj *array = value.asObj()->as<ArrayObj>();
+  return array->specialize() ? array : nullptr;
+}
+
+__attribute__((always_inline)) inline Value
+numericArrayError(const Value &value) {
+  return value.isArray() ? error(expectedNumbers) : error(expectedArray);
+}
+
+__attribute__((always_inline)) inline bool isTruthy(const Value &value) {
+  return !value.isNil() && !(value.isBool() && !value.asBool());
+}
+
+// Returns the callback if it is a pure native, which is safe to call from
+// worker threads, or nullptr.
+__attribute__((always_inline)) inline const NativeFunction *
+threadSafeNative(const Value &callback) {
+  if (!callback.is(ValueType::NATIVE_FUNCTION)) {
+    return nullptr;
+  }
+  const NativeFunction *native = callback.asObj()->as<NativeFunction>();
+  return native->pure ? native : nullptr;
+}
+
+// Calls a pure native with each element of a numeric array on the worker
+// pool, storing the results in `results`. Returns the first error, if any.
+// Natives bound from double(double) functions are called unboxed.
+const Obj *mapNumbers(const NativeFunction *native, const ArrayObj *array,
+                      std::vector<Value> &results) {
+  results.resize(array->size());
+  if (native->unary != nullptr) {
+    ThreadPool::shared().parallelFor(
+        array->size(), parallel::SEQUENTIAL_CUTOFF,
+        [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; i++) {
+            results[i] = Value{native->unary(array->data()[i])};
+          }
+        });
+    return nullptr;
+  }
+  std::atomic<const Obj *> failure{nullptr};
+  ThreadPool::shared().parallelFor(
+      array->size(), parallel::SEQUENTIAL_CUTOFF,
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          Value argument{array->data()[i]};
+          results[i] = native->fun(1, &argument);
+          if (results[i].is(ValueType::NATIVE_ERROR)) {
+            failure.store(results[i].asObj(), std::memory_order_relaxed);
+            return;
+          }
+        }
+      });
+  return failure.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+Value lenNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (args[0].isMap()) {
+    return Value{static_cast<double>(args[0].asObj()->as<MapObj>()->size())};
+  }
+  if (!args[0].isArray()) {
+    return error(expectedArrayOrMap);
+  }
+  return Value{static_cast<double>(args[0].asObj()->as<ArrayObj>()->size())};
+}
+
+Value pushNative(int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  if (!args[0].isArray()) {
+    return error(expectedArray);
+  }
+  args[0].asObj()->as<ArrayObj>()->push(args[1]);
+  return args[0];
+}
+
+Value resizeNative(int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  if (!args[0].isArray()) {
+    return error(expectedArray);
+  }
+  if (!args[1].isNumber() || args[1].asNumber() < 0 ||
+      std::trunc(args[1].asNumber()) != args[1].asNumber()) {
+    return error(expectedSize);
+  }
+  args[0].asObj()->as<ArrayObj>()->resize(
+      static_cast<size_t>(args[1].asNumber()));
+  return args[0];
+}
+
+Value sumNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  const ArrayObj *array = numericArray(args[0]);
+  if (array == nullptr) {
+    return numericArrayError(args[0]);
+  }
+  return Value{parallel::sum(array->data(), array->size())};
+}
+
+Value dotNative(int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  const ArrayObj *a = numericArray(args[0]);
+  if (a == nullptr) {
+    return numericArrayError(args[0]);
+  }
+  const ArrayObj *b = numericArray(args[1]);
+  if (b == nullptr) {
+    return numericArrayError(args[1]);
+  }
+  if (a->size() != b->size()) {
+    return error(lengthMismatch);
+  }
+  return Value{simd::dot(a->data(), b->data(), a->size())};
+}
+
+Value minNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  const ArrayObj *array = numericArray(args[0]);
+  if (array == nullptr) {
+    return numericArrayError(args[0]);
+  }
+  if (array->size() == 0) {
+    return error(emptyArray);
+  }
+  return Value{simd::min(array->data(), array->size())};
+}
+
+Value maxNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  const ArrayObj *array = numericArray(args[0]);
+  if (array == nullptr) {
+    return numericArrayError(args[0]);
+  }
+  if (array->size() == 0) {
+    return error(emptyArray);
+  }
+  return Value{simd::max(array->data(), array->size())};
+}
+
+Value scaleNative(int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  ArrayObj *array = numericArray(args[0]);
+  if (array == nullptr) {
+    return numericArrayError(args[0]);
+  }
+  if (!args[1].isNumber()) {
+    return error(expectedNumber);
+  }
+  simd::scale(array->data(), array->size(), args[1].asNumber());
+  return args[0];
+}
+
+Value axpyNative(int argCount, Value *args) {
+  if (argCount != 3) {
+    return error(expectedThreeArguments);
+  }
+  if (!args[0].isNumber()) {
+    return error(expectedNumber);
+  }
+  const ArrayObj *x = numericArray(args[1]);
+  if (x == nullptr) {
+    return numericArrayError(args[1]);
+  }
+  ArrayObj *y = numericArray(args[2]);
+  if (y == nullptr) {
+    return numericArrayError(args[2]);
+  }
+  if (x->size() != y->size()) {
+    return error(lengthMismatch);
+  }
+  simd::axpy(args[0].asNumber(), x->data(), y->data(), y->size());
+  return args[2];
+}
+
+Value hasNative(int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  if (!args[0].isMap()) {
+    return error(expectedMap);
+  }
+  return Value{args[0].asObj()->as<MapObj>()->find(args[1]) != nullptr};
+}
+
+Value removeNative(int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  if (!args[0].isMap()) {
+    return error(expectedMap);
+  }
+  return Value{args[0].asObj()->as<MapObj>()->remove(args[1])};
+}
+
+Value absNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].isNumber()) {
+    return error(expectedNumber);
+  }
+  return Value{std::fabs(args[0].asNumber())};
+}
+
+Value sqrtNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].isNumber()) {
+    return error(expectedNumber);
+  }
+  return Value{std::sqrt(args[0].asNumber())};
+}
+
+Value nowNative(int argCount, Value *args) {
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return Value{std::chrono::duration<double>(now).count()};
+}
+
+Value threadsNative(int argCount, Value *args) {
+  if (argCount == 0) {
+    return Value{static_cast<double>(ThreadPool::shared().size())};
+  }
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].isNumber() || args[0].asNumber() < 1 ||
+      std::trunc(args[0].asNumber()) != args[0].asNumber()) {
+    return error(expectedThreadCount);
+  }
+  ThreadPool::shared().resize(static_cast<size_t>(args[0].asNumber()));
+  return args[0];
+}
+
+Value sortNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  ArrayObj *array = numericArray(args[0]);
+  if (array == nullptr) {
+    return numericArrayError(args[0]);
+  }
+  parallel::sort(array->data(), array->size());
+  return args[0];
+}
+
+Value mapNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  if (!args[0].isArray()) {
+    return error(expectedArray);
+  }
+  ArrayObj *source = args[0].asObj()->as<ArrayObj>();
+  const Value callback = args[1];
+  ArrayObj *result = vm.allocate<ArrayObj>();
+
+  const NativeFunction *native = threadSafeNative(callback);
+  if (native != nullptr && source->specialize()) {
+    std::vector<Value> results;
+    if (const Obj *failure = mapNumbers(native, source, results)) {
+      return Value{failure};
+    }
+    for (const Value &value : results) {
+      result->push(value);
+    }
+    return Value{result};
+  }
+
+  // The callback may change the array, so re-check the size every time.
+  for (size_t i = 0; i < source->size(); i++) {
+    const Value element = source->get(i);
+    Value mapped;
+    if (!vm.callFunction(callback, 1, &element, mapped)) {
+      return error(callbackFailed);
+    }
+    result->push(mapped);
+  }
+  return Value{result};
+}
+
+Value filterNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  if (!args[0].isArray()) {
+    return error(expectedArray);
+  }
+  ArrayObj *source = args[0].asObj()->as<ArrayObj>();
+  const Value callback = args[1];
+  ArrayObj *result = vm.allocate<ArrayObj>();
+
+  const NativeFunction *native = threadSafeNative(callback);
+  if (native != nullptr && source->specialize()) {
+    std::vector<Value> keep;
+    if (const Obj *failure = mapNumbers(native, source, keep)) {
+      return Value{failure};
+    }
+    for (size_t i = 0; i < keep.size(); i++) {
+      if (isTruthy(keep[i])) {
+        result->push(Value{source->data()[i]});
+      }
+    }
+    return Value{result};
+  }
+
+  for (size_t i = 0; i < source->size(); i++) {
+    const Value element = source->get(i);
+    Value keep;
+    if (!vm.callFunction(callback, 1, &element, keep)) {
+      return error(callbackFailed);
+    }
+    if (isTruthy(keep)) {
+      result->push(element);
+    }
+  }
+  return Value{result};
+}
+
+// Left folds make no assumption about the callback being associative, so
+// this one always runs sequentially; sum() is the parallel reduction.
+Value reduceNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 3) {
+    return error(expectedThreeArguments);
+  }
+  if (!args[0].isArray()) {
+    return error(expectedArray);
+  }
+  const ArrayObj *source = args[0].asObj()->as<ArrayObj>();
+  const Value callback = args[1];
+  Value operands[2] = {args[2], Value{}};
+  for (size_t i = 0; i < source->size(); i++) {
+    operands[1] = source->get(i);
+    if (!vm.callFunction(callback, 2, operands, operands[0])) {
+      return error(callbackFailed);
+    }
+  }
+  return operands[0];
+}
+
+namespace {
+
+const NativeError expectedChannel{"Argument must be a channel."};
+const NativeError expectedCapacity{"Capacity must be a positive integer."};
+const NativeError unsendable{
+    "Can only send nil, booleans, numbers, strings, arrays and maps."};
+const NativeError nestedTooDeeply{"Message is nested too deeply."};
+const NativeError channelClosed{"Channel is closed."};
+
+// Deeper messages are taken for cycles.
+constexpr int MESSAGE_DEPTH = 64;
+
+// Copies `value` into `message`, or returns the reason it can't be sent.
+const NativeError *pack(const Channel &channel, const Value &value,
+                        Message &message, int depth) {
+  if (value.isNumber() || value.isBool() || value.isNil()) {
+    message.value = value;
+    return nullptr;
+  }
+  if (depth == MESSAGE_DEPTH) {
+    return &nestedTooDeeply;
+  }
+  switch (value.getType()) {
+  case ValueType::STRING: {
+    const StringObj *string = value.asObj()->as<StringObj>();
+    if (channel.image() != nullptr && channel.image()->strings().owns(string)) {
+      message.value = value;
+    } else {
+      message.kind = Message::Kind::STRING;
+      message.text = string->str;
+    }
+    return nullptr;
+  }
+  case ValueType::ARRAY: {
+    ArrayObj *array = value.asObj()->as<ArrayObj>();
+    if (array->isNumeric()) {
+      message.kind = Message::Kind::NUMBERS;
+      message.numbers.assign(array->data(), array->data() + array->size());
+      return nullptr;
+    }
+    message.kind = Message::Kind::ARRAY;
+    message.items.resize(array->size());
+    for (size_t i = 0; i < array->size(); i++) {
+      if (const NativeError *failure =
+              pack(channel, array->get(i), message.items[i], depth + 1)) {
+        return failure;
+      }
+    }
+    return nullptr;
+  }
+  case ValueType::MAP: {
+    const MapObj *map = value.asObj()->as<MapObj>();
+    message.kind = Message::Kind::MAP;
+    message.items.reserve(map->size() * 2);
+    for (size_t i = map->nextSlot(0); i < map->capacity();
+         i = map->nextSlot(i + 1)) {
+      for (const Value &part : {map->slot(i).key, map->slot(i).value}) {
+        if (const NativeError *failure = pack(
+                channel, part, message.items.emplace_back(), depth + 1)) {
+          return failure;
+        }
+      }
+    }
+    return nullptr;
+  }
+  default:
+    return &unsendable;
+  }
+}
+
+// Builds the value `message` carries on `vm`'s heap.
+Value unpack(VM &vm, const Channel &channel, Message &message) {
+  switch (message.kind) {
+  case Message::Kind::VALUE:
+    // Image strings are this VM's own only if it runs the same image.
+    if (message.value.isString() &&
+        vm.codeImage() != channel.image().get()) {
+      return vm.string(message.value.asObj()->as<StringObj>()->str);
+    }
+    return message.value;
+  case Message::Kind::STRING:
+    return vm.string(message.text);
+  case Message::Kind::NUMBERS: {
+    ArrayObj *array = vm.allocate<ArrayObj>();
+    array->resize(message.numbers.size());
+    std::copy(message.numbers.begin(), message.numbers.end(), array->data());
+    return Value{array};
+  }
+  case Message::Kind::ARRAY: {
+    ArrayObj *array = vm.allocate<ArrayObj>();
+    for (Message &item : message.items) {
+      array->push(unpack(vm, channel, item));
+    }
+    return Value{array};
+  }
+  case Message::Kind::MAP: {
+    MapObj *map = vm.allocate<MapObj>();
+    for (size_t i = 0; i + 1 < message.items.size(); i += 2) {
+      map->set(unpack(vm, channel, message.items[i]),
+               unpack(vm, channel, message.items[i + 1]));
+    }
+    return Value{map};
+  }
+  }
+  return Value{};
+}
+
+__attribute__((always_inline)) inline Channel *channelArgument(
+    const Value &value) {
+  return value.is(ValueType::CHANNEL)
+             ? value.asObj()->as<ChannelObj>()->channel.get()
+             : nullptr;
+}
+
+} // namespace
+
+Value channelNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  const double capacity = args[0].isNumber() ? args[0].asNumber() : 0;
+  if (!(capacity >= 1 && capacity <= 1 << 24) ||
+      static_cast<double>(static_cast<size_t>(capacity)) != capacity) {
+    return error(expectedCapacity);
+  }
+  return vm.channel(std::make_shared<Channel>(static_cast<size_t>(capacity)));
+}
+
+Value sendNative(int argCount, Value *args) {
+  if (argCount != 2) {
+    return error(expectedTwoArguments);
+  }
+  Channel *channel = channelArgument(args[0]);
+  if (channel == nullptr) {
+    return error(expectedChannel);
+  }
+  Message message;
+  if (const NativeError *failure = pack(*channel, args[1], message, 0)) {
+    return error(*failure);
+  }
+  if (!channel->send(message)) {
+    return error(channelClosed);
+  }
+  return Value{};
+}
+
+Value receiveNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  Channel *channel = channelArgument(args[0]);
+  if (channel == nullptr) {
+    return error(expectedChannel);
+  }
+  Message message;
+  if (!channel->receive(message)) {
+    return Value{};
+  }
+  return unpack(vm, *channel, message);
+}
+
+Value closeNative(int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  Channel *channel = channelArgument(args[0]);
+  if (channel == nullptr) {
+    return error(expectedChannel);
+  }
+  channel->close();
+  return Value{};
+}
+
+Value readFileNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].isString()) {
+    return error(expectedPath);
+  }
+  const std::shared_ptr<const MappedFile> file =
+      MappedFile::open(std::string{args[0].asObj()->as<StringObj>()->str});
+  if (file == nullptr) {
+    return Value{};
+  }
+  return vm.string(file->contents(), file);
+}
+
+Value linesNative(VM &vm, int argCount, Value *args) {
+  if (argCount != 1) {
+    return error(expectedOneArgument);
+  }
+  if (!args[0].isString()) {
+    return error(expectedPath);
+  }
+  std::shared_ptr<const MappedFile> file =
+      MappedFile::open(std::string{args[0].asObj()->as<StringObj>()->str});
+  if (file == nullptr) {
+    return Value{};
+  }
+  file->sequential();
+  return Value{vm.allocate<LinesObj>(std::move(file))};
+}
+
+Value flushNative(VM &vm, int argCount, Value *) {
+  if (argCount != 0) {
+    return error(expectedNoArguments);
+  }
+  vm.flush();
+  return Value{};
+}
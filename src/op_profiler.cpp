@@ -0,0 +1,96 @@
+#include "op_profiler.hpp"
+#include "debug.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <vector>
+
+OpProfiler::OpProfiler() : pairs(OPCODE_COUNT * OPCODE_COUNT, 0) {}
+
+uint64_t OpProfiler::total() const {
+  return std::accumulate(counts.begin(), counts.end(), uint64_t{0});
+}
+
+void OpProfiler::report(std::ostream &out, size_t pairLimit) const {
+  const uint64_t all = total();
+  if (all == 0) {
+    out << "No instructions executed.\n";
+    return;
+  }
+
+  std::vector<size_t> ops;
+  for (size_t op = 0; op < OPCODE_COUNT; op++) {
+    if (counts[op] != 0) {
+      ops.push_back(op);
+    }
+  }
+  std::stable_sort(ops.begin(), ops.end(),
+                   [&](size_t a, size_t b) { return counts[a] > counts[b]; });
+
+  out << fmt::format("{:<20} {:>14} {:>7} {:>10}\n", "opcode", "count", "%",
+                     "cycles");
+  for (const size_t op : ops) {
+    const std::string average =
+        samples[op] == 0
+            ? std::string{"-"}
+            : fmt::format("{:.1f}", static_cast<double>(cycles[op]) /
+                                        static_cast<double>(samples[op]));
+    out << fmt::format("{:<20} {:>14} {:>6.2f}% {:>10}\n", opcodeName(op),
+                       counts[op], 100.0 * counts[op] / all, average);
+  }
+  out << fmt::format("{:<20} {:>14}\n", "total", all);
+
+  std::vector<size_t> pairIndices;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    if (pairs[i] != 0) {
+      pairIndices.push_back(i);
+    }
+  }
+  const size_t shown = std::min(pairLimit, pairIndices.size());
+  std::partial_sort(
+      pairIndices.begin(), pairIndices.begin() + shown, pairIndices.end(),
+      [&](size_t a, size_t b) {
+        return pairs[a] > pairs[b] || (pairs[a] == pairs[b] && a < b);
+      });
+
+  out << fmt::format("\n{:<41} {:>14}\n", "pair", "count");
+  for (size_t i = 0; i < shown; i++) {
+    const size_t pair = pairIndices[i];
+    const std::string name =
+        fmt::format("{} -> {}", opcodeName(pair / OPCODE_COUNT),
+                    opcodeName(pair % OPCODE_COUNT));
+    out << fmt::format("{:<41} {:>14}\n", name, pairs[pair]);
+  }
+}
+
+void OpProfiler::writeJson(std::ostream &out) const {
+  out << fmt::format("{{\"total\":{},\"samplePeriod\":{},\"opcodes\":[",
+                     total(), SAMPLE_PERIOD);
+  bool first = true;
+  for (size_t op = 0; op < OPCODE_COUNT; op++) {
+    if (counts[op] == 0) {
+      continue;
+    }
+    out << fmt::format(
+        "{}{{\"name\":\"{}\",\"count\":{},\"samples\":{},\"cycles\":{}}}",
+        first ? "" : ",", opcodeName(op), counts[op], samples[op],
+        cycles[op]);
+    first = false;
+  }
+  out << "],\"pairs\":[";
+  first = true;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    if (pairs[i] == 0) {
+      continue;
+    }
+    out << fmt::format("{}{{\"first\":\"{}\",\"second\":\"{}\",\"count\":{}}}",
+                       first ? "" : ",", opcodeName(i / OPCODE_COUNT),
+                       opcodeName(i % OPCODE_COUNT), pairs[i]);
+    first = false;
+  }
+  out << "]}\n";
+}
@@ -0,0 +1,31 @@
+#include "output.hpp"
+#include <iostream>
+#include <ostream>
+#include <unistd.h>
+
+namespace {
+
+bool isTerminal(const std::ostream &stream) {
+  static const bool stdoutIsTerminal = isatty(STDOUT_FILENO) != 0;
+  return &stream == &std::cout && stdoutIsTerminal;
+}
+
+} // namespace
+
+Output::Output(std::ostream &stream)
+    : stream{&stream}, lineBuffered{isTerminal(stream)} {}
+
+void Output::setStream(std::ostream &stream) {
+  flush();
+  this->stream = &stream;
+  lineBuffered = isTerminal(stream);
+}
+
+void Output::flush() {
+  if (buffer.size() == 0) {
+    return;
+  }
+  stream->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  stream->flush();
+  buffer.clear();
+}
@@ -0,0 +1,75 @@
+#include "parallel.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace {
+
+// Strict weak order over doubles; NaNs compare greater than everything.
+__attribute__((always_inline)) inline bool less(double a, double b) {
+  return a < b || (std::isnan(b) && !std::isnan(a));
+}
+
+} // namespace
+
+namespace parallel {
+
+double sum(const double *data, size_t size) {
+  if (size <= SEQUENTIAL_CUTOFF) {
+    return simd::sum(data, size);
+  }
+  const size_t blocks = (size + SEQUENTIAL_CUTOFF - 1) / SEQUENTIAL_CUTOFF;
+  std::vector<double> partials(blocks);
+  ThreadPool::shared().parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; block++) {
+      const size_t offset = block * SEQUENTIAL_CUTOFF;
+      partials[block] = simd::sum(data + offset,
+                                  std::min(SEQUENTIAL_CUTOFF, size - offset));
+    }
+  });
+  return simd::sum(partials.data(), blocks);
+}
+
+// Sorts one run per thread, then merges neighbouring runs pairwise, each
+// round in parallel, ping-ponging between `data` and a scratch buffer.
+void sort(double *data, size_t size) {
+  ThreadPool &pool = ThreadPool::shared();
+  if (size <= SEQUENTIAL_CUTOFF || pool.size() == 1) {
+    std::sort(data, data + size, less);
+    return;
+  }
+  const size_t runs = std::min(pool.size(), size / SEQUENTIAL_CUTOFF);
+  std::vector<size_t> bounds(runs + 1);
+  for (size_t i = 0; i <= runs; i++) {
+    bounds[i] = size * i / runs;
+  }
+  pool.parallelFor(runs, 1, [&](size_t begin, size_t end) {
+    for (size_t run = begin; run < end; run++) {
+      std::sort(data + bounds[run], data + bounds[run + 1], less);
+    }
+  });
+
+  std::vector<double> scratch(size);
+  double *from = data;
+  double *to = scratch.data();
+  for (size_t width = 1; width < runs; width *= 2) {
+    const size_t pairs = (runs + 2 * width - 1) / (2 * width);
+    pool.parallelFor(pairs, 1, [&](size_t begin, size_t end) {
+      for (size_t pair = begin; pair < end; pair++) {
+        const size_t lo = bounds[pair * 2 * width];
+        const size_t mid = bounds[std::min(runs, pair * 2 * width + width)];
+        const size_t hi = bounds[std::min(runs, pair * 2 * width + 2 * width)];
+        std::merge(from + lo, from + mid, from + mid, from + hi, to + lo, less);
+      }
+    });
+    std::swap(from, to);
+  }
+  if (from != data) {
+    std::copy(from, from + size, data);
+  }
+}
+
+} // namespace parallel
@@ -0,0 +1,278 @@
+#include "perf_counters.hpp"
+#include "chunk.hpp"
+#include "function.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fmt/core.h>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::string_view functionName(const Function *function) {
+  if (function == nullptr) {
+    return "(host)";
+  }
+  return function->name.empty() ? std::string_view{"script"}
+                                 : std::string_view{function->name};
+}
+
+std::string ratio(uint64_t numerator, uint64_t denominator) {
+  return denominator == 0
+             ? std::string{"-"}
+             : fmt::format("{:.2f}", static_cast<double>(numerator) /
+                                         static_cast<double>(denominator));
+}
+
+#ifdef __linux__
+struct EventConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+constexpr std::array<EventConfig, PerfCounters::EVENT_COUNT> CONFIGS{{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+}};
+
+int openEvent(const EventConfig &event, int group) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.disabled = group == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(
+      syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+#endif
+
+} // namespace
+
+PerfCounters::PerfCounters(bool perFunction) : trackFunctions{perFunction} {
+#ifdef __linux__
+  // Events the CPU or hypervisor doesn't expose are left out; the first one
+  // that opens leads the group.
+  std::string missing;
+  for (size_t event = 0; event < EVENT_COUNT; event++) {
+    const int fd = openEvent(CONFIGS[event], leader);
+    if (fd < 0) {
+      missing += fmt::format(" {} ({})",
+                             eventName(static_cast<Event>(event)),
+                             std::strerror(errno));
+      continue;
+    }
+    if (leader < 0) {
+      leader = fd;
+    }
+    fds[event] = fd;
+    slot[event] = static_cast<int>(opened++);
+  }
+  if (leader < 0) {
+    error_ = "perf_event_open failed for" + missing +
+             "; see /proc/sys/kernel/perf_event_paranoid";
+  } else if (!missing.empty()) {
+    error_ = "unavailable events:" + missing;
+  }
+#else
+  error_ = "perf_event_open is only available on Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for (const int fd : fds) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+#endif
+}
+
+std::string_view PerfCounters::eventName(Event event) {
+  switch (event) {
+  case CYCLES:
+    return "cycles";
+  case INSTRUCTIONS:
+    return "instructions";
+  case BRANCH_MISSES:
+    return "branch-misses";
+  case L1I_MISSES:
+    return "L1i-misses";
+  default:
+    return "unknown";
+  }
+}
+
+bool PerfCounters::read(Counts &counts) const {
+#ifdef __linux__
+  struct {
+    uint64_t count;
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+    uint64_t values[EVENT_COUNT];
+  } data;
+  if (::read(leader, &data, sizeof(data)) <= 0 || data.count != opened) {
+    return false;
+  }
+  // Scale up if the kernel multiplexed the group with other events.
+  const double scale =
+      data.timeRunning == 0 || data.timeRunning >= data.timeEnabled
+          ? 1.0
+          : static_cast<double>(data.timeEnabled) / data.timeRunning;
+  for (size_t event = 0; event < EVENT_COUNT; event++) {
+    counts[event] = slot[event] < 0
+                        ? 0
+                        : static_cast<uint64_t>(data.values[slot[event]] *
+                                                scale);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PerfCounters::charge(const Function *function) {
+  Counts now;
+  if (!read(now)) {
+    return;
+  }
+  Counts &self = perFunction[function].self;
+  for (size_t event = 0; event < EVENT_COUNT; event++) {
+    self[event] += now[event] - last[event];
+  }
+  last = now;
+}
+
+void PerfCounters::begin() {
+  if (!available()) {
+    return;
+  }
+#ifdef __linux__
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  if (read(last)) {
+    runStart = last;
+  }
+}
+
+void PerfCounters::end(const Function *running) {
+  if (!available()) {
+    return;
+  }
+  if (trackFunctions) {
+    charge(running);
+  } else if (!read(last)) {
+    return;
+  }
+#ifdef __linux__
+  ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  for (size_t event = 0; event < EVENT_COUNT; event++) {
+    totals[event] += last[event] - runStart[event];
+  }
+  runCount++;
+}
+
+void PerfCounters::enter(const Function *caller, const Function *callee) {
+  if (!available()) {
+    return;
+  }
+  charge(caller);
+  perFunction[callee].calls++;
+}
+
+void PerfCounters::leave(const Function *callee) {
+  if (!available()) {
+    return;
+  }
+  charge(callee);
+}
+
+void PerfCounters::report(std::ostream &out) const {
+  if (!available()) {
+    out << "Performance counters unavailable: " << error_ << '\n';
+    return;
+  }
+  if (!error_.empty()) {
+    out << "Performance counters: " << error_ << '\n';
+  }
+  auto cell = [&](const Counts &counts, Event event) {
+    return has(event) ? fmt::format("{}", counts[event]) : std::string{"n/a"};
+  };
+
+  out << fmt::format("{:<24} {:>10} {:>14} {:>14} {:>6} {:>13} {:>12}\n",
+                     "function", "calls", "cycles", "instructions", "IPC",
+                     "branch-miss", "L1i-miss");
+  out << fmt::format("{:<24} {:>10} {:>14} {:>14} {:>6} {:>13} {:>12}\n",
+                     fmt::format("total ({} runs)", runCount), "",
+                     cell(totals, CYCLES), cell(totals, INSTRUCTIONS),
+                     ratio(totals[INSTRUCTIONS], totals[CYCLES]),
+                     cell(totals, BRANCH_MISSES), cell(totals, L1I_MISSES));
+
+  const Event key = has(CYCLES) ? CYCLES : INSTRUCTIONS;
+  std::vector<std::pair<const Function *, FunctionCounts>> functions(
+      perFunction.begin(), perFunction.end());
+  std::sort(functions.begin(), functions.end(),
+            [&](const auto &a, const auto &b) {
+              return a.second.self[key] > b.second.self[key];
+            });
+  for (const auto &[function, counts] : functions) {
+    out << fmt::format(
+        "{:<24} {:>10} {:>14} {:>14} {:>6} {:>13} {:>12}\n",
+        functionName(function), counts.calls, cell(counts.self, CYCLES),
+        cell(counts.self, INSTRUCTIONS),
+        ratio(counts.self[INSTRUCTIONS], counts.self[CYCLES]),
+        cell(counts.self, BRANCH_MISSES), cell(counts.self, L1I_MISSES));
+  }
+}
+
+void PerfCounters::writeJson(std::ostream &out) const {
+  auto counts = [&](const Counts &values) {
+    std::string fields;
+    for (size_t event = 0; event < EVENT_COUNT; event++) {
+      if (has(static_cast<Event>(event))) {
+        fields += fmt::format(",\"{}\":{}", eventName(static_cast<Event>(event)),
+                              values[event]);
+      }
+    }
+    return fields;
+  };
+
+  if (!available()) {
+    out << fmt::format("{{\"available\":false,\"error\":\"{}\"}}\n", error_);
+    return;
+  }
+  out << fmt::format("{{\"available\":true,\"total\":{{\"runs\":{}{}}}",
+                     runCount, counts(totals));
+  out << ",\"functions\":[";
+  bool first = true;
+  for (const auto &[function, entry] : perFunction) {
+    const size_t line =
+        function == nullptr ? 0 : function->chunk->getLine(0);
+    out << fmt::format("{}{{\"name\":\"{}\",\"line\":{},\"calls\":{}{}}}",
+                       first ? "" : ",", functionName(function), line,
+                       entry.calls, counts(entry.self));
+    first = false;
+  }
+  out << "]}\n";
+}
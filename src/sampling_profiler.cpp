@@ -0,0 +1,143 @@
+#include "sampling_profiler.hpp"
+#include "call_frame.hpp"
+#include "chunk.hpp"
+#include "vm.hpp"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <map>
+#include <ostream>
+#include <signal.h>
+#include <span>
+#include <string>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+std::atomic<SamplingProfiler *> SamplingProfiler::active{nullptr};
+
+SamplingProfiler::SamplingProfiler(unsigned hz)
+    : hz{hz == 0 ? DEFAULT_HZ : hz} {}
+
+SamplingProfiler::~SamplingProfiler() { stop(); }
+
+bool SamplingProfiler::start(const VM &target) {
+  SamplingProfiler *expected = nullptr;
+  if (!active.compare_exchange_strong(expected, this)) {
+    return false;
+  }
+  vm = &target;
+  if (!buffer) {
+    buffer = std::make_unique<Site[]>(BUFFER_FRAMES);
+  }
+
+  struct sigaction action {};
+  action.sa_handler = &SamplingProfiler::handleSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, nullptr);
+
+  const long interval = 1'000'000'000L / hz;
+#ifdef __linux__
+  // Count CPU time of this thread only and deliver the signal to it, so the
+  // handler never runs on a thread pool worker while this one mutates the
+  // frames it walks.
+  sigevent event{};
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event._sigev_un._tid = static_cast<pid_t>(syscall(SYS_gettid));
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) {
+    active.store(nullptr);
+    return false;
+  }
+  itimerspec spec{};
+  spec.it_interval.tv_nsec = interval % 1'000'000'000L;
+  spec.it_interval.tv_sec = interval / 1'000'000'000L;
+  spec.it_value = spec.it_interval;
+  timer_settime(timer, 0, &spec, nullptr);
+#else
+  itimerval spec{};
+  spec.it_interval.tv_usec = interval / 1000 % 1'000'000;
+  spec.it_interval.tv_sec = interval / 1'000'000'000L;
+  spec.it_value = spec.it_interval;
+  setitimer(ITIMER_PROF, &spec, nullptr);
+#endif
+  return true;
+}
+
+void SamplingProfiler::stop() {
+  if (active.load() != this) {
+    return;
+  }
+#ifdef __linux__
+  timer_delete(timer);
+#else
+  itimerval spec{};
+  setitimer(ITIMER_PROF, &spec, nullptr);
+#endif
+  active.store(nullptr);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+void SamplingProfiler::handleSignal(int) {
+  SamplingProfiler *profiler = active.load(std::memory_order_relaxed);
+  if (profiler != nullptr) {
+    const int savedErrno = errno;
+    profiler->sample();
+    errno = savedErrno;
+  }
+}
+
+void SamplingProfiler::sample() {
+  const std::span<const CallFrame> frames = vm->callStack();
+  if (used + frames.size() + 1 > BUFFER_FRAMES) {
+    droppedCount++;
+    return;
+  }
+  buffer[used++] = Site{nullptr, frames.size()};
+  for (const CallFrame &frame : frames) {
+    const Function *function = frame.closure->function;
+    buffer[used++] = Site{
+        function, static_cast<size_t>(frame.getIp() -
+                                      function->chunk->code().begin())};
+  }
+  sampleCount++;
+}
+
+void SamplingProfiler::writeCollapsed(std::ostream &out) const {
+  std::map<std::string, uint64_t> stacks;
+  std::string stack;
+  for (size_t i = 0; i < used;) {
+    const size_t depth = buffer[i++].offset;
+    stack.clear();
+    if (depth == 0) {
+      // Compiling, or in host code between runs.
+      stack = "(outside vm)";
+    }
+    for (size_t end = i + depth; i < end; i++) {
+      const Site &site = buffer[i];
+      // The ip has moved past the opcode being executed (for callers, past
+      // the call), so attribute the sample to the byte before it.
+      const size_t line =
+          site.function->chunk->getLine(site.offset == 0 ? 0 : site.offset - 1);
+      if (!stack.empty()) {
+        stack += ';';
+      }
+      stack += fmt::format("{}:{}",
+                           site.function->name.empty()
+                               ? std::string_view{"script"}
+                               : std::string_view{site.function->name},
+                           line);
+    }
+    stacks[stack]++;
+  }
+  for (const auto &[name, count] : stacks) {
+    out << name << ' ' << count << '\n';
+  }
+}
@@ -26,10 +26,16 @@ const Token Scanner::scanToken() noexcept {
     return makeToken(TokenType::LEFT_BRACE);
   case '}':
     return makeToken(TokenType::RIGHT_BRACE);
+  case '[':
+    return makeToken(TokenType::LEFT_BRACKET);
+  case ']':
+    return makeToken(TokenType::RIGHT_BRACKET);
   case ';':
     return makeToken(TokenType::SEMICOLON);
   case ',':
     return makeToken(TokenType::COMMA);
+  case ':':
+    return makeToken(TokenType::COLON);
   case '.':
     return makeToken(TokenType::DOT);
   case '-':
@@ -93,11 +99,11 @@ const Token Scanner::handleString() noexcept {
 const Token Scanner::handleNumber() noexcept {
   while (std::isdigit(peek())) {
     advance();
-    if (peek() == '.' && std::isdigit(peekNext())) {
+  }
+  if (peek() == '.' && std::isdigit(peekNext())) {
+    advance();
+    while (std::isdigit(peek())) {
       advance();
-      while (std::isdigit(peek())) {
-        advance();
-      }
     }
   }
   return makeToken(TokenType::NUMBER);
@@ -131,7 +137,15 @@ const TokenType Scanner::identifyIdentifierType() noexcept {
     }
     break;
   case 'i':
-    return checkKeyword(1, "f", TokenType::IF);
+    if (current - start > 1) {
+      switch (source[start + 1]) {
+      case 'f':
+        return checkKeyword(2, "", TokenType::IF);
+      case 'n':
+        return checkKeyword(2, "", TokenType::IN);
+      }
+    }
+    break;
   case 'n':
     return checkKeyword(1, "il", TokenType::NIL);
   case 'o':
@@ -163,7 +177,8 @@ const TokenType Scanner::identifyIdentifierType() noexcept {
 const TokenType Scanner::checkKeyword(const size_t start,
                                       const std::string_view rest,
                                       const TokenType type) {
-  if (rest.compare(source.substr(this->start + start, rest.size())) == 0) {
+  if (current - this->start == start + rest.size() &&
+      rest.compare(source.substr(this->start + start, rest.size())) == 0) {
     return type;
   }
   return TokenType::IDENTIFIER;
@@ -0,0 +1,168 @@
+#include "simd.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && !defined(__SANITIZE_ADDRESS__)
+#define SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+// load() returns a 32-byte vector by value; it is always inlined, so the ABI
+// warning GCC emits for non-AVX builds doesn't apply.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace {
+
+// Four lanes maps to one AVX register or two SSE2 registers.
+typedef double double4 __attribute__((vector_size(32)));
+constexpr size_t LANES = 4;
+
+__attribute__((always_inline)) inline double4 load(const double *ptr) {
+  double4 v;
+  std::memcpy(&v, ptr, sizeof(v));
+  return v;
+}
+
+__attribute__((always_inline)) inline void store(double *ptr, const double4 &v) {
+  std::memcpy(ptr, &v, sizeof(v));
+}
+
+__attribute__((always_inline)) inline double4 splat(double x) {
+  return double4{x, x, x, x};
+}
+
+// 32 bytes, compared a vector at a time when searching text.
+typedef char char32 __attribute__((vector_size(32)));
+typedef uint64_t uint64x4 __attribute__((vector_size(32)));
+constexpr size_t BYTES = 32;
+
+__attribute__((always_inline)) inline double horizontalSum(const double4 &v) {
+  return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+} // namespace
+
+namespace simd {
+
+// Two independent accumulators hide the latency of the vector adds.
+SIMD_CLONES double sum(const double *data, size_t size) noexcept {
+  double4 acc0 = splat(0.0);
+  double4 acc1 = splat(0.0);
+  size_t i = 0;
+  for (; i + 2 * LANES <= size; i += 2 * LANES) {
+    acc0 += load(data + i);
+    acc1 += load(data + i + LANES);
+  }
+  double result = horizontalSum(acc0 + acc1);
+  for (; i < size; i++) {
+    result += data[i];
+  }
+  return result;
+}
+
+SIMD_CLONES double dot(const double *a, const double *b, size_t size) noexcept {
+  double4 acc0 = splat(0.0);
+  double4 acc1 = splat(0.0);
+  size_t i = 0;
+  for (; i + 2 * LANES <= size; i += 2 * LANES) {
+    acc0 += load(a + i) * load(b + i);
+    acc1 += load(a + i + LANES) * load(b + i + LANES);
+  }
+  double result = horizontalSum(acc0 + acc1);
+  for (; i < size; i++) {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+SIMD_CLONES double min(const double *data, size_t size) noexcept {
+  double result = data[0];
+  size_t i = 0;
+  if (size >= LANES) {
+    double4 acc = load(data);
+    for (i = LANES; i + LANES <= size; i += LANES) {
+      const double4 v = load(data + i);
+      acc = v < acc ? v : acc;
+    }
+    result = acc[0];
+    for (size_t lane = 1; lane < LANES; lane++) {
+      result = acc[lane] < result ? acc[lane] : result;
+    }
+  }
+  for (; i < size; i++) {
+    result = data[i] < result ? data[i] : result;
+  }
+  return result;
+}
+
+SIMD_CLONES double max(const double *data, size_t size) noexcept {
+  double result = data[0];
+  size_t i = 0;
+  if (size >= LANES) {
+    double4 acc = load(data);
+    for (i = LANES; i + LANES <= size; i += LANES) {
+      const double4 v = load(data + i);
+      acc = v > acc ? v : acc;
+    }
+    result = acc[0];
+    for (size_t lane = 1; lane < LANES; lane++) {
+      result = acc[lane] > result ? acc[lane] : result;
+    }
+  }
+  for (; i < size; i++) {
+    result = data[i] > result ? data[i] : result;
+  }
+  return result;
+}
+
+SIMD_CLONES void scale(double *data, size_t size, double factor) noexcept {
+  const double4 k = splat(factor);
+  size_t i = 0;
+  for (; i + LANES <= size; i += LANES) {
+    store(data + i, load(data + i) * k);
+  }
+  for (; i < size; i++) {
+    data[i] *= factor;
+  }
+}
+
+SIMD_CLONES void axpy(double alpha, const double *x, double *y,
+                      size_t size) noexcept {
+  const double4 a = splat(alpha);
+  size_t i = 0;
+  for (; i + LANES <= size; i += LANES) {
+    store(y + i, a * load(x + i) + load(y + i));
+  }
+  for (; i < size; i++) {
+    y[i] = alpha * x[i] + y[i];
+  }
+}
+
+// Tests 32 bytes per compare and only looks at single bytes in the block
+// with the match.
+SIMD_CLONES size_t find(const char *data, size_t size, char byte) noexcept {
+  const char32 needle = char32{} + byte;
+  size_t i = 0;
+  for (; i + BYTES <= size; i += BYTES) {
+    char32 block;
+    std::memcpy(&block, data + i, sizeof(block));
+    const auto match = block == needle;
+    uint64x4 lanes;
+    std::memcpy(&lanes, &match, sizeof(lanes));
+    if ((lanes[0] | lanes[1] | lanes[2] | lanes[3]) != 0) {
+      break;
+    }
+  }
+  for (; i < size; i++) {
+    if (data[i] == byte) {
+      return i;
+    }
+  }
+  return size;
+}
+
+} // namespace simd
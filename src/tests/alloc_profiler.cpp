@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include "alloc_profiler.hpp"
+#include "vm.hpp"
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+class AllocationProfilerTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    void run(std::string_view source) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+        testing::internal::GetCapturedStdout();
+    }
+
+    // Estimated allocations of `type` at runtime sites in `function`, or in
+    // any function if `function` is empty.
+    double estimated(ValueType type, std::string_view function = {}) {
+        double count = 0;
+        for (const auto &[site, stats] : vm.allocationProfile()->sites()) {
+            if (site.type == type && !site.compile &&
+                (function.empty() ||
+                 (site.function != nullptr && site.function->name == function))) {
+                count += stats.count;
+            }
+        }
+        return count;
+    }
+
+    VM vm{};
+};
+
+TEST_F(AllocationProfilerTest, CountsEveryAllocationByType) {
+    const AllocationProfiler &profiler = vm.enableAllocationProfiler(4096);
+    run("for (var i = 0; i < 10; i = i + 1) { var a = [i]; var m = {1: i}; }");
+    const auto &types = profiler.types();
+    EXPECT_EQ(types[static_cast<size_t>(ValueType::ARRAY)].count, 10);
+    EXPECT_EQ(types[static_cast<size_t>(ValueType::MAP)].count, 10);
+    EXPECT_EQ(types[static_cast<size_t>(ValueType::ARRAY)].bytes,
+              10 * sizeof(ArrayObj));
+    // The script itself, compiled.
+    EXPECT_EQ(types[static_cast<size_t>(ValueType::FUNCTION)].count, 1);
+}
+
+TEST_F(AllocationProfilerTest, AttributesSitesToFunctionAndLine) {
+    // Every allocation is sampled at a one-byte interval.
+    vm.enableAllocationProfiler(1);
+    run("fun make() {\n"
+        "  return [1, 2];\n"
+        "}\n"
+        "for (var i = 0; i < 5; i = i + 1) make();");
+    bool found = false;
+    for (const auto &[site, stats] : vm.allocationProfile()->sites()) {
+        if (site.type == ValueType::ARRAY) {
+            ASSERT_NE(site.function, nullptr);
+            EXPECT_EQ(site.function->name, "make");
+            EXPECT_EQ(site.line, 2);
+            EXPECT_FALSE(site.compile);
+            EXPECT_EQ(stats.samples, 5);
+            found = true;
+        }
+    }
+    EXPECT_TRUE(found);
+}
+
+TEST_F(AllocationProfilerTest, CountsOnlyNewConcatenatedStrings) {
+    const AllocationProfiler &profiler = vm.enableAllocationProfiler(1);
+    run("var s = \"a\" + \"b\";\n"
+        "var t = \"a\" + \"b\";");
+    EXPECT_GT(estimated(ValueType::STRING), 0);
+    size_t runtimeSamples = 0;
+    for (const auto &[site, stats] : profiler.sites()) {
+        if (site.type == ValueType::STRING && !site.compile) {
+            runtimeSamples += stats.samples;
+        }
+    }
+    EXPECT_EQ(runtimeSamples, 1);
+}
+
+TEST_F(AllocationProfilerTest, SampledEstimatesTrackExactCounts) {
+    const AllocationProfiler &profiler = vm.enableAllocationProfiler(1024);
+    run("fun make() {\n"
+        "  return [];\n"
+        "}\n"
+        "for (var i = 0; i < 4000; i = i + 1) make();");
+    EXPECT_EQ(profiler.types()[static_cast<size_t>(ValueType::ARRAY)].count,
+              4000);
+    EXPECT_NEAR(estimated(ValueType::ARRAY, "make"), 4000, 1000);
+}
+
+TEST_F(AllocationProfilerTest, WritesReportAndJson) {
+    const AllocationProfiler &profiler = vm.enableAllocationProfiler(1);
+    run("var a = [1];");
+    std::ostringstream report;
+    profiler.report(report);
+    EXPECT_NE(report.str().find("array"), std::string::npos);
+    EXPECT_NE(report.str().find("script:1"), std::string::npos);
+    std::ostringstream json;
+    profiler.writeJson(json);
+    EXPECT_EQ(json.str().rfind("{\"interval\":1,", 0), 0);
+    EXPECT_NE(json.str().find("\"type\":\"array\""), std::string::npos);
+}
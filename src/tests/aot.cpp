@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include "aot.hpp"
+#include "function.hpp"
+#include "mehh_aot.h"
+#include "value.hpp"
+#include "vm.hpp"
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+class AotTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    const Function *compile(std::string_view source) {
+        const std::optional<const Function *> script = vm.compile(source);
+        EXPECT_TRUE(script.has_value());
+        return script.value_or(nullptr);
+    }
+
+    std::string emit(std::string_view source) {
+        std::ostringstream out;
+        emitC(compile(source), source, out);
+        return out.str();
+    }
+
+    VM vm{};
+};
+
+TEST_F(AotTest, SharesValueRepresentation) {
+    EXPECT_EQ(Value{}.bits(), MEHH_NIL);
+    EXPECT_EQ(Value{false}.bits(), MEHH_FALSE);
+    EXPECT_EQ(Value{true}.bits(), MEHH_TRUE);
+    EXPECT_EQ(Value{2.5}.bits(), mehh_number(2.5));
+    EXPECT_EQ(mehh_as_number(Value{-1.0}.bits()), -1.0);
+    EXPECT_TRUE(mehh_is_number(Value{0.0}.bits()));
+    EXPECT_FALSE(mehh_is_number(Value{}.bits()));
+    EXPECT_TRUE(mehh_falsey(Value{false}.bits()));
+    EXPECT_FALSE(mehh_falsey(Value{0.0}.bits()));
+}
+
+TEST_F(AotTest, TranslatesLocalsToCVariables) {
+    const std::string c = emit("fun f(a, b) {\n"
+                               "  var c = a + b;\n"
+                               "  return c * 2;\n"
+                               "}\n"
+                               "print f(1, 2);\n");
+    // f is the second function; its parameters arrive in slots 1 and 2.
+    EXPECT_NE(c.find("static bool mehh_f1("), std::string::npos);
+    EXPECT_NE(c.find("mehh_value v2 = slots[2];"), std::string::npos);
+    // Stack slots are variables too, which the C compiler folds away.
+    EXPECT_NE(c.find("  v3 = v1;\n"), std::string::npos);
+    EXPECT_NE(c.find("if (mehh_is_number(v3) && mehh_is_number(v4)) v3 = "
+                     "mehh_number(mehh_as_number(v3) + mehh_as_number(v4));"),
+              std::string::npos);
+    // The constant 2 is inlined as its bits.
+    EXPECT_NE(c.find("v5 = UINT64_C(0x4000000000000000);"), std::string::npos);
+    EXPECT_NE(c.find("*result = v4;\n  return true;"), std::string::npos);
+    EXPECT_NE(c.find("mehh_aot_main(source, entries, 2, "), std::string::npos);
+}
+
+TEST_F(AotTest, ChecksumIdentifiesBytecode) {
+    const Function *first = compile("fun f(x) { return x; } print f(1);");
+    const Function *same = compile("fun f(x) { return x; } print f(1);");
+    const Function *other = compile("fun f(x) { return -x; } print f(1);");
+
+    const auto functions = aotFunctions(first);
+    ASSERT_EQ(functions.size(), 2);
+    EXPECT_EQ(functions[0], first);
+    EXPECT_EQ(functions[1]->name, "f");
+
+    EXPECT_EQ(aotChecksum(functions), aotChecksum(aotFunctions(same)));
+    EXPECT_NE(aotChecksum(functions), aotChecksum(aotFunctions(other)));
+}
+
+TEST_F(AotTest, LeavesGeneratorsToTheInterpreter) {
+    const std::string c = emit("fun* gen(n) { yield n; }\n"
+                               "fun f() {\n"
+                               "  for (var x in gen(1)) print x;\n"
+                               "}\n"
+                               "f();\n");
+    EXPECT_EQ(c.find("static bool mehh_gen1("), std::string::npos);
+    EXPECT_NE(c.find("static bool mehh_f2("), std::string::npos);
+    EXPECT_NE(c.find("mehh_iterate(vm, "), std::string::npos);
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include "simd.hpp"
+#include "vm.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ArrayTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    std::string run(std::string_view source,
+                    InterpretResult expected = INTERPRET_OK) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), expected);
+        return testing::internal::GetCapturedStdout();
+    }
+
+    VM vm{};
+};
+
+TEST_F(ArrayTest, KernelsHandleRemainders) {
+    // Sizes around the vector width exercise the scalar tails.
+    for (size_t size = 1; size < 20; size++) {
+        std::vector<double> a(size);
+        std::vector<double> b(size);
+        double sum = 0, dot = 0;
+        for (size_t i = 0; i < size; i++) {
+            a[i] = static_cast<double>(i) - 7;
+            b[i] = 2.0 * i;
+            sum += a[i];
+            dot += a[i] * b[i];
+        }
+        EXPECT_DOUBLE_EQ(simd::sum(a.data(), size), sum);
+        EXPECT_DOUBLE_EQ(simd::dot(a.data(), b.data(), size), dot);
+        EXPECT_DOUBLE_EQ(simd::min(a.data(), size), -7);
+        EXPECT_DOUBLE_EQ(simd::max(a.data(), size), size - 8.0);
+
+        simd::axpy(0.5, b.data(), a.data(), size);
+        simd::scale(a.data(), size, 2.0);
+        for (size_t i = 0; i < size; i++) {
+            EXPECT_DOUBLE_EQ(a[i], 2.0 * ((i - 7.0) + i));
+        }
+    }
+}
+
+TEST_F(ArrayTest, IndexGetAndSet) {
+    EXPECT_EQ(run("var a = [1, 2, 3];"
+                  "a[1] = a[0] + a[2];"
+                  "print a[1];"
+                  "print len(a);"),
+              "4\n3\n");
+}
+
+TEST_F(ArrayTest, MixedContentsFallBackAndRespecialize) {
+    EXPECT_EQ(run("var a = [1, nil, 3];"
+                  "a[1] = 2;"
+                  "print sum(a);"),
+              "6\n");
+}
+
+TEST_F(ArrayTest, KernelsRejectNonNumbers) {
+    run("print sum([1, true]);", INTERPRET_RUNTIME_ERROR);
+}
+
+TEST_F(ArrayTest, OutOfBoundsIsRuntimeError) {
+    run("var a = [1]; print a[1];", INTERPRET_RUNTIME_ERROR);
+    run("var a = [1]; print a[0.5];", INTERPRET_RUNTIME_ERROR);
+    run("var a = [1]; a[-1] = 2;", INTERPRET_RUNTIME_ERROR);
+}
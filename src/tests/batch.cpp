@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include "batch.hpp"
+#include "vm.hpp"
+#include <cmath>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class BatchTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    Value define(std::string_view source, std::string_view name) {
+        EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+        return vm.global(name).value();
+    }
+
+    static bool vectorizes(const Value &function) {
+        return BatchProgram::compile(
+                   *function.asObj()->as<Closure>()->function)
+            .has_value();
+    }
+
+    // Runs `function` over both columns in batch and returns the results.
+    std::vector<double> run(const Value &function, const std::vector<double> &x,
+                            const std::vector<double> &y,
+                            InterpretResult expected = INTERPRET_OK) {
+        std::vector<double> results(x.size());
+        const std::span<const double> columns[] = {x, y};
+        EXPECT_EQ(vm.callBatch(function, columns, results), expected);
+        return results;
+    }
+
+    VM vm{};
+};
+
+TEST_F(BatchTest, DivergentBranchesAndLoops) {
+    const Value score = define("fun score(x, y) {"
+                               "  var s = x * 2 + y;"
+                               "  if (s > 10) s = s - 10; else s = -s;"
+                               "  for (var i = 0; i < x; i = i + 1) s = s + 1;"
+                               "  return s;"
+                               "}",
+                               "score");
+    EXPECT_TRUE(vectorizes(score));
+
+    // More rows than one batch, with a partial last batch.
+    std::vector<double> x, y;
+    for (int i = 0; i < 1000; i++) {
+        x.push_back(i % 13);
+        y.push_back(i % 7 - 3);
+    }
+    const std::vector<double> results = run(score, x, y);
+    for (size_t i = 0; i < x.size(); i++) {
+        double s = x[i] * 2 + y[i];
+        s = s > 10 ? s - 10 : -s;
+        EXPECT_EQ(results[i], s + x[i]) << "row " << i;
+    }
+}
+
+TEST_F(BatchTest, NegatedComparisonsMatchScalar) {
+    const Value pick = define("fun pick(x, y) {"
+                              "  if (x <= y and !(x == 3) and x != y) return 1;"
+                              "  return 0;"
+                              "}",
+                              "pick");
+    EXPECT_TRUE(vectorizes(pick));
+    // x <= y compiles to !(x > y), so it holds against NaN.
+    const std::vector<double> results =
+        run(pick, {1, 2, 3, 4, 5}, {3, 2, 5, 1, NAN});
+    EXPECT_EQ(results, (std::vector<double>{1, 0, 0, 0, 1}));
+
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(vm.interpret("print pick(1, 3); print pick(2, 2); print !nil;"),
+              INTERPRET_OK);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "1\n0\ntrue\n");
+}
+
+TEST_F(BatchTest, UnsupportedFunctionsRunRowByRow) {
+    const Value norm = define("fun norm(x, y) { return sqrt(x * x + y * y); }",
+                              "norm");
+    EXPECT_FALSE(vectorizes(norm));
+    EXPECT_EQ(run(norm, {3, 5}, {4, 12}), (std::vector<double>{5, 13}));
+}
+
+TEST_F(BatchTest, NonNumericResultIsRuntimeError) {
+    const Value sign = define("fun sign(x, y) {"
+                              "  if (x < 0) return \"negative\";"
+                              "  return x;"
+                              "}",
+                              "sign");
+    EXPECT_FALSE(vectorizes(sign));
+    testing::internal::CaptureStdout();
+    run(sign, {1, -1}, {0, 0}, INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(),
+              "Batch function must return a number.\n");
+}
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include "channel.hpp"
+#include "code_image.hpp"
+#include "vm.hpp"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+Message number(double n) {
+    Message message;
+    message.value = Value{n};
+    return message;
+}
+
+} // namespace
+
+TEST(ChannelTest, QueuesInOrderUpToCapacity) {
+    Channel channel{3};
+    EXPECT_EQ(channel.capacity(), 4);
+    for (int i = 0; i < 4; i++) {
+        Message message = number(i);
+        EXPECT_TRUE(channel.trySend(message));
+    }
+    Message extra = number(4);
+    EXPECT_FALSE(channel.trySend(extra));
+    for (int i = 0; i < 4; i++) {
+        Message message;
+        ASSERT_TRUE(channel.tryReceive(message));
+        EXPECT_EQ(message.value.asNumber(), i);
+    }
+    Message none;
+    EXPECT_FALSE(channel.tryReceive(none));
+}
+
+TEST(ChannelTest, PassesEveryMessageOnceBetweenThreads) {
+    constexpr int PRODUCERS = 3;
+    constexpr int CONSUMERS = 3;
+    constexpr int PER_PRODUCER = 20000;
+    // Small, so senders and receivers both have to park.
+    Channel channel{8};
+    std::vector<int64_t> totals(CONSUMERS, 0);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < CONSUMERS; c++) {
+        threads.emplace_back([&, c] {
+            Message message;
+            while (channel.receive(message)) {
+                totals[c] += static_cast<int64_t>(message.value.asNumber());
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&] {
+            for (int i = 1; i <= PER_PRODUCER; i++) {
+                Message message = number(i);
+                ASSERT_TRUE(channel.send(message));
+            }
+        });
+    }
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+    channel.close();
+    for (std::thread &consumer : threads) {
+        consumer.join();
+    }
+    int64_t total = 0;
+    for (int64_t part : totals) {
+        total += part;
+    }
+    EXPECT_EQ(total, int64_t{PRODUCERS} * PER_PRODUCER * (PER_PRODUCER + 1) / 2);
+    Message late = number(0);
+    EXPECT_FALSE(channel.send(late));
+}
+
+TEST(ChannelTest, ReceivesEveryAcceptedSendAcrossClose) {
+    constexpr int PRODUCERS = 4;
+    constexpr int CONSUMERS = 2;
+    for (int round = 0; round < 50; round++) {
+        Channel channel{64};
+        std::vector<int64_t> accepted(PRODUCERS, 0);
+        std::vector<int64_t> received(CONSUMERS, 0);
+        std::vector<std::thread> threads;
+        for (int c = 0; c < CONSUMERS; c++) {
+            threads.emplace_back([&, c] {
+                Message message;
+                while (channel.receive(message)) {
+                    received[c]++;
+                }
+            });
+        }
+        for (int p = 0; p < PRODUCERS; p++) {
+            threads.emplace_back([&, p] {
+                for (int i = 0;; i++) {
+                    Message message = number(i);
+                    if (!channel.send(message)) {
+                        return;
+                    }
+                    accepted[p]++;
+                }
+            });
+        }
+        // Close while the senders are still going.
+        std::this_thread::sleep_for(std::chrono::microseconds{200});
+        channel.close();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        int64_t sent = 0;
+        for (int64_t count : accepted) {
+            sent += count;
+        }
+        int64_t got = 0;
+        for (int64_t count : received) {
+            got += count;
+        }
+        EXPECT_EQ(got, sent) << "round " << round;
+    }
+}
+
+TEST(ChannelTest, CopiesValuesBetweenVMs) {
+    const auto channel = std::make_shared<Channel>(4);
+    std::ostringstream consumerOutput;
+    std::thread producer([&] {
+        VM vm{};
+        const std::optional<Handle> script = vm.load(
+            "fun produce(ch) {\n"
+            "  for (var i = 0; i < 500; i = i + 1) {\n"
+            "    send(ch, [i, {\"k\": i * 2, \"list\": [1, \"x\", nil]}]);\n"
+            "  }\n"
+            "  close(ch);\n"
+            "}\n");
+        ASSERT_TRUE(vm.call(*script).has_value());
+        EXPECT_TRUE(vm.call(*vm.function("produce"), vm.channel(channel))
+                        .has_value());
+    });
+    VM vm{};
+    vm.setOutput(consumerOutput);
+    const std::optional<Handle> script = vm.load(
+        "fun consume(ch) {\n"
+        "  var total = 0;\n"
+        "  var count = 0;\n"
+        "  for (var v = receive(ch); v != nil; v = receive(ch)) {\n"
+        "    total = total + v[0] + v[1][\"k\"] + len(v[1][\"list\"]);\n"
+        "    count = count + 1;\n"
+        "  }\n"
+        "  print count;\n"
+        "  return total;\n"
+        "}\n");
+    ASSERT_TRUE(vm.call(*script).has_value());
+    const std::optional<Value> total =
+        vm.call(*vm.function("consume"), vm.channel(channel));
+    producer.join();
+    ASSERT_TRUE(total.has_value());
+    EXPECT_EQ(total->asNumber(), 3 * 124750 + 3 * 500);
+    EXPECT_EQ(consumerOutput.str(), "500\n");
+}
+
+TEST(ChannelTest, MovesImageStringsWithoutCopying) {
+    const std::shared_ptr<const CodeImage> image =
+        CodeImage::compile("fun give(ch) { send(ch, \"shared\"); }\n"
+                           "fun take(ch) { return receive(ch); }\n");
+    ASSERT_NE(image, nullptr);
+    const auto channel = std::make_shared<Channel>(4, image);
+    VM sender{image};
+    VM receiver{image};
+    VM stranger{};
+    ASSERT_TRUE(sender.call(*sender.script()).has_value());
+    ASSERT_TRUE(receiver.call(*receiver.script()).has_value());
+    const Handle give = *sender.function("give");
+
+    ASSERT_TRUE(sender.call(give, sender.channel(channel)).has_value());
+    const std::optional<Value> moved =
+        receiver.call(*receiver.function("take"), receiver.channel(channel));
+    ASSERT_TRUE(moved.has_value());
+    EXPECT_EQ(moved->asObj(), image->strings().find("shared"));
+
+    // A VM running other code gets its own copy.
+    ASSERT_TRUE(sender.call(give, sender.channel(channel)).has_value());
+    ASSERT_TRUE(stranger.interpret("fun take(ch) { return receive(ch); }") ==
+                INTERPRET_OK);
+    const std::optional<Value> copied =
+        stranger.call(*stranger.function("take"), stranger.channel(channel));
+    ASSERT_TRUE(copied.has_value());
+    EXPECT_NE(copied->asObj(), moved->asObj());
+    EXPECT_EQ(copied->asObj()->as<StringObj>()->str, "shared");
+}
+
+TEST(ChannelTest, RejectsValuesThatCantLeaveTheirVM) {
+    VM vm{};
+    std::ostringstream out;
+    vm.setOutput(out);
+    EXPECT_EQ(vm.interpret("var ch = channel(2); fun f() {} send(ch, [f]);"),
+              INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(out.str(),
+              "Can only send nil, booleans, numbers, strings, arrays and "
+              "maps.\n[line 1] in script\nscript\nCall error\n");
+    out.str({});
+    EXPECT_EQ(vm.interpret("var a = [1, nil]; a[1] = a; send(channel(1), a);"),
+              INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(out.str().substr(0, out.str().find('\n')),
+              "Message is nested too deeply.");
+    out.str({});
+    EXPECT_EQ(vm.interpret("var c = channel(1); close(c); print receive(c);"
+                           "send(c, 1);"),
+              INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(out.str().substr(0, out.str().find("[line")),
+              "nil\nChannel is closed.\n");
+}
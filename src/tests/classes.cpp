@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include "vm.hpp"
+#include <string>
+#include <string_view>
+
+class ClassTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    std::string run(std::string_view source) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+        return testing::internal::GetCapturedStdout();
+    }
+
+    VM vm{};
+};
+
+TEST_F(ClassTest, InitializerSetsFields) {
+    EXPECT_EQ(run("class P { init(x, y) { this.x = x; this.y = y; } }"
+                  "var p = P(1, 2);"
+                  "print p.x + p.y;"),
+              "3\n");
+}
+
+TEST_F(ClassTest, InstancesWithDifferentLayoutsAtOneSite) {
+    // The same access site sees two shapes; the cache must not mix slots.
+    EXPECT_EQ(run("class A {}"
+                  "var a = A(); a.x = 1; a.y = 2;"
+                  "var b = A(); b.y = 3; b.x = 4;"
+                  "fun getY(o) { return o.y; }"
+                  "print getY(a) + getY(b) * 10 + getY(a) * 100;"),
+              "232\n");
+}
+
+TEST_F(ClassTest, InvokeUsesMethodAndThis) {
+    EXPECT_EQ(run("class C {"
+                  "  init() { this.n = 0; }"
+                  "  inc() { this.n = this.n + 1; return this; }"
+                  "}"
+                  "var c = C();"
+                  "c.inc().inc().inc();"
+                  "print c.n;"),
+              "3\n");
+}
+
+TEST_F(ClassTest, FieldShadowsMethodOnInvoke) {
+    EXPECT_EQ(run("class C { m() { return 1; } }"
+                  "fun two() { return 2; }"
+                  "var c = C();"
+                  "print c.m();"
+                  "c.m = two;"
+                  "print c.m();"),
+              "1\n2\n");
+}
+
+TEST_F(ClassTest, BoundMethodKeepsReceiver) {
+    EXPECT_EQ(run("class C { init(v) { this.v = v; } get() { return this.v; } }"
+                  "var m = C(7).get;"
+                  "print m();"),
+              "7\n");
+}
+
+TEST_F(ClassTest, OnlyMethodValuesAreBound) {
+    const AllocationProfiler &profile = vm.enableAllocationProfiler(
+        AllocationProfiler::DEFAULT_INTERVAL);
+    const auto bound = [&] {
+        return profile.types()[static_cast<size_t>(ValueType::BOUND_METHOD)]
+            .count;
+    };
+    EXPECT_EQ(run("class C { get() { return 1; } }"
+                  "var c = C();"
+                  "var total = 0;"
+                  "for (var i = 0; i < 100; i = i + 1) total = total + c.get();"
+                  "print total;"),
+              "100\n");
+    EXPECT_EQ(bound(), 0u);
+    // Every read is a binding of its own.
+    EXPECT_EQ(run("print c.get == c.get;"), "false\n");
+    EXPECT_EQ(bound(), 2u);
+}
+
+TEST_F(ClassTest, UndefinedPropertyIsRuntimeError) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(vm.interpret("class C {} print C().nope;"),
+              INTERPRET_RUNTIME_ERROR);
+    testing::internal::GetCapturedStdout();
+}
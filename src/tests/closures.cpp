@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+#include "debug.hpp"
+#include "vm.hpp"
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ClosureTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    std::string run(std::string_view source) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+        return testing::internal::GetCapturedStdout();
+    }
+
+    // The capture byte of every upvalue of every OP_CLOSURE in `source`,
+    // including those in the functions it defines, in bytecode order.
+    std::vector<uint8_t> captures(std::string_view source) {
+        const std::optional<const Function *> script = vm.compile(source);
+        EXPECT_TRUE(script.has_value());
+        std::vector<uint8_t> kinds;
+        if (script.has_value()) {
+            collectCaptures(**script, kinds);
+        }
+        return kinds;
+    }
+
+    VM vm{};
+
+private:
+    static void collectCaptures(const Function &function,
+                                std::vector<uint8_t> &kinds) {
+        const Chunk &chunk = *function.chunk;
+        std::ostringstream ignored;
+        for (size_t offset = 0; offset < chunk.getCode().size();) {
+            if (chunk.getCode()[offset] == OP_CLOSURE) {
+                const Function *inner =
+                    chunk.getConstants()
+                        .getValues()[chunk.getCode()[offset + 1]]
+                        .asObj()
+                        ->as<Function>();
+                for (int i = 0; i < inner->upvalueCount; i++) {
+                    kinds.push_back(chunk.getCode()[offset + 2 + 2 * i]);
+                }
+                collectCaptures(*inner, kinds);
+            }
+            offset = disassembleInstruction(chunk, offset, ignored);
+        }
+    }
+};
+
+TEST_F(ClosureTest, UnwrittenLocalIsCapturedByValue) {
+    EXPECT_EQ(captures("fun f() {"
+                       "  var x = 1;"
+                       "  fun get() { return x; }"
+                       "  return get;"
+                       "}"),
+              std::vector<uint8_t>{CAPTURE_VALUE});
+}
+
+TEST_F(ClosureTest, LocalWrittenAfterCaptureGetsACell) {
+    EXPECT_EQ(captures("fun f() {"
+                       "  var x = 1;"
+                       "  fun get() { return x; }"
+                       "  x = 2;"
+                       "  return get;"
+                       "}"),
+              std::vector<uint8_t>{CAPTURE_LOCAL});
+}
+
+TEST_F(ClosureTest, LocalWrittenInLoopGetsACell) {
+    EXPECT_EQ(captures("fun f() {"
+                       "  for (var i = 0; i < 3; i = i + 1) {"
+                       "    fun get() { return i; }"
+                       "  }"
+                       "}"),
+              std::vector<uint8_t>{CAPTURE_LOCAL});
+}
+
+TEST_F(ClosureTest, CounterSurvivesReturn) {
+    EXPECT_EQ(run("fun makeCounter() {"
+                  "  var i = 0;"
+                  "  fun count() { i = i + 1; return i; }"
+                  "  return count;"
+                  "}"
+                  "var c = makeCounter();"
+                  "c();"
+                  "print c();"),
+              "2\n");
+}
+
+TEST_F(ClosureTest, ClosuresShareCapturedLocal) {
+    EXPECT_EQ(run("fun f() {"
+                  "  var x = 1;"
+                  "  fun get() { return x; }"
+                  "  fun set(v) { x = v; }"
+                  "  set(2);"
+                  "  print get();"
+                  "}"
+                  "f();"),
+              "2\n");
+}
+
+TEST_F(ClosureTest, WriteAfterCaptureIsVisible) {
+    EXPECT_EQ(run("{"
+                  "  var a = 1;"
+                  "  fun f() { return a; }"
+                  "  a = 2;"
+                  "  print f();"
+                  "}"),
+              "2\n");
+}
+
+TEST_F(ClosureTest, LoopBodyLocalsAreCapturedPerIteration) {
+    EXPECT_EQ(run("{"
+                  "  var first;"
+                  "  for (var i = 0; i < 3; i = i + 1) {"
+                  "    var j = i;"
+                  "    fun f() { return j; }"
+                  "    if (i < 1) first = f;"
+                  "  }"
+                  "  print first();"
+                  "}"),
+              "0\n");
+}
+
+TEST_F(ClosureTest, LoopVariableWrittenInIncrementIsShared) {
+    EXPECT_EQ(run("{"
+                  "  var last;"
+                  "  for (var i = 0; i < 3; i = i + 1) {"
+                  "    fun f() { return i; }"
+                  "    last = f;"
+                  "  }"
+                  "  print last();"
+                  "}"),
+              "3\n");
+}
+
+TEST_F(ClosureTest, LocalFunctionCanRecurse) {
+    EXPECT_EQ(run("{"
+                  "  fun fact(n) { if (n < 2) return 1; return n * fact(n - 1); }"
+                  "  print fact(5);"
+                  "}"),
+              "120\n");
+}
+
+TEST_F(ClosureTest, ManyClosuresCanBeCreated) {
+    EXPECT_EQ(run("fun make(n) { fun get() { return n; } return get; }"
+                  "var total = 0;"
+                  "for (var i = 0; i < 1000; i = i + 1) total = total + make(i)();"
+                  "print total;"),
+              "499500\n");
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include "code_image.hpp"
+#include "executor.hpp"
+#include "vm.hpp"
+#include <future>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Objects of a class made by each VM, so every VM builds its own shapes
+// for the same property access sites.
+static const char *const POINTS =
+    "class P { init(x) { this.x = x; } twice() { return this.x * 2; } }\n"
+    "var total = 0;\n"
+    "for (var i = 0; i < 100; i = i + 1) {\n"
+    "  var p = P(i);\n"
+    "  p.y = p.x + 1;\n"
+    "  total = total + p.twice() + p.y;\n"
+    "}\n"
+    "print total;\n";
+
+TEST(CodeImageTest, RunsOneImageOnManyVMs) {
+    const std::shared_ptr<const CodeImage> image = CodeImage::compile(POINTS);
+    ASSERT_NE(image, nullptr);
+    std::ostringstream first;
+    std::ostringstream second;
+    VM a{image};
+    VM b{image};
+    a.setOutput(first);
+    b.setOutput(second);
+    // Interleaved, so a cache left behind by one VM would be hit by the other.
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(a.call(*a.script()).has_value());
+        ASSERT_TRUE(b.call(*b.script()).has_value());
+    }
+    EXPECT_EQ(first.str(), "14950\n14950\n14950\n");
+    EXPECT_EQ(second.str(), "14950\n14950\n14950\n");
+}
+
+TEST(CodeImageTest, KeepsGlobalsPerVM) {
+    const std::shared_ptr<const CodeImage> image =
+        CodeImage::compile("var n; if (n == nil) n = 0; n = n + 1;"
+                           "fun bump() { n = n + 1; return n; }");
+    ASSERT_NE(image, nullptr);
+    VM a{image};
+    VM b{image};
+    ASSERT_TRUE(a.call(*a.script()).has_value());
+    ASSERT_TRUE(b.call(*b.script()).has_value());
+    const Handle bump = a.function("bump").value();
+    EXPECT_EQ(a.call(bump)->asNumber(), 2);
+    EXPECT_EQ(a.call(bump)->asNumber(), 3);
+    EXPECT_EQ(b.global("n")->asNumber(), 1);
+}
+
+TEST(CodeImageTest, InternsRuntimeStringsThroughTheImage) {
+    const std::shared_ptr<const CodeImage> image =
+        CodeImage::compile("var key = \"ab\";\n"
+                           "var m = {\"ab\": 1};\n"
+                           "m[\"a\" + \"b\"] = m[\"a\" + \"b\"] + 1;\n"
+                           "print m[key];\n"
+                           "print len(m);\n");
+    ASSERT_NE(image, nullptr);
+    std::ostringstream out;
+    VM vm{image};
+    vm.setOutput(out);
+    ASSERT_TRUE(vm.call(*vm.script()).has_value());
+    EXPECT_EQ(out.str(), "2\n1\n");
+    // Literals are the image's strings in every VM made for it.
+    VM other{image};
+    ASSERT_TRUE(other.call(*other.script()).has_value());
+    EXPECT_EQ(vm.global("key")->asObj(), other.global("key")->asObj());
+    EXPECT_EQ(vm.string("ab").asObj(), other.string("ab").asObj());
+}
+
+TEST(CodeImageTest, ReportsCompileErrors) {
+    std::ostringstream out;
+    EXPECT_EQ(CodeImage::compile("print ;", out), nullptr);
+    EXPECT_EQ(out.str(), "[line 1] Error at ;: Expect expression\n");
+    EXPECT_FALSE(VM{}.script().has_value());
+}
+
+TEST(CodeImageTest, RunsOnExecutorWorkers) {
+    const std::shared_ptr<const CodeImage> image = CodeImage::compile(POINTS);
+    ASSERT_NE(image, nullptr);
+    Executor executor{4};
+    std::vector<std::future<Executor::Result>> results;
+    for (int i = 0; i < 100; i++) {
+        results.push_back(executor.run(image));
+    }
+    for (std::future<Executor::Result> &result : results) {
+        const Executor::Result ran = result.get();
+        EXPECT_EQ(ran.status, INTERPRET_OK);
+        EXPECT_EQ(ran.output, "14950\n");
+    }
+}
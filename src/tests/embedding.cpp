@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include "vm.hpp"
+#include <optional>
+#include <string>
+
+class EmbeddingTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    // Loads `source` and runs its top level once, so its functions exist.
+    void define(const std::string &source) {
+        const std::optional<Handle> script = vm.load(source);
+        ASSERT_TRUE(script.has_value());
+        ASSERT_TRUE(vm.call(*script).has_value());
+    }
+
+    VM vm{};
+};
+
+TEST_F(EmbeddingTest, RunsLoadedScriptsWithoutRecompiling) {
+    const std::optional<Handle> script =
+        vm.load("var n; if (n == nil) n = 0; n = n + 1; print n;");
+    ASSERT_TRUE(script.has_value());
+    testing::internal::CaptureStdout();
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(vm.call(*script).has_value());
+    }
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "1\n1\n1\n");
+}
+
+TEST_F(EmbeddingTest, CallsScriptFunctions) {
+    define("fun add(a, b) { return a + b; }\n"
+           "fun greet(name) { return \"hi \" + name; }\n"
+           "fun isBig(x) { return x > 100; }\n");
+    const Handle add = vm.function("add").value();
+    for (int i = 0; i < 100; i++) {
+        const std::optional<Value> sum = vm.call(add, i, 0.5);
+        ASSERT_TRUE(sum.has_value());
+        EXPECT_EQ(sum->asNumber(), i + 0.5);
+    }
+
+    const std::optional<Value> greeting =
+        vm.call(vm.function("greet").value(), vm.string("host"));
+    ASSERT_TRUE(greeting.has_value());
+    EXPECT_EQ(greeting->asObj()->as<StringObj>()->str, "hi host");
+
+    EXPECT_EQ(vm.call(vm.function("isBig").value(), 101)->asBool(), true);
+    EXPECT_FALSE(vm.function("missing").has_value());
+}
+
+TEST_F(EmbeddingTest, CallsNativesAndClasses) {
+    define("class Point { init(x, y) { this.x = x; this.y = y; } }\n"
+           "var notCallable = 1;\n");
+    EXPECT_EQ(vm.call(vm.function("sqrt").value(), 16.0)->asNumber(), 4);
+    const std::optional<Value> point =
+        vm.call(vm.function("Point").value(), 1, 2);
+    ASSERT_TRUE(point.has_value());
+    EXPECT_TRUE(point->is(ValueType::INSTANCE));
+    EXPECT_FALSE(vm.function("notCallable").has_value());
+}
+
+TEST_F(EmbeddingTest, RecoversFromRuntimeErrors) {
+    define("fun half(x) { return x / 2; }\n");
+    const Handle half = vm.function("half").value();
+    testing::internal::CaptureStdout();
+    EXPECT_FALSE(vm.call(half, true).has_value());
+    EXPECT_FALSE(vm.call(half).has_value());
+    EXPECT_EQ(testing::internal::GetCapturedStdout(),
+              "Operands must be numbers\n[line 1] in script\nhalf\n"
+              "Expected 1 arguments but got 0.\n");
+    EXPECT_EQ(vm.call(half, 9)->asNumber(), 4.5);
+}
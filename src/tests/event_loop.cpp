@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+#include "event_loop.hpp"
+#include "vm.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+std::string run(VM &vm, const std::string &source,
+                InterpretResult expected = INTERPRET_OK) {
+    std::ostringstream out;
+    vm.setOutput(out);
+    EXPECT_EQ(vm.interpret(source), expected);
+    return out.str();
+}
+
+std::string firstLine(const std::string &text) {
+    return text.substr(0, text.find('\n'));
+}
+
+// A directory of its own for each test, removed afterwards. Made by
+// mkdtemp rather than named after the test, whose name has a '/' in it for
+// parameterized tests.
+class TempDir {
+public:
+    TempDir() {
+        std::string name =
+            (std::filesystem::temp_directory_path() / "mehh_io_XXXXXX").string();
+        EXPECT_NE(mkdtemp(name.data()), nullptr) << std::strerror(errno);
+        path = name;
+    }
+    ~TempDir() { std::filesystem::remove_all(path); }
+
+    [[nodiscard]] std::string file(const std::string &name) const {
+        return (path / name).string();
+    }
+
+private:
+    std::filesystem::path path;
+};
+
+// Reaps until every request submitted is done.
+std::vector<std::unique_ptr<IoRequest>> finish(EventLoop &loop) {
+    std::vector<std::unique_ptr<IoRequest>> done;
+    while (loop.pending() > 0) {
+        for (std::unique_ptr<IoRequest> &request : loop.reap(true)) {
+            done.push_back(std::move(request));
+        }
+    }
+    return done;
+}
+
+} // namespace
+
+class EventLoopBackendTest
+    : public ::testing::TestWithParam<EventLoop::Backend> {};
+
+TEST_P(EventLoopBackendTest, WritesThenReadsFiles) {
+    TempDir dir;
+    EventLoop loop{GetParam()};
+    // Bigger than a single transfer of the fallback block size.
+    const std::string big(1 << 20, 'x');
+    loop.write(dir.file("big"), big, nullptr);
+    loop.write(dir.file("empty"), "", nullptr);
+    loop.write(dir.file("missing/file"), "lost", nullptr);
+    std::vector<std::unique_ptr<IoRequest>> written = finish(loop);
+    ASSERT_EQ(written.size(), 3);
+    for (const std::unique_ptr<IoRequest> &request : written) {
+        EXPECT_EQ(request->error,
+                  request->path == dir.file("missing/file") ? ENOENT : 0)
+            << request->path;
+    }
+
+    loop.read(dir.file("big"), nullptr);
+    loop.read(dir.file("empty"), nullptr);
+    loop.read(dir.file("missing/file"), nullptr);
+    // Its size isn't known up front.
+    loop.read("/proc/self/status", nullptr);
+    std::vector<std::unique_ptr<IoRequest>> read = finish(loop);
+    ASSERT_EQ(read.size(), 4);
+    for (const std::unique_ptr<IoRequest> &request : read) {
+        if (request->path == dir.file("big")) {
+            EXPECT_EQ(request->error, 0);
+            EXPECT_EQ(request->data, big);
+        } else if (request->path == dir.file("empty")) {
+            EXPECT_EQ(request->error, 0);
+            EXPECT_EQ(request->data, "");
+        } else if (request->path == dir.file("missing/file")) {
+            EXPECT_EQ(request->error, ENOENT);
+        } else {
+            EXPECT_EQ(request->error, 0);
+            EXPECT_NE(request->data.find("Pid:"), std::string::npos);
+        }
+    }
+}
+
+TEST_P(EventLoopBackendTest, KeepsManyRequestsInFlight) {
+    TempDir dir;
+    {
+        std::ofstream{dir.file("data")} << "contents";
+    }
+    EventLoop loop{GetParam()};
+    // More than fit in the io_uring submission queue at once.
+    constexpr size_t READS = 1000;
+    for (size_t i = 0; i < READS; i++) {
+        loop.read(dir.file("data"), nullptr);
+    }
+    EXPECT_EQ(loop.pending(), READS);
+    std::vector<std::unique_ptr<IoRequest>> done = finish(loop);
+    ASSERT_EQ(done.size(), READS);
+    for (const std::unique_ptr<IoRequest> &request : done) {
+        EXPECT_EQ(request->data, "contents");
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, EventLoopBackendTest,
+                         ::testing::Values(EventLoop::Backend::IO_URING,
+                                           EventLoop::Backend::THREADS));
+
+TEST(AsyncIoTest, FibersAwaitReadsSideBySide) {
+    TempDir dir;
+    for (int i = 0; i < 4; i++) {
+        std::ofstream{dir.file(std::to_string(i))} << "file " << i;
+    }
+    VM vm{};
+    EXPECT_EQ(run(vm, "var dir = \"" + dir.file("") + "\";\n"
+                      "fun load(name) {\n"
+                      "  var pending = readFileAsync(dir + name);\n"
+                      "  return await(pending);\n"
+                      "}\n"
+                      "var fibers = [];\n"
+                      "push(fibers, spawn(load, \"0\"));\n"
+                      "push(fibers, spawn(load, \"1\"));\n"
+                      "push(fibers, spawn(load, \"2\"));\n"
+                      "push(fibers, spawn(load, \"3\"));\n"
+                      "for (var f in fibers) print join(f);\n"),
+              "file 0\nfile 1\nfile 2\nfile 3\n");
+}
+
+TEST(AsyncIoTest, WritesAndReportsFailures) {
+    TempDir dir;
+    VM vm{};
+    EXPECT_EQ(run(vm, "var path = \"" + dir.file("out") + "\";\n"
+                      "print await(writeFileAsync(path, \"written\"));\n"
+                      "print await(readFileAsync(path));\n"
+                      "print await(readFileAsync(path + \".missing\"));\n"
+                      "print await(writeFileAsync(path + \"/sub\", \"x\"));\n"),
+              "true\nwritten\nnil\nfalse\n");
+    // An awaitable gives the same result every time.
+    EXPECT_EQ(run(vm, "var a = readFileAsync(path);\n"
+                      "await(a);\n"
+                      "print await(a);\n"),
+              "written\n");
+}
+
+TEST(AsyncIoTest, AwaitBlocksWhereFibersCantSwitch) {
+    TempDir dir;
+    {
+        std::ofstream{dir.file("data")} << "inside";
+    }
+    VM vm{};
+    // Inside a native's callback the fiber can't switch away, so await()
+    // waits there, even with another fiber queued.
+    EXPECT_EQ(run(vm, "var path = \"" + dir.file("data") + "\";\n"
+                      "fun other() { print \"other\"; }\n"
+                      "spawn(other);\n"
+                      "fun load(p) { return await(readFileAsync(p)); }\n"
+                      "var read = map([path], load);\n"
+                      "print read[0];\n"
+                      "yield();\n"),
+              "inside\nother\n");
+}
+
+TEST(AsyncIoTest, RejectsBadArguments) {
+    VM vm{};
+    EXPECT_EQ(firstLine(run(vm, "readFileAsync(1);", INTERPRET_RUNTIME_ERROR)),
+              "Path must be a string.");
+    EXPECT_EQ(firstLine(run(vm, "writeFileAsync(\"a\", 1);",
+                            INTERPRET_RUNTIME_ERROR)),
+              "Contents must be a string.");
+    EXPECT_EQ(firstLine(run(vm, "await(1);", INTERPRET_RUNTIME_ERROR)),
+              "Argument must be an awaitable.");
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "executor.hpp"
+#include "vm.hpp"
+#include <future>
+#include <string>
+#include <vector>
+
+TEST(ExecutorTest, GivesEveryJobItsOwnVM) {
+    Executor executor{4};
+    std::vector<std::future<double>> results;
+    for (int i = 0; i < 200; i++) {
+        results.push_back(executor.submit([i](VM &vm) {
+            // Sees a global left behind by an earlier job, if VMs leak.
+            const std::string source = "var total; if (total == nil) total = 0;"
+                                       "total = total + " +
+                                       std::to_string(i) + ";";
+            EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+            return vm.global("total")->asNumber();
+        }));
+    }
+    for (int i = 0; i < 200; i++) {
+        EXPECT_EQ(results[i].get(), i);
+    }
+}
+
+TEST(ExecutorTest, CapturesEachScriptsOutput) {
+    Executor executor{3};
+    std::vector<std::future<Executor::Result>> results;
+    for (int i = 0; i < 100; i++) {
+        results.push_back(executor.run(
+            "var s = 0;\n"
+            "for (var j = 0; j < 1000; j = j + 1) s = s + j;\n"
+            "print s + " + std::to_string(i) + ";\n"));
+    }
+    for (int i = 0; i < 100; i++) {
+        const Executor::Result result = results[i].get();
+        EXPECT_EQ(result.status, INTERPRET_OK);
+        EXPECT_EQ(result.output, std::to_string(499500 + i) + "\n");
+    }
+}
+
+TEST(ExecutorTest, ReportsErrorsToTheJobsOutput) {
+    Executor executor{2};
+    std::future<Executor::Result> compileError = executor.run("print ;");
+    std::future<Executor::Result> runtimeError = executor.run("-nil;");
+    const Executor::Result compiled = compileError.get();
+    EXPECT_EQ(compiled.status, INTERPRET_COMPILE_ERROR);
+    EXPECT_EQ(compiled.output, "[line 1] Error at ;: Expect expression\n");
+    const Executor::Result ran = runtimeError.get();
+    EXPECT_EQ(ran.status, INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(ran.output,
+              "Operand must be a number\n[line 1] in script\nscript\n");
+}
+
+TEST(ExecutorTest, RunsParallelNativesInline) {
+    Executor executor{2};
+    std::future<Executor::Result> result = executor.run(
+        "var a = [];\n"
+        "for (var i = 0; i < 50000; i = i + 1) push(a, 50000 - i);\n"
+        "sort(a);\n"
+        "print a[0];\n"
+        "print sum(a);\n");
+    EXPECT_EQ(result.get().output, "1\n1250025000\n");
+}
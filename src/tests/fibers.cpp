@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include "fiber.hpp"
+#include "vm.hpp"
+#include <optional>
+#include <sstream>
+#include <string>
+
+namespace {
+
+std::string run(VM &vm, const std::string &source,
+                InterpretResult expected = INTERPRET_OK) {
+    std::ostringstream out;
+    vm.setOutput(out);
+    EXPECT_EQ(vm.interpret(source), expected);
+    return out.str();
+}
+
+std::string firstLine(const std::string &text) {
+    return text.substr(0, text.find('\n'));
+}
+
+} // namespace
+
+TEST(FiberTest, YieldTakesTurnsInSpawnOrder) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun count(base) {\n"
+                      "  for (var i = 0; i < 3; i = i + 1) {\n"
+                      "    print base + i;\n"
+                      "    yield();\n"
+                      "  }\n"
+                      "}\n"
+                      "spawn(count, 10);\n"
+                      "spawn(count, 20);\n"
+                      "for (var i = 0; i < 4; i = i + 1) yield();\n"),
+              "10\n20\n11\n21\n12\n22\n");
+    // With nothing else to run, yield() carries on.
+    EXPECT_EQ(run(vm, "yield(); print 1;"), "1\n");
+}
+
+TEST(FiberTest, JoinReturnsTheResultAndWakesEveryJoiner) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun slow(n) {\n"
+                      "  for (var i = 0; i < n; i = i + 1) yield();\n"
+                      "  return n * 2;\n"
+                      "}\n"
+                      "var f = spawn(slow, 100);\n"
+                      "fun wait() { return join(f) + 1; }\n"
+                      "var a = spawn(wait);\n"
+                      "var b = spawn(wait);\n"
+                      "print join(a) + join(b);\n"
+                      "print join(f);\n"),
+              "402\n200\n");
+}
+
+TEST(FiberTest, FibersShareUpvalues) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun counter() {\n"
+                      "  var n = 0;\n"
+                      "  fun step() { n = n + 1; yield(); return n; }\n"
+                      "  return step;\n"
+                      "}\n"
+                      "var step = counter();\n"
+                      "var f = spawn(step);\n"
+                      "print step();\n"
+                      "print join(f);\n"),
+              "2\n2\n");
+}
+
+TEST(FiberTest, ReportsMisuse) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "var f; fun g() { return join(f); } f = spawn(g); join(f);",
+                  INTERPRET_RUNTIME_ERROR),
+              "A fiber can't join itself.\n[line 1] in script\ng\nCall error\n");
+    EXPECT_EQ(firstLine(run(vm, "fun g() {} spawn(g, 1);",
+                            INTERPRET_RUNTIME_ERROR)),
+              "Wrong number of arguments for the function.");
+    EXPECT_EQ(firstLine(run(vm,
+                            "fun cb(x) { yield(); return x; }\n"
+                            "fun idle() {}\n"
+                            "spawn(idle);\n"
+                            "map([1], cb);\n",
+                            INTERPRET_RUNTIME_ERROR)),
+              "Can't switch fibers inside a native callback or compiled code.");
+}
+
+TEST(FiberTest, DetectsDeadlock) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "var f;\n"
+                      "fun a() { return join(f); }\n"
+                      "var g = spawn(a);\n"
+                      "fun b() { return join(g); }\n"
+                      "f = spawn(b);\n"
+                      "join(g);\n",
+                  INTERPRET_RUNTIME_ERROR),
+              "Deadlock: every fiber is waiting.\n[line 4] in script\nb\n"
+              "Call error\n");
+}
+
+TEST(FiberTest, AnErrorEndsEveryFiber) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun bad() { yield(); return -nil; }\n"
+                      "fun idle() { yield(); print \"idle\"; }\n"
+                      "var f = spawn(bad);\n"
+                      "spawn(idle);\n"
+                      "join(f);\n",
+                  INTERPRET_RUNTIME_ERROR),
+              "Operand must be a number\n[line 1] in script\nbad\n");
+    // The next run starts afresh on the VM's own fiber.
+    EXPECT_EQ(run(vm, "yield(); print 3;"), "3\n");
+}
+
+TEST(FiberTest, KeepsItsStacksInline) {
+    // The VM's registers plus room for STACK_MAX values and FRAME_MAX
+    // frames, in one allocation.
+    EXPECT_LT(sizeof(FiberObj), 8 * 1024);
+}
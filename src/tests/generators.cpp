@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include "generator.hpp"
+#include "vm.hpp"
+#include <optional>
+#include <sstream>
+#include <string>
+
+namespace {
+
+std::string run(VM &vm, const std::string &source,
+                InterpretResult expected = INTERPRET_OK) {
+    std::ostringstream out;
+    vm.setOutput(out);
+    EXPECT_EQ(vm.interpret(source), expected);
+    return out.str();
+}
+
+std::string firstLine(const std::string &text) {
+    return text.substr(0, text.find('\n'));
+}
+
+} // namespace
+
+TEST(GeneratorTest, ForInRunsTheGeneratorLazily) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun* range(n) {\n"
+                      "  for (var i = 0; i < n; i = i + 1) {\n"
+                      "    print \"make\";\n"
+                      "    yield i;\n"
+                      "  }\n"
+                      "}\n"
+                      "for (var x in range(3)) print x;\n"),
+              "make\n0\nmake\n1\nmake\n2\n");
+}
+
+TEST(GeneratorTest, CallingAGeneratorResumesIt) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun* pair(a, b) { yield a; yield b; return \"end\"; }\n"
+                      "var g = pair(1, 2);\n"
+                      "print g;\n"
+                      "print g();\n"
+                      "print g();\n"
+                      "print g();\n"
+                      "print g();\n"),
+              "<generator>\n1\n2\nend\nnil\n");
+}
+
+TEST(GeneratorTest, NestsAndLeavesLoopsOnReturn) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun* range(n) { for (var i = 0; i < n; i = i + 1) yield i; }\n"
+                      "fun* squares(n) { for (var i in range(n)) yield i * i; }\n"
+                      "fun* none() { return 5; }\n"
+                      "var total = 0;\n"
+                      "for (var s in squares(10)) total = total + s;\n"
+                      "for (var s in none()) total = -1;\n"
+                      "print total;\n"),
+              "285\n");
+}
+
+TEST(GeneratorTest, KeepsCapturedLocalsShared) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "var read;\n"
+                      "fun* counter() {\n"
+                      "  var n = 0;\n"
+                      "  fun get() { return n; }\n"
+                      "  read = get;\n"
+                      "  while (true) { n = n + 1; yield n; }\n"
+                      "}\n"
+                      "var c = counter();\n"
+                      "c(); c(); c();\n"
+                      "print read();\n"
+                      "var d = counter();\n"
+                      "d();\n"
+                      "print read();\n"),
+              "3\n1\n");
+}
+
+TEST(GeneratorTest, HostCallsResumeGenerators) {
+    VM vm{};
+    ASSERT_EQ(run(vm, "fun* evens() { for (var i = 0; ; i = i + 2) yield i; }\n"
+                      "var it = evens();\n"),
+              "");
+    const std::optional<Handle> generator = vm.function("it");
+    ASSERT_TRUE(generator.has_value());
+    for (int i = 0; i < 3; i++) {
+        const std::optional<Value> next = vm.call(*generator);
+        ASSERT_TRUE(next.has_value());
+        EXPECT_EQ(next->asNumber(), 2 * i);
+    }
+}
+
+TEST(GeneratorTest, YieldIsOnlyAKeywordInGenerators) {
+    VM vm{};
+    // Elsewhere it is still the native that switches fibers.
+    EXPECT_EQ(run(vm, "fun f() { yield(); return 1; } print f();"), "1\n");
+    EXPECT_EQ(run(vm, "var yield = 2; print yield;"), "2\n");
+}
+
+TEST(GeneratorTest, ReportsMisuse) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "fun* g() { yield 1; return -nil; }\n"
+                      "var it = g();\n"
+                      "for (var x in it) print x;\n",
+                  INTERPRET_RUNTIME_ERROR),
+              "1\nOperand must be a number\n[line 1] in script\ng\n"
+              "[line 3] in script\nscript\n");
+    // A generator that failed is over.
+    EXPECT_EQ(run(vm, "print it();"), "nil\n");
+    EXPECT_EQ(firstLine(run(vm, "var me; fun* g() { me(); } me = g(); me();",
+                            INTERPRET_RUNTIME_ERROR)),
+              "Generator is already running.");
+    EXPECT_EQ(firstLine(run(vm, "fun* g() {} g()(1);", INTERPRET_RUNTIME_ERROR)),
+              "Expected 0 arguments but got 1.");
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "chunk.hpp"
+#include "compiler.hpp"
+#include "instruction_profiler.hpp"
+#include "string_intern.hpp"
+#include "vm.hpp"
+#include <sstream>
+#include <string>
+#include <string_view>
+
+class InstructionProfilerTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    // The annotated disassembly of running `source`, or an empty string if
+    // this build has no dispatch hook.
+    std::string profile(std::string_view source) {
+        if (!vm.enableInstructionProfiler()) {
+            return {};
+        }
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+        testing::internal::GetCapturedStdout();
+        std::ostringstream out;
+        vm.instructionProfile()->report(out);
+        return out.str();
+    }
+
+    StringIntern strings{};
+    VM vm{};
+    InstructionProfiler profiler{};
+};
+
+TEST_F(InstructionProfilerTest, CountsHitsAndOperandTypes) {
+    Compiler compiler{strings};
+    const auto function = compiler.compile("1 + 2;");
+    ASSERT_TRUE(function.has_value());
+    // OP_CONSTANT 0, OP_CONSTANT 1, then OP_ADD at offset 4.
+    ASSERT_EQ((*function)->chunk->getCode()[4], OP_ADD);
+
+    const Value numbers[] = {Value{1.0}, Value{2.0}};
+    const Value mixed[] = {Value{strings.intern("a")}, Value{2.0}};
+    profiler.record(*function, 4, OP_ADD, numbers + 2);
+    profiler.record(*function, 4, OP_ADD, numbers + 2);
+    EXPECT_EQ(profiler.hits(*function, 4), 2);
+    EXPECT_EQ(profiler.hits(*function, 0), 0);
+
+    std::ostringstream monomorphic;
+    profiler.report(monomorphic, *function);
+    EXPECT_NE(monomorphic.str().find("OP_ADD  ; types number, number\n"),
+              std::string::npos);
+
+    profiler.record(*function, 4, OP_ADD, mixed + 2);
+    std::ostringstream polymorphic;
+    profiler.report(polymorphic, *function);
+    EXPECT_NE(polymorphic.str().find(
+                  "; types {number|string}, number (polymorphic)"),
+              std::string::npos);
+}
+
+TEST_F(InstructionProfilerTest, MarksHottestBlocks) {
+    const std::string report =
+        profile("var x = 0;\n"
+                "for (var i = 0; i < 100; i = i + 1) {\n"
+                "  x = x + i;\n"
+                "}\n");
+    if (report.empty()) {
+        GTEST_SKIP() << "built without MEHH_PROFILE_OPS";
+    }
+    EXPECT_EQ(report.rfind("== script (line 1): ", 0), 0);
+    EXPECT_NE(report.find("<== hot #1"), std::string::npos);
+    EXPECT_NE(report.find("<== hot #3"), std::string::npos);
+    // The loop test runs once more than the body.
+    EXPECT_NE(report.find("       101  "), std::string::npos);
+    EXPECT_NE(report.find("       100  "), std::string::npos);
+}
+
+TEST_F(InstructionProfilerTest, ShowsPropertyCacheState) {
+    const std::string report =
+        profile("class Point { init(x) { this.x = x; } }\n"
+                "var p = Point(1);\n"
+                "var y = p.x;\n");
+    if (report.empty()) {
+        GTEST_SKIP() << "built without MEHH_PROFILE_OPS";
+    }
+    EXPECT_NE(report.find("== init (line 1)"), std::string::npos);
+    EXPECT_NE(report.find("; cache append slot 0"), std::string::npos);
+    EXPECT_NE(report.find("; cache field slot 0"), std::string::npos);
+}
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include "mapped_file.hpp"
+#include "mehh.hpp"
+#include "simd.hpp"
+#include "vm.hpp"
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+std::string run(VM &vm, const std::string &source,
+                InterpretResult expected = INTERPRET_OK) {
+    std::ostringstream out;
+    vm.setOutput(out);
+    EXPECT_EQ(vm.interpret(source), expected);
+    return out.str();
+}
+
+std::string firstLine(const std::string &text) {
+    return text.substr(0, text.find('\n'));
+}
+
+// A file with `contents`, removed afterwards.
+class TempFile {
+public:
+    explicit TempFile(const std::string &contents)
+        : path{std::filesystem::temp_directory_path() /
+               ("mehh_mapped_" + std::to_string(getpid()) + "_" +
+                ::testing::UnitTest::GetInstance()->current_test_info()->name())} {
+        std::ofstream{path, std::ios::binary} << contents;
+    }
+    ~TempFile() { std::filesystem::remove(path); }
+
+    [[nodiscard]] std::string name() const { return path.string(); }
+
+private:
+    std::filesystem::path path;
+};
+
+} // namespace
+
+TEST(MappedFileTest, FindsBytesAroundTheVectorWidth) {
+    for (size_t size = 0; size < 100; size++) {
+        for (size_t at = 0; at <= size; at++) {
+            std::string text(size, 'a');
+            if (at < size) {
+                text[at] = '\n';
+            }
+            EXPECT_EQ(simd::find(text.data(), size, '\n'), at) << size;
+        }
+    }
+}
+
+TEST(MappedFileTest, StringsViewTheirStorage) {
+    VM vm{};
+    auto storage = std::make_shared<const std::string>("viewed in place");
+    const Value viewed = vm.string(*storage, storage);
+    EXPECT_EQ(viewed.asObj()->as<StringObj>()->str.data(), storage->data());
+    // Views aren't interned, so the intern table never holds on to them.
+    EXPECT_NE(vm.string("viewed in place").asObj(), viewed.asObj());
+    const Value literal = vm.string("a literal");
+    auto copy = std::make_shared<const std::string>("a literal");
+    EXPECT_NE(vm.string(*copy, copy).asObj(), literal.asObj());
+}
+
+TEST(MappedFileTest, LinesCompareByContents) {
+    TempFile file{"a\nb\na\n"};
+    VM vm{};
+    EXPECT_EQ(run(vm, "var seen = {};\n"
+                      "for (var line in lines(\"" + file.name() + "\")) {\n"
+                      "  seen[line] = line == \"a\";\n"
+                      "}\n"
+                      "print len(seen);\n"
+                      "print seen[\"a\"];\n"
+                      "print seen[\"b\"];\n"
+                      "print has(seen, \"c\");\n"),
+              "2\ntrue\nfalse\nfalse\n");
+}
+
+TEST(MappedFileTest, ReadFileReturnsTheContents) {
+    TempFile file{"hello world"};
+    VM vm{};
+    EXPECT_EQ(run(vm, "var path = \"" + file.name() + "\";\n"
+                      "var text = readFile(path);\n"
+                      "print text;\n"
+                      "var m = {\"hello world\": 1};\n"
+                      "print m[text];\n"
+                      "print readFile(path + \".missing\");\n"),
+              "hello world\n1\nnil\n");
+    const std::optional<Value> text = vm.global("text");
+    ASSERT_TRUE(text.has_value());
+    EXPECT_EQ(text->asObj()->as<StringObj>()->str, "hello world");
+    EXPECT_EQ(firstLine(run(vm, "readFile(1);", INTERPRET_RUNTIME_ERROR)),
+              "Path must be a string.");
+}
+
+TEST(MappedFileTest, LinesIteratesWithoutLineEndings) {
+    TempFile file{"first\nsecond\r\n\nlast"};
+    VM vm{};
+    EXPECT_EQ(run(vm, "var file = lines(\"" + file.name() + "\");\n"
+                      "for (var line in file) print line;\n"
+                      "var count = 0;\n"
+                      "for (var line in file) count = count + 1;\n"
+                      "print count;\n"
+                      "print lines(\"" + file.name() + ".missing\");\n"),
+              "first\nsecond\n\nlast\n4\nnil\n");
+    TempFile empty{""};
+    EXPECT_EQ(run(vm, "for (var line in lines(\"" + empty.name() + "\")) "
+                      "print line;\n"
+                      "print \"done\";\n"),
+              "done\n");
+}
+
+TEST(MappedFileTest, LinesStreamsPastReleasedPages) {
+    // Crosses the points where lines() gives memory back a few times.
+    constexpr size_t LINES = 600000;
+    std::string contents;
+    for (size_t i = 0; i < LINES; i++) {
+        contents += std::string(63, 'x') + '\n';
+    }
+    TempFile file{contents};
+    VM vm{};
+    EXPECT_EQ(run(vm, "var first;\n"
+                      "var count = 0;\n"
+                      "for (var line in lines(\"" + file.name() + "\")) {\n"
+                      "  if (count == 0) first = line;\n"
+                      "  count = count + 1;\n"
+                      "}\n"
+                      "print count;\n"
+                      "print first == \"" + std::string(63, 'x') + "\";\n"),
+              std::to_string(LINES) + "\ntrue\n");
+}
+
+TEST(MappedFileTest, RunsScriptsFromAPipe) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    const std::string source = "print 1 + 2;";
+    ASSERT_EQ(write(fds[1], source.data(), source.size()),
+              static_cast<ssize_t>(source.size()));
+    close(fds[1]);
+    Mehh mehh;
+    testing::internal::CaptureStdout();
+    mehh.runFile("/dev/fd/" + std::to_string(fds[0]));
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "3\n");
+    close(fds[0]);
+}
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include "map.hpp"
+#include "vm.hpp"
+#include <string>
+#include <string_view>
+
+class MapTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    std::string run(std::string_view source,
+                    InterpretResult expected = INTERPRET_OK) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), expected);
+        return testing::internal::GetCapturedStdout();
+    }
+
+    VM vm{};
+};
+
+TEST_F(MapTest, GrowsAndRemovesAcrossManyKeys) {
+    MapObj map{};
+    for (int i = 0; i < 1000; i++) {
+        map.set(Value{static_cast<double>(i)}, Value{static_cast<double>(i * 2)});
+    }
+    EXPECT_EQ(map.size(), 1000);
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_TRUE(map.remove(Value{static_cast<double>(i)}));
+    }
+    EXPECT_FALSE(map.remove(Value{0.0}));
+    EXPECT_EQ(map.size(), 500);
+    for (int i = 0; i < 1000; i++) {
+        const Value *value = map.find(Value{static_cast<double>(i)});
+        if (i % 2 == 0) {
+            EXPECT_EQ(value, nullptr);
+        } else {
+            ASSERT_NE(value, nullptr);
+            EXPECT_EQ(value->asNumber(), i * 2);
+        }
+    }
+}
+
+TEST_F(MapTest, ChurnReusesTombstones) {
+    MapObj map{};
+    for (int i = 0; i < 10000; i++) {
+        map.set(Value{static_cast<double>(i)}, Value{true});
+        EXPECT_TRUE(map.remove(Value{static_cast<double>(i)}));
+    }
+    EXPECT_EQ(map.size(), 0);
+    EXPECT_LE(map.capacity(), 32);
+}
+
+TEST_F(MapTest, NegativeZeroIsZero) {
+    MapObj map{};
+    map.set(Value{-0.0}, Value{1.0});
+    ASSERT_NE(map.find(Value{0.0}), nullptr);
+}
+
+TEST_F(MapTest, LiteralGetAndSet) {
+    EXPECT_EQ(run("var m = {\"a\": 1, 2: \"two\"};"
+                  "m[\"b\"] = m[\"a\"] + 1;"
+                  "print m[\"b\"];"
+                  "print m[2];"
+                  "print m[\"missing\"];"
+                  "print len(m);"),
+              "2\n"
+              "two\n"
+              "nil\n"
+              "3\n");
+}
+
+TEST_F(MapTest, StringKeysMatchByContent) {
+    EXPECT_EQ(run("var m = {};"
+                  "m[\"ab\"] = 1;"
+                  "print m[\"a\" + \"b\"];"),
+              "1\n");
+}
+
+TEST_F(MapTest, HasAndRemove) {
+    EXPECT_EQ(run("var m = {nil: false};"
+                  "print has(m, nil);"
+                  "print remove(m, nil);"
+                  "print has(m, nil);"
+                  "print remove(m, nil);"),
+              "true\ntrue\nfalse\nfalse\n");
+}
+
+TEST_F(MapTest, ForInVisitsEveryKey) {
+    EXPECT_EQ(run("var m = {};"
+                  "for (var i = 0; i < 100; i = i + 1) m[i] = i;"
+                  "var total = 0;"
+                  "for (var k in m) total = total + m[k];"
+                  "print total;"),
+              "4950\n");
+}
+
+TEST_F(MapTest, ForInOverArray) {
+    EXPECT_EQ(run("var index = 0;"
+                  "for (var x in [1, 2, 3]) index = index + x;"
+                  "print index;"),
+              "6\n");
+}
+
+TEST_F(MapTest, ForInOverNonSequenceFails) {
+    run("for (var x in 1) print x;", INTERPRET_RUNTIME_ERROR);
+}
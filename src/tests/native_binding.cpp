@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include "vm.hpp"
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace {
+
+double half(double x) { return x / 2; }
+
+double lerp(double a, double b, float t) { return a + (b - a) * t; }
+
+int64_t repeat(int64_t n, bool twice) { return twice ? n * 2 : n; }
+
+size_t length(std::string_view text) noexcept { return text.size(); }
+
+double first(const ArrayObj *array) { return array->get(0).asNumber(); }
+
+Value identity(const Value &value) { return value; }
+
+int calls = 0;
+
+void count() { calls++; }
+
+Value greet(VM &vm, std::string_view name) {
+    return vm.string("hello " + std::string{name});
+}
+
+} // namespace
+
+class NativeBindingTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        vm.bind<&half>("half", true);
+        vm.bind<&lerp>("lerp");
+        vm.bind<&repeat>("repeat");
+        vm.bind<&length>("length");
+        vm.bind<&first>("first");
+        vm.bind<&identity>("identity");
+        vm.bind<&count>("count");
+        vm.bind<&greet>("greet");
+    }
+
+    void TearDown() override {}
+
+    std::string run(std::string_view source,
+                    InterpretResult expected = INTERPRET_OK) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), expected);
+        return testing::internal::GetCapturedStdout();
+    }
+
+    VM vm{};
+};
+
+TEST_F(NativeBindingTest, ConvertsArgumentsAndResults) {
+    EXPECT_EQ(run("print half(3);\n"
+                  "print lerp(0, 10, 0.25);\n"
+                  "print repeat(21, true);\n"
+                  "print length(\"four\");\n"
+                  "print first([7, 8]);\n"
+                  "print identity(nil);\n"
+                  "print count();\n"
+                  "print greet(\"mehh\");\n"),
+              "1.5\n2.5\n42\n4\n7\nnil\nnil\nhello mehh\n");
+    EXPECT_EQ(calls, 1);
+}
+
+TEST_F(NativeBindingTest, ChecksArityAndTypes) {
+    EXPECT_EQ(run("half(1, 2);", INTERPRET_RUNTIME_ERROR),
+              "Expected 1 argument.\n[line 1] in script\nscript\nCall error\n");
+    EXPECT_EQ(run("lerp(1);", INTERPRET_RUNTIME_ERROR),
+              "Expected 3 arguments.\n[line 1] in script\nscript\nCall error\n");
+    EXPECT_EQ(run("half(\"one\");", INTERPRET_RUNTIME_ERROR),
+              "Argument must be a number.\n[line 1] in script\nscript\nCall error\n");
+    EXPECT_EQ(run("repeat(1.5, true);", INTERPRET_RUNTIME_ERROR),
+              "Argument must be an integer.\n[line 1] in script\nscript\nCall error\n");
+    // 2^63, one past the largest int64_t.
+    EXPECT_EQ(run("repeat(9223372036854775808, false);",
+                  INTERPRET_RUNTIME_ERROR),
+              "Argument must be an integer.\n[line 1] in script\nscript\nCall error\n");
+    EXPECT_EQ(run("repeat(1, nil);", INTERPRET_RUNTIME_ERROR),
+              "Argument must be a boolean.\n[line 1] in script\nscript\nCall error\n");
+    EXPECT_EQ(run("length(1);", INTERPRET_RUNTIME_ERROR),
+              "Argument must be a string.\n[line 1] in script\nscript\nCall error\n");
+    EXPECT_EQ(run("first(1);", INTERPRET_RUNTIME_ERROR),
+              "Argument must be an array.\n[line 1] in script\nscript\nCall error\n");
+}
+
+TEST_F(NativeBindingTest, MapsUnaryFunctionsUnboxed) {
+    const Value native = vm.global("half").value();
+    EXPECT_NE(native.asObj()->as<NativeFunction>()->unary, nullptr);
+    EXPECT_EQ(vm.global("lerp")->asObj()->as<NativeFunction>()->unary,
+              nullptr);
+    EXPECT_EQ(run("var a = [];\n"
+                  "for (var i = 0; i < 5000; i = i + 1) push(a, i);\n"
+                  "print sum(map(a, half));\n"),
+              "6248750\n");
+}
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "chunk.hpp"
+#include "op_profiler.hpp"
+#include "vm.hpp"
+#include <sstream>
+#include <string>
+
+class OpProfilerTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    OpProfiler profiler{};
+};
+
+TEST_F(OpProfilerTest, CountsOpcodesAndPairs) {
+    profiler.record(OP_CONSTANT);
+    profiler.record(OP_CONSTANT);
+    profiler.record(OP_ADD);
+    profiler.record(OP_RETURN);
+    EXPECT_EQ(profiler.total(), 4);
+    EXPECT_EQ(profiler.count(OP_CONSTANT), 2);
+    EXPECT_EQ(profiler.pairCount(OP_CONSTANT, OP_CONSTANT), 1);
+    EXPECT_EQ(profiler.pairCount(OP_CONSTANT, OP_ADD), 1);
+    EXPECT_EQ(profiler.pairCount(OP_ADD, OP_RETURN), 1);
+    EXPECT_EQ(profiler.pairCount(OP_RETURN, OP_CONSTANT), 0);
+}
+
+TEST_F(OpProfilerTest, PairsDoNotSpanRuns) {
+    profiler.record(OP_RETURN);
+    profiler.endRun();
+    profiler.record(OP_CONSTANT);
+    EXPECT_EQ(profiler.pairCount(OP_RETURN, OP_CONSTANT), 0);
+}
+
+TEST_F(OpProfilerTest, ReportIsSortedByCount) {
+    profiler.record(OP_NIL);
+    for (int i = 0; i < 3; i++) {
+        profiler.record(OP_POP);
+    }
+    std::ostringstream out;
+    profiler.report(out);
+    const std::string report = out.str();
+    EXPECT_LT(report.find("OP_POP"), report.find("OP_NIL"));
+    EXPECT_NE(report.find("OP_POP -> OP_POP"), std::string::npos);
+}
+
+TEST_F(OpProfilerTest, WritesJson) {
+    profiler.record(OP_TRUE);
+    profiler.record(OP_NOT);
+    std::ostringstream out;
+    profiler.writeJson(out);
+    EXPECT_EQ(out.str(),
+              "{\"total\":2,\"samplePeriod\":61,\"opcodes\":["
+              "{\"name\":\"OP_TRUE\",\"count\":1,\"samples\":0,\"cycles\":0},"
+              "{\"name\":\"OP_NOT\",\"count\":1,\"samples\":0,\"cycles\":0}],"
+              "\"pairs\":[{\"first\":\"OP_TRUE\",\"second\":\"OP_NOT\","
+              "\"count\":1}]}\n");
+}
+
+TEST_F(OpProfilerTest, ProfilesInterpretedCode) {
+    VM vm{};
+    if (!vm.enableOpProfiler()) {
+        GTEST_SKIP() << "built without MEHH_PROFILE_OPS";
+    }
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(vm.interpret("var x = 0;"
+                           "for (var i = 0; i < 100; i = i + 1) x = x + i;"),
+              INTERPRET_OK);
+    testing::internal::GetCapturedStdout();
+    const OpProfiler *profile = vm.opProfile();
+    ASSERT_NE(profile, nullptr);
+    // Two back jumps per iteration: body to increment, increment to test.
+    EXPECT_EQ(profile->count(OP_LOOP), 200);
+    EXPECT_GE(profile->pairCount(OP_GET_LOCAL, OP_CONSTANT), 100);
+}
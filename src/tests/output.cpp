@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include "output.hpp"
+#include "vm.hpp"
+#include <cstddef>
+#include <sstream>
+#include <string>
+
+namespace {
+
+std::string run(VM &vm, const std::string &source,
+                InterpretResult expected = INTERPRET_OK) {
+    std::ostringstream out;
+    vm.setOutput(out);
+    EXPECT_EQ(vm.interpret(source), expected);
+    return out.str();
+}
+
+const std::ostringstream *watched = nullptr;
+
+// How much of what the script printed has reached its stream.
+size_t written() { return watched->str().size(); }
+
+} // namespace
+
+TEST(OutputTest, PrintsShortestRoundTripNumbers) {
+    VM vm{};
+    EXPECT_EQ(run(vm, "print 3;\n"
+                      "print 0.1;\n"
+                      "print 1 / 3;\n"
+                      "print 333283335;\n"
+                      "print 1000000 * 1000000 * 1000000 * 1000;\n"
+                      "print -0;\n"
+                      "print [1.5, \"a\", nil];\n"),
+              "3\n0.1\n0.3333333333333333\n333283335\n1e+21\n-0\n"
+              "[1.5, a, nil]\n");
+}
+
+TEST(OutputTest, BuffersUntilFlushed) {
+    VM vm{};
+    std::ostringstream out;
+    watched = &out;
+    vm.bind<&written>("written");
+    vm.setOutput(out);
+    EXPECT_EQ(vm.interpret("print \"a\";\n"
+                           "print written();\n"
+                           "flush();\n"
+                           "print written();\n"),
+              INTERPRET_OK);
+    // The rest is written out once the run returns.
+    EXPECT_EQ(out.str(), "a\n0\n4\n");
+}
+
+TEST(OutputTest, FlushesWhenFull) {
+    std::ostringstream stream;
+    {
+        Output output{stream};
+        const std::string line(1000, 'x');
+        while (stream.str().empty()) {
+            output.write(line);
+            output.newline();
+        }
+        EXPECT_GE(stream.str().size(), Output::CAPACITY);
+        output.write("tail");
+    }
+    EXPECT_EQ(stream.str().substr(stream.str().size() - 4), "tail");
+}
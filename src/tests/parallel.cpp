@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "parallel.hpp"
+#include "thread_pool.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ParallelTest : public ::testing::Test {
+protected:
+    void SetUp() override { ThreadPool::shared().resize(4); }
+
+    void TearDown() override {}
+
+    std::string run(std::string_view source,
+                    InterpretResult expected = INTERPRET_OK) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), expected);
+        return testing::internal::GetCapturedStdout();
+    }
+
+    static std::vector<double> randomNumbers(size_t size) {
+        std::mt19937_64 random{42};
+        std::uniform_real_distribution<double> distribution{-1e6, 1e6};
+        std::vector<double> numbers(size);
+        for (double &number : numbers) {
+            number = distribution(random);
+        }
+        return numbers;
+    }
+
+    VM vm{};
+};
+
+TEST_F(ParallelTest, ParallelForCoversEveryIndexOnce) {
+    ThreadPool pool{4};
+    std::vector<std::atomic<int>> hits(100000);
+    pool.parallelFor(hits.size(), 1000, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            hits[i]++;
+        }
+    });
+    for (const std::atomic<int> &hit : hits) {
+        EXPECT_EQ(hit.load(), 1);
+    }
+}
+
+TEST_F(ParallelTest, ResizeInsideAJobDoesNothing) {
+    ThreadPool pool{4};
+    std::atomic<size_t> covered{0};
+    pool.parallelFor(100000, 1000, [&](size_t begin, size_t end) {
+        pool.resize(2);
+        covered += end - begin;
+    });
+    EXPECT_EQ(covered.load(), 100000u);
+    EXPECT_EQ(pool.size(), 4u);
+}
+
+TEST_F(ParallelTest, MapRunsImpureNativesOnTheCallingThread) {
+    EXPECT_EQ(run("var a = [];"
+                  "resize(a, 40000);"
+                  "for (var i = 0; i < len(a); i = i + 1) a[i] = 4;"
+                  "print len(map(a, threads));"
+                  "print threads();"),
+              "40000\n4\n");
+}
+
+TEST_F(ParallelTest, SortMatchesSequentialForAnyThreadCount) {
+    const std::vector<double> input = randomNumbers(200003);
+    std::vector<double> expected = input;
+    std::sort(expected.begin(), expected.end());
+    for (size_t threads : {1, 2, 3, 8}) {
+        ThreadPool::shared().resize(threads);
+        std::vector<double> numbers = input;
+        parallel::sort(numbers.data(), numbers.size());
+        EXPECT_EQ(numbers, expected) << threads << " threads";
+    }
+}
+
+TEST_F(ParallelTest, SumDoesNotDependOnThreadCount) {
+    const std::vector<double> input = randomNumbers(100000);
+    ThreadPool::shared().resize(1);
+    const double sequential = parallel::sum(input.data(), input.size());
+    ThreadPool::shared().resize(6);
+    EXPECT_EQ(parallel::sum(input.data(), input.size()), sequential);
+}
+
+TEST_F(ParallelTest, MapCallsClosures) {
+    EXPECT_EQ(run("var offset = 10;"
+                  "fun shift(x) { return x + offset; }"
+                  "print map([1, 2, 3], shift);"),
+              "[11, 12, 13]\n");
+}
+
+TEST_F(ParallelTest, FilterAndReduce) {
+    EXPECT_EQ(run("var a = [5, 1, 4, 2, 3];"
+                  "fun big(x) { return x > 2; }"
+                  "fun add(acc, x) { return acc + x; }"
+                  "print filter(a, big);"
+                  "print reduce(a, add, 10);"
+                  "print sort(a);"),
+              "[5, 4, 3]\n"
+              "25\n"
+              "[1, 2, 3, 4, 5]\n");
+}
+
+TEST_F(ParallelTest, NativeCallbacksRunOverLargeArrays) {
+    EXPECT_EQ(run("var a = [];"
+                  "resize(a, 100000);"
+                  "for (var i = 0; i < 100000; i = i + 1) a[i] = i * i;"
+                  "print sum(map(a, sqrt));"
+                  "print len(filter(a, abs));"),
+              "4999950000\n"
+              "100000\n");
+}
+
+TEST_F(ParallelTest, NativeCallbackErrorIsReported) {
+    EXPECT_EQ(run("var a = [];"
+                  "resize(a, 100000);"
+                  "map(a, len);",
+                  INTERPRET_RUNTIME_ERROR)
+                  .substr(0, 35),
+              "Argument must be an array or a map.");
+}
+
+TEST_F(ParallelTest, CallbackErrorStopsTheNative) {
+    run("fun broken(x) { return x + nil; }"
+        "map([1, 2], broken);",
+        INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(run("print reduce([1, 2, 3], missing, 0);",
+                  INTERPRET_RUNTIME_ERROR)
+                  .substr(0, 9),
+              "Undefined");
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include "perf_counters.hpp"
+#include "vm.hpp"
+#include <sstream>
+#include <string>
+
+class PerfCountersTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    void run(std::string_view source) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+        testing::internal::GetCapturedStdout();
+    }
+
+    VM vm{};
+};
+
+TEST_F(PerfCountersTest, UnavailableCountersReportWhy) {
+    const PerfCounters &counters = vm.enablePerfCounters(false);
+    if (counters.available()) {
+        GTEST_SKIP() << "perf_event_open is permitted here";
+    }
+    run("print 1;");
+    EXPECT_EQ(counters.runs(), 0);
+    EXPECT_FALSE(counters.error().empty());
+    std::ostringstream json;
+    counters.writeJson(json);
+    EXPECT_EQ(json.str().rfind("{\"available\":false", 0), 0);
+}
+
+TEST_F(PerfCountersTest, CountsEachRun) {
+    const PerfCounters &counters = vm.enablePerfCounters(false);
+    if (!counters.available()) {
+        GTEST_SKIP() << counters.error();
+    }
+    run("var x = 0;");
+    run("for (var i = 0; i < 1000; i = i + 1) x = x + i;");
+    EXPECT_EQ(counters.runs(), 2);
+    if (counters.has(PerfCounters::INSTRUCTIONS)) {
+        EXPECT_GT(counters.total()[PerfCounters::INSTRUCTIONS], 1000);
+    }
+    EXPECT_TRUE(counters.functions().empty());
+}
+
+TEST_F(PerfCountersTest, ChargesFunctions) {
+    const PerfCounters &counters = vm.enablePerfCounters(true);
+    if (!counters.available()) {
+        GTEST_SKIP() << counters.error();
+    }
+    run("fun spin(n) { var x = 0; for (var i = 0; i < n; i = i + 1) x = x + i;"
+        "  return x; }"
+        "for (var i = 0; i < 10; i = i + 1) spin(10000);");
+    const Function *spin = nullptr;
+    for (const auto &[function, entry] : counters.functions()) {
+        if (function != nullptr && function->name == "spin") {
+            spin = function;
+            EXPECT_EQ(entry.calls, 10);
+            if (counters.has(PerfCounters::INSTRUCTIONS)) {
+                EXPECT_GT(entry.self[PerfCounters::INSTRUCTIONS], 100000);
+            }
+        }
+    }
+    EXPECT_NE(spin, nullptr);
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "sampling_profiler.hpp"
+#include "vm.hpp"
+#include <cstddef>
+#include <sstream>
+#include <string>
+
+class SamplingProfilerTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    // Collapsed stacks of a run of `source`, sampled at 10 kHz.
+    std::string profile(std::string_view source) {
+        SamplingProfiler profiler{10000};
+        EXPECT_TRUE(profiler.start(vm));
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), INTERPRET_OK);
+        testing::internal::GetCapturedStdout();
+        profiler.stop();
+        std::ostringstream out;
+        profiler.writeCollapsed(out);
+        samples = profiler.samples();
+        return out.str();
+    }
+
+    VM vm{};
+    size_t samples = 0;
+};
+
+TEST_F(SamplingProfilerTest, RecordsFunctionsAndLines) {
+    const std::string stacks = profile(
+        "fun spin() {\n"
+        "  var x = 0;\n"
+        "  for (var i = 0; i < 2000000; i = i + 1) x = x + i;\n"
+        "  return x;\n"
+        "}\n"
+        "spin();\n");
+    EXPECT_GT(samples, 0);
+    EXPECT_NE(stacks.find("script:6;spin:3 "), std::string::npos) << stacks;
+}
+
+TEST_F(SamplingProfilerTest, CountsAddUpToSamples) {
+    const std::string stacks = profile(
+        "var x = 0;"
+        "for (var i = 0; i < 2000000; i = i + 1) x = x + i;");
+    std::istringstream lines{stacks};
+    std::string line;
+    size_t total = 0;
+    while (std::getline(lines, line)) {
+        total += std::stoul(line.substr(line.rfind(' ') + 1));
+    }
+    EXPECT_EQ(total, samples);
+}
+
+TEST_F(SamplingProfilerTest, OnlyOneProfilerRunsAtATime) {
+    SamplingProfiler first{};
+    SamplingProfiler second{};
+    ASSERT_TRUE(first.start(vm));
+    EXPECT_FALSE(second.start(vm));
+    first.stop();
+    EXPECT_TRUE(second.start(vm));
+}
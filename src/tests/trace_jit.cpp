@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include "trace_jit.hpp"
+#include "vm.hpp"
+#include "x64_assembler.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class TraceJitTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        if (vm.traceJit() == nullptr) {
+            GTEST_SKIP() << "built without MEHH_JIT";
+        }
+        EXPECT_TRUE(interpreter.enableJit(false));
+    }
+
+    void TearDown() override {}
+
+    static std::string run(VM &on, std::string_view source,
+                           InterpretResult expected) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(on.interpret(source), expected);
+        return testing::internal::GetCapturedStdout();
+    }
+
+    // Runs `source` traced and interpreted; both must print the same.
+    std::string run(std::string_view source,
+                    InterpretResult expected = INTERPRET_OK) {
+        const std::string traced = run(vm, source, expected);
+        EXPECT_EQ(traced, run(interpreter, source, expected));
+        return traced;
+    }
+
+    const TraceJit::Stats &stats() const { return vm.traceJit()->stats(); }
+
+    VM vm{};
+    VM interpreter{};
+};
+
+TEST_F(TraceJitTest, CompilesHotLoops) {
+    EXPECT_EQ(run("var a = 0;\n"
+                  "var b = 1;\n"
+                  "for (var i = 0; i < 1000; i = i + 1) {\n"
+                  "  var c = a + b;\n"
+                  "  a = b;\n"
+                  "  b = c - a * 0.5;\n"
+                  "}\n"
+                  "print a;\n"),
+              "1.4425279646226296e+107\n");
+    EXPECT_EQ(stats().traces, 1);
+    EXPECT_GT(stats().iterations, 900);
+}
+
+TEST_F(TraceJitTest, SideExitsResumeTheInterpreter) {
+    // The loop is recorded while x is a number, then x turns nil and the
+    // comparison with nil goes the other way.
+    EXPECT_EQ(run("var x = 0;\n"
+                  "var out = 0;\n"
+                  "for (var i = 0; i < 500; i = i + 1) {\n"
+                  "  if (i == 300) x = nil;\n"
+                  "  if (x == nil) out = out + 1; else out = out + x;\n"
+                  "  if (x != nil) x = x + 1;\n"
+                  "}\n"
+                  "print out;\n"
+                  "{ var k = 7; print k; }\n"),
+              "45050\n7\n");
+    EXPECT_GT(stats().iterations, 400);
+}
+
+TEST_F(TraceJitTest, SideTracesCoverBranchyBodies) {
+    EXPECT_EQ(run("var total = 0;\n"
+                  "for (var i = 0; i < 200; i = i + 1) {\n"
+                  "  for (var j = 0; j < 100; j = j + 1) {\n"
+                  "    if (j < i) total = total + j; else total = total - 1;\n"
+                  "  }\n"
+                  "}\n"
+                  "print total;\n"),
+              "651650\n");
+    EXPECT_GE(stats().sideTraces, 1);
+    EXPECT_GT(stats().iterations, 19000);
+}
+
+TEST_F(TraceJitTest, InlinesCalls) {
+    EXPECT_EQ(run("fun sq(x) { return x * x; }\n"
+                  "fun hyp(a, b) { return sqrt(sq(a) + sq(b)); }\n"
+                  "var acc = 0;\n"
+                  "for (var i = 0; i < 1000; i = i + 1) acc = acc + hyp(i, 1);\n"
+                  "print acc > 499500;\n"),
+              "true\n");
+    EXPECT_EQ(stats().traces, 1);
+    EXPECT_GT(stats().iterations, 900);
+}
+
+TEST_F(TraceJitTest, ExitsRebuildInlinedFrames) {
+    // The error happens inside f, inlined into the loop's trace.
+    EXPECT_EQ(run("fun f(x) {\n"
+                  "  return x + 1;\n"
+                  "}\n"
+                  "var y = 1;\n"
+                  "var s = 0;\n"
+                  "for (var i = 0; i < 500; i = i + 1) {\n"
+                  "  if (i == 450) y = \"one\";\n"
+                  "  s = s + f(y);\n"
+                  "}\n",
+                  INTERPRET_RUNTIME_ERROR),
+              "Operands must be two numbers or two strings.\n"
+              "[line 2] in script\nf\n[line 8] in script\nscript\n");
+    EXPECT_EQ(stats().traces, 1);
+}
+
+TEST_F(TraceJitTest, IndexesNumericArrays) {
+    EXPECT_EQ(run("var a = [];\n"
+                  "for (var i = 0; i < 1000; i = i + 1) push(a, i);\n"
+                  "var s = 0;\n"
+                  "for (var i = 0; i < len(a); i = i + 1) {\n"
+                  "  a[i] = a[i] * 2;\n"
+                  "  s = s + a[i];\n"
+                  "}\n"
+                  "var t = 0;\n"
+                  "for (var x in a) t = t + abs(x - 1000);\n"
+                  "print s;\n"
+                  "print t;\n"
+                  "print a[999];\n"),
+              "999000\n500000\n1998\n");
+    // push isn't traced, but the loops reading and writing a are.
+    EXPECT_EQ(stats().traces, 2);
+}
+
+TEST_F(TraceJitTest, ReportsErrorsAtTheFailingLine) {
+    EXPECT_EQ(run("var a = [1, 2, 3];\n"
+                  "var s = 0;\n"
+                  "for (var i = 0; i < 500; i = i + 1) {\n"
+                  "  s = s + i;\n"
+                  "  if (i == 400) s = s + a[i];\n"
+                  "}\n",
+                  INTERPRET_RUNTIME_ERROR),
+              "Array index 400 out of bounds for length 3.\n"
+              "[line 5] in script\nscript\n");
+}
+
+TEST_F(TraceJitTest, LeavesUnsupportedLoopsToTheInterpreter) {
+    run("var s = \"\";\n"
+        "for (var i = 0; i < 300; i = i + 1) s = s + \"a\";\n"
+        "print s == \"aaa\";\n");
+    EXPECT_EQ(stats().traces, 0);
+    EXPECT_GE(stats().aborts, 1);
+}
+
+TEST(X64AssemblerTest, EncodesExtendedRegisters) {
+    X64Assembler as;
+    // movsd xmm1, [r12 + 8] needs REX.B and a SIB byte.
+    as.movsdLoad(1, X64Assembler::R12, 8);
+    // mov r9, rax
+    as.mov(X64Assembler::R9, X64Assembler::RAX);
+    // movsd xmm10, [rdx + rax * 8]
+    as.movsdLoadIndexed(10, X64Assembler::RDX, X64Assembler::RAX);
+    const std::vector<uint8_t> expected{
+        0xF2, 0x41, 0x0F, 0x10, 0x8C, 0x24, 0x08, 0x00, 0x00, 0x00,
+        0x49, 0x89, 0xC1,
+        0xF2, 0x44, 0x0F, 0x10, 0x14, 0xC2,
+    };
+    EXPECT_EQ(as.code(), expected);
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "vm.hpp"
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+class TracerTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+
+    // The trace of running `source`.
+    std::string trace(std::string_view source,
+                      InterpretResult expected = INTERPRET_OK) {
+        std::ostringstream out;
+        vm.startTracing(out);
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), expected);
+        testing::internal::GetCapturedStdout();
+        EXPECT_EQ(vm.stopTracing(), 0);
+        return out.str();
+    }
+
+    static size_t count(const std::string &haystack, std::string_view needle) {
+        size_t n = 0;
+        for (size_t at = haystack.find(needle); at != std::string::npos;
+             at = haystack.find(needle, at + 1)) {
+            n++;
+        }
+        return n;
+    }
+
+    VM vm{};
+};
+
+TEST_F(TracerTest, RecordsBalancedCalls) {
+    const std::string json =
+        trace("fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+              "print fib(5);");
+    EXPECT_EQ(json.rfind("{\"traceEvents\":[", 0), 0);
+    EXPECT_EQ(json.substr(json.size() - 4), "\n]}\n");
+    EXPECT_EQ(count(json, "\"name\":\"fib\",\"cat\":\"function\",\"ph\":\"B\""),
+              15);
+    EXPECT_EQ(count(json, "\"name\":\"fib\",\"cat\":\"function\",\"ph\":\"E\""),
+              15);
+    EXPECT_EQ(count(json, "\"name\":\"script\",\"cat\":\"function\",\"ph\":\"B\""),
+              1);
+}
+
+TEST_F(TracerTest, RecordsNatives) {
+    const std::string json = trace("var t = clock();");
+    EXPECT_EQ(count(json, "\"name\":\"clock\",\"cat\":\"native\",\"ph\":\"B\""),
+              1);
+    EXPECT_EQ(count(json, "\"name\":\"clock\",\"cat\":\"native\",\"ph\":\"E\""),
+              1);
+}
+
+TEST_F(TracerTest, ClosesFramesOnRuntimeError) {
+    const std::string json =
+        trace("fun f() { return 1 + nil; } f();", INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(count(json, "\"ph\":\"B\""), count(json, "\"ph\":\"E\""));
+}
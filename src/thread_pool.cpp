@@ -0,0 +1,137 @@
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+thread_local bool insideWorker = false;
+// Set while the thread runs chunks of a job, including the thread that
+// submitted it, which holds `submit` meanwhile.
+thread_local bool insideJob = false;
+
+// Marks the calling thread as running chunks for its lifetime.
+class JobScope {
+public:
+  JobScope() : outer{insideJob} { insideJob = true; }
+  ~JobScope() { insideJob = outer; }
+  JobScope(const JobScope &) = delete;
+  JobScope &operator=(const JobScope &) = delete;
+
+private:
+  const bool outer;
+};
+
+size_t defaultThreads() {
+  if (const char *env = std::getenv("MEHH_THREADS")) {
+    const long threads = std::strtol(env, nullptr, 10);
+    if (threads > 0) {
+      return static_cast<size_t>(threads);
+    }
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threads) { start(std::max<size_t>(threads, 1) - 1); }
+
+ThreadPool::~ThreadPool() { stop(); }
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool{defaultThreads()};
+  return pool;
+}
+
+void ThreadPool::runInline() { insideWorker = true; }
+
+void ThreadPool::resize(size_t threads) {
+  // The job running this holds `submit` and needs the workers it has.
+  if (insideJob) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard{submit};
+  stop();
+  start(std::max<size_t>(threads, 1) - 1);
+}
+
+void ThreadPool::start(size_t workerCount) {
+  stopping = false;
+  workers.reserve(workerCount);
+  for (size_t i = 0; i < workerCount; i++) {
+    // Pass the current generation along: a worker that only gets going
+    // after the first job was posted must still pick it up.
+    workers.emplace_back(&ThreadPool::workerLoop, this, generation);
+  }
+}
+
+void ThreadPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void ThreadPool::workerLoop(uint64_t seen) {
+  insideWorker = true;
+  std::unique_lock<std::mutex> lock{mutex};
+  for (;;) {
+    wake.wait(lock, [&] { return stopping || generation != seen; });
+    if (stopping) {
+      return;
+    }
+    seen = generation;
+    lock.unlock();
+    runChunks();
+    lock.lock();
+    if (--active == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::runChunks() {
+  JobScope scope;
+  for (size_t begin = next.fetch_add(chunk, std::memory_order_relaxed);
+       begin < count; begin = next.fetch_add(chunk, std::memory_order_relaxed)) {
+    (*body)(begin, std::min(count, begin + chunk));
+  }
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const Body &body) {
+  grain = std::max<size_t>(grain, 1);
+  if (count <= grain || insideWorker || insideJob) {
+    if (count > 0) {
+      JobScope scope;
+      body(0, count);
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> guard{submit};
+  if (workers.empty()) {
+    JobScope scope;
+    body(0, count);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    this->body = &body;
+    this->count = count;
+    // A few chunks per thread evens out uneven chunk costs.
+    chunk = std::max(grain, (count + size() * 4 - 1) / (size() * 4));
+    next.store(0, std::memory_order_relaxed);
+    active = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+  runChunks();
+  std::unique_lock<std::mutex> lock{mutex};
+  done.wait(lock, [&] { return active == 0; });
+  this->body = nullptr;
+}
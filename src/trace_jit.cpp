@@ -0,0 +1,1409 @@
+#include "trace_jit.hpp"
+#include "array.hpp"
+#include "chunk.hpp"
+#include "function.hpp"
+#include "natives.hpp"
+#include "value.hpp"
+#include "vm.hpp"
+#include "x64_assembler.hpp"
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <sys/mman.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Asm = X64Assembler;
+
+constexpr uint64_t QNAN = 0x7FFC000000000000ULL;
+constexpr uint64_t SIGN = 0x8000000000000000ULL;
+
+constexpr size_t ARENA_SIZE = 4 << 20;
+// Bytecode instructions in one trace, counting those of inlined calls.
+constexpr size_t MAX_TRACE_LENGTH = 2000;
+constexpr size_t MAX_INLINE_DEPTH = 8;
+constexpr size_t MAX_SIDE_TRACES = 32;
+// Failed recordings before a loop is left to the interpreter for good.
+constexpr uint8_t MAX_FAILURES = 3;
+// Entries refused, e.g. because a global has gone, before the same.
+constexpr uint32_t MAX_REFUSALS = 64;
+// A tree that averages less than an iteration per entry costs more than it
+// saves; it is checked every this many entries.
+constexpr uint64_t ENTRY_CHECK = 64;
+
+// Per tree, the context the trace reads through R12: a pointer for each
+// global or upvalue, then the bits, data and size of each numeric array.
+constexpr size_t MAX_INDIRECTS = 32;
+constexpr size_t MAX_VIEWS = 16;
+constexpr size_t CONTEXT_WORDS = MAX_INDIRECTS + 3 * MAX_VIEWS;
+
+// Fixed registers. The rest are allocated to values: XMM0-14 to numbers
+// and the GPRs below to anything else, with RAX, RDX and XMM15 as scratch.
+constexpr Asm::Reg BASE = Asm::RBX;
+constexpr Asm::Reg CONTEXT = Asm::R12;
+constexpr Asm::Reg NAN_MASK = Asm::R13;
+constexpr Asm::Reg ITERATIONS = Asm::R14;
+constexpr Asm::Reg ITERATIONS_OUT = Asm::R15;
+constexpr Asm::Xmm SCRATCH = 15;
+constexpr std::array<Asm::Reg, 7> GPRS{Asm::RCX, Asm::RSI, Asm::RDI, Asm::R8,
+                                       Asm::R9,  Asm::R10, Asm::R11};
+
+int32_t indirectOffset(size_t k) { return static_cast<int32_t>(8 * k); }
+int32_t viewBits(size_t v) {
+  return static_cast<int32_t>(8 * (MAX_INDIRECTS + 3 * v));
+}
+int32_t viewData(size_t v) { return viewBits(v) + 8; }
+int32_t viewSize(size_t v) { return viewBits(v) + 16; }
+
+bool isFalsey(const Value &value) {
+  return value.isNil() || (value.isBool() && !value.asBool());
+}
+
+// Whether `index` would pass VM::checkIndex for `array`.
+bool validIndex(const ArrayObj *array, const Value &index) {
+  if (!index.isNumber()) {
+    return false;
+  }
+  const double i = index.asNumber();
+  return i >= 0 && i < array->size() &&
+         static_cast<double>(static_cast<size_t>(i)) == i;
+}
+
+bool isNumericArray(const Value &value) {
+  return value.isArray() && value.asObj()->as<ArrayObj>()->isNumeric();
+}
+
+} // namespace
+
+struct TraceJit::Tree {
+  using Entry = uint32_t (*)(Value *base, uint64_t *context,
+                             uint64_t *iterations);
+
+  // A global (by interned name) or an upvalue of a closure; a null closure
+  // is the root frame's, which can differ between entries.
+  struct Indirect {
+    const StringObj *global;
+    const Closure *closure;
+    uint8_t index;
+  };
+
+  struct Exit {
+    struct Frame {
+      // Stack slot of the frame's slot 0, from the root frame's.
+      uint32_t base;
+      uint32_t ip;
+    };
+    // The root frame first, then inlined calls.
+    std::vector<Frame> frames;
+    uint32_t depth;
+    uint32_t taken = 0;
+    // End of the stub's jump to the epilogue, retargeted to a side trace.
+    uint8_t *jump = nullptr;
+    bool linked = false;
+    bool abandoned = false;
+  };
+
+  const Function *function;
+  uint32_t header;
+  // Stack depth at the header, from the root frame's slot 0.
+  uint32_t depth;
+  uint32_t maxDepth;
+  // Frames of inlined calls.
+  uint32_t maxFrames = 0;
+  std::vector<Indirect> indirects;
+  // Where each array view is read from at entry: a stack slot, or an
+  // indirect k as -1 - k.
+  std::vector<int> views;
+  std::vector<Exit> exits;
+  Entry entry = nullptr;
+  const uint8_t *head = nullptr;
+  const uint8_t *epilogue = nullptr;
+  size_t sideTraces = 0;
+  uint64_t entries = 0;
+  uint64_t iterations = 0;
+  uint32_t refusals = 0;
+  std::array<uint64_t, CONTEXT_WORDS> context{};
+};
+
+// Records one path through a loop body and compiles it at the same time.
+//
+// The recorder keeps a concrete copy of the stack, globals and upvalues it
+// touches, steps it through the bytecode without side effects to decide
+// types and branches, and tracks where the trace holds each value: still in
+// memory, a known constant, or in a register. Memory is only brought up to
+// date at exits and at the back-edge.
+class TraceJit::Recorder {
+public:
+  // Records from the VM's current state: at the loop header for a root
+  // trace, or just after leaving through `from` for a side trace.
+  Recorder(VM &vm, Tree &tree, const Tree::Exit *from)
+      : vm{vm}, tree{tree}, root{from == nullptr},
+        rootFrame{vm.frames.size() - (root ? 1 : from->frames.size())},
+        base{static_cast<size_t>(vm.frames[rootFrame].slots -
+                                 vm.stack.begin())},
+        firstExit{tree.exits.size()}, firstIndirect{tree.indirects.size()},
+        firstView{tree.views.size()} {
+    xmmOwner.fill(FREE);
+    gprOwner.fill(FREE);
+    if (root) {
+      frames.push_back(Frame{vm.frames[rootFrame].closure, 0, tree.header});
+    } else {
+      for (size_t i = 0; i < from->frames.size(); i++) {
+        frames.push_back(Frame{vm.frames[rootFrame + i].closure,
+                               from->frames[i].base, from->frames[i].ip});
+      }
+    }
+    for (size_t i = base; i < vm.stack.size(); i++) {
+      slots.emplace_back();
+      values.push_back(vm.stack[i]);
+    }
+    maxDepth = std::max<uint32_t>(tree.maxDepth, slots.size());
+    maxFrames = tree.maxFrames;
+    for (const Tree::Indirect &known : tree.indirects) {
+      indirectSlots.emplace_back();
+      indirectValues.push_back(*pointer(known));
+    }
+    head = as.label();
+    epilogue = as.label();
+  }
+
+  // Records until the back-edge. Returns false, with the tree as it was,
+  // if the path does something traces can't.
+  bool record() {
+    if (root) {
+      as.push(Asm::RBX);
+      as.push(Asm::R12);
+      as.push(Asm::R13);
+      as.push(Asm::R14);
+      as.push(Asm::R15);
+      as.mov(BASE, Asm::RDI);
+      as.mov(CONTEXT, Asm::RSI);
+      as.mov(ITERATIONS_OUT, Asm::RDX);
+      as.movImm(NAN_MASK, QNAN);
+      as.movImm(ITERATIONS, 0);
+      as.bind(head);
+      headOffset = as.size();
+    } else {
+      as.bindExternal(head, tree.head);
+      as.bindExternal(epilogue, tree.epilogue);
+    }
+    if (!body()) {
+      rollback();
+      return false;
+    }
+    for (const Stub &stub : stubs) {
+      as.bind(stub.label);
+      for (const Writeback &writeback : stub.writebacks) {
+        store(writeback);
+      }
+      as.movImm(Asm::RAX, stub.exit);
+      as.jmp(epilogue);
+      jumps.emplace_back(stub.exit, as.size());
+    }
+    if (root) {
+      as.bind(epilogue);
+      epilogueOffset = as.size();
+      as.store(ITERATIONS_OUT, 0, ITERATIONS);
+      as.pop(Asm::R15);
+      as.pop(Asm::R14);
+      as.pop(Asm::R13);
+      as.pop(Asm::R12);
+      as.pop(Asm::RBX);
+      as.ret();
+    }
+    return true;
+  }
+
+  // Fills in the addresses of installed code.
+  void commit(uint8_t *code) {
+    if (root) {
+      tree.entry = reinterpret_cast<Tree::Entry>(code);
+      tree.head = code + headOffset;
+      tree.epilogue = code + epilogueOffset;
+    }
+    for (const auto &[exit, end] : jumps) {
+      tree.exits[exit].jump = code + end;
+    }
+    tree.maxDepth = maxDepth;
+    tree.maxFrames = maxFrames;
+  }
+
+  void rollback() {
+    tree.exits.resize(firstExit);
+    tree.indirects.resize(firstIndirect);
+    tree.views.resize(firstView);
+  }
+
+  X64Assembler as;
+
+private:
+  enum class Where : uint8_t { MEMORY, CONSTANT, XMM, GPR };
+
+  struct Slot {
+    Where where = Where::MEMORY;
+    uint8_t reg = 0;
+    // The value differs from what memory holds.
+    bool dirty = false;
+    // Guarded, or produced, as a number.
+    bool number = false;
+    uint64_t bits = 0;
+    // For a copy of an array, the location it was read from, which the
+    // trace reads again at entry to find the array's elements.
+    std::optional<int> origin;
+  };
+
+  struct Writeback {
+    int location;
+    Where where;
+    uint8_t reg;
+    uint64_t bits;
+  };
+
+  struct Stub {
+    Asm::Label label;
+    uint32_t exit;
+    std::vector<Writeback> writebacks;
+  };
+
+  struct Frame {
+    const Closure *closure;
+    uint32_t base;
+    uint32_t ip;
+  };
+
+  static constexpr int FREE = INT_MIN;
+
+  // Locations are stack slots from the root frame's slot 0, or indirects
+  // numbered -1, -2, ...
+  static int indirect(size_t k) { return -1 - static_cast<int>(k); }
+
+  Slot &slot(int location) {
+    return location >= 0 ? slots[location] : indirectSlots[-1 - location];
+  }
+
+  Value &value(int location) {
+    return location >= 0 ? values[location] : indirectValues[-1 - location];
+  }
+
+  // Locations that exist and hold the same array at every entry.
+  bool stable(int location) const {
+    return location < 0 || static_cast<uint32_t>(location) < tree.depth;
+  }
+
+  Value *pointer(const Tree::Indirect &indirect) {
+    if (indirect.global != nullptr) {
+      const auto it = vm.globals.find(indirect.global->str);
+      return it != vm.globals.end() ? &it->second : nullptr;
+    }
+    const Closure *closure = indirect.closure != nullptr
+                                 ? indirect.closure
+                                 : vm.frames[rootFrame].closure;
+    return closure->upvalues[indirect.index]->location;
+  }
+
+  std::optional<int> addIndirect(const Tree::Indirect &wanted) {
+    for (size_t k = 0; k < tree.indirects.size(); k++) {
+      const Tree::Indirect &known = tree.indirects[k];
+      if (known.global == wanted.global && known.closure == wanted.closure &&
+          known.index == wanted.index) {
+        return indirect(k);
+      }
+    }
+    Value *location = pointer(wanted);
+    if (location == nullptr || tree.indirects.size() == MAX_INDIRECTS) {
+      return std::nullopt;
+    }
+    // An open upvalue into the stack slots the trace keeps in registers, or
+    // two names for one cell, would need the two kept in sync.
+    const Value *stackBase = vm.stack.data() + base;
+    if (location >= stackBase && location < stackBase + STACK_MAX) {
+      return std::nullopt;
+    }
+    for (const Tree::Indirect &known : tree.indirects) {
+      if (pointer(known) == location) {
+        return std::nullopt;
+      }
+    }
+    tree.indirects.push_back(wanted);
+    indirectSlots.emplace_back();
+    indirectValues.push_back(*location);
+    return indirect(tree.indirects.size() - 1);
+  }
+
+  std::optional<size_t> view(int location) {
+    for (size_t v = 0; v < tree.views.size(); v++) {
+      if (tree.views[v] == location) {
+        return v;
+      }
+    }
+    if (tree.views.size() == MAX_VIEWS) {
+      return std::nullopt;
+    }
+    tree.views.push_back(location);
+    return tree.views.size() - 1;
+  }
+
+  // The view of the array at `location`, if it is one the trace can index.
+  std::optional<size_t> arrayView(int location) {
+    const std::optional<int> origin = slot(location).origin;
+    if (!isNumericArray(value(location)) || !origin.has_value()) {
+      return std::nullopt;
+    }
+    return view(*origin);
+  }
+
+  // Memory
+
+  // Where `location` lives in memory. Indirect locations load their
+  // pointer into RDX.
+  std::pair<Asm::Reg, int32_t> address(int location) {
+    if (location >= 0) {
+      return {BASE, static_cast<int32_t>(8 * location)};
+    }
+    as.load(Asm::RDX, CONTEXT, indirectOffset(-1 - location));
+    return {Asm::RDX, 0};
+  }
+
+  Writeback writeback(int location) {
+    const Slot &s = slot(location);
+    return Writeback{location, s.where, s.reg, s.bits};
+  }
+
+  void store(const Writeback &writeback) {
+    if (writeback.where == Where::CONSTANT) {
+      as.movImm(Asm::RAX, writeback.bits);
+    }
+    const auto [reg, disp] = address(writeback.location);
+    switch (writeback.where) {
+    case Where::CONSTANT:
+      as.store(reg, disp, Asm::RAX);
+      break;
+    case Where::XMM:
+      as.movsdStore(reg, disp, writeback.reg);
+      break;
+    case Where::GPR:
+      as.store(reg, disp, static_cast<Asm::Reg>(writeback.reg));
+      break;
+    case Where::MEMORY:
+      break;
+    }
+  }
+
+  // Registers
+
+  void assign(int location, Where where, uint8_t reg) {
+    Slot &s = slot(location);
+    s.where = where;
+    s.reg = reg;
+    if (where == Where::XMM) {
+      xmmOwner[reg] = location;
+      xmmStamp[reg] = ++clock;
+    } else {
+      gprOwner[reg] = location;
+      gprStamp[reg] = ++clock;
+    }
+  }
+
+  // Drops the register holding `location`, if any, without saving it.
+  void release(int location) {
+    const Slot &s = slot(location);
+    if (s.where == Where::XMM) {
+      xmmOwner[s.reg] = FREE;
+    } else if (s.where == Where::GPR) {
+      gprOwner[s.reg] = FREE;
+    }
+  }
+
+  void touch(int location) {
+    const Slot &s = slot(location);
+    if (s.where == Where::XMM) {
+      xmmStamp[s.reg] = ++clock;
+    } else if (s.where == Where::GPR) {
+      gprStamp[s.reg] = ++clock;
+    }
+  }
+
+  void spill(int location) {
+    Slot &s = slot(location);
+    if (s.dirty) {
+      store(writeback(location));
+    }
+    release(location);
+    s.where = Where::MEMORY;
+    s.dirty = false;
+  }
+
+  // A free register, spilling the least recently used value if needed.
+  Asm::Xmm freeXmm() {
+    Asm::Xmm victim = 0;
+    for (Asm::Xmm r = 0; r < SCRATCH; r++) {
+      if (xmmOwner[r] == FREE) {
+        return r;
+      }
+      if (xmmStamp[r] < xmmStamp[victim]) {
+        victim = r;
+      }
+    }
+    spill(xmmOwner[victim]);
+    return victim;
+  }
+
+  Asm::Reg freeGpr() {
+    Asm::Reg victim = GPRS[0];
+    for (const Asm::Reg r : GPRS) {
+      if (gprOwner[r] == FREE) {
+        return r;
+      }
+      if (gprStamp[r] < gprStamp[victim]) {
+        victim = r;
+      }
+    }
+    spill(gprOwner[victim]);
+    return victim;
+  }
+
+  // Exits
+
+  // A side exit that resumes the interpreter at the current instruction
+  // with the current state.
+  Asm::Label exit() {
+    Tree::Exit state;
+    for (size_t i = 0; i < frames.size(); i++) {
+      state.frames.push_back(Tree::Exit::Frame{
+          frames[i].base, i + 1 == frames.size() ? at : frames[i].ip});
+    }
+    state.depth = static_cast<uint32_t>(slots.size());
+    Stub stub{as.label(), static_cast<uint32_t>(tree.exits.size()), {}};
+    for (size_t p = 0; p < slots.size(); p++) {
+      if (slots[p].dirty) {
+        stub.writebacks.push_back(writeback(static_cast<int>(p)));
+      }
+    }
+    for (size_t k = 0; k < indirectSlots.size(); k++) {
+      if (indirectSlots[k].dirty) {
+        stub.writebacks.push_back(writeback(indirect(k)));
+      }
+    }
+    tree.exits.push_back(std::move(state));
+    stubs.push_back(std::move(stub));
+    return stubs.back().label;
+  }
+
+  void guardNumber(Asm::Reg reg) {
+    const Asm::Label out = exit();
+    as.mov(Asm::RDX, reg);
+    as.andReg(Asm::RDX, NAN_MASK);
+    as.cmp(Asm::RDX, NAN_MASK);
+    as.jcc(Asm::EQUAL, out);
+  }
+
+  // Guards that `location` does (or doesn't) hold exactly `bits`. Once
+  // equal, it is a constant.
+  void guardBits(int location, uint64_t bits, bool equal) {
+    Slot &s = slot(location);
+    if (s.where == Where::CONSTANT) {
+      return;
+    }
+    const Asm::Reg reg = toGpr(location);
+    const Asm::Label out = exit();
+    as.movImm(Asm::RAX, bits);
+    as.cmp(reg, Asm::RAX);
+    as.jcc(equal ? Asm::NOT_EQUAL : Asm::EQUAL, out);
+    if (equal) {
+      release(location);
+      s.where = Where::CONSTANT;
+      s.bits = bits;
+    }
+  }
+
+  // Guards the truthiness `location` was recorded with.
+  void guardTruthiness(int location) {
+    const Slot &s = slot(location);
+    const Value v = value(location);
+    if (s.where == Where::CONSTANT || s.number) {
+      return;
+    }
+    if (v.isNil() || v.isBool()) {
+      guardBits(location, v.bits(), true);
+      return;
+    }
+    // nil and false are adjacent: falsey values are at most 1 above nil.
+    const Asm::Reg reg = toGpr(location);
+    const Asm::Label out = exit();
+    as.movImm(Asm::RAX, Value{}.bits());
+    as.mov(Asm::RDX, reg);
+    as.subReg(Asm::RDX, Asm::RAX);
+    as.cmpImm(Asm::RDX, 1);
+    as.jcc(Asm::BELOW_EQUAL, out);
+  }
+
+  // Values
+
+  Asm::Xmm toXmm(int location) {
+    Slot &s = slot(location);
+    switch (s.where) {
+    case Where::XMM:
+      touch(location);
+      return s.reg;
+    case Where::CONSTANT: {
+      const Asm::Xmm reg = freeXmm();
+      as.movImm(Asm::RAX, s.bits);
+      as.movqToXmm(reg, Asm::RAX);
+      assign(location, Where::XMM, reg);
+      break;
+    }
+    case Where::GPR: {
+      const Asm::Reg gpr = static_cast<Asm::Reg>(s.reg);
+      if (!s.number) {
+        guardNumber(gpr);
+      }
+      const Asm::Xmm reg = freeXmm();
+      as.movqToXmm(reg, gpr);
+      gprOwner[gpr] = FREE;
+      assign(location, Where::XMM, reg);
+      break;
+    }
+    case Where::MEMORY: {
+      const Asm::Xmm reg = freeXmm();
+      const auto [base, disp] = address(location);
+      if (s.number) {
+        as.movsdLoad(reg, base, disp);
+      } else {
+        as.load(Asm::RAX, base, disp);
+        guardNumber(Asm::RAX);
+        as.movqToXmm(reg, Asm::RAX);
+      }
+      assign(location, Where::XMM, reg);
+      s.dirty = false;
+      break;
+    }
+    }
+    s.number = true;
+    return s.reg;
+  }
+
+  Asm::Reg toGpr(int location) {
+    Slot &s = slot(location);
+    switch (s.where) {
+    case Where::GPR:
+      touch(location);
+      return static_cast<Asm::Reg>(s.reg);
+    case Where::CONSTANT: {
+      const Asm::Reg reg = freeGpr();
+      as.movImm(reg, s.bits);
+      assign(location, Where::GPR, reg);
+      break;
+    }
+    case Where::XMM: {
+      const Asm::Reg reg = freeGpr();
+      as.movqFromXmm(reg, s.reg);
+      xmmOwner[s.reg] = FREE;
+      assign(location, Where::GPR, reg);
+      break;
+    }
+    case Where::MEMORY: {
+      const Asm::Reg reg = freeGpr();
+      const auto [base, disp] = address(location);
+      as.load(reg, base, disp);
+      assign(location, Where::GPR, reg);
+      s.dirty = false;
+      break;
+    }
+    }
+    return static_cast<Asm::Reg>(s.reg);
+  }
+
+  // Pushes a copy of `from`, loaded before the push so that a guard on it
+  // exits with the stack as the instruction found it.
+  void pushCopy(int from) {
+    load(from);
+    copy(from, push(Value{}));
+  }
+
+  int push(const Value &v) {
+    slots.emplace_back();
+    values.push_back(v);
+    maxDepth = std::max<uint32_t>(maxDepth, slots.size());
+    return static_cast<int>(slots.size() - 1);
+  }
+
+  void truncate(size_t depth) {
+    for (size_t p = depth; p < slots.size(); p++) {
+      release(static_cast<int>(p));
+    }
+    slots.resize(depth);
+    values.resize(depth);
+  }
+
+  void setConstant(int location, const Value &v) {
+    release(location);
+    Slot &s = slot(location);
+    s = Slot{};
+    s.where = Where::CONSTANT;
+    s.bits = v.bits();
+    s.dirty = true;
+    s.number = v.isNumber();
+    value(location) = v;
+  }
+
+  void setXmm(int location, Asm::Xmm reg, double number) {
+    release(location);
+    slot(location) = Slot{};
+    assign(location, Where::XMM, reg);
+    slot(location).dirty = true;
+    slot(location).number = true;
+    value(location) = Value{number};
+  }
+
+  // Gives `to` the value, and register, of `from`, which is then dead.
+  void move(int from, int to) {
+    release(to);
+    slot(to) = slot(from);
+    slot(to).dirty = true;
+    value(to) = value(from);
+    slot(from) = Slot{};
+    const Slot &s = slot(to);
+    if (s.where == Where::XMM) {
+      xmmOwner[s.reg] = to;
+    } else if (s.where == Where::GPR) {
+      gprOwner[s.reg] = to;
+    }
+  }
+
+  // Loads `location` into a register, guarding its type if it is a number.
+  void load(int location) {
+    if (slot(location).where == Where::MEMORY) {
+      if (value(location).isNumber()) {
+        toXmm(location);
+      } else {
+        toGpr(location);
+      }
+    }
+  }
+
+  void copy(int from, int to) {
+    const Value v = value(from);
+    load(from);
+    touch(from);
+    release(to);
+    const Slot &src = slot(from);
+    Slot copied{};
+    copied.dirty = true;
+    copied.number = src.number;
+    copied.origin = stable(from) ? std::optional<int>{from} : src.origin;
+    copied.where = src.where;
+    copied.bits = src.bits;
+    slot(to) = copied;
+    value(to) = v;
+    if (src.where == Where::XMM) {
+      const Asm::Xmm reg = freeXmm();
+      as.movapd(reg, slot(from).reg);
+      assign(to, Where::XMM, reg);
+    } else if (src.where == Where::GPR) {
+      const Asm::Reg reg = freeGpr();
+      as.mov(reg, static_cast<Asm::Reg>(slot(from).reg));
+      assign(to, Where::GPR, reg);
+    }
+  }
+
+  // Writes everything back and forgets what the registers held, as the
+  // loop header expects.
+  void flush() {
+    for (size_t p = 0; p < slots.size(); p++) {
+      spill(static_cast<int>(p));
+      slots[p] = Slot{};
+    }
+    for (size_t k = 0; k < indirectSlots.size(); k++) {
+      spill(indirect(k));
+      indirectSlots[k] = Slot{};
+    }
+  }
+
+  // Instructions
+
+  bool arithmetic(uint8_t op) {
+    const int a = static_cast<int>(slots.size() - 2);
+    const int b = a + 1;
+    if (!values[a].isNumber() || !values[b].isNumber()) {
+      return false;
+    }
+    toXmm(a);
+    const Asm::Xmm rb = toXmm(b);
+    const Asm::Xmm ra = slot(a).reg;
+    const double x = values[a].asNumber();
+    const double y = values[b].asNumber();
+    double result = 0;
+    switch (op) {
+    case OP_ADD:
+      as.addsd(ra, rb);
+      result = x + y;
+      break;
+    case OP_SUBTRACT:
+      as.subsd(ra, rb);
+      result = x - y;
+      break;
+    case OP_MULTIPLY:
+      as.mulsd(ra, rb);
+      result = x * y;
+      break;
+    default:
+      as.divsd(ra, rb);
+      result = x / y;
+      break;
+    }
+    slot(a).dirty = true;
+    slot(a).origin.reset();
+    values[a] = Value{result};
+    truncate(slots.size() - 1);
+    return true;
+  }
+
+  bool compare(bool less) {
+    const int a = static_cast<int>(slots.size() - 2);
+    const int b = a + 1;
+    if (!values[a].isNumber() || !values[b].isNumber()) {
+      return false;
+    }
+    toXmm(a);
+    const Asm::Xmm rb = toXmm(b);
+    const Asm::Xmm ra = slot(a).reg;
+    const double x = values[a].asNumber();
+    const double y = values[b].asNumber();
+    const bool result = less ? x < y : x > y;
+    const Asm::Label out = exit();
+    // ucomisd sets "above" only for ordered operands, so NaN compares false.
+    if (less) {
+      as.ucomisd(rb, ra);
+    } else {
+      as.ucomisd(ra, rb);
+    }
+    as.jcc(result ? Asm::BELOW_EQUAL : Asm::ABOVE, out);
+    setConstant(a, Value{result});
+    truncate(slots.size() - 1);
+    return true;
+  }
+
+  bool equal() {
+    const int a = static_cast<int>(slots.size() - 2);
+    const int b = a + 1;
+    const Value x = values[a];
+    const Value y = values[b];
+    bool result;
+    if (x.isNumber() && y.isNumber()) {
+      result = x.asNumber() == y.asNumber();
+      toXmm(a);
+      const Asm::Xmm rb = toXmm(b);
+      const Asm::Xmm ra = slot(a).reg;
+      const Asm::Label out = exit();
+      as.ucomisd(ra, rb);
+      if (result) {
+        as.jcc(Asm::NOT_EQUAL, out);
+        as.jcc(Asm::PARITY, out);
+      } else {
+        const Asm::Label unordered = as.label();
+        as.jcc(Asm::PARITY, unordered);
+        as.jcc(Asm::EQUAL, out);
+        as.bind(unordered);
+      }
+    } else {
+      // Against nil or a boolean, equality is identity of the bits.
+      int other = a;
+      Value constant = y;
+      if (slot(a).where == Where::CONSTANT && (x.isNil() || x.isBool())) {
+        other = b;
+        constant = x;
+      } else if (slot(b).where != Where::CONSTANT ||
+                 !(y.isNil() || y.isBool())) {
+        return false;
+      }
+      result = value(other).bits() == constant.bits();
+      if (!slot(other).number) {
+        guardBits(other, constant.bits(), result);
+      }
+    }
+    setConstant(a, Value{result});
+    truncate(slots.size() - 1);
+    return true;
+  }
+
+  bool call(uint8_t argCount) {
+    const int callee = static_cast<int>(slots.size() - 1 - argCount);
+    const Value target = values[callee];
+    if (!target.isObj()) {
+      return false;
+    }
+    if (target.asObj()->getType() == ValueType::CLOSURE) {
+      const Closure *closure =
+          static_cast<const Closure *>(target.asObj());
+      if (closure->function->arity != argCount ||
+          closure->function->generator ||
+          frames.size() > MAX_INLINE_DEPTH) {
+        return false;
+      }
+      guardBits(callee, target.bits(), true);
+      frames.back().ip = at + 2;
+      frames.push_back(
+          Frame{closure, static_cast<uint32_t>(callee), 0});
+      maxFrames = std::max<uint32_t>(maxFrames, frames.size() - 1);
+      return true;
+    }
+    if (target.asObj()->getType() != ValueType::NATIVE_FUNCTION ||
+        argCount != 1) {
+      return false;
+    }
+    const NativeFunctionPtr fun =
+        static_cast<const NativeFunction *>(target.asObj())->fun;
+    const int arg = callee + 1;
+    const Value v = values[arg];
+    if ((fun == sqrtNative || fun == absNative) && v.isNumber()) {
+      guardBits(callee, target.bits(), true);
+      const Asm::Xmm reg = toXmm(arg);
+      if (fun == sqrtNative) {
+        as.sqrtsd(reg, reg);
+        values[arg] = Value{std::sqrt(v.asNumber())};
+      } else {
+        as.movImm(Asm::RAX, ~SIGN);
+        as.movqToXmm(SCRATCH, Asm::RAX);
+        as.andpd(reg, SCRATCH);
+        values[arg] = Value{std::fabs(v.asNumber())};
+      }
+      move(arg, callee);
+    } else if (fun == lenNative) {
+      const std::optional<size_t> array = arrayView(arg);
+      if (!array.has_value()) {
+        return false;
+      }
+      guardBits(callee, target.bits(), true);
+      const Asm::Reg reg = toGpr(arg);
+      const Asm::Label out = exit();
+      as.cmpMem(reg, CONTEXT, viewBits(*array));
+      as.jcc(Asm::NOT_EQUAL, out);
+      const Asm::Xmm result = freeXmm();
+      as.load(Asm::RAX, CONTEXT, viewSize(*array));
+      as.cvtsi2sd(result, Asm::RAX);
+      setXmm(callee, result,
+             static_cast<double>(v.asObj()->as<ArrayObj>()->size()));
+    } else {
+      return false;
+    }
+    truncate(callee + 1);
+    frames.back().ip = at + 2;
+    return true;
+  }
+
+  // Guards that `target` is the array of view `array` and `index` a valid
+  // index into it, and leaves the index in RAX.
+  void guardIndex(int target, int index, size_t array) {
+    toGpr(target);
+    toXmm(index);
+    const Asm::Reg reg = static_cast<Asm::Reg>(slot(target).reg);
+    const Asm::Xmm number = slot(index).reg;
+    const Asm::Label out = exit();
+    as.cmpMem(reg, CONTEXT, viewBits(array));
+    as.jcc(Asm::NOT_EQUAL, out);
+    as.cvttsd2si(Asm::RAX, number);
+    as.cvtsi2sd(SCRATCH, Asm::RAX);
+    as.ucomisd(SCRATCH, number);
+    as.jcc(Asm::NOT_EQUAL, out);
+    as.jcc(Asm::PARITY, out);
+    // Unsigned, so negative indices fail too.
+    as.cmpMem(Asm::RAX, CONTEXT, viewSize(array));
+    as.jcc(Asm::ABOVE_EQUAL, out);
+  }
+
+  bool getIndex() {
+    const int target = static_cast<int>(slots.size() - 2);
+    const int index = target + 1;
+    const std::optional<size_t> array = arrayView(target);
+    if (!array.has_value() ||
+        !validIndex(values[target].asObj()->as<ArrayObj>(), values[index])) {
+      return false;
+    }
+    guardIndex(target, index, *array);
+    const Asm::Xmm result = freeXmm();
+    as.load(Asm::RDX, CONTEXT, viewData(*array));
+    as.movsdLoadIndexed(result, Asm::RDX, Asm::RAX);
+    const Value element = values[target].asObj()->as<ArrayObj>()->get(
+        static_cast<size_t>(values[index].asNumber()));
+    setXmm(target, result, element.asNumber());
+    truncate(slots.size() - 1);
+    return true;
+  }
+
+  bool setIndex() {
+    const int target = static_cast<int>(slots.size() - 3);
+    const int index = target + 1;
+    const int stored = target + 2;
+    const std::optional<size_t> array = arrayView(target);
+    if (!array.has_value() || !values[stored].isNumber() ||
+        !validIndex(values[target].asObj()->as<ArrayObj>(), values[index])) {
+      return false;
+    }
+    toXmm(stored);
+    guardIndex(target, index, *array);
+    as.load(Asm::RDX, CONTEXT, viewData(*array));
+    as.movsdStoreIndexed(Asm::RDX, Asm::RAX, slot(stored).reg);
+    move(stored, target);
+    truncate(slots.size() - 2);
+    return true;
+  }
+
+  bool iterate(uint8_t local, uint16_t offset) {
+    const int sequence = static_cast<int>(frames.back().base + local);
+    const int cursor = sequence + 1;
+    if (!isNumericArray(values[sequence]) || !stable(sequence)) {
+      return false;
+    }
+    const std::optional<size_t> array = view(sequence);
+    if (!array.has_value()) {
+      return false;
+    }
+    const ArrayObj *elements = values[sequence].asObj()->as<ArrayObj>();
+    const size_t next = static_cast<size_t>(values[cursor].asNumber());
+    const bool more = next < elements->size();
+    toGpr(sequence);
+    toXmm(cursor);
+    const Asm::Reg reg = static_cast<Asm::Reg>(slot(sequence).reg);
+    const Asm::Label out = exit();
+    as.cmpMem(reg, CONTEXT, viewBits(*array));
+    as.jcc(Asm::NOT_EQUAL, out);
+    as.cvttsd2si(Asm::RAX, slot(cursor).reg);
+    as.cmpMem(Asm::RAX, CONTEXT, viewSize(*array));
+    as.jcc(more ? Asm::ABOVE_EQUAL : Asm::BELOW, out);
+    if (!more) {
+      frames.back().ip = at + 4 + offset;
+      return true;
+    }
+    const int element = push(elements->get(next));
+    const Asm::Xmm result = freeXmm();
+    as.load(Asm::RDX, CONTEXT, viewData(*array));
+    as.movsdLoadIndexed(result, Asm::RDX, Asm::RAX);
+    setXmm(element, result, elements->get(next).asNumber());
+    as.addImm(Asm::RAX, 1);
+    as.cvtsi2sd(slot(cursor).reg, Asm::RAX);
+    slot(cursor).dirty = true;
+    values[cursor] = Value{static_cast<double>(next + 1)};
+    frames.back().ip = at + 4;
+    return true;
+  }
+
+  bool body() {
+    for (;;) {
+      if (++length > MAX_TRACE_LENGTH) {
+        return false;
+      }
+      Frame &frame = frames.back();
+      const Function *function = frame.closure->function;
+      const std::vector<uint8_t> &code = function->chunk->getCode();
+      const std::vector<Value> &constants =
+          function->chunk->getConstants().getValues();
+      at = frame.ip;
+      const auto byte = [&](size_t i) { return code[at + 1 + i]; };
+      const auto offset = [&](size_t i) {
+        return static_cast<uint16_t>((code[at + 1 + i] << 8) |
+                                     code[at + 2 + i]);
+      };
+      const int top = static_cast<int>(slots.size() - 1);
+      switch (code[at]) {
+      case OP_CONSTANT:
+        setConstant(push(Value{}), constants[byte(0)]);
+        frame.ip = at + 2;
+        break;
+      case OP_NIL:
+        setConstant(push(Value{}), Value{});
+        frame.ip = at + 1;
+        break;
+      case OP_TRUE:
+      case OP_FALSE:
+        setConstant(push(Value{}), Value{code[at] == OP_TRUE});
+        frame.ip = at + 1;
+        break;
+      case OP_POP:
+        truncate(slots.size() - 1);
+        frame.ip = at + 1;
+        break;
+      case OP_GET_LOCAL: {
+        const int local = static_cast<int>(frame.base + byte(0));
+        pushCopy(local);
+        frame.ip = at + 2;
+        break;
+      }
+      case OP_SET_LOCAL:
+        copy(top, static_cast<int>(frame.base + byte(0)));
+        frame.ip = at + 2;
+        break;
+      case OP_GET_GLOBAL:
+      case OP_SET_GLOBAL:
+      case OP_GET_UPVALUE:
+      case OP_SET_UPVALUE: {
+        const bool global =
+            code[at] == OP_GET_GLOBAL || code[at] == OP_SET_GLOBAL;
+        const Tree::Indirect wanted =
+            global
+                ? Tree::Indirect{constants[byte(0)].asObj()->as<StringObj>(),
+                                 nullptr, 0}
+                : Tree::Indirect{nullptr,
+                                 frames.size() == 1 ? nullptr : frame.closure,
+                                 byte(0)};
+        const std::optional<int> location = addIndirect(wanted);
+        if (!location.has_value()) {
+          return false;
+        }
+        if (code[at] == OP_GET_GLOBAL || code[at] == OP_GET_UPVALUE) {
+          pushCopy(*location);
+        } else {
+          copy(top, *location);
+        }
+        frame.ip = at + 2;
+        break;
+      }
+      case OP_ADD:
+      case OP_SUBTRACT:
+      case OP_MULTIPLY:
+      case OP_DIVIDE:
+        if (!arithmetic(code[at])) {
+          return false;
+        }
+        frame.ip = at + 1;
+        break;
+      case OP_NEGATE: {
+        if (!values[top].isNumber()) {
+          return false;
+        }
+        const Asm::Xmm reg = toXmm(top);
+        as.movImm(Asm::RAX, SIGN);
+        as.movqToXmm(SCRATCH, Asm::RAX);
+        as.xorpd(reg, SCRATCH);
+        slot(top).dirty = true;
+        slot(top).origin.reset();
+        values[top] = Value{-values[top].asNumber()};
+        frame.ip = at + 1;
+        break;
+      }
+      case OP_LESS:
+      case OP_GREATER:
+        if (!compare(code[at] == OP_LESS)) {
+          return false;
+        }
+        frame.ip = at + 1;
+        break;
+      case OP_EQUAL:
+        if (!equal()) {
+          return false;
+        }
+        frame.ip = at + 1;
+        break;
+      case OP_NOT:
+        guardTruthiness(top);
+        setConstant(top, Value{isFalsey(values[top])});
+        frame.ip = at + 1;
+        break;
+      case OP_JUMP:
+        frame.ip = at + 3 + offset(0);
+        break;
+      case OP_JUMP_IF_FALSE:
+        guardTruthiness(top);
+        frame.ip = at + 3 + (isFalsey(values[top]) ? offset(0) : 0);
+        break;
+      case OP_LOOP: {
+        const uint32_t target = at + 3 - offset(0);
+        if (frames.size() == 1 && target == tree.header) {
+          flush();
+          as.addImm(ITERATIONS, 1);
+          as.jmp(head);
+          return true;
+        }
+        // Other back-edges are plain jumps, like the one from a for loop's
+        // increment to its condition, until one comes round again: then
+        // the trace would be unrolling an inner loop.
+        const std::pair<const Function *, uint32_t> edge{function, at};
+        if (std::find(backEdges.begin(), backEdges.end(), edge) !=
+            backEdges.end()) {
+          return false;
+        }
+        backEdges.push_back(edge);
+        frame.ip = target;
+        break;
+      }
+      case OP_ITERATE:
+        if (!iterate(byte(0), offset(1))) {
+          return false;
+        }
+        break;
+      case OP_CALL:
+        if (!call(byte(0))) {
+          return false;
+        }
+        break;
+      case OP_RETURN: {
+        if (frames.size() == 1) {
+          return false;
+        }
+        const int callee = static_cast<int>(frame.base);
+        move(top, callee);
+        truncate(callee + 1);
+        frames.pop_back();
+        break;
+      }
+      case OP_GET_INDEX:
+        if (!getIndex()) {
+          return false;
+        }
+        frame.ip = at + 1;
+        break;
+      case OP_SET_INDEX:
+        if (!setIndex()) {
+          return false;
+        }
+        frame.ip = at + 1;
+        break;
+      default:
+        return false;
+      }
+    }
+  }
+
+  VM &vm;
+  Tree &tree;
+  const bool root;
+  // Index of the root frame in VM::frames.
+  const size_t rootFrame;
+  // Stack index of the root frame's slot 0.
+  const size_t base;
+  const size_t firstExit;
+  const size_t firstIndirect;
+  const size_t firstView;
+
+  std::vector<Frame> frames;
+  std::vector<Slot> slots;
+  std::vector<Value> values;
+  std::vector<Slot> indirectSlots;
+  std::vector<Value> indirectValues;
+  std::array<int, 16> xmmOwner;
+  std::array<int, 16> gprOwner;
+  std::array<uint64_t, 16> xmmStamp{};
+  std::array<uint64_t, 16> gprStamp{};
+  uint64_t clock = 0;
+
+  Asm::Label head;
+  Asm::Label epilogue;
+  size_t headOffset = 0;
+  size_t epilogueOffset = 0;
+  std::vector<Stub> stubs;
+  // Each stub's exit and the end of its final jump.
+  std::vector<std::pair<uint32_t, size_t>> jumps;
+
+  // Back-edges other than the loop's own taken so far.
+  std::vector<std::pair<const Function *, uint32_t>> backEdges;
+  // Offset of the instruction being recorded.
+  uint32_t at = 0;
+  size_t length = 0;
+  uint32_t maxDepth;
+  uint32_t maxFrames;
+};
+
+TraceJit::TraceJit() = default;
+
+TraceJit::~TraceJit() {
+  if (arena != nullptr) {
+    munmap(arena, ARENA_SIZE);
+  }
+}
+
+bool TraceJit::loop(VM &vm) {
+  const CallFrame &frame = vm.frames.back();
+  const Function *function = frame.closure->function;
+  const uint32_t header = static_cast<uint32_t>(
+      frame.getIp() - function->chunk->getCode().begin());
+  Loop &loop = loops[{function, header}];
+  if (loop.disabled) {
+    return false;
+  }
+  if (loop.tree == nullptr) {
+    loop.tree = record(vm, function, header);
+    if (loop.tree == nullptr) {
+      stats_.aborts++;
+      loop.disabled = ++loop.failures == MAX_FAILURES;
+      return false;
+    }
+    stats_.traces++;
+  }
+  Tree &tree = *loop.tree;
+  if (!enter(vm, tree)) {
+    loop.disabled = ++tree.refusals == MAX_REFUSALS;
+  } else if (tree.entries % ENTRY_CHECK == 0 &&
+             tree.iterations < tree.entries) {
+    loop.disabled = true;
+  }
+  return !loop.disabled;
+}
+
+std::unique_ptr<TraceJit::Tree>
+TraceJit::record(VM &vm, const Function *function, uint32_t header) {
+  auto tree = std::make_unique<Tree>();
+  tree->function = function;
+  tree->header = header;
+  const CallFrame &frame = vm.frames.back();
+  tree->depth =
+      static_cast<uint32_t>(vm.stack.end() - frame.slots);
+  tree->maxDepth = tree->depth;
+  Recorder recorder{vm, *tree, nullptr};
+  if (!recorder.record()) {
+    return nullptr;
+  }
+  uint8_t *code = install(recorder.as);
+  if (code == nullptr) {
+    return nullptr;
+  }
+  recorder.commit(code);
+  return tree;
+}
+
+void TraceJit::extend(VM &vm, Tree &tree, uint32_t exit) {
+  // Side traces may add exits, so copy what is needed first.
+  const Tree::Exit from = tree.exits[exit];
+  tree.exits[exit].abandoned = true;
+  if (tree.sideTraces == MAX_SIDE_TRACES) {
+    return;
+  }
+  Recorder recorder{vm, tree, &from};
+  if (!recorder.record()) {
+    stats_.aborts++;
+    return;
+  }
+  uint8_t *code = install(recorder.as);
+  if (code == nullptr) {
+    recorder.rollback();
+    return;
+  }
+  recorder.commit(code);
+  patch(tree.exits[exit].jump, code);
+  tree.exits[exit].linked = true;
+  tree.sideTraces++;
+  stats_.sideTraces++;
+}
+
+bool TraceJit::enter(VM &vm, Tree &tree) {
+  const CallFrame &frame = vm.frames.back();
+  const size_t base = static_cast<size_t>(frame.slots - vm.stack.begin());
+  if (vm.stack.size() - base != tree.depth ||
+      base + tree.maxDepth > STACK_MAX ||
+      vm.frames.size() + tree.maxFrames > FRAME_MAX ||
+      !resolve(vm, tree, base)) {
+    return false;
+  }
+  vm.stack.resize(base + tree.maxDepth);
+  uint64_t iterations = 0;
+  const uint32_t exit =
+      tree.entry(vm.stack.data() + base, tree.context.data(), &iterations);
+  tree.entries++;
+  tree.iterations += iterations;
+  stats_.entries++;
+  stats_.iterations += iterations;
+  leave(vm, tree, exit, base);
+  Tree::Exit &taken = tree.exits[exit];
+  if (++taken.taken >= HOT_EXIT && !taken.abandoned) {
+    extend(vm, tree, exit);
+  }
+  return true;
+}
+
+bool TraceJit::resolve(VM &vm, Tree &tree, size_t base) {
+  const Value *stackBase = vm.stack.data() + base;
+  const Closure *closure = vm.frames.back().closure;
+  for (size_t k = 0; k < tree.indirects.size(); k++) {
+    const Tree::Indirect &indirect = tree.indirects[k];
+    Value *location;
+    if (indirect.global != nullptr) {
+      const auto it = vm.globals.find(indirect.global->str);
+      if (it == vm.globals.end()) {
+        return false;
+      }
+      location = &it->second;
+    } else {
+      const Closure *owner =
+          indirect.closure != nullptr ? indirect.closure : closure;
+      location = owner->upvalues[indirect.index]->location;
+    }
+    if (location >= stackBase && location < stackBase + tree.maxDepth) {
+      return false;
+    }
+    for (size_t j = 0; j < k; j++) {
+      if (tree.context[j] == reinterpret_cast<uint64_t>(location)) {
+        return false;
+      }
+    }
+    tree.context[k] = reinterpret_cast<uint64_t>(location);
+  }
+  for (size_t v = 0; v < tree.views.size(); v++) {
+    const int location = tree.views[v];
+    const Value array =
+        location >= 0
+            ? stackBase[location]
+            : *reinterpret_cast<const Value *>(tree.context[-1 - location]);
+    if (!isNumericArray(array)) {
+      return false;
+    }
+    ArrayObj *elements = array.asObj()->as<ArrayObj>();
+    tree.context[MAX_INDIRECTS + 3 * v] = array.bits();
+    tree.context[MAX_INDIRECTS + 3 * v + 1] =
+        reinterpret_cast<uint64_t>(elements->data());
+    tree.context[MAX_INDIRECTS + 3 * v + 2] = elements->size();
+  }
+  return true;
+}
+
+void TraceJit::leave(VM &vm, const Tree &tree, uint32_t exit, size_t base) {
+  const Tree::Exit &state = tree.exits[exit];
+  vm.stack.resize(base + state.depth);
+  vm.frames.back().ip() =
+      tree.function->chunk->code().begin() + state.frames[0].ip;
+  for (size_t i = 1; i < state.frames.size(); i++) {
+    const Tree::Exit::Frame &frame = state.frames[i];
+    const Closure *closure = static_cast<const Closure *>(
+        vm.stack[base + frame.base].asObj());
+    vm.frames.emplace_back(closure, vm.stack.begin() + base + frame.base);
+    vm.frames.back().ip() =
+        closure->function->chunk->code().begin() + frame.ip;
+  }
+  vm.publishFrames();
+}
+
+uint8_t *TraceJit::install(X64Assembler &as) {
+  if (arena == nullptr) {
+    void *memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      return nullptr;
+    }
+    arena = static_cast<uint8_t *>(memory);
+  }
+  if (used + as.size() > ARENA_SIZE) {
+    return nullptr;
+  }
+  uint8_t *code = arena + used;
+  as.link(code);
+  protect(true);
+  std::memcpy(code, as.code().data(), as.size());
+  protect(false);
+  used = (used + as.size() + 15) & ~size_t{15};
+  return code;
+}
+
+void TraceJit::patch(uint8_t *end, const uint8_t *target) {
+  protect(true);
+  X64Assembler::retarget(end, target);
+  protect(false);
+}
+
+void TraceJit::protect(bool writable) {
+  mprotect(arena, ARENA_SIZE,
+           writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+}
@@ -0,0 +1,97 @@
+#include "tracer.hpp"
+#include "function.hpp"
+#include "tsc.hpp"
+#include "value.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// How often the flush thread drains the ring. At one event per 20ns the
+// ring holds about 5ms of calls.
+constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds{1};
+
+// TSC ticks per microsecond, measured against the steady clock.
+double calibrate() {
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point start = Clock::now();
+  const uint64_t startTsc = readTsc();
+  while (Clock::now() - start < std::chrono::milliseconds{2}) {
+  }
+  const double elapsed =
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  return static_cast<double>(readTsc() - startTsc) / elapsed;
+}
+
+int nextTid() {
+  static std::atomic<int> tids{1};
+  return tids.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string_view calleeName(const Obj *callee) {
+  if (callee->getType() == ValueType::NATIVE_FUNCTION) {
+    return static_cast<const NativeFunction *>(callee)->name;
+  }
+  const Function *function = static_cast<const Function *>(callee);
+  return function->name.empty() ? std::string_view{"script"}
+                                : std::string_view{function->name};
+}
+
+} // namespace
+
+Tracer::Tracer(std::ostream &out)
+    : out{out}, ring{std::make_unique<Event[]>(CAPACITY)},
+      startTsc{readTsc()}, ticksPerMicrosecond{calibrate()}, pid{getpid()},
+      tid{nextTid()} {
+  out << "{\"traceEvents\":[\n";
+  out << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},"
+                     "\"tid\":{},\"args\":{{\"name\":\"mehh VM {}\"}}}}",
+                     pid, tid, tid);
+  flusher = std::thread{&Tracer::flushLoop, this};
+}
+
+Tracer::~Tracer() { stop(); }
+
+void Tracer::stop() {
+  if (!flusher.joinable()) {
+    return;
+  }
+  stopping.store(true, std::memory_order_release);
+  flusher.join();
+  drain();
+  out << "\n]}\n";
+  out.flush();
+}
+
+void Tracer::flushLoop() {
+  while (!stopping.load(std::memory_order_acquire)) {
+    drain();
+    std::this_thread::sleep_for(FLUSH_INTERVAL);
+  }
+}
+
+void Tracer::drain() {
+  const size_t h = head.load(std::memory_order_acquire);
+  size_t t = tail.load(std::memory_order_relaxed);
+  for (; t != h; t++) {
+    const Event &event = ring[t & (CAPACITY - 1)];
+    const double ts =
+        static_cast<double>(event.tsc - startTsc) / ticksPerMicrosecond;
+    out << fmt::format(",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"{}\","
+                       "\"ts\":{:.3f},\"pid\":{},\"tid\":{}}}",
+                       calleeName(event.callee),
+                       event.callee->getType() == ValueType::NATIVE_FUNCTION
+                           ? "native"
+                           : "function",
+                       event.enter ? 'B' : 'E', ts, pid, tid);
+  }
+  tail.store(t, std::memory_order_release);
+}
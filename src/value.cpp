@@ -1,47 +1,111 @@
 #include "value.hpp"
+#include "array.hpp"
+#include "class.hpp"
 #include "function.hpp"
+#include "map.hpp"
+#include "output.hpp"
 #include <iostream>
+#include <ostream>
 
-void printValue(const Value &value) {
+void printValue(const Value &value, Output &out) {
   switch (value.getType()) {
   case ValueType::NIL:
-    std::cout << "nil";
+    out.write("nil");
     break;
   case ValueType::NUMBER:
-    std::cout << value.asNumber();
-    break;
-  case ValueType::BOOL: {
-    auto val = value.asBool();
-    if (val) {
-      std::cout << "true";
-    } else {
-      std::cout << "false";
-    }
-  } break;
+    out.number(value.asNumber());
+    break;
+  case ValueType::BOOL:
+    out.write(value.asBool() ? "true" : "false");
+    break;
   case ValueType::STRING:
-    std::cout << value.asObj()->as<StringObj>()->str << '\n';
+    out.write(value.asObj()->as<StringObj>()->str);
     break;
   case ValueType::FUNCTION: {
     auto function = value.asObj()->as<Function>();
     if (function->name.empty()) {
-      std::cout << "<script>";
+      out.write("<script>");
       return;
     }
-    std::cout << "<fn " << function->name << ">";
+    out.format("<fn {}>", function->name);
   } break;
   case ValueType::NATIVE_FUNCTION:
-    std::cout << "<native fn>";
+    out.write("<native fn>");
     break;
   case ValueType::CLOSURE: {
     auto val = Value{value.asObj()->as<Closure>()->function};
-    printValue(val);
+    printValue(val, out);
+    break;
+  }
+  case ValueType::CLASS:
+    out.write(value.asObj()->as<ClassObj>()->name->str);
+    break;
+  case ValueType::INSTANCE:
+    out.write(value.asObj()->as<Instance>()->klass->name->str);
+    out.write(" instance");
+    break;
+  case ValueType::BOUND_METHOD: {
+    auto val = Value{value.asObj()->as<BoundMethod>()->method->function};
+    printValue(val, out);
+    break;
+  }
+  case ValueType::ARRAY: {
+    const ArrayObj *array = value.asObj()->as<ArrayObj>();
+    out.put('[');
+    for (size_t i = 0; i < array->size(); i++) {
+      if (i > 0) {
+        out.write(", ");
+      }
+      printValue(array->get(i), out);
+    }
+    out.put(']');
     break;
   }
+  case ValueType::MAP: {
+    const MapObj *map = value.asObj()->as<MapObj>();
+    out.put('{');
+    bool first = true;
+    for (size_t i = map->nextSlot(0); i < map->capacity();
+         i = map->nextSlot(i + 1)) {
+      if (!first) {
+        out.write(", ");
+      }
+      first = false;
+      printValue(map->slot(i).key, out);
+      out.write(": ");
+      printValue(map->slot(i).value, out);
+    }
+    out.put('}');
+    break;
+  }
+  case ValueType::CHANNEL:
+    out.write("<channel>");
+    break;
+  case ValueType::FIBER:
+    out.write("<fiber>");
+    break;
+  case ValueType::GENERATOR:
+    out.write("<generator>");
+    break;
+  case ValueType::AWAITABLE:
+    out.write("<awaitable>");
+    break;
+  case ValueType::LINES:
+    out.write("<lines>");
+    break;
+  case ValueType::NATIVE_ERROR:
+    out.write("<error>");
+    break;
   case ValueType::UPVALUE:
-    std::cout << "upvalue";
+    out.write("upvalue");
     break;
   case ValueType::OBJ:
-    std::cout << "obj";
+    out.write("obj");
     break;
   }
 }
+
+void printValue(const Value &value, std::ostream &out) {
+  Output output{out};
+  printValue(value, output);
+}
@@ -1,28 +1,93 @@
 #include "vm.hpp"
-#include "Tracy.hpp"
+#include "batch.hpp"
 #include "call_frame.hpp"
 #include "chunk.hpp"
 #include "compiler.hpp"
 #include "function.hpp"
+#include "mapped_file.hpp"
+#include "natives.hpp"
+#include "simd.hpp"
 #include "value.hpp"
 #include "value_array.hpp"
-#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <stdint.h>
 #include <string>
 #include <string_view>
 #include <sys/cdefs.h>
+#include <utility>
 #include <variant>
 #include <vector>
 
-// #define BENCHMARK
 #define UNLIKELY(x) __builtin_expect(x, 0)
 #define MUSTTAIL __attribute__((musttail))
 
-VM::VM() noexcept : compiler(Compiler{stringIntern}) {
+VM::VM() noexcept : VM(nullptr) {}
+
+VM::VM(std::shared_ptr<const CodeImage> image) noexcept
+    : image{std::move(image)},
+      stringIntern{this->image ? &this->image->strings() : nullptr},
+      compiler(Compiler{stringIntern}) {
+  mainFiber.state = FiberObj::State::READY;
+  stack = mainFiber.stack;
+  frames = mainFiber.frames;
+  publishFrameStack();
+  initString = stringIntern.intern("init");
   defineNative("clock", &native);
+  definePureNative("len", lenNative);
+  defineNative("push", pushNative);
+  defineNative("resize", resizeNative);
+  definePureNative("sum", sumNative);
+  definePureNative("dot", dotNative);
+  definePureNative("min", minNative);
+  definePureNative("max", maxNative);
+  defineNative("scale", scaleNative);
+  defineNative("axpy", axpyNative);
+  defineNative("has", hasNative);
+  defineNative("remove", removeNative);
+  definePureNative("abs", absNative);
+  definePureNative("sqrt", sqrtNative);
+  defineNative("now", nowNative);
+  defineNative("threads", threadsNative);
+  defineNative("sort", sortNative);
+  defineNative("map", mapNative);
+  defineNative("filter", filterNative);
+  defineNative("reduce", reduceNative);
+  defineNative("channel", channelNative);
+  defineNative("send", sendNative);
+  defineNative("receive", receiveNative);
+  defineNative("close", closeNative);
+  defineNative("spawn", spawnNative);
+  defineNative("yield", yieldNative);
+  defineNative("join", joinNative);
+  defineNative("readFileAsync", readFileAsyncNative);
+  defineNative("writeFileAsync", writeFileAsyncNative);
+  defineNative("await", awaitNative);
+  defineNative("readFile", readFileNative);
+  defineNative("lines", linesNative);
+  defineNative("flush", flushNative);
+  hotLoops.fill(TraceJit::HOT_LOOP);
+#ifdef MEHH_JIT
+  jit = std::make_unique<TraceJit>();
+#endif
+  if (this->image) {
+    imageScript = Value{newClosure(this->image->script())};
+  }
+}
+
+bool VM::enableJit(bool enable) {
+#ifdef MEHH_JIT
+  if (!enable) {
+    jit.reset();
+  } else if (jit == nullptr) {
+    jit = std::make_unique<TraceJit>();
+  }
+  return true;
+#else
+  return !enable;
+#endif
 }
 
 __attribute__((always_inline)) inline const bool
@@ -36,17 +101,22 @@ VM::valuesEqual(const Value &a, const Value &b) {
   const auto typeB = b.getType();
 
   // TODO: Remove branches when possible
-  if (typeA == ValueType::NIL && typeB == ValueType::NIL) {
+  if (typeA != typeB) {
+    return false;
+  }
+  switch (typeA) {
+  case ValueType::NIL:
     return true;
-  } else if (typeA == ValueType::BOOL && typeB == ValueType::BOOL) {
+  case ValueType::BOOL:
     return a.asBool() == b.asBool();
-  } else if (typeA == ValueType::NUMBER && typeB == ValueType::NUMBER) {
-    return a.asNumber() == a.asNumber();
-  } else if (typeA == ValueType::STRING && typeB == ValueType::STRING) {
+  case ValueType::NUMBER:
+    return a.asNumber() == b.asNumber();
+  case ValueType::STRING:
     // TODO: Implement properly
     return a.asObj()->as<StringObj>()->str == b.asObj()->as<StringObj>()->str;
-  } else {
-    return false;
+  default:
+    // Everything else compares by identity.
+    return a.asObj() == b.asObj();
   }
 }
 
@@ -65,11 +135,62 @@ VM::callValue(const Value &callee, const uint8_t argCount) {
     bool res = call(static_cast<const Closure *>(ptr), argCount);
     return res;
   }
+  case ValueType::BOUND_METHOD: {
+    const BoundMethod *bound = static_cast<const BoundMethod *>(ptr);
+    *(stack.end() - argCount - 1) = bound->receiver;
+    return call(bound->method, argCount);
+  }
+  case ValueType::CLASS: {
+    ClassObj *klass = static_cast<ClassObj *>(ptr);
+    *(stack.end() - argCount - 1) = Value{allocate<Instance>(klass)};
+    if (klass->initializer != nullptr) {
+      return call(klass->initializer, argCount);
+    }
+    if (UNLIKELY(argCount != 0)) {
+      runtimeError("Expected 0 arguments but got {}.", argCount);
+      return false;
+    }
+    return true;
+  }
+  case ValueType::GENERATOR: {
+    if (UNLIKELY(argCount != 0)) {
+      runtimeError("Expected 0 arguments but got {}.", argCount);
+      return false;
+    }
+    GeneratorObj *generator = ptr->as<GeneratorObj>();
+    if (generator->state == GeneratorObj::State::DONE) {
+      stack.back() = Value{};
+      return true;
+    }
+    // The frame's slot 0 takes the callee's place.
+    stack.pop_back();
+    generator->loopExit.reset();
+    return resumeGenerator(generator);
+  }
   case ValueType::NATIVE_FUNCTION: {
-    Value result = static_cast<const NativeFunction *>(ptr)->fun(
-        argCount, stack.end().get_ptr() - argCount);
-    stack.erase(stack.end() - argCount, stack.end());
+    const NativeFunction *native = static_cast<const NativeFunction *>(ptr);
+    Value *args = stack.end() - argCount;
+    if (UNLIKELY(tracer != nullptr)) {
+      tracer->enter(native);
+    }
+    Value result = native->fun != nullptr ? native->fun(argCount, args)
+                                          : native->vmFun(*this, argCount, args);
+    if (UNLIKELY(tracer != nullptr)) {
+      tracer->exit(native);
+    }
+    if (UNLIKELY(result.is(ValueType::NATIVE_ERROR))) {
+      // A failed callback has already reported its error and reset the VM.
+      if (!frames.empty()) {
+        runtimeError("{}", result.asObj()->as<NativeError>()->message);
+      }
+      return false;
+    }
+    // The result replaces the callee and its arguments.
+    stack.erase(stack.end() - argCount - 1, stack.end());
     stack.push_back(result);
+    if (UNLIKELY(pendingSwitch != nullptr)) {
+      return switchFiber();
+    }
     return true;
   }
   default: {
@@ -79,17 +200,59 @@ VM::callValue(const Value &callee, const uint8_t argCount) {
   }
 }
 
-__attribute__((always_inline)) const UpvalueObj
-VM::captureUpvalue(const StackIterator &local) {
-  return UpvalueObj{local.get_ptr()};
+UpvalueObj *VM::captureUpvalue(Value *local) {
+  UpvalueObj *prev = nullptr;
+  UpvalueObj *upvalue = openUpvalues;
+  while (upvalue != nullptr && upvalue->location > local) {
+    prev = upvalue;
+    upvalue = upvalue->next;
+  }
+  // Reuse the cell if another closure already captured this slot.
+  if (upvalue != nullptr && upvalue->location == local) {
+    return upvalue;
+  }
+
+  UpvalueObj *created = &upvalues.emplace_back(local);
+  if (UNLIKELY(allocProfiler != nullptr)) {
+    recordAllocation(ValueType::UPVALUE, sizeof(UpvalueObj));
+  }
+  created->next = upvalue;
+  if (prev == nullptr) {
+    openUpvalues = created;
+  } else {
+    prev->next = created;
+  }
+  return created;
+}
+
+void VM::closeUpvalues(const Value *last) {
+  while (openUpvalues != nullptr && openUpvalues->location >= last) {
+    UpvalueObj *upvalue = openUpvalues;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    openUpvalues = upvalue->next;
+  }
 }
 
 __attribute__((always_inline)) const bool VM::call(const Closure *closure,
                                                    const uint8_t argCount) {
   if (__builtin_expect(argCount == closure->function->arity, 1)) {
+    if (UNLIKELY(closure->function->generator)) {
+      newGenerator(closure, argCount);
+      return true;
+    }
     if (__builtin_expect(frames.size() < FRAME_MAX, 1)) {
+      if (UNLIKELY(callCounters != nullptr)) {
+        callCounters->enter(
+            frames.empty() ? nullptr : frames.back().closure->function,
+            closure->function);
+      }
+      if (UNLIKELY(tracer != nullptr)) {
+        tracer->enter(closure->function);
+      }
       // (end - argCount - 1) accounts for the 0th slot
       frames.emplace_back(closure, stack.end() - argCount - 1);
+      publishFrames();
       return true;
     } else {
       runtimeError("Stack overflow");
@@ -102,8 +265,194 @@ __attribute__((always_inline)) const bool VM::call(const Closure *closure,
   }
 }
 
+// Slow path of OP_INVOKE: a field holding a callable shadows methods.
+const bool VM::invokeProperty(Instance *instance, const StringObj *name,
+                              PropertyCache &cache, const uint8_t argCount) {
+  const uint32_t slot = instance->shape->lookup(name);
+  if (slot != Shape::NOT_FOUND) {
+    cache = PropertyCache{instance->shape, nullptr, nullptr, slot};
+    const Value field = instance->fields[slot];
+    *(stack.end() - argCount - 1) = field;
+    return callValue(field, argCount);
+  }
+  const Closure *method = instance->klass->findMethod(name);
+  if (UNLIKELY(method == nullptr)) {
+    runtimeError("Undefined property '{}'.", name->str);
+    return false;
+  }
+  cache = PropertyCache{instance->shape, nullptr, method, 0};
+  return call(method, argCount);
+}
+
+void VM::newGenerator(const Closure *closure, uint8_t argCount) {
+  GeneratorObj *generator = allocate<GeneratorObj>(closure);
+  Value *const base = stack.end() - argCount - 1;
+  *base = Value{generator};
+  generator->slots.assign(base, stack.end());
+  stack.erase(base + 1, stack.end());
+}
+
+__attribute__((always_inline)) inline bool
+VM::resumeGenerator(GeneratorObj *generator) {
+  if (UNLIKELY(generator->state == GeneratorObj::State::RUNNING)) {
+    runtimeError("Generator is already running.");
+    return false;
+  }
+  if (UNLIKELY(frames.size() + compiledDepth >= FRAME_MAX ||
+               stack.size() + generator->slots.size() > STACK_MAX)) {
+    runtimeError("Stack overflow");
+    return false;
+  }
+  Value *const base = stack.end();
+  stack.append(generator->slots.data(),
+               generator->slots.data() + generator->slots.size());
+  // Its open upvalues point above everything on the stack, so they go in
+  // front of the VM's.
+  if (UNLIKELY(generator->openUpvalues != nullptr)) {
+    UpvalueObj *last = generator->openUpvalues;
+    for (UpvalueObj *upvalue = last; upvalue != nullptr;
+         upvalue = upvalue->next) {
+      upvalue->location = base + (upvalue->location - generator->slots.data());
+      last = upvalue;
+    }
+    last->next = openUpvalues;
+    openUpvalues = generator->openUpvalues;
+    generator->openUpvalues = nullptr;
+  }
+  generator->state = GeneratorObj::State::RUNNING;
+  frames.emplace_back(generator->closure, base).ip() = generator->ip;
+  publishFrames();
+  return true;
+}
+
+bool VM::runGenerator(GeneratorObj *generator, Value &result) {
+  if (generator->state == GeneratorObj::State::DONE) {
+    result = Value{};
+    return true;
+  }
+  CallFrame *caller = frame;
+  const size_t depth = frames.size();
+  generator->loopExit.reset();
+  if (!resumeGenerator(generator)) {
+    return false;
+  }
+  return finishCall(depth, caller, result);
+}
+
+bool VM::nextLine(const LinesObj *lines, Value &cursor, Value &line) {
+  // Memory of pages the loop has moved past is given back once per this
+  // many bytes. Lines are uninterned views into the file, so a file of any
+  // size costs about as much as its lines in use, plus a StringObj header
+  // per line while the heap frees nothing.
+  constexpr size_t RELEASE_SHIFT = 24;
+  const std::string_view contents = lines->file->contents();
+  const size_t offset = static_cast<size_t>(cursor.asNumber());
+  if (offset >= contents.size()) {
+    return false;
+  }
+  size_t end = offset + simd::find(contents.data() + offset,
+                                   contents.size() - offset, '\n');
+  const size_t next = end < contents.size() ? end + 1 : end;
+  if (end > offset && contents[end - 1] == '\r') {
+    end--;
+  }
+  line = string(contents.substr(offset, end - offset), lines->file);
+  if ((offset >> RELEASE_SHIFT) != (next >> RELEASE_SHIFT)) {
+    lines->file->release((offset >> RELEASE_SHIFT) << RELEASE_SHIFT,
+                         (next >> RELEASE_SHIFT) << RELEASE_SHIFT);
+  }
+  cursor.setNumber(static_cast<double>(next));
+  return true;
+}
+
 void VM::defineNative(std::string name, NativeFunction *fn) {
-  globals.insert_or_assign(stringIntern.intern(name)->str, Value{fn});
+  fn->name = stringIntern.intern(name)->str;
+  globals.insert_or_assign(fn->name, Value{fn});
+}
+
+void VM::defineNative(std::string name, NativeFunctionPtr fn) {
+  defineNative(std::move(name), allocate<NativeFunction>(fn));
+}
+
+void VM::definePureNative(std::string name, NativeFunctionPtr fn) {
+  NativeFunction *native = allocate<NativeFunction>(fn);
+  native->pure = true;
+  defineNative(std::move(name), native);
+}
+
+void VM::defineNative(std::string name, VMNativeFunctionPtr fn) {
+  defineNative(std::move(name), allocate<NativeFunction>(fn));
+}
+
+bool VM::callFunction(const Value &callee, int argCount, const Value *args,
+                      Value &result) {
+  if (UNLIKELY(stack.size() + argCount + 1 > STACK_MAX)) {
+    runtimeError("Stack overflow");
+    return false;
+  }
+  stack.push_back(callee);
+  for (int i = 0; i < argCount; i++) {
+    stack.push_back(args[i]);
+  }
+  return callPushed(argCount, result);
+}
+
+bool VM::callPushed(int argCount, Value &result) {
+  CallFrame *caller = frame;
+  const size_t depth = frames.size();
+  if (!callValue(stack[stack.size() - 1 - argCount], argCount)) {
+    // A native failing outside any frame reports nothing and leaves its
+    // arguments behind.
+    if (depth == 0) {
+      resetStack();
+    }
+    return false;
+  }
+  const bool finished = finishCall(depth, caller, result);
+  // Back in the host, which may look at the output next.
+  if (depth == 0) {
+    out.flush();
+  }
+  return finished;
+}
+
+bool VM::callClosure(const Closure *closure, int argCount, const Value *slots,
+                     Value &result) {
+  if (UNLIKELY(stack.size() + argCount + 1 > STACK_MAX ||
+               frames.size() + compiledDepth >= FRAME_MAX)) {
+    runtimeError("Stack overflow");
+    return false;
+  }
+  CallFrame *caller = frame;
+  const size_t depth = frames.size();
+  for (int i = 0; i <= argCount; i++) {
+    stack.push_back(slots[i]);
+  }
+  if (!call(closure, argCount)) {
+    return false;
+  }
+  return finishCall(depth, caller, result);
+}
+
+bool VM::finishCall(size_t depth, CallFrame *caller, Value &result) {
+  // Natives and classes without an initializer finish inside callValue.
+  if (frames.size() > depth) {
+    const size_t enclosingExit = exitDepth;
+    exitDepth = depth;
+    const InterpretResult status = run();
+    exitDepth = enclosingExit;
+    if (status != INTERPRET_OK) {
+      return false;
+    }
+  }
+  result = stack.back();
+  stack.pop_back();
+  frame = caller;
+  return true;
+}
+
+std::optional<const Function *> VM::compile(const std::string_view source) {
+  return compiler.compile(source);
 }
 
 const InterpretResult VM::interpret(const std::string_view source) {
@@ -118,16 +467,181 @@ const InterpretResult VM::interpret(const std::string_view source) {
   // and smart pointers.
   const Function *funPtr = stack.back().asObj()->as<const Function>();
   Closure closure{funPtr};
-  if (!call(&closure, 0)) {
-    return InterpretResult::INTERPRET_RUNTIME_ERROR;
+  closure.caches = inlineCaches.of(*funPtr->chunk);
+  if (perfCounters) {
+    perfCounters->begin();
+  }
+  const InterpretResult result =
+      call(&closure, 0) ? run() : INTERPRET_RUNTIME_ERROR;
+  if (result == INTERPRET_OK) {
+    stack.pop_back();
+  }
+  if (opProfiler) {
+    opProfiler->endRun();
+  }
+  if (perfCounters) {
+    perfCounters->end(nullptr);
+  }
+  out.flush();
+  return result;
+}
+
+const PerfCounters &VM::enablePerfCounters(bool perFunction) {
+  perfCounters = std::make_unique<PerfCounters>(perFunction);
+  callCounters = perFunction ? perfCounters.get() : nullptr;
+  return *perfCounters;
+}
+
+const AllocationProfiler &VM::enableAllocationProfiler(size_t interval) {
+  allocProfiler = std::make_unique<AllocationProfiler>(interval);
+  compiler.profileAllocations(allocProfiler.get());
+  return *allocProfiler;
+}
+
+void VM::recordAllocation(ValueType type, size_t bytes) {
+  if (!allocProfiler->count(type, bytes)) {
+    return;
+  }
+  AllocationProfiler::Site site{nullptr, 0, type, false};
+  if (!frames.empty()) {
+    CallFrame &top = frames.back();
+    Chunk *chunk = top.closure->function->chunk;
+    site.function = top.closure->function;
+    // The ip is already past the allocating instruction's opcode.
+    site.line = chunk->getLine(
+        std::distance(chunk->code().begin(), top.ip()) - 1);
+  }
+  allocProfiler->sample(site, bytes);
+}
+
+void VM::startTracing(std::ostream &out) {
+  tracer = std::make_unique<Tracer>(out);
+}
+
+uint64_t VM::stopTracing() {
+  if (!tracer) {
+    return 0;
+  }
+  tracer->stop();
+  const uint64_t dropped = tracer->dropped();
+  tracer.reset();
+  return dropped;
+}
+
+bool VM::enableOpProfiler() {
+#ifdef PROFILE_OPS
+  opProfiler = std::make_unique<OpProfiler>();
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool VM::enableInstructionProfiler() {
+#ifdef PROFILE_OPS
+  instructionProfiler = std::make_unique<InstructionProfiler>(&inlineCaches);
+  return true;
+#else
+  return false;
+#endif
+}
+
+InterpretResult VM::callBatch(const Value &callee,
+                              std::span<const std::span<const double>> columns,
+                              std::span<double> results) {
+  for (const std::span<const double> &column : columns) {
+    if (UNLIKELY(column.size() < results.size())) {
+      runtimeError("Batch column has {} rows, expected {}.", column.size(),
+                   results.size());
+      return INTERPRET_RUNTIME_ERROR;
+    }
+  }
+  if (callee.is(ValueType::CLOSURE)) {
+    const Closure *closure = callee.asObj()->as<Closure>();
+    if (closure->function->upvalueCount == 0 &&
+        closure->function->arity == columns.size()) {
+      if (std::optional<BatchProgram> program =
+              BatchProgram::compile(*closure->function)) {
+        program->run(columns, results);
+        return INTERPRET_OK;
+      }
+    }
+  }
+
+  std::vector<Value> args(columns.size(), Value{});
+  for (size_t row = 0; row < results.size(); row++) {
+    for (size_t arg = 0; arg < columns.size(); arg++) {
+      args[arg].setNumber(columns[arg][row]);
+    }
+    Value result;
+    if (!callFunction(callee, args.size(), args.data(), result)) {
+      return INTERPRET_RUNTIME_ERROR;
+    }
+    if (UNLIKELY(!result.isNumber())) {
+      runtimeError("Batch function must return a number.");
+      return INTERPRET_RUNTIME_ERROR;
+    }
+    results[row] = result.asNumber();
+  }
+  return INTERPRET_OK;
+}
+
+std::optional<Value> VM::global(std::string_view name) const {
+  const auto it = globals.find(name);
+  if (it == globals.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+std::optional<Handle> VM::load(const std::string_view source) {
+  const std::optional<const Function *> function = compiler.compile(source);
+  if (!function.has_value()) {
+    return std::nullopt;
+  }
+  return Handle{Value{newClosure(function.value())}};
+}
+
+std::optional<Handle> VM::script() const {
+  if (!image) {
+    return std::nullopt;
+  }
+  return Handle{imageScript};
+}
+
+std::optional<Handle> VM::function(std::string_view name) const {
+  const std::optional<Value> value = global(name);
+  if (!value.has_value() || !value->isObj()) {
+    return std::nullopt;
+  }
+  switch (value->asObj()->getType()) {
+  case ValueType::CLOSURE:
+  case ValueType::CLASS:
+  case ValueType::NATIVE_FUNCTION:
+  case ValueType::BOUND_METHOD:
+  case ValueType::GENERATOR:
+    return Handle{*value};
+  default:
+    return std::nullopt;
   }
-  return run();
 }
 
 InterpretResult VM::dispatch() {
   frame = &frames.back();
 
   uint8_t instruction = frame->readByte();
+#ifdef PROFILE_OPS
+  if (UNLIKELY(opProfiler != nullptr)) {
+    opProfiler->record(instruction);
+  }
+  if (UNLIKELY(instructionProfiler != nullptr)) {
+    const Function *function = frame->closure->function;
+    instructionProfiler->record(
+        function,
+        std::distance(function->chunk->code().begin(), frame->ip()) - 1,
+        instruction, stack.data() + stack.size());
+  }
+#endif
 
   switch (instruction) {
   case OP_RETURN:
@@ -182,10 +696,36 @@ InterpretResult VM::dispatch() {
     MUSTTAIL return op_jump();
   case OP_LOOP:
     MUSTTAIL return op_loop();
+  case OP_ITERATE:
+    MUSTTAIL return op_iterate();
+  case OP_YIELD:
+    MUSTTAIL return op_yield();
+  case OP_GENERATOR_RETURN:
+    MUSTTAIL return op_generator_return();
   case OP_CALL:
     MUSTTAIL return op_call();
   case OP_CLOSURE:
     MUSTTAIL return op_closure();
+  case OP_CLOSE_UPVALUE:
+    MUSTTAIL return op_close_upvalue();
+  case OP_CLASS:
+    MUSTTAIL return op_class();
+  case OP_METHOD:
+    MUSTTAIL return op_method();
+  case OP_GET_PROPERTY:
+    MUSTTAIL return op_get_property();
+  case OP_SET_PROPERTY:
+    MUSTTAIL return op_set_property();
+  case OP_INVOKE:
+    MUSTTAIL return op_invoke();
+  case OP_ARRAY:
+    MUSTTAIL return op_array();
+  case OP_MAP:
+    MUSTTAIL return op_map();
+  case OP_GET_INDEX:
+    MUSTTAIL return op_get_index();
+  case OP_SET_INDEX:
+    MUSTTAIL return op_set_index();
   }
   return INTERPRET_COMPILE_ERROR;
 }
@@ -193,11 +733,27 @@ InterpretResult VM::dispatch() {
 const InterpretResult VM::run() { MUSTTAIL return dispatch(); };
 
 InterpretResult VM::op_return() {
+  if (UNLIKELY(callCounters != nullptr)) {
+    callCounters->leave(frame->closure->function);
+  }
+  if (UNLIKELY(tracer != nullptr)) {
+    tracer->exit(frame->closure->function);
+  }
   Value result = std::move(stack.back());
   stack.pop_back();
+  closeUpvalues(frame->slots);
   frames.pop_back();
-  if (frames.empty()) {
-    stack.pop_back();
+  publishFrames();
+  if (frames.size() == exitDepth) {
+    // Leave the result where the callee was.
+    stack.erase(frame->slots, stack.end());
+    stack.push_back(result);
+    if (UNLIKELY(fiber != &mainFiber) && exitDepth == 0) {
+      if (UNLIKELY(!finishFiber())) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      MUSTTAIL return dispatch();
+    }
     return INTERPRET_OK;
   }
   // Erase all the called function's stack window.
@@ -207,21 +763,61 @@ InterpretResult VM::op_return() {
   MUSTTAIL return dispatch();
 }
 
+InterpretResult VM::op_yield() {
+  const Value value = stack.back();
+  stack.pop_back();
+  GeneratorObj *generator = frame->slots[0].asObj()->as<GeneratorObj>();
+  generator->ip = frame->ip();
+  generator->slots.assign(frame->slots, stack.end());
+  // Upvalues still open into the frame follow it into the generator.
+  UpvalueObj **tail = &generator->openUpvalues;
+  while (openUpvalues != nullptr && openUpvalues->location >= frame->slots) {
+    UpvalueObj *upvalue = openUpvalues;
+    openUpvalues = upvalue->next;
+    upvalue->location =
+        generator->slots.data() + (upvalue->location - frame->slots);
+    *tail = upvalue;
+    tail = &upvalue->next;
+  }
+  *tail = nullptr;
+  generator->state = GeneratorObj::State::SUSPENDED;
+  stack.erase(frame->slots, stack.end());
+  stack.push_back(value);
+  frames.pop_back();
+  publishFrames();
+  if (frames.size() == exitDepth) {
+    return INTERPRET_OK;
+  }
+  frame = &frames.back();
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_generator_return() {
+  const Value result = stack.back();
+  stack.pop_back();
+  GeneratorObj *generator = frame->slots[0].asObj()->as<GeneratorObj>();
+  generator->state = GeneratorObj::State::DONE;
+  generator->slots.clear();
+  closeUpvalues(frame->slots);
+  stack.erase(frame->slots, stack.end());
+  frames.pop_back();
+  publishFrames();
+  if (generator->loopExit.has_value()) {
+    // Leave the for-in loop that resumed it; the result goes nowhere.
+    frames.back().ip() += *generator->loopExit;
+  } else {
+    stack.push_back(result);
+  }
+  if (frames.size() == exitDepth) {
+    return INTERPRET_OK;
+  }
+  frame = &frames.back();
+  MUSTTAIL return dispatch();
+}
+
 InterpretResult VM::op_constant() {
-#ifdef BENCHMARK
-  auto t1 = std::chrono::high_resolution_clock::now();
-#endif
   const Value constant = frame->readConstant();
   stack.push_back(constant);
-  // printValue(constant);
-  // std::cout << "\n";
-#ifdef BENCHMARK
-  auto t2 = std::chrono::high_resolution_clock::now();
-  /* Getting number of milliseconds as an integer. */
-  auto ms_int = duration_cast<std::chrono::nanoseconds>(t2 - t1);
-  times[OP_CONSTANT] += ms_int.count();
-  calls[OP_CONSTANT]++;
-#endif
   MUSTTAIL return dispatch();
 }
 
@@ -270,10 +866,16 @@ InterpretResult VM::op_add() {
   if (t_a == ValueType::NUMBER && t_b == ValueType::NUMBER) {
     stack.push_back(Value{a.asNumber() + b.asNumber()});
   } else if (t_a == ValueType::STRING && t_b == ValueType::STRING) {
+    const size_t internedCount = stringIntern.size();
     const StringObj * const interned =
         stringIntern.intern(std::string{a.asObj()->as<StringObj>()->str} +
                             std::string{b.asObj()->as<StringObj>()->str});
     // TODO: Fix allocations
+    if (UNLIKELY(allocProfiler != nullptr) &&
+        stringIntern.size() != internedCount) {
+      recordAllocation(ValueType::STRING,
+                       sizeof(StringObj) + interned->str.size());
+    }
     stack.push_back(Value{interned});
   } else {
     runtimeError("Operands must be two numbers or two strings.");
@@ -337,29 +939,17 @@ InterpretResult VM::op_multiply() {
 }
 
 InterpretResult VM::op_pop() {
-  ZoneScopedNC("POP", tracy::Color::CadetBlue);
   stack.pop_back();
-  FrameMark;
   MUSTTAIL return dispatch();
 }
 
 InterpretResult VM::op_get_global() {
-#ifdef BENCHMARK
-  auto t1 = std::chrono::high_resolution_clock::now();
-#endif
   const Value &value = frame->readConstantRef();
   if (value.getType() == ValueType::STRING) {
     const auto &variable =
         globals.find(value.asObj()->as<StringObj>()->str);
     if (variable != globals.end()) {
       stack.push_back(variable->second);
-#ifdef BENCHMARK
-      auto t2 = std::chrono::high_resolution_clock::now();
-      /* Getting number of milliseconds as an integer. */
-      auto ms_int = duration_cast<std::chrono::nanoseconds>(t2 - t1);
-      times[OP_GET_GLOBAL] += ms_int.count();
-      calls[OP_GET_GLOBAL]++;
-#endif
       MUSTTAIL return dispatch();
     } else {
       runtimeError("Undefined variable '{}.'",
@@ -387,40 +977,26 @@ InterpretResult VM::op_set_global() {
 }
 
 InterpretResult VM::op_get_local() {
-  ZoneScopedNC("GET LOCAL", tracy::Color::Pink);
-#ifdef BENCHMARK
-  auto t1 = std::chrono::high_resolution_clock::now();
-#endif
   uint8_t slot = frame->readByte();
   stack.push_back(frame->slots[slot]);
-  FrameMark;
-#ifdef BENCHMARK
-  auto t2 = std::chrono::high_resolution_clock::now();
-  /* Getting number of milliseconds as an integer. */
-  auto ms_int = duration_cast<std::chrono::nanoseconds>(t2 - t1);
-  times[OP_GET_LOCAL] += ms_int.count();
-  calls[OP_GET_LOCAL]++;
-#endif
   MUSTTAIL return dispatch();
 }
 
 InterpretResult VM::op_set_local() {
-  ZoneScopedNC("SET LOCAL", tracy::Color::Pink);
   uint8_t slot = frame->readByte();
   frame->slots[slot] = stack.back();
-  FrameMark;
   MUSTTAIL return dispatch();
 }
 
 InterpretResult VM::op_get_upvalue() {
   uint8_t slot = frame->readByte();
-  stack.push_back(*(frame->closure->upvalues[slot].location));
+  stack.push_back(*(frame->closure->upvalues[slot]->location));
   MUSTTAIL return dispatch();
 }
 
 InterpretResult VM::op_set_upvalue() {
   uint8_t slot = frame->readByte();
-  Value * val = frame->closure->upvalues[slot].location;
+  Value * val = frame->closure->upvalues[slot]->location;
   val->set(stack.back());
   MUSTTAIL return dispatch();
 }
@@ -463,56 +1039,97 @@ InterpretResult VM::op_divide() {
 }
 
 InterpretResult VM::op_not() {
-  // TODO: In place
-  Value &val = stack.back();
-  stack.emplace_back(isFalsey(val));
+  stack.back() = Value{isFalsey(stack.back())};
   MUSTTAIL return dispatch();
 }
 
 InterpretResult VM::op_print() {
-  printValue(stack.back());
-  std::cout << "\n";
+  printValue(stack.back(), out);
+  out.newline();
   stack.pop_back();
   MUSTTAIL return dispatch();
 }
 
 InterpretResult VM::op_jump() {
-#ifdef BENCHMARK
-  auto t1 = std::chrono::high_resolution_clock::now();
-#endif
   frame->ip() += frame->readShort();
-#ifdef BENCHMARK
-  auto t2 = std::chrono::high_resolution_clock::now();
-  /* Getting number of milliseconds as an integer. */
-  auto ms_int = duration_cast<std::chrono::nanoseconds>(t2 - t1);
-  times[OP_JUMP] += ms_int.count();
-  calls[OP_JUMP]++;
-#endif
   MUSTTAIL return dispatch();
 }
 
 InterpretResult VM::op_jump_if_false() {
-  ZoneScopedNC("JUMP", tracy::Color::Black);
-#ifdef BENCHMARK
-  auto t1 = std::chrono::high_resolution_clock::now();
-#endif
   uint16_t offset = frame->readShort();
   if (isFalsey(stack.back())) {
     frame->ip() += offset;
   }
-#ifdef BENCHMARK
-  auto t2 = std::chrono::high_resolution_clock::now();
-  /* Getting number of milliseconds as an integer. */
-  auto ms_int = duration_cast<std::chrono::nanoseconds>(t2 - t1);
-  times[OP_JUMP_IF_FALSE] += ms_int.count();
-  calls[OP_JUMP_IF_FALSE]++;
-#endif
-  FrameMark;
   MUSTTAIL return dispatch();
 }
+// Traces skip the hooks of the tracer and profilers, so loops are left to
+// the interpreter while any of them is on.
+__attribute__((noinline, cold)) bool VM::hotLoop() {
+  if (jit == nullptr || tracer != nullptr || callCounters != nullptr ||
+      opProfiler != nullptr || instructionProfiler != nullptr) {
+    return false;
+  }
+  return jit->loop(*this);
+}
+
 InterpretResult VM::op_loop() {
   uint16_t offset = frame->readShort();
   frame->ip() -= offset;
+#ifdef MEHH_JIT
+  const size_t counter =
+      (reinterpret_cast<uintptr_t>(&*frame->ip()) >> 2) % hotLoops.size();
+  if (UNLIKELY(--hotLoops[counter] == 0)) {
+    // A traced loop comes back on every back-edge.
+    hotLoops[counter] = hotLoop() ? 1 : TraceJit::HOT_LOOP;
+    frame = &frames.back();
+  }
+#endif
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_iterate() {
+  const uint8_t slot = frame->readByte();
+  const uint16_t offset = frame->readShort();
+  const Value &sequence = frame->slots[slot];
+  Value &cursor = frame->slots[slot + 1];
+  const size_t index = static_cast<size_t>(cursor.asNumber());
+  if (sequence.isArray()) {
+    const ArrayObj *array = sequence.asObj()->as<ArrayObj>();
+    if (index < array->size()) {
+      stack.push_back(array->get(index));
+      cursor.setNumber(static_cast<double>(index + 1));
+      MUSTTAIL return dispatch();
+    }
+  } else if (sequence.isMap()) {
+    const MapObj *map = sequence.asObj()->as<MapObj>();
+    const size_t next = map->nextSlot(index);
+    if (next < map->capacity()) {
+      stack.push_back(map->slot(next).key);
+      cursor.setNumber(static_cast<double>(next + 1));
+      MUSTTAIL return dispatch();
+    }
+  } else if (sequence.is(ValueType::GENERATOR)) {
+    GeneratorObj *generator = sequence.asObj()->as<GeneratorObj>();
+    if (generator->state != GeneratorObj::State::DONE) {
+      // Its next value lands where an element would.
+      generator->loopExit = offset;
+      if (UNLIKELY(!resumeGenerator(generator))) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &frames.back();
+      MUSTTAIL return dispatch();
+    }
+  } else if (sequence.is(ValueType::LINES)) {
+    Value line;
+    if (nextLine(sequence.asObj()->as<LinesObj>(), cursor, line)) {
+      stack.push_back(line);
+      MUSTTAIL return dispatch();
+    }
+  } else {
+    runtimeError("Can only iterate over arrays, maps, generators and lines.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  frame->ip() += offset;
   MUSTTAIL return dispatch();
 }
 
@@ -523,18 +1140,218 @@ InterpretResult VM::op_closure() {
   {
     const Function *funPtr =
         frame->readConstantRef().asObj()->as<Function>();
-    Closure closure{funPtr};
+    // Construct in place: by-value upvalues point into the closure itself.
+    Closure &closure = *newClosure(funPtr);
     for (int i = 0; i < closure.function->upvalueCount; i++) {
-      uint8_t isLocal = frame->readByte();
+      uint8_t capture = frame->readByte();
       uint8_t index = frame->readByte();
-      if (isLocal) {
-        closure.upvalues.push_back(captureUpvalue(frame->slots + index));
-      } else {
+      switch (capture) {
+      case CAPTURE_LOCAL:
+        closure.upvalues.push_back(
+            captureUpvalue(frame->slots + index));
+        break;
+      case CAPTURE_VALUE:
+        closure.upvalues.push_back(
+            &closure.captured.emplace_back(frame->slots[index]));
+        break;
+      default:
         closure.upvalues.push_back(frame->closure->upvalues[index]);
+        break;
       }
     }
-    closures.push_back(closure);
-    stack.emplace_back(&closures.back());
+    stack.emplace_back(&closure);
+  }
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_close_upvalue() {
+  closeUpvalues(&stack.back());
+  stack.pop_back();
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_class() {
+  const StringObj *name = frame->readConstantRef().asObj()->as<StringObj>();
+  stack.emplace_back(allocate<ClassObj>(name));
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_method() {
+  const StringObj *name = frame->readConstantRef().asObj()->as<StringObj>();
+  const Closure *method = stack.back().asObj()->as<Closure>();
+  ClassObj *klass = (stack.end() - 2)->asObj()->as<ClassObj>();
+  klass->methods.insert_or_assign(name, method);
+  if (name == initString) {
+    klass->initializer = method;
+  }
+  stack.pop_back();
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_get_property() {
+  const Value &name = frame->readConstantRef();
+  PropertyCache &cache = frame->readCache();
+  if (UNLIKELY(!stack.back().isInstance())) {
+    runtimeError("Only instances have properties.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  Instance *instance = stack.back().asObj()->as<Instance>();
+
+  if (__builtin_expect(cache.shape == instance->shape, 1)) {
+    if (cache.method == nullptr) {
+      stack.back() = instance->fields[cache.slot];
+    } else {
+      // Each read binds anew, as a method value; calls use OP_INVOKE.
+      stack.back() = Value{
+          allocate<BoundMethod>(stack.back(), cache.method)};
+    }
+    MUSTTAIL return dispatch();
+  }
+
+  const StringObj *nameStr = name.asObj()->as<StringObj>();
+  const uint32_t slot = instance->shape->lookup(nameStr);
+  if (slot != Shape::NOT_FOUND) {
+    cache = PropertyCache{instance->shape, nullptr, nullptr, slot};
+    stack.back() = instance->fields[slot];
+    MUSTTAIL return dispatch();
+  }
+  const Closure *method = instance->klass->findMethod(nameStr);
+  if (UNLIKELY(method == nullptr)) {
+    runtimeError("Undefined property '{}'.", nameStr->str);
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  cache = PropertyCache{instance->shape, nullptr, method, 0};
+  stack.back() = Value{allocate<BoundMethod>(stack.back(), method)};
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_set_property() {
+  const Value &name = frame->readConstantRef();
+  PropertyCache &cache = frame->readCache();
+  Value &receiver = *(stack.end() - 2);
+  if (UNLIKELY(!receiver.isInstance())) {
+    runtimeError("Only instances have fields.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  Instance *instance = receiver.asObj()->as<Instance>();
+  const Value value = stack.back();
+
+  if (__builtin_expect(cache.shape == instance->shape, 1)) {
+    if (cache.transition == nullptr) {
+      instance->fields[cache.slot] = value;
+    } else {
+      instance->fields.push_back(stack.back());
+      instance->shape = cache.transition;
+    }
+  } else {
+    const StringObj *nameStr = name.asObj()->as<StringObj>();
+    const uint32_t slot = instance->shape->lookup(nameStr);
+    if (slot != Shape::NOT_FOUND) {
+      cache = PropertyCache{instance->shape, nullptr, nullptr, slot};
+      instance->fields[slot] = value;
+    } else {
+      Shape *next = instance->shape->transition(nameStr);
+      cache = PropertyCache{instance->shape, next, nullptr,
+                            instance->shape->slotCount()};
+      instance->fields.push_back(stack.back());
+      instance->shape = next;
+    }
+  }
+
+  stack.pop_back();
+  stack.back() = value;
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_invoke() {
+  const Value &name = frame->readConstantRef();
+  const uint8_t argCount = frame->readByte();
+  PropertyCache &cache = frame->readCache();
+  const Value &receiver = *(stack.end() - argCount - 1);
+  if (UNLIKELY(!receiver.isInstance())) {
+    runtimeError("Only instances have methods.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  Instance *instance = receiver.asObj()->as<Instance>();
+
+  if (__builtin_expect(cache.shape == instance->shape && cache.method != nullptr,
+                       1)) {
+    if (UNLIKELY(!call(cache.method, argCount))) {
+      return INTERPRET_RUNTIME_ERROR;
+    }
+  } else if (UNLIKELY(!invokeProperty(
+                 instance, name.asObj()->as<StringObj>(), cache, argCount))) {
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  frame = &frames.back();
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_array() {
+  const uint8_t count = frame->readByte();
+  ArrayObj *array = allocate<ArrayObj>();
+  for (auto it = stack.end() - count; it != stack.end(); ++it) {
+    array->push(*it);
+  }
+  stack.erase(stack.end() - count, stack.end());
+  stack.emplace_back(array);
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_map() {
+  const uint8_t count = frame->readByte();
+  MapObj *map = allocate<MapObj>();
+  for (auto it = stack.end() - 2 * count; it != stack.end(); it += 2) {
+    map->set(it[0], it[1]);
+  }
+  stack.erase(stack.end() - 2 * count, stack.end());
+  stack.emplace_back(map);
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_get_index() {
+  const Value &target = *(stack.end() - 2);
+  if (target.isMap()) {
+    // Missing keys read as nil.
+    const Value *value = target.asObj()->as<MapObj>()->find(stack.back());
+    stack.pop_back();
+    stack.back() = value != nullptr ? *value : Value{};
+    MUSTTAIL return dispatch();
+  }
+  if (UNLIKELY(!target.isArray())) {
+    runtimeError("Only arrays and maps can be indexed.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  const ArrayObj *array = target.asObj()->as<ArrayObj>();
+  if (UNLIKELY(!checkIndex(array, stack.back()))) {
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  const Value value =
+      array->get(static_cast<size_t>(stack.back().asNumber()));
+  stack.pop_back();
+  stack.back() = value;
+  MUSTTAIL return dispatch();
+}
+
+InterpretResult VM::op_set_index() {
+  const Value &target = *(stack.end() - 3);
+  if (target.isMap()) {
+    target.asObj()->as<MapObj>()->set(*(stack.end() - 2), stack.back());
+    *(stack.end() - 3) = stack.back();
+    stack.erase(stack.end() - 2, stack.end());
+    MUSTTAIL return dispatch();
+  }
+  if (UNLIKELY(!target.isArray())) {
+    runtimeError("Only arrays and maps can be indexed.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  ArrayObj *array = target.asObj()->as<ArrayObj>();
+  if (UNLIKELY(!checkIndex(array, *(stack.end() - 2)))) {
+    return INTERPRET_RUNTIME_ERROR;
   }
+  array->set(static_cast<size_t>((stack.end() - 2)->asNumber()),
+             stack.back());
+  *(stack.end() - 3) = stack.back();
+  stack.erase(stack.end() - 2, stack.end());
   MUSTTAIL return dispatch();
 }
@@ -0,0 +1,225 @@
+#include "x64_assembler.hpp"
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+constexpr intptr_t UNBOUND = -1;
+
+} // namespace
+
+X64Assembler::Label X64Assembler::label() {
+  labels.push_back(UNBOUND);
+  external.push_back(false);
+  return Label{labels.size() - 1};
+}
+
+void X64Assembler::bind(Label label) {
+  labels[label.id] = static_cast<intptr_t>(bytes.size());
+}
+
+void X64Assembler::bindExternal(Label label, const uint8_t *address) {
+  labels[label.id] = reinterpret_cast<intptr_t>(address);
+  external[label.id] = true;
+}
+
+void X64Assembler::link(uint8_t *address) {
+  for (const Fixup &fixup : fixups) {
+    assert(labels[fixup.label] != UNBOUND);
+    const intptr_t target =
+        external[fixup.label]
+            ? labels[fixup.label]
+            : reinterpret_cast<intptr_t>(address) + labels[fixup.label];
+    const intptr_t end =
+        reinterpret_cast<intptr_t>(address) + fixup.at + 4;
+    const int32_t rel = static_cast<int32_t>(target - end);
+    std::memcpy(&bytes[fixup.at], &rel, sizeof(rel));
+  }
+}
+
+void X64Assembler::retarget(uint8_t *end, const uint8_t *target) {
+  const int32_t rel = static_cast<int32_t>(target - end);
+  std::memcpy(end - 4, &rel, sizeof(rel));
+}
+
+void X64Assembler::imm32(uint32_t imm) {
+  for (int i = 0; i < 4; i++) {
+    byte(static_cast<uint8_t>(imm >> (8 * i)));
+  }
+}
+
+void X64Assembler::rex(bool wide, uint8_t reg, uint8_t index, uint8_t base) {
+  const uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) |
+                         ((index >> 3) << 1) | (base >> 3);
+  if (prefix != 0x40) {
+    byte(prefix);
+  }
+}
+
+void X64Assembler::memory(uint8_t reg, Reg base, int32_t disp) {
+  byte(0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) {
+    // RSP and R12 as a base need a SIB byte.
+    byte(0x24);
+  }
+  imm32(static_cast<uint32_t>(disp));
+}
+
+void X64Assembler::push(Reg reg) {
+  rex(false, 0, 0, reg);
+  byte(0x50 + (reg & 7));
+}
+
+void X64Assembler::pop(Reg reg) {
+  rex(false, 0, 0, reg);
+  byte(0x58 + (reg & 7));
+}
+
+void X64Assembler::ret() { byte(0xC3); }
+
+void X64Assembler::movImm(Reg dst, uint64_t imm) {
+  if (imm <= UINT32_MAX) {
+    // mov r32, imm32 zero-extends.
+    rex(false, 0, 0, dst);
+    byte(0xB8 + (dst & 7));
+    imm32(static_cast<uint32_t>(imm));
+    return;
+  }
+  rex(true, 0, 0, dst);
+  byte(0xB8 + (dst & 7));
+  imm32(static_cast<uint32_t>(imm));
+  imm32(static_cast<uint32_t>(imm >> 32));
+}
+
+void X64Assembler::aluReg(uint8_t opcode, Reg rm, Reg reg) {
+  rex(true, reg, 0, rm);
+  byte(opcode);
+  byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X64Assembler::mov(Reg dst, Reg src) { aluReg(0x89, dst, src); }
+
+void X64Assembler::load(Reg dst, Reg base, int32_t disp) {
+  rex(true, dst, 0, base);
+  byte(0x8B);
+  memory(dst, base, disp);
+}
+
+void X64Assembler::store(Reg base, int32_t disp, Reg src) {
+  rex(true, src, 0, base);
+  byte(0x89);
+  memory(src, base, disp);
+}
+
+void X64Assembler::andReg(Reg dst, Reg src) { aluReg(0x21, dst, src); }
+
+void X64Assembler::subReg(Reg dst, Reg src) { aluReg(0x29, dst, src); }
+
+void X64Assembler::cmp(Reg a, Reg b) { aluReg(0x39, a, b); }
+
+void X64Assembler::cmpMem(Reg a, Reg base, int32_t disp) {
+  rex(true, a, 0, base);
+  byte(0x3B);
+  memory(a, base, disp);
+}
+
+void X64Assembler::cmpImm(Reg a, int8_t imm) {
+  rex(true, 0, 0, a);
+  byte(0x83);
+  byte(0xF8 | (a & 7));
+  byte(static_cast<uint8_t>(imm));
+}
+
+void X64Assembler::addImm(Reg dst, int8_t imm) {
+  rex(true, 0, 0, dst);
+  byte(0x83);
+  byte(0xC0 | (dst & 7));
+  byte(static_cast<uint8_t>(imm));
+}
+
+void X64Assembler::sse(uint8_t prefix, uint8_t opcode, uint8_t reg,
+                       uint8_t rm, bool wide) {
+  byte(prefix);
+  rex(wide, reg, 0, rm);
+  byte(0x0F);
+  byte(opcode);
+  byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X64Assembler::sseMemory(uint8_t prefix, uint8_t opcode, uint8_t reg,
+                             Reg base, int32_t disp) {
+  byte(prefix);
+  rex(false, reg, 0, base);
+  byte(0x0F);
+  byte(opcode);
+  memory(reg, base, disp);
+}
+
+void X64Assembler::sseIndexed(uint8_t prefix, uint8_t opcode, uint8_t reg,
+                              Reg base, Reg index) {
+  // [base + index * 8] with no displacement, which RBP and R13 can't take
+  // as a base.
+  assert((base & 7) != RBP && index != RSP);
+  byte(prefix);
+  rex(false, reg, index, base);
+  byte(0x0F);
+  byte(opcode);
+  byte(0x04 | ((reg & 7) << 3));
+  byte(0xC0 | ((index & 7) << 3) | (base & 7));
+}
+
+void X64Assembler::movsdLoad(Xmm dst, Reg base, int32_t disp) {
+  sseMemory(0xF2, 0x10, dst, base, disp);
+}
+
+void X64Assembler::movsdStore(Reg base, int32_t disp, Xmm src) {
+  sseMemory(0xF2, 0x11, src, base, disp);
+}
+
+void X64Assembler::movsdLoadIndexed(Xmm dst, Reg base, Reg index) {
+  sseIndexed(0xF2, 0x10, dst, base, index);
+}
+
+void X64Assembler::movsdStoreIndexed(Reg base, Reg index, Xmm src) {
+  sseIndexed(0xF2, 0x11, src, base, index);
+}
+
+void X64Assembler::movqToXmm(Xmm dst, Reg src) {
+  sse(0x66, 0x6E, dst, src, true);
+}
+
+void X64Assembler::movqFromXmm(Reg dst, Xmm src) {
+  sse(0x66, 0x7E, src, dst, true);
+}
+
+void X64Assembler::movapd(Xmm dst, Xmm src) { sse(0x66, 0x28, dst, src); }
+void X64Assembler::addsd(Xmm dst, Xmm src) { sse(0xF2, 0x58, dst, src); }
+void X64Assembler::subsd(Xmm dst, Xmm src) { sse(0xF2, 0x5C, dst, src); }
+void X64Assembler::mulsd(Xmm dst, Xmm src) { sse(0xF2, 0x59, dst, src); }
+void X64Assembler::divsd(Xmm dst, Xmm src) { sse(0xF2, 0x5E, dst, src); }
+void X64Assembler::sqrtsd(Xmm dst, Xmm src) { sse(0xF2, 0x51, dst, src); }
+void X64Assembler::andpd(Xmm dst, Xmm src) { sse(0x66, 0x54, dst, src); }
+void X64Assembler::xorpd(Xmm dst, Xmm src) { sse(0x66, 0x57, dst, src); }
+void X64Assembler::ucomisd(Xmm a, Xmm b) { sse(0x66, 0x2E, a, b); }
+
+void X64Assembler::cvttsd2si(Reg dst, Xmm src) {
+  sse(0xF2, 0x2C, dst, src, true);
+}
+
+void X64Assembler::cvtsi2sd(Xmm dst, Reg src) {
+  sse(0xF2, 0x2A, dst, src, true);
+}
+
+void X64Assembler::jmp(Label target) {
+  byte(0xE9);
+  fixups.push_back(Fixup{bytes.size(), target.id});
+  imm32(0);
+}
+
+void X64Assembler::jcc(Condition condition, Label target) {
+  byte(0x0F);
+  byte(0x80 | condition);
+  fixups.push_back(Fixup{bytes.size(), target.id});
+  imm32(0);
+}